@@ -0,0 +1,243 @@
+//ACK batching benchmark: clients keep a window of chats in flight to NetworkServer,
+//which acknowledges them one frame per chat, in range ACKs at the end of each event
+//loop turn, or in range ACKs after a 5 ms delay. Reports chats acknowledged, ACK frames,
+//client recv() calls and TCP segments (system wide, from /proc/net/snmp) per second.
+//Usage: ackbench [server binary] [port] [clients] [window] [seconds]
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/ackbatch.h"
+
+using namespace std;
+
+struct Client {
+    int fd;
+    uint16_t id;        //its own client id, the server pins a connection to one
+    uint32_t sent;
+    FrameDecoder decoder;
+};
+
+struct Counts {
+    uint64_t acked = 0;
+    uint64_t ackFrames = 0;
+    uint64_t recvCalls = 0;
+    uint64_t segments = 0;
+};
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+//Tcp OutSegs from /proc/net/snmp: the first Tcp: line names the fields, the second has the values
+static uint64_t tcpOutSegs()
+{
+    ifstream snmp("/proc/net/snmp");
+    string names, values;
+    while (getline(snmp, names))
+        if (names.rfind("Tcp:", 0) == 0 && getline(snmp, values))
+            break;
+    istringstream n(names), v(values);
+    string name, value;
+    while (n >> name && v >> value)
+        if (name == "OutSegs")
+            return strtoull(value.c_str(), nullptr, 10);
+    return 0;
+}
+
+static void sendChat(Client &client)
+{
+    static const char message[] = "ack batching benchmark message";
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = 3;
+    header.sender_id = client.id;
+    header.receiver_id = 1;
+    header.message_id = ++client.sent;
+    frame_Send(client.fd, header, message, sizeof(message) - 1);
+}
+
+static bool drive(unsigned short port, int clientCount, int window, double seconds, Counts &counts)
+{
+    vector<Client> clients(clientCount);
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < clientCount; i++)
+    {
+        if (!connectTo(port, clients[i].fd))
+        {
+            perror("connect");
+            return false;
+        }
+        clients[i].id = (uint16_t)(2 + i);
+        clients[i].sent = 0;
+        int on = 1;
+        setsockopt(clients[i].fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(clients[i].fd, F_SETFL, O_NONBLOCK);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+    }
+
+    uint64_t segmentsBefore = tcpOutSegs();
+    auto end = chrono::steady_clock::now() + chrono::duration<double>(seconds);
+    for (auto &client : clients)
+        for (int w = 0; w < window; w++)
+            sendChat(client);
+
+    epoll_event events[256];
+    while (chrono::steady_clock::now() < end)
+    {
+        int n = epoll_wait(epfd, events, 256, 100);
+        for (int i = 0; i < n; i++)
+        {
+            Client &client = clients[events[i].data.u32];
+            Frame frame;
+            while (1)
+            {
+                char *space = client.decoder.writePtr();
+                ssize_t got = recv(client.fd, space, client.decoder.writable(), 0);
+                counts.recvCalls++;
+                if (got <= 0)
+                    break;
+                client.decoder.commit(got);
+                while (client.decoder.next(frame))
+                {
+                    uint64_t ids = 0;
+                    if (frame.header.messageType == 4)
+                        ids = 1;
+                    else if (frame.header.messageType == 9)
+                        ids = ackRange_Ids(frame.payload, frame.header.payloadLen);
+                    if (ids == 0)
+                        continue;
+                    counts.ackFrames++;
+                    counts.acked += ids;
+                    //refill the window
+                    for (uint64_t k = 0; k < ids; k++)
+                        sendChat(client);
+                }
+            }
+        }
+    }
+    counts.segments = tcpOutSegs() - segmentsBefore;
+
+    for (auto &client : clients)
+        close(client.fd);
+    close(epfd);
+    return true;
+}
+
+static bool runWith(const char *server, unsigned short port, const char *ackDelay, int clientCount, int window,
+                    double seconds, Counts &counts)
+{
+    int console[2];
+    if (pipe(console) < 0)
+        return false;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "1", "nack", "256", ackDelay, (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+
+    int probe = -1;
+    for (int tries = 0; tries < 200 && !connectTo(port, probe); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (probe < 0)
+    {
+        fprintf(stderr, "server did not start\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        return false;
+    }
+    close(probe);
+
+    bool ok = drive(port, clientCount, window, seconds, counts);
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8093;
+    int clientCount = argc > 3 ? atoi(argv[3]) : 32;
+    int window = argc > 4 ? atoi(argv[4]) : 16;
+    double seconds = argc > 5 ? atof(argv[5]) : 3.0;
+
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    printf("%d clients, %d chats in flight each\n", clientCount, window);
+    printf("%-22s %12s %12s %12s %12s %10s\n", "ACK mode", "chats/sec", "ACKs/sec", "recv()/sec", "segs/sec",
+           "segs/chat");
+    struct Mode {
+        const char *name;
+        const char *ackDelay;
+    };
+    Counts baseline;
+    for (Mode mode : {Mode{"one ACK per chat", "-1"}, Mode{"range ACK, loop turn", "0"}, Mode{"range ACK, 5 ms", "5"}})
+    {
+        Counts counts;
+        if (!runWith(server, port, mode.ackDelay, clientCount, window, seconds, counts))
+            return EXIT_FAILURE;
+        bool first = baseline.acked == 0;
+        if (first)
+            baseline = counts;
+        printf("%-22s %12.0f %12.0f %12.0f %12.0f %10.2f\n", mode.name, counts.acked / seconds,
+               counts.ackFrames / seconds, counts.recvCalls / seconds, counts.segments / seconds,
+               counts.acked ? (double)counts.segments / counts.acked : 0.0);
+        if (!first && counts.acked > 0)
+        {
+            double perChat = (double)counts.recvCalls / counts.acked, basePerChat = (double)baseline.recvCalls / baseline.acked;
+            double segPerChat = (double)counts.segments / counts.acked, baseSegPerChat = (double)baseline.segments / baseline.acked;
+            printf("%-22s %12s %11.0f%% fewer recv() and %.0f%% fewer segments per chat\n", "", "",
+                   100.0 * (1 - perChat / basePerChat), 100.0 * (1 - segPerChat / baseSegPerChat));
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+//Heap allocation benchmark for the server's receive path. Runs NetworkServer with
+//allocshim.so preloaded, which counts every allocation the server makes, and checks
+//that steady state exchanges cost none: a chat to the server and its range ACK, a chat
+//relayed to another client and that client's ACK relayed back, a status request and
+//its response, and with a server that ACKs chats one by one, a chat and its ACK.
+//Usage: allocbench [server binary] [port] [exchanges]
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+}
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+struct Client {
+    int fd = -1;
+    uint16_t id;
+    uint32_t nextId = 0;
+    FrameDecoder decoder;
+};
+
+static void sendFrame(Client &client, uint8_t type, uint16_t receiver, const char *payload, size_t len)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = client.id;
+    header.receiver_id = receiver;
+    header.message_id = ++client.nextId;
+    frame_Send(client.fd, header, payload, len);
+}
+
+//Blocks until a whole frame is in; false on EOF
+static bool readFrame(Client &client, Frame &frame)
+{
+    while (!client.decoder.next(frame))
+    {
+        char *space = client.decoder.writePtr();
+        ssize_t got = recv(client.fd, space, client.decoder.writable(), 0);
+        if (got <= 0)
+            return false;
+        client.decoder.commit(got);
+    }
+    return true;
+}
+
+//One round trip of some kind; false if the answer wasn't what it should be
+typedef bool (*Exchange)(Client &a, Client &b);
+
+static const char chatText[] = "steady state chat, long enough that a std::string of it would allocate";
+
+static bool chatToServer(Client &a, Client &)
+{
+    Frame frame;
+    sendFrame(a, 3, 1, chatText, sizeof(chatText) - 1);
+    return readFrame(a, frame) && (frame.header.messageType == 9 || frame.header.messageType == 4);
+}
+
+static bool relayedChat(Client &a, Client &b)
+{
+    Frame frame;
+    sendFrame(a, 3, b.id, chatText, sizeof(chatText) - 1);
+    if (!readFrame(b, frame) || frame.header.messageType != 3)
+        return false;
+    char id[16];
+    int len = snprintf(id, sizeof(id), "%u", frame.header.message_id);
+    sendFrame(b, 4, a.id, id, len);
+    return readFrame(a, frame) && frame.header.messageType == 4;
+}
+
+static bool statusRequest(Client &a, Client &)
+{
+    Frame frame;
+    sendFrame(a, 1, 1, "", 0);
+    return readFrame(a, frame) && frame.header.messageType == 2;
+}
+
+struct Server {
+    pid_t pid = -1;
+    int console = -1;
+};
+
+static bool startServer(const char *server, unsigned short port, const char *ackDelay, const string &countFile,
+                        Server &out)
+{
+    int console[2];
+    if (pipe(console) < 0)
+        return false;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        setenv("ALLOCSHIM_FILE", countFile.c_str(), 1);
+        setenv("LD_PRELOAD", "./allocshim.so", 1);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "1", "nack", "256", ackDelay, (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+    out.pid = pid;
+    out.console = console[1];
+    return true;
+}
+
+static void stopServer(Server &server)
+{
+    close(server.console);
+    waitpid(server.pid, nullptr, 0);
+}
+
+//Warms an exchange up, then counts what the server allocates over exchanges more of it
+static bool measure(const char *name, Exchange exchange, Client &a, Client &b, const volatile uint64_t *allocations,
+                    size_t exchanges)
+{
+    for (size_t i = 0; i < exchanges / 10 + 1000; i++)
+        if (!exchange(a, b))
+        {
+            fprintf(stderr, "FAILED: %s: no answer\n", name);
+            return false;
+        }
+    //the log writer may still be catching up with the warm up
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    uint64_t before = *allocations;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < exchanges; i++)
+        if (!exchange(a, b))
+        {
+            fprintf(stderr, "FAILED: %s: no answer\n", name);
+            return false;
+        }
+    double secs = seconds(start);
+    this_thread::sleep_for(chrono::milliseconds(200));
+    uint64_t allocated = *allocations - before;
+    printf("  %-44s %8.0f exchanges/s, %lu allocations in %zu exchanges (%.3f each)\n", name, exchanges / secs,
+           (unsigned long)allocated, exchanges, (double)allocated / exchanges);
+    return allocated == 0;
+}
+
+static bool run(const char *server, unsigned short port, const char *ackDelay, size_t exchanges, bool all)
+{
+    char countFile[] = "/tmp/allocbench.XXXXXX";
+    int fd = mkstemp(countFile);
+    if (fd < 0 || ftruncate(fd, sizeof(uint64_t)) < 0)
+    {
+        perror("allocation counter");
+        return false;
+    }
+    const volatile uint64_t *allocations =
+        (const volatile uint64_t *)mmap(nullptr, sizeof(uint64_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    Server proc;
+    if (!startServer(server, port, ackDelay, countFile, proc))
+        return false;
+    Client a, b;
+    a.id = 2;
+    b.id = 3;
+    for (int tries = 0; tries < 200 && !connectTo(port, a.fd); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    bool ok = a.fd >= 0 && connectTo(port, b.fd) && statusRequest(a, b) && statusRequest(b, a);
+    if (!ok)
+        fprintf(stderr, "FAILED: couldn't connect to %s\n", server);
+
+    printf("server ACK delay %s:\n", ackDelay);
+    ok = ok && measure("chat to the server and its ACK", chatToServer, a, b, allocations, exchanges);
+    if (all)
+        ok = ok && measure("chat relayed to a client and its ACK back", relayedChat, a, b, allocations, exchanges) &&
+             measure("status request and response", statusRequest, a, b, allocations, exchanges);
+    close(a.fd);
+    close(b.fd);
+    stopServer(proc);
+    munmap((void *)allocations, sizeof(uint64_t));
+    unlink(countFile);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8102;
+    size_t exchanges = argc > 3 ? (size_t)atoi(argv[3]) : 100000;
+
+    if (access("./allocshim.so", R_OK) != 0)
+    {
+        fprintf(stderr, "allocshim.so not found, run make first\n");
+        return EXIT_FAILURE;
+    }
+    //each chat ACKed in a range ACK at the end of its batch, then each on its own
+    bool ok = run(server, port, "0", exchanges, true);
+    ok = run(server, port, "-1", exchanges, false) && ok;
+    printf("%s\n", ok ? "PASSED: no allocations in steady state" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
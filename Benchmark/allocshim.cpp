@@ -0,0 +1,91 @@
+//Counts the heap allocations of a process it is preloaded into, for allocbench:
+//  ALLOCSHIM_FILE=/tmp/count LD_PRELOAD=./allocshim.so server ...
+//The count is a uint64_t at the start of ALLOCSHIM_FILE, kept in a shared mapping so
+//another process can read it while this one runs. Every malloc(), calloc(), realloc()
+//and aligned allocation counts, which covers operator new too.
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+}
+
+//allocations before the mapping is up land here
+static uint64_t early;
+static uint64_t *counter = &early;
+
+static inline void count()
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+__attribute__((constructor)) static void mapCounter()
+{
+    const char *path = getenv("ALLOCSHIM_FILE");
+    if (!path)
+        return;
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+        return;
+    if (ftruncate(fd, sizeof(uint64_t)) == 0)
+    {
+        void *map = mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            *(uint64_t *)map = early;
+            counter = (uint64_t *)map;
+        }
+    }
+    close(fd);
+}
+
+extern "C" {
+
+void *malloc(size_t size)
+{
+    count();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    count();
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count();
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    count();
+    return __libc_memalign(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    count();
+    return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size)
+{
+    count();
+    void *p = __libc_memalign(align, size);
+    if (!p)
+        return 12;    //ENOMEM
+    *out = p;
+    return 0;
+}
+}
@@ -0,0 +1,90 @@
+//Checksum kernel throughput across payload sizes
+//Compares the old byte-at-a-time sum with the portable and SSE4.2 CRC32C.
+//Usage: checkbench [megabytes per measurement]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../Common/checksum.h"
+
+using namespace std;
+
+//checkSum_Gen as it was
+static uint32_t byteSum(uint32_t, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i++)
+        sum += p[i];
+    return (uint16_t)sum;
+}
+
+static bool selfCheck()
+{
+    //the standard CRC32C check value
+    if (crc32c_Portable(0, "123456789", 9) != 0xE3069283 || crc32c_Update(0, "123456789", 9) != 0xE3069283)
+    {
+        fprintf(stderr, "FAILED: CRC32C check value\n");
+        return false;
+    }
+
+    vector<uint8_t> data(70000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 2654435761u >> 13);
+    for (size_t len : {0, 1, 7, 8, 9, 100, 383, 384, 385, 1000, 3071, 3072, 3073, 5000, 9999, 65535})
+    {
+        for (size_t offset = 0; offset < 8; offset++)
+        {
+            if (crc32c_Portable(7, data.data() + offset, len) != crc32c_Hardware(7, data.data() + offset, len))
+            {
+                fprintf(stderr, "FAILED: implementations disagree at length %zu offset %zu\n", len, offset);
+                return false;
+            }
+        }
+    }
+    //chaining must match one pass
+    uint32_t chained = crc32c_Update(crc32c_Update(0, data.data(), 1000), data.data() + 1000, 5000);
+    if (chained != crc32c_Update(0, data.data(), 6000))
+    {
+        fprintf(stderr, "FAILED: chained CRC differs\n");
+        return false;
+    }
+    return true;
+}
+
+static double measure(uint32_t (*kernel)(uint32_t, const void *, size_t), const vector<uint8_t> &data,
+                      size_t len, size_t megabytes)
+{
+    size_t rounds = megabytes * 1024 * 1024 / len + 1;
+    volatile uint32_t sink = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+        sink = sink + kernel(0, data.data(), len);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return rounds * len / secs / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes = argc > 1 ? atoi(argv[1]) : 512;
+
+    if (!selfCheck())
+        return EXIT_FAILURE;
+
+    printf("hardware CRC32C %s\n", crc32c_HardwareAvailable() ? "available (SSE4.2)" : "not available, dispatching to portable");
+    printf("%8s %14s %14s %14s %14s\n", "payload", "old sum GB/s", "portable GB/s", "sse4.2 GB/s", "dispatched ns");
+
+    vector<uint8_t> data(65536, 0x5a);
+    for (size_t len : {16, 64, 256, 1024, 4096, 16384, 65535})
+    {
+        double sum = measure(byteSum, data, len, megabytes / 4);
+        double portable = measure(crc32c_Portable, data, len, megabytes);
+        double hardware = crc32c_HardwareAvailable() ? measure(crc32c_Hardware, data, len, megabytes) : 0;
+        double dispatched = measure(crc32c_Update, data, len, megabytes);
+        printf("%8zu %14.2f %14.2f %14.2f %14.1f\n", len, sum, portable, hardware, len / dispatched);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+//Client send coalescing benchmark. A bot connected to NetworkServer pushes bursts of
+//chats and waits for the server to ACK each burst, while its receive thread answers
+//every ACK with a status request on the same connection, as the client's does with its
+//own replies. Once with one send() per frame, as the client used to, then through
+//SendPipeline in low latency and in throughput mode: writes per frame, burst throughput,
+//and the round trip of a chat sent on its own, which the throughput window delays.
+//Every chat must be ACKed and every status request answered.
+//Usage: coalescebench [server binary] [port] [bursts] [burst size]
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/ackbatch.h"
+#include "../Common/histogram.h"
+#include "../Common/sendpipeline.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+}
+
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+//One bot's connection, sending from both of its threads
+struct Bot {
+    int fd = -1;
+    uint16_t id;
+    SendPipeline *pipeline = nullptr;    //null: one send() per frame
+    atomic<uint32_t> nextId{0};
+    atomic<uint64_t> directWrites{0};
+
+    mutex lock;
+    condition_variable progress;
+    uint64_t acked = 0;            //chats the server has ACKed
+    uint64_t statusSent = 0;       //by the receive thread
+    uint64_t statusAnswered = 0;
+};
+
+static bool sendFrame(Bot &bot, uint8_t type, const char *payload, size_t len)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = bot.id;
+    header.receiver_id = 1;
+    header.message_id = ++bot.nextId;
+    if (bot.pipeline)
+        return bot.pipeline->send(header, payload, len);
+    bot.directWrites++;
+    return frame_Send(bot.fd, header, payload, len);
+}
+
+//Counts ACKs and status responses, answering every ACK frame with a status request
+static void receive(Bot &bot)
+{
+    FrameDecoder decoder;
+    Frame frame;
+    while (1)
+    {
+        char *space = decoder.writePtr();
+        ssize_t got = recv(bot.fd, space, decoder.writable(), 0);
+        if (got <= 0)
+            return;
+        decoder.commit(got);
+        while (decoder.next(frame))
+        {
+            uint64_t chats = 0, answers = 0;
+            if (frame.header.messageType == 9)
+                for (size_t i = 0; i < ackRange_Count(frame.header.payloadLen); i++)
+                {
+                    uint32_t first, last;
+                    ackRange_Load(frame.payload, i, first, last);
+                    chats += last - first + 1;
+                }
+            else if (frame.header.messageType == 4)
+                chats = 1;
+            else if (frame.header.messageType == 2)
+                answers = 1;
+            else
+                continue;
+            if (chats > 0)
+                sendFrame(bot, 1, "", 0);
+            {
+                lock_guard<mutex> guard(bot.lock);
+                bot.acked += chats;
+                bot.statusSent += chats > 0;
+                bot.statusAnswered += answers;
+            }
+            bot.progress.notify_all();
+        }
+    }
+}
+
+static bool waitAcked(Bot &bot, uint64_t chats)
+{
+    unique_lock<mutex> guard(bot.lock);
+    return bot.progress.wait_for(guard, chrono::seconds(10), [&]() { return bot.acked >= chats; });
+}
+
+static bool run(const char *name, unsigned short port, uint16_t id, bool pipelined, SendPipeline::Mode mode,
+                size_t bursts, size_t burstSize)
+{
+    Bot bot;
+    bot.id = id;
+    if (!connectTo(port, bot.fd))
+    {
+        fprintf(stderr, "FAILED: %s: couldn't connect\n", name);
+        return false;
+    }
+    SendPipeline pipeline(bot.fd, mode);
+    if (pipelined)
+        bot.pipeline = &pipeline;
+    thread receiver(receive, ref(bot));
+    sendFrame(bot, 1, "", 0);
+
+    char text[64];
+    memset(text, 'x', sizeof(text));
+    uint64_t chats = 0;
+    bool ok = true;
+
+    //bursts as fast as the server ACKs them
+    uint64_t writesBefore = bot.directWrites + pipeline.writes();
+    uint32_t framesBefore = bot.nextId;
+    auto start = chrono::steady_clock::now();
+    for (size_t b = 0; b < bursts && ok; b++)
+    {
+        for (size_t i = 0; i < burstSize; i++)
+            ok = sendFrame(bot, 3, text, sizeof(text)) && ok;
+        chats += burstSize;
+        ok = ok && waitAcked(bot, chats);
+    }
+    double secs = seconds(start);
+    uint64_t writes = bot.directWrites + pipeline.writes() - writesBefore;
+    uint32_t frames = bot.nextId - framesBefore;
+
+    //then one chat at a time
+    Histogram single;
+    for (int i = 0; i < 2000 && ok; i++)
+    {
+        uint64_t sentAt = nowNs();
+        ok = sendFrame(bot, 3, text, sizeof(text)) && waitAcked(bot, ++chats);
+        single.record(nowNs() - sentAt);
+    }
+
+    //every status request the receive thread sent gets its answer
+    {
+        unique_lock<mutex> guard(bot.lock);
+        ok = ok && bot.progress.wait_for(guard, chrono::seconds(10),
+                                         [&]() { return bot.statusAnswered >= bot.statusSent; });
+    }
+    if (ok)
+        printf("  %-24s %6.3f writes per frame, %9.0f chats/s in bursts, single chat round trip p50 %6.1f us\n",
+               name, (double)writes / frames, bursts * burstSize / secs,
+               single.percentile(0.5) / 1e3);
+    else
+        fprintf(stderr, "FAILED: %s: %lu of %lu chats ACKed, %lu of %lu status requests answered\n", name,
+                (unsigned long)bot.acked, (unsigned long)chats, (unsigned long)bot.statusAnswered,
+                (unsigned long)bot.statusSent);
+
+    pipeline.stop();
+    shutdown(bot.fd, SHUT_RDWR);
+    receiver.join();
+    close(bot.fd);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8104;
+    size_t bursts = argc > 3 ? (size_t)atoi(argv[3]) : 500;
+    size_t burstSize = argc > 4 ? (size_t)atoi(argv[4]) : 200;
+
+    //one worker, ACKs at the end of each batch
+    int console[2];
+    if (pipe(console) < 0)
+        return EXIT_FAILURE;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "1", "nack", "4096", "0", (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+    int probe = -1;
+    for (int tries = 0; tries < 200 && !connectTo(port, probe); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (probe >= 0)
+        close(probe);
+
+    printf("%zu bursts of %zu chats, each ACK answered with a status request:\n", bursts, burstSize);
+    bool ok = run("one send() per frame", port, 2, false, SendPipeline::LowLatency, bursts, burstSize);
+    ok = run("pipeline, low latency", port, 3, true, SendPipeline::LowLatency, bursts, burstSize) && ok;
+    ok = run("pipeline, throughput", port, 4, true, SendPipeline::Throughput, bursts, burstSize) && ok;
+
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+    printf("%s\n", ok ? "PASSED: every chat ACKed and every status request answered" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,309 @@
+//Chat compression benchmark. Builds a corpus of chat-like messages (mostly short lines,
+//some longer ones, now and then a pasted log or link) and compresses each the way the
+//client does, with and without the built-in chat dictionary: bytes on the wire and CPU
+//per message to compress and expand, every message checked to come back the same. Then
+//relays the corpus through NetworkServer from one client to another, plain and
+//compressed, for end-to-end throughput and bytes, and once more to a receiver that
+//never asked for compressed chats, which must get them expanded by the server.
+//Usage: compressbench [server binary] [port] [messages]
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/compress.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+}
+
+static const char *words[] = {
+    "the", "I", "you", "to", "a", "it", "and", "that", "is", "of", "in", "we", "on", "for", "this", "just",
+    "so", "be", "have", "but", "not", "what", "with", "can", "are", "do", "was", "if", "me", "my", "get",
+    "ok", "yeah", "think", "know", "like", "will", "going", "now", "then", "there", "about", "tomorrow",
+    "meeting", "deploy", "build", "test", "server", "release", "branch", "review", "later", "lunch",
+    "sounds", "good", "thanks", "sure", "maybe", "fixed", "broken", "again", "weird", "anyone", "link",
+    "lol", "haha", "please", "sorry", "when", "where", "why", "how", "time", "today", "tonight", "week",
+};
+static const size_t wordCount = sizeof(words) / sizeof(words[0]);
+
+static const char *pastes[] = {
+    "2024-05-14T09:12:44.512Z ERROR [worker-3] request failed: connection refused (retry %d of 5)\n",
+    "    at com.example.chat.Router.deliver(Router.java:%d)\n",
+    "https://github.com/example/chat/pull/%d/files#diff-3a9c\n",
+    "{\"id\": %d, \"name\": \"build\", \"status\": \"ok\", \"message\": \"finished in 41s\"}\n",
+};
+
+//Mostly short lines, some longer ones, about one in twenty a paste of repeated log lines
+static vector<string> makeCorpus(size_t count)
+{
+    mt19937 rng(42);
+    vector<string> corpus;
+    for (size_t i = 0; i < count; i++)
+    {
+        string text;
+        unsigned kind = rng() % 20;
+        if (kind == 0)
+        {
+            const char *format = pastes[rng() % 4];
+            unsigned lines = 3 + rng() % 30;
+            for (unsigned l = 0; l < lines; l++)
+            {
+                char line[160];
+                snprintf(line, sizeof(line), format, (int)(rng() % 500));
+                text += line;
+            }
+        }
+        else
+        {
+            size_t length = kind < 13 ? 3 + rng() % 10 : 12 + rng() % 50;
+            for (size_t w = 0; w < length; w++)
+                text += string(w ? " " : "") + words[min<size_t>(rng() % wordCount, rng() % wordCount)];
+            text += "?!.."[rng() % 4];
+        }
+        corpus.push_back(text);
+    }
+    return corpus;
+}
+
+//What a client sends: the text as is, or compressed when that is smaller
+static bool compressed(const string &text, CompressFormat format, string &payload)
+{
+    return text.size() >= compressMinBytes && compress_Chat(text.data(), text.size(), payload, format);
+}
+
+static bool offline(const vector<string> &corpus)
+{
+    size_t raw = 0;
+    for (const string &text : corpus)
+        raw += headerWireLen + text.size();
+    printf("%zu messages, %.1f bytes of text on average, %zu bytes on the wire sent plain\n", corpus.size(),
+           (double)(raw - corpus.size() * headerWireLen) / corpus.size(), raw);
+
+    const struct {
+        const char *name;
+        CompressFormat format;
+    } formats[] = {{"no dictionary", CompressPlain}, {"chat dictionary", CompressChatDictionary}};
+    for (const auto &f : formats)
+    {
+        //sizes and a round trip check first, then timing on its own
+        size_t wire = 0, shrunk = 0;
+        string payload, text;
+        for (const string &original : corpus)
+        {
+            if (!compressed(original, f.format, payload))
+            {
+                wire += headerWireLen + original.size();
+                continue;
+            }
+            shrunk++;
+            wire += headerWireLen + payload.size();
+            if (!compress_Expand(payload.data(), payload.size(), text) || text != original)
+            {
+                fprintf(stderr, "FAILED: %s: \"%s\" didn't come back the same\n", f.name, original.c_str());
+                return false;
+            }
+        }
+
+        const int rounds = 5;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++)
+            for (const string &original : corpus)
+                compressed(original, f.format, payload);
+        double compressNs = seconds(start) * 1e9 / (rounds * corpus.size());
+
+        vector<string> payloads;
+        for (const string &original : corpus)
+            if (compressed(original, f.format, payload))
+                payloads.push_back(payload);
+        start = chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++)
+            for (const string &p : payloads)
+                compress_Expand(p.data(), p.size(), text);
+        double expandNs = seconds(start) * 1e9 / (rounds * max<size_t>(payloads.size(), 1));
+
+        printf("  %-16s %5.1f%% of messages compressed, %zu bytes on the wire (%.1f%% of plain), "
+               "%.0f ns to compress a message, %.0f ns to expand one\n",
+               f.name, 100.0 * shrunk / corpus.size(), wire, 100.0 * wire / raw, compressNs, expandNs);
+    }
+    return true;
+}
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+static void sendFrame(int fd, uint8_t type, uint16_t sender, uint16_t receiver, uint32_t id, const string &payload)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = sender;
+    header.receiver_id = receiver;
+    header.message_id = id;
+    frame_Send(fd, header, payload.data(), payload.size());
+}
+
+//Blocks until a whole frame is in, counting the bytes read; false on EOF
+static bool readFrame(int fd, FrameDecoder &decoder, Frame &frame, size_t &bytes)
+{
+    while (!decoder.next(frame))
+    {
+        char *space = decoder.writePtr();
+        ssize_t got = recv(fd, space, decoder.writable(), 0);
+        if (got <= 0)
+            return false;
+        decoder.commit(got);
+        bytes += got;
+    }
+    return true;
+}
+
+struct Client {
+    int fd = -1;
+    uint16_t id;
+    FrameDecoder decoder;
+    size_t bytesIn = 0;
+};
+
+//Registers with a status request, offering to take compressed chats or not; true if
+//the server's answer agrees
+static bool hello(Client &client, unsigned short port, bool offer)
+{
+    for (int tries = 0; tries < 200 && !connectTo(port, client.fd); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (client.fd < 0)
+        return false;
+    sendFrame(client.fd, 1, client.id, 1, 1, offer ? compressFeature : "");
+    Frame frame;
+    if (!readFrame(client.fd, client.decoder, frame, client.bytesIn) || frame.header.messageType != 2)
+        return false;
+    string answer(frame.payload, frame.header.payloadLen);
+    return (answer.find(compressFeature) != string::npos) == offer;
+}
+
+//Client 2 sends the corpus to client 3, keeping window chats unacknowledged, and client
+//3 checks each one and ACKs it
+static bool relay(unsigned short port, const vector<string> &corpus, const char *name, bool compress, bool receiverOffers)
+{
+    Client a, b;
+    a.id = 2;
+    b.id = 3;
+    if (!hello(a, port, true) || !hello(b, port, receiverOffers))
+    {
+        fprintf(stderr, "FAILED: %s: status handshake\n", name);
+        return false;
+    }
+
+    const size_t window = 32;
+    size_t next = 0, received = 0, bytesOut = 0;
+    Frame frame;
+    string payload, text;
+    bool ok = true, sawCompressed = false;
+    auto start = chrono::steady_clock::now();
+    while (ok && received < corpus.size())
+    {
+        for (; next < corpus.size() && next - received < window; next++)
+        {
+            const string &original = corpus[next];
+            bool shrunk = compress && compressed(original, CompressChatDictionary, payload);
+            const string &sent = shrunk ? payload : original;
+            sendFrame(a.fd, shrunk ? 3 | compressedFlag : 3, a.id, b.id, next + 1, sent);
+            bytesOut += headerWireLen + sent.size();
+        }
+        ok = readFrame(b.fd, b.decoder, frame, b.bytesIn) && frame_Type(frame.header.messageType) == 3;
+        if (!ok)
+            break;
+        sawCompressed |= frame_Compressed(frame.header.messageType);
+        if (frame_Compressed(frame.header.messageType))
+            ok = compress_Expand(frame.payload, frame.header.payloadLen, text);
+        else
+            text.assign(frame.payload, frame.header.payloadLen);
+        ok = ok && frame.header.message_id == received + 1 && text == corpus[received];
+        sendFrame(b.fd, 4, b.id, a.id, 1, to_string(frame.header.message_id));
+        ok = ok && readFrame(a.fd, a.decoder, frame, a.bytesIn) && frame.header.messageType == 4;
+        received++;
+    }
+    double secs = seconds(start);
+    close(a.fd);
+    close(b.fd);
+    if (!ok || (!receiverOffers && sawCompressed))
+    {
+        fprintf(stderr, "FAILED: %s: message %zu didn't arrive as sent\n", name, received + 1);
+        return false;
+    }
+    printf("  %-36s %8.0f messages/s, %9zu bytes sent, %9zu bytes received\n", name, corpus.size() / secs,
+           bytesOut, b.bytesIn);
+    return true;
+}
+
+static bool endToEnd(const char *server, unsigned short port, const vector<string> &corpus)
+{
+    int console[2];
+    if (pipe(console) < 0)
+        return false;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "1", (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+
+    printf("through the server:\n");
+    bool ok = relay(port, corpus, "plain", false, true) && relay(port, corpus, "compressed", true, true) &&
+              relay(port, corpus, "compressed, expanded for the receiver", true, false);
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8101;
+    size_t count = argc > 3 ? (size_t)atoi(argv[3]) : 100000;
+
+    vector<string> corpus = makeCorpus(count);
+    bool ok = offline(corpus) && endToEnd(server, port, corpus);
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
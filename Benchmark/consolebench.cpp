@@ -0,0 +1,207 @@
+//Receive-loop throughput with console output done three ways: every thread formatting
+//its timestamp and writing to cout per frame (as the client used to), handing lines to
+//the Console thread through its MPSC queue, and no output at all.
+//Each receiver decodes and checksums a pre-encoded stream of chats fed in 4 KB reads;
+//stdout goes to a pipe drained by another thread, standing in for the terminal.
+//Checks first that the MPSC queue loses nothing and keeps each producer's order.
+//Usage: consolebench [frames per receiver] [receivers]
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/checksum.h"
+#include "../Common/console.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/mpscqueue.h"
+
+using namespace std;
+
+enum Mode { PerFrameCout, ConsoleThread, NoOutput };
+
+static double seconds(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+}
+
+//Producers push (producer, sequence) pairs while the consumer pops concurrently
+static bool selfCheck()
+{
+    const unsigned producers = 4;
+    const uint32_t perProducer = 200000;
+    MpscQueue<uint64_t> queue;
+    vector<thread> threads;
+    for (unsigned p = 0; p < producers; p++)
+        threads.emplace_back([&queue, p]() {
+            for (uint32_t seq = 0; seq < perProducer; seq++)
+                queue.push((uint64_t)p << 32 | seq);
+        });
+
+    vector<uint32_t> expected(producers, 0);
+    uint64_t got = 0, wrong = 0, value;
+    while (got < (uint64_t)producers * perProducer)
+    {
+        if (!queue.pop(value))
+        {
+            this_thread::yield();
+            continue;
+        }
+        unsigned p = value >> 32;
+        if (p >= producers || (uint32_t)value != expected[p])
+            wrong++;
+        else
+            expected[p]++;
+        got++;
+    }
+    for (auto &t : threads)
+        t.join();
+    if (wrong != 0 || !queue.empty())
+    {
+        fprintf(stderr, "FAILED: %lu items out of order, from nowhere or left over\n", (unsigned long)wrong);
+        return false;
+    }
+    return true;
+}
+
+//count chats, the timestamp moving on one second every thousand frames
+static string encodeStream(unsigned count, uint16_t sender)
+{
+    string stream;
+    uint8_t wire[headerWireLen + 64];
+    uint32_t start = (uint32_t)time(nullptr);
+    for (unsigned i = 0; i < count; i++)
+    {
+        string text = "hello from client " + to_string(sender) + ", message " + to_string(i);
+        MessageHeader header;
+        header.headerLen = headerWireLen;
+        header.messageType = 3;
+        header.timeStamp = start + i / 1000;
+        header.sender_id = sender;
+        header.receiver_id = 2;
+        header.message_id = i + 1;
+        header.payloadLen = text.size();
+        header.checksum = 0;
+        size_t len = frame_Encode(header, text.data(), text.size(), wire);
+        stream.append((const char *)wire, len);
+    }
+    return stream;
+}
+
+//One receive thread: what handleServerResponse does per chat, minus the socket
+static unsigned receive(const string &stream, Mode mode, Console &console)
+{
+    FrameDecoder decoder;
+    Frame frame;
+    unsigned shown = 0;
+    for (size_t at = 0; at < stream.size(); at += 4096)
+    {
+        decoder.feed(stream.data() + at, min<size_t>(4096, stream.size() - at));
+        while (decoder.next(frame))
+        {
+            const MessageHeader *header = &frame.header;
+            if (!checkSum_Check(frame.wire, frame.payload, header->payloadLen))
+                continue;
+            string message(frame.payload, header->payloadLen);
+            shown++;
+            if (mode == PerFrameCout)
+            {
+                time_t raw_time = header->timeStamp;
+                struct tm *time_info = localtime(&raw_time);
+                char time_str[20];
+                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", time_info);
+                cout << "\n[" << time_str << "]: ";
+                cout << "Client " << header->sender_id << ": " << message << endl;
+                cout << "Enter message: ";
+                cout.flush();
+            }
+            else if (mode == ConsoleThread)
+                console.print("Client " + to_string(header->sender_id) + ": " + message, header->timeStamp);
+        }
+    }
+    return shown;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned frames = argc > 1 ? atoi(argv[1]) : 200000;
+    unsigned receivers = argc > 2 ? atoi(argv[2]) : 4;
+
+    if (!selfCheck())
+        return EXIT_FAILURE;
+
+    vector<string> streams;
+    for (unsigned r = 0; r < receivers; r++)
+        streams.push_back(encodeStream(frames, 10 + r));
+
+    //stdout into a pipe someone keeps reading, like a terminal would
+    cout.flush();
+    int pipefd[2];
+    if (pipe(pipefd) != 0)
+    {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+    int savedOut = dup(1);
+    dup2(pipefd[1], 1);
+    close(pipefd[1]);
+    thread drain([fd = pipefd[0]]() {
+        char buf[65536];
+        while (read(fd, buf, sizeof(buf)) > 0)
+            ;
+    });
+
+    const char *names[] = {"cout per frame", "console thread", "no output"};
+    double loopSecs[3], totalSecs[3];
+    uint64_t lines[3] = {0, 0, 0}, batches[3] = {0, 0, 0};
+    unsigned shownAll[3];
+    for (int mode = PerFrameCout; mode <= NoOutput; mode++)
+    {
+        Console console;
+        console.setPrompt("Enter message: ");
+        console.start();
+        vector<unsigned> shown(receivers, 0);
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (unsigned r = 0; r < receivers; r++)
+            threads.emplace_back([&, r]() { shown[r] = receive(streams[r], (Mode)mode, console); });
+        for (auto &t : threads)
+            t.join();
+        loopSecs[mode] = seconds(start);
+        cout.flush();
+        console.stop();
+        totalSecs[mode] = seconds(start);
+        lines[mode] = console.lines();
+        batches[mode] = console.batches();
+        shownAll[mode] = 0;
+        for (unsigned s : shown)
+            shownAll[mode] += s;
+    }
+
+    dup2(savedOut, 1);
+    close(savedOut);
+    drain.join();
+
+    uint64_t total = (uint64_t)frames * receivers;
+    printf("%u receiver thread(s), %u chats each\n", receivers, frames);
+    for (int mode = PerFrameCout; mode <= NoOutput; mode++)
+    {
+        printf("%-15s receive loop %8.0f frames/s, all printed after %.3f s", names[mode],
+               shownAll[mode] / loopSecs[mode], totalSecs[mode]);
+        if (batches[mode])
+            printf(", %.1f lines per write", (double)lines[mode] / batches[mode]);
+        printf("\n");
+        if (shownAll[mode] != total || (mode == ConsoleThread && lines[mode] != total))
+        {
+            fprintf(stderr, "FAILED: %s showed %u of %lu chats\n", names[mode], shownAll[mode], (unsigned long)total);
+            return EXIT_FAILURE;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+//FrameDecoder stress check and throughput benchmark
+//The recorded stream is first decoded after being split at every byte boundary
+//and fed one byte at a time; the benchmark only runs if every slicing matches.
+//Usage: framebench [megabytes to decode]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+
+using namespace std;
+
+struct Recorded {
+    MessageHeader header;
+    string payload;
+};
+
+static string makeStream(const vector<Recorded> &frames)
+{
+    string stream;
+    for (const auto &frame : frames)
+    {
+        uint8_t wire[headerWireLen];
+        header_Encode(frame.header, wire);
+        stream.append((const char *)wire, headerWireLen);
+        stream += frame.payload;
+    }
+    return stream;
+}
+
+static vector<Recorded> makeFrames(const vector<size_t> &payloadSizes)
+{
+    vector<Recorded> frames;
+    uint32_t id = 0;
+    for (size_t size : payloadSizes)
+    {
+        Recorded frame;
+        frame.header = MessageHeader{};
+        frame.header.headerLen = headerWireLen;
+        frame.header.messageType = 3;
+        frame.header.message_id = ++id;
+        frame.header.payloadLen = size;
+        for (size_t i = 0; i < size; i++)
+            frame.payload += (char)('a' + (id + i) % 26);
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+static bool matches(const Frame &got, const Recorded &want)
+{
+    return got.header.headerLen == want.header.headerLen && got.header.messageType == want.header.messageType &&
+           got.header.message_id == want.header.message_id && got.header.payloadLen == want.header.payloadLen &&
+           want.payload.compare(0, string::npos, got.payload, got.header.payloadLen) == 0;
+}
+
+//Feeds the stream in the given slices, checking every frame comes out whole and in order
+static bool decodeSlices(const string &stream, const vector<size_t> &cuts, const vector<Recorded> &want)
+{
+    FrameDecoder decoder;
+    Frame frame;
+    size_t seen = 0, pos = 0;
+    for (size_t i = 0; i <= cuts.size(); i++)
+    {
+        size_t end = i < cuts.size() ? cuts[i] : stream.size();
+        decoder.feed(stream.data() + pos, end - pos);
+        pos = end;
+        while (decoder.next(frame))
+        {
+            if (seen >= want.size() || !matches(frame, want[seen]))
+                return false;
+            seen++;
+        }
+    }
+    return seen == want.size() && decoder.buffered() == 0 && !decoder.corrupt();
+}
+
+static bool stressCheck()
+{
+    //empty payloads, a header-sized one and several well past the old 1 KB limit
+    vector<Recorded> frames = makeFrames({0, 5, 20, 1, 1000, 1004, 3000, 0, 65535, 17, 8192, 2});
+    string stream = makeStream(frames);
+
+    for (size_t cut = 0; cut <= stream.size(); cut++)
+    {
+        if (!decodeSlices(stream, {cut}, frames))
+        {
+            fprintf(stderr, "FAILED: stream split at byte %zu\n", cut);
+            return false;
+        }
+    }
+
+    vector<size_t> everyByte;
+    for (size_t cut = 1; cut < stream.size(); cut++)
+        everyByte.push_back(cut);
+    if (!decodeSlices(stream, everyByte, frames))
+    {
+        fprintf(stderr, "FAILED: stream fed one byte at a time\n");
+        return false;
+    }
+
+    FrameDecoder decoder;
+    Frame frame;
+    string bad = stream;
+    bad[0] = 7;
+    decoder.feed(bad.data(), bad.size());
+    if (decoder.next(frame) || !decoder.corrupt())
+    {
+        fprintf(stderr, "FAILED: bad header length not reported\n");
+        return false;
+    }
+
+    printf("stress: %zu frames, %zu-byte stream decoded at every split point and byte by byte\n",
+           frames.size(), stream.size());
+    return true;
+}
+
+static void throughput(size_t payloadSize, size_t megabytes)
+{
+    vector<Recorded> frames = makeFrames(vector<size_t>(256, payloadSize));
+    string stream = makeStream(frames);
+    size_t rounds = megabytes * 1024 * 1024 / stream.size() + 1;
+
+    //64 KB reads, the way a busy socket hands data over
+    const size_t chunk = 65536;
+    FrameDecoder decoder;
+    Frame frame;
+    size_t decoded = 0, checksum = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (size_t pos = 0; pos < stream.size(); pos += chunk)
+        {
+            size_t len = min(chunk, stream.size() - pos);
+            memcpy(decoder.writePtr(len), stream.data() + pos, len);
+            decoder.commit(len);
+            while (decoder.next(frame))
+            {
+                decoded++;
+                checksum += frame.payload[0];
+            }
+        }
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("payload %6zu B  %10zu frames  %8.3f s  %12.0f frames/sec  %8.1f MB/s  (%zu)\n",
+           payloadSize, decoded, secs, decoded / secs, rounds * stream.size() / secs / 1e6, checksum % 10);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes = argc > 1 ? atoi(argv[1]) : 256;
+
+    if (!stressCheck())
+        return EXIT_FAILURE;
+
+    for (size_t size : {16, 128, 1024, 4096, 16384})
+        throughput(size, megabytes);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,355 @@
+//History query benchmark. Fills a MessageStore with a 1M chat conversation, one of
+//200k chats whose timestamps jump about (clients with skewed clocks), and chats between
+//other clients around them, then times history queries: the last 50 chats, the last 50
+//of a one hour window, and a whole ten minute window. Every answer is checked against
+//a scan of all the chats the benchmark appended, which is also timed as the baseline.
+//Also times reopening the store, which rebuilds the index, and asks NetworkServer for
+//history over the wire (types 11 and 12), and checks another connection can't read it.
+//Usage: historybench [server binary] [port] [chats in the large conversation]
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/history.h"
+#include "../Common/histogram.h"
+#include "../Common/messagestore.h"
+
+using namespace std;
+
+static const uint32_t baseStamp = 1700000000;
+
+struct Sent {
+    uint16_t sender;
+    uint16_t receiver;
+    uint32_t id;
+    uint32_t stamp;
+};
+
+static double seconds(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+}
+
+static string encodeChat(const Sent &chat, const string &text)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = 3;
+    header.timeStamp = chat.stamp;
+    header.sender_id = chat.sender;
+    header.receiver_id = chat.receiver;
+    header.message_id = chat.id;
+    string wire(headerWireLen + text.size(), '\0');
+    frame_Encode(header, text.data(), text.size(), (uint8_t *)&wire[0]);
+    return wire;
+}
+
+//The answer without an index: every chat ever appended, newest first
+static void scan(const vector<Sent> &log, uint16_t a, uint16_t b, uint32_t from, uint32_t to, size_t limit,
+                 vector<uint32_t> &ids)
+{
+    ids.clear();
+    for (size_t i = log.size(); i-- > 0 && ids.size() < limit;)
+    {
+        const Sent &chat = log[i];
+        bool between = (chat.sender == a && chat.receiver == b) || (chat.sender == b && chat.receiver == a);
+        if (between && chat.stamp >= from && chat.stamp <= to)
+            ids.push_back(chat.id);
+    }
+    reverse(ids.begin(), ids.end());
+}
+
+//Times queries of one kind at random positions through a conversation spanning span seconds
+static bool timeQueries(MessageStore &store, const vector<Sent> &log, const char *name, uint16_t a, uint16_t b,
+                        uint32_t span, uint32_t window, size_t limit)
+{
+    mt19937 rng(7);
+    Histogram indexed, scanned;
+    vector<StoredFrame> frames;
+    vector<uint32_t> expected;
+    const int queries = 200;
+    for (int q = 0; q < queries; q++)
+    {
+        uint32_t from = window ? baseStamp + rng() % (span - window) : 0;
+        uint32_t to = window ? from + window : UINT32_MAX;
+
+        auto start = chrono::steady_clock::now();
+        store.history(a, b, from, to, limit, frames);
+        indexed.record((uint64_t)(seconds(start) * 1e9));
+
+        //the scan is slow, a few of them are enough
+        if (q % 20 == 0)
+        {
+            start = chrono::steady_clock::now();
+            scan(log, a, b, from, to, limit, expected);
+            scanned.record((uint64_t)(seconds(start) * 1e9));
+            bool same = expected.size() == frames.size();
+            for (size_t i = 0; same && i < frames.size(); i++)
+                same = frames[i].messageId == expected[i];
+            if (!same)
+            {
+                fprintf(stderr, "FAILED: %s from %u to %u: %zu chats, a scan finds %zu\n", name, from, to,
+                        frames.size(), expected.size());
+                return false;
+            }
+        }
+    }
+    printf("  %-34s %5zu chats  index p50 %8.1f us  p99 %8.1f us   scan p50 %9.1f us\n", name, frames.size(),
+           indexed.percentile(0.5) / 1e3, indexed.percentile(0.99) / 1e3, scanned.percentile(0.5) / 1e3);
+    return true;
+}
+
+static bool queryLatency(const string &dir, uint32_t large)
+{
+    string path = dir + "/history";
+    vector<Sent> log;
+    log.reserve(large * 1.5);
+    mt19937 rng(1);
+    uint32_t skewed = large / 5;
+    uint32_t ids[64] = {};
+
+    //2 and 3 chat every 0.1 s. 4 and 5 go on for as long, with clocks up to a minute
+    //apart. 6..63 chat among themselves in between.
+    MessageStore store;
+    string why;
+    if (!store.open(path, why))
+    {
+        fprintf(stderr, "open: %s\n", why.c_str());
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < large; i++)
+    {
+        uint32_t stamp = baseStamp + i / 10;
+        uint16_t sender = 2 + i % 2;
+        log.push_back(Sent{sender, (uint16_t)(5 - sender), ++ids[sender], stamp});
+        if (i % 5 == 0)
+        {
+            sender = 4 + rng() % 2;
+            log.push_back(Sent{sender, (uint16_t)(9 - sender), ++ids[sender], stamp + (uint32_t)(rng() % 60)});
+        }
+        if (i % 3 == 0)
+        {
+            sender = 6 + rng() % 58;
+            uint16_t receiver = 6 + (sender - 6 + 1 + rng() % 57) % 58;
+            log.push_back(Sent{sender, receiver, ++ids[sender], stamp});
+        }
+    }
+    for (const Sent &chat : log)
+    {
+        string wire = encodeChat(chat, "history message " + to_string(chat.id));
+        store.append((const uint8_t *)wire.data(), wire.size(), false);
+    }
+    double appendSecs = seconds(start);
+    uint32_t span = large / 10;
+    printf("%zu chats appended and indexed in %.2f s, %zu conversations; %u chats between 2 and 3, %u between 4 and 5\n",
+           log.size(), appendSecs, store.conversationCount(), large, skewed);
+
+    bool ok = timeQueries(store, log, "last 50", 2, 3, span, 0, 50) &&
+              timeQueries(store, log, "last 50 of an hour", 2, 3, span, 3600, 50) &&
+              timeQueries(store, log, "ten minutes", 2, 3, span, 600, 10000) &&
+              timeQueries(store, log, "skewed clocks: last 50 of an hour", 4, 5, span, 3600, 50) &&
+              timeQueries(store, log, "skewed clocks: ten minutes", 4, 5, span, 600, 10000);
+    store.close();
+    if (!ok)
+        return false;
+
+    start = chrono::steady_clock::now();
+    if (!store.open(path, why))
+    {
+        fprintf(stderr, "reopen: %s\n", why.c_str());
+        return false;
+    }
+    printf("reopened in %.2f s, %lu frames scanned and indexed again\n", seconds(start),
+           (unsigned long)store.framesRecovered());
+    return timeQueries(store, log, "after reopening: last 50 of an hour", 2, 3, span, 3600, 50);
+}
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+static void sendFrame(int fd, uint8_t type, uint16_t sender, uint16_t receiver, uint32_t id, const string &payload)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = sender;
+    header.receiver_id = receiver;
+    header.message_id = id;
+    frame_Send(fd, header, payload.data(), payload.size());
+}
+
+//Blocks until a whole frame is in; false on EOF
+static bool readFrame(int fd, FrameDecoder &decoder, Frame &frame)
+{
+    while (!decoder.next(frame))
+    {
+        char *space = decoder.writePtr();
+        ssize_t got = recv(fd, space, decoder.writable(), 0);
+        if (got <= 0)
+            return false;
+        decoder.commit(got);
+    }
+    return true;
+}
+
+//While client 2 is connected, a second connection asks for client 2's conversation with
+//3: as client 2, which is refused since client 2's connection holds that id; then as
+//client 4, which has no conversation with 3; then as client 2 again, refused since the
+//connection is client 4 now. None of it may get a single chat back.
+static bool strangerGetsNothing(unsigned short port, const string &query)
+{
+    int c = -1;
+    if (!connectTo(port, c))
+        return false;
+    FrameDecoder decoder;
+    Frame frame;
+    sendFrame(c, 11, 2, 1, 1, query);
+    bool ok = readFrame(c, decoder, frame) && frame.header.messageType == 6;
+    if (ok)
+    {
+        sendFrame(c, 11, 4, 1, 2, query);
+        ok = readFrame(c, decoder, frame) && frame.header.messageType == 12 && frame.header.payloadLen == 0;
+    }
+    if (ok)
+    {
+        sendFrame(c, 11, 2, 1, 3, query);
+        ok = readFrame(c, decoder, frame) && frame.header.messageType == 6;
+    }
+    close(c);
+    if (!ok)
+        fprintf(stderr, "FAILED: another connection got at client 2's history (type %d, %u bytes)\n",
+                frame.header.messageType, frame.header.payloadLen);
+    return ok;
+}
+
+//Client 2 sends 3000 chats to client 3, who is offline, then asks for the last 2500.
+//The server answers at most 1000: ids 2001..3000 must come back in order, over several
+//replies, then the empty one
+static bool overTheWire(const char *server, unsigned short port, const string &dir)
+{
+    int console[2];
+    if (pipe(console) < 0)
+        return false;
+    string storeDir = dir + "/server";
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "1", "nack", "256", "0", "epoll", storeDir.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+
+    int a = -1;
+    for (int tries = 0; tries < 200 && !connectTo(port, a); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    bool ok = a >= 0;
+    FrameDecoder decoder;
+    Frame frame;
+    const uint32_t chats = 3000, asked = 2500, answered = 1000;
+    for (uint32_t id = 1; ok && id <= chats; id++)
+    {
+        sendFrame(a, 3, 2, 3, id, "chat " + to_string(id) + string(200, '.'));
+        ok = readFrame(a, decoder, frame) && frame.header.messageType == 4;
+    }
+
+    HistoryQuery query{3, 0, UINT32_MAX, (uint16_t)asked};
+    string payload(historyQueryWireLen, '\0');
+    historyQuery_Encode(query, (uint8_t *)&payload[0]);
+    auto start = chrono::steady_clock::now();
+    if (ok)
+        sendFrame(a, 11, 2, 1, chats + 1, payload);
+    uint32_t expect = chats - answered + 1;
+    int replies = 0;
+    while (ok)
+    {
+        ok = readFrame(a, decoder, frame) && frame.header.messageType == 12;
+        if (!ok || frame.header.payloadLen == 0)
+            break;
+        replies++;
+        const uint8_t *at = (const uint8_t *)frame.payload, *end = at + frame.header.payloadLen;
+        while (ok && at < end)
+        {
+            MessageHeader chat = header_Decode(at);
+            ok = chat.messageType == 3 && chat.sender_id == 2 && chat.message_id == expect++;
+            at += headerWireLen + chat.payloadLen;
+        }
+    }
+    double secs = seconds(start);
+    ok = ok && expect == chats + 1;
+    bool guarded = ok && strangerGetsNothing(port, payload);
+    if (a >= 0)
+        close(a);
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+    if (!ok)
+    {
+        fprintf(stderr, "FAILED: history over the wire, stopped at chat %u\n", expect - 1);
+        return false;
+    }
+    printf("over the wire: asked for %u of %u chats, got the last %u in %d replies, %.0f us\n", asked, chats, answered,
+           replies, secs * 1e6);
+    if (!guarded)
+        return false;
+    printf("another connection asking for it as client 2 was refused, as client 4 got nothing\n");
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8100;
+    uint32_t large = argc > 3 ? atoi(argv[3]) : 1000000;
+
+    char dirTemplate[] = "/tmp/historybench.XXXXXX";
+    if (!mkdtemp(dirTemplate))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    string dir = dirTemplate;
+    bool ok = queryLatency(dir, large) && overTheWire(server, port, dir);
+    string command = "rm -rf '" + dir + "'";
+    if (system(command.c_str()) != 0)
+        fprintf(stderr, "couldn't remove %s\n", dir.c_str());
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,87 @@
+//CPU cost of idle receive threads: old MSG_PEEK spin vs. poll() + eventfd
+//Usage: idlecpu [connections] [seconds]
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "../Common/readiness.h"
+
+using namespace std;
+
+static atomic<bool> exitThread{false};
+static int exitfd = -1;
+
+//The receive wait as it was before: poll the socket without blocking until data or exit
+static void spinReceive(int sockfd)
+{
+    char buff[1024];
+    while (recv(sockfd, buff, sizeof(buff), MSG_DONTWAIT | MSG_PEEK) == -1)
+    {
+        if (exitThread.load())
+            return;
+    }
+}
+
+static void waitReceive(int sockfd)
+{
+    waitReadable(sockfd, exitfd);
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void measure(const char *name, void (*receive)(int), int connections, double seconds)
+{
+    vector<int> fds;
+    vector<thread> threads;
+    exitThread.store(false);
+    exitfd = shutdownFd_Create();
+
+    for (int i = 0; i < connections; i++)
+    {
+        int pair[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        fds.push_back(pair[0]);
+        fds.push_back(pair[1]);
+        threads.emplace_back(receive, pair[0]);
+    }
+
+    double cpuStart = cpuSeconds();
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    double cpuUsed = cpuSeconds() - cpuStart;
+
+    auto stopStart = chrono::steady_clock::now();
+    exitThread.store(true);
+    shutdownFd_Signal(exitfd);
+    for (auto &t : threads)
+        t.join();
+    double stopMs = chrono::duration<double, milli>(chrono::steady_clock::now() - stopStart).count();
+
+    printf("%-6s %5d idle connections  cpu %8.3f s over %.1f s  %10.3f ms cpu/connection/sec  shutdown %7.3f ms\n",
+           name, connections, cpuUsed, seconds, cpuUsed * 1000 / connections / seconds, stopMs);
+
+    for (int fd : fds)
+        close(fd);
+    close(exitfd);
+}
+
+int main(int argc, char *argv[])
+{
+    int connections = argc > 1 ? atoi(argv[1]) : 8;
+    double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+
+    measure("before", spinReceive, connections, seconds);
+    measure("after", waitReceive, connections, seconds);
+    return 0;
+}
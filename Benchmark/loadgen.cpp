@@ -0,0 +1,382 @@
+//Load generator and latency harness: N loopback clients speak the chat protocol to
+//NetworkServer or TestServer, sending chats (type 3) and status requests (type 1) to
+//the server and waiting for their ACKs (type 4 or range ACK 9) and responses (type 2).
+//Closed loop keeps a window of requests in flight per client; open loop sends at a
+//fixed total rate whatever the answers do, and times each request from when it was
+//due rather than when it went out, so a stalled server shows up in the latency rather
+//than slowing the load down. Reports throughput and p50/p99/p99.9 latency, and fails
+//(exit status 1) on a lost, NACKed or refused request or a missed -q/-l limit, which
+//makes it the regression gate for performance changes: see `make gate`.
+//
+//Usage: loadgen [-x server binary | -x -] [-p port] [-n workers] [-c clients]
+//               [-s message bytes] [-r total requests/sec, 0 for closed loop]
+//               [-w window per client] [-t seconds] [-S percent status requests]
+//               [-q min requests/sec] [-l max p99 us]
+//-x - drives a server that is already running. TestServer listens on 8080 and takes
+//one client only: loadgen -x ../TestServer/server -p 8080 -c 1
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/ackbatch.h"
+#include "../Common/histogram.h"
+#include "../Common/metrics.h"
+
+using namespace std;
+
+struct Options {
+    const char *server = "../NetworkServer/server";
+    unsigned short port = 8098;
+    int workers = 1;
+    int clients = 16;
+    size_t messageBytes = 64;
+    double rate = 0;            //total requests/sec; 0 is closed loop
+    int window = 1;
+    double seconds = 3;
+    int statusPercent = 0;
+    double minRate = 0;
+    double maxP99Us = 0;
+};
+
+struct Client {
+    int fd = -1;
+    uint16_t id;
+    FrameDecoder decoder;
+    vector<uint64_t> sentAt;    //ns each request was due, by message_id - 1; 0 once answered
+    uint32_t inFlight = 0;
+};
+
+struct Results {
+    uint64_t sent = 0;
+    uint64_t answered = 0;
+    uint64_t chats = 0;
+    uint64_t statuses = 0;
+    uint64_t refused = 0;       //NACKs and errors
+    uint64_t lost = 0;          //still unanswered a second after the end
+    uint64_t unexpected = 0;    //answers for ids never sent or already answered
+    Histogram latency;
+};
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+//Request number k overall is a status request for statusPercent of every 100
+static void sendRequest(Client &client, const Options &opt, const string &payload, uint64_t k, uint64_t dueNs,
+                        Results &results)
+{
+    bool status = (int)(k % 100) < opt.statusPercent;
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = status ? 1 : 3;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = client.id;
+    header.receiver_id = 1;
+    client.sentAt.push_back(dueNs);
+    header.message_id = client.sentAt.size();
+    if (status)
+        frame_Send(client.fd, header, nullptr, 0);
+    else
+        frame_Send(client.fd, header, payload.data(), payload.size());
+    client.inFlight++;
+    results.sent++;
+}
+
+//Settles request id; kind counts it as a chat or status answer, nullptr if it was refused
+static void answer(Client &client, uint64_t id, uint64_t now, Results &results, uint64_t *kind)
+{
+    if (id == 0 || id > client.sentAt.size() || client.sentAt[id - 1] == 0)
+    {
+        results.unexpected++;
+        return;
+    }
+    uint64_t due = client.sentAt[id - 1];
+    client.sentAt[id - 1] = 0;
+    client.inFlight--;
+    if (!kind)
+    {
+        results.refused++;
+        return;
+    }
+    (*kind)++;
+    results.answered++;
+    results.latency.record(now > due ? now - due : 0);
+}
+
+static uint64_t idIn(const Frame &frame)
+{
+    return strtoul(string(frame.payload, frame.header.payloadLen).c_str(), nullptr, 10);
+}
+
+//Reads what there is; false if the server closed the connection
+static bool readAnswers(Client &client, Results &results)
+{
+    Frame frame;
+    while (1)
+    {
+        char *space = client.decoder.writePtr();
+        ssize_t got = recv(client.fd, space, client.decoder.writable(), 0);
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR))
+            return false;
+        if (got < 0)
+            return true;
+        client.decoder.commit(got);
+        uint64_t now = metrics_NowNs();
+        while (client.decoder.next(frame))
+        {
+            const MessageHeader &header = frame.header;
+            switch (header.messageType)
+            {
+            case 2:
+                answer(client, idIn(frame), now, results, &results.statuses);
+                break;
+            case 4:
+                answer(client, idIn(frame), now, results, &results.chats);
+                break;
+            case 9:
+                for (size_t r = 0; r < ackRange_Count(header.payloadLen); r++)
+                {
+                    uint32_t first, last;
+                    ackRange_Load(frame.payload, r, first, last);
+                    for (uint64_t id = first; id <= last; id++)
+                        answer(client, id, now, results, &results.chats);
+                }
+                break;
+            case 5:
+            case 6:
+                answer(client, idIn(frame), now, results, nullptr);
+                break;
+            default:
+                break;  //e.g. TestServer's console chats
+            }
+        }
+        if (client.decoder.corrupt())
+            return false;
+    }
+}
+
+static bool drive(const Options &opt, Results &results)
+{
+    vector<Client> clients(opt.clients);
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < opt.clients; i++)
+    {
+        Client &client = clients[i];
+        //the first connect also waits for a server just started; no separate probe, as
+        //TestServer only ever accepts one connection
+        for (int tries = 0; tries < (i == 0 ? 200 : 1) && !connectTo(opt.port, client.fd); tries++)
+            this_thread::sleep_for(chrono::milliseconds(10));
+        if (client.fd < 0)
+        {
+            fprintf(stderr, "connect failed after %d clients: %s\n", i, strerror(errno));
+            for (int j = 0; j < i; j++)
+                close(clients[j].fd);
+            close(epfd);
+            return false;
+        }
+        client.id = 2 + i;
+        int on = 1;
+        setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(client.fd, F_SETFL, O_NONBLOCK);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, client.fd, &ev);
+    }
+
+    const string payload(opt.messageBytes, 'x');
+    bool closedLoop = opt.rate <= 0;
+    uint64_t start = metrics_NowNs();
+    uint64_t end = start + (uint64_t)(opt.seconds * 1e9);
+    uint64_t next = 0;      //open loop: request number next is due at start + next / rate
+    if (closedLoop)
+        for (auto &client : clients)
+            for (int w = 0; w < opt.window; w++)
+                sendRequest(client, opt, payload, next++, metrics_NowNs(), results);
+
+    //after the end, what is still in flight gets a second to come back
+    bool ok = true;
+    uint64_t drainEnd = end + 1000000000;
+    uint64_t outstanding = results.sent;
+    epoll_event events[256];
+    while (ok)
+    {
+        uint64_t now = metrics_NowNs();
+        bool sending = now < end;
+        if (!sending && (outstanding == 0 || now >= drainEnd))
+            break;
+
+        uint64_t waitNs = (sending ? end : drainEnd) - now;
+        if (!closedLoop && sending)
+        {
+            //everything due by now goes out, round robin over the clients
+            uint64_t due = (uint64_t)((now - start) * 1e-9 * opt.rate) + 1;
+            for (; next < due; next++)
+                sendRequest(clients[next % clients.size()], opt, payload, next, start + (uint64_t)(next * 1e9 / opt.rate),
+                             results);
+            uint64_t nextDue = start + (uint64_t)(next * 1e9 / opt.rate);
+            waitNs = nextDue > now ? nextDue - now : 0;
+        }
+
+        timespec timeout{(time_t)(waitNs / 1000000000), (long)(waitNs % 1000000000)};
+        int n = epoll_pwait2(epfd, events, 256, &timeout, nullptr);
+        for (int i = 0; i < n; i++)
+        {
+            Client &client = clients[events[i].data.u32];
+            uint32_t before = client.inFlight;
+            if (!readAnswers(client, results))
+            {
+                fprintf(stderr, "server closed client %u\n", client.id);
+                ok = false;
+                break;
+            }
+            if (closedLoop && sending)
+                for (uint32_t k = client.inFlight; k < before; k++)
+                    sendRequest(client, opt, payload, next++, metrics_NowNs(), results);
+        }
+        outstanding = 0;
+        for (auto &client : clients)
+            outstanding += client.inFlight;
+    }
+    results.lost = outstanding;
+
+    for (auto &client : clients)
+        close(client.fd);
+    close(epfd);
+    return ok;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: loadgen [-x server binary | -x -] [-p port] [-n workers] [-c clients] [-s message bytes]\n"
+                    "               [-r total requests/sec, 0 for closed loop] [-w window per client] [-t seconds]\n"
+                    "               [-S percent status requests] [-q min requests/sec] [-l max p99 us]\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    int c;
+    while ((c = getopt(argc, argv, "x:p:n:c:s:r:w:t:S:q:l:")) != -1)
+    {
+        switch (c)
+        {
+        case 'x': opt.server = optarg; break;
+        case 'p': opt.port = (unsigned short)atoi(optarg); break;
+        case 'n': opt.workers = atoi(optarg); break;
+        case 'c': opt.clients = atoi(optarg); break;
+        case 's': opt.messageBytes = strtoul(optarg, nullptr, 10); break;
+        case 'r': opt.rate = atof(optarg); break;
+        case 'w': opt.window = atoi(optarg); break;
+        case 't': opt.seconds = atof(optarg); break;
+        case 'S': opt.statusPercent = atoi(optarg); break;
+        case 'q': opt.minRate = atof(optarg); break;
+        case 'l': opt.maxP99Us = atof(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind < argc || opt.clients < 1 || opt.window < 1 || opt.messageBytes > UINT16_MAX)
+        usage();
+
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    //the server is stopped like from its console, by an "e" line and then the pipe closing
+    int console[2] = {-1, -1};
+    pid_t pid = -1;
+    if (strcmp(opt.server, "-") != 0)
+    {
+        if (pipe(console) < 0)
+            return EXIT_FAILURE;
+        pid = fork();
+        if (pid == 0)
+        {
+            dup2(console[0], STDIN_FILENO);
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(console[1]);
+            string portArg = to_string(opt.port), workersArg = to_string(opt.workers);
+            execl(opt.server, opt.server, portArg.c_str(), workersArg.c_str(), (char *)nullptr);
+            _exit(127);
+        }
+        close(console[0]);
+    }
+
+    if (opt.rate > 0)
+        printf("%d clients, open loop at %.0f requests/sec", opt.clients, opt.rate);
+    else
+        printf("%d clients, closed loop with %d in flight each", opt.clients, opt.window);
+    printf(", %zu byte chats, %d%% status requests, %.1f s\n", opt.messageBytes, opt.statusPercent, opt.seconds);
+
+    Results results;
+    bool ok = drive(opt, results);
+    if (pid > 0)
+    {
+        if (write(console[1], "e\n", 2) < 0)
+            kill(pid, SIGTERM);
+        close(console[1]);
+        waitpid(pid, nullptr, 0);
+    }
+
+    const Histogram &h = results.latency;
+    double rate = results.answered / opt.seconds;
+    double p99Us = h.percentile(0.99) / 1e3;
+    printf("sent %lu  answered %lu (%lu chats, %lu status)  refused %lu  lost %lu  unexpected %lu\n",
+           (unsigned long)results.sent, (unsigned long)results.answered, (unsigned long)results.chats,
+           (unsigned long)results.statuses, (unsigned long)results.refused, (unsigned long)results.lost,
+           (unsigned long)results.unexpected);
+    printf("throughput %.0f requests/sec, %.1f MB/s of chat payload\n", rate,
+           results.chats * opt.messageBytes / opt.seconds / 1e6);
+    printf("latency us: mean %.1f  p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", h.mean() / 1e3,
+           h.percentile(0.5) / 1e3, p99Us, h.percentile(0.999) / 1e3, h.max() / 1e3);
+
+    if (results.refused || results.lost || results.unexpected)
+        ok = false;
+    if (opt.minRate > 0 && rate < opt.minRate)
+    {
+        fprintf(stderr, "throughput %.0f is below %.0f requests/sec\n", rate, opt.minRate);
+        ok = false;
+    }
+    if (opt.maxP99Us > 0 && p99Us > opt.maxP99Us)
+    {
+        fprintf(stderr, "p99 %.1f us is above %.1f us\n", p99Us, opt.maxP99Us);
+        ok = false;
+    }
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,189 @@
+//Load test for NetworkServer: many loopback clients chatting at once
+//Usage: loadtest [port] [messages per client] [client counts...]
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/ackbatch.h"
+
+using namespace std;
+
+struct Client {
+    int fd;
+    uint16_t id;        //its own client id, the server pins a connection to one
+    int sent;
+    int acked;
+    FrameDecoder decoder;
+};
+
+//Ids keep counting across rounds, so a round never claims one a connection of the last
+//round might still hold until the server has seen it close
+static uint16_t nextClientId()
+{
+    static uint16_t next = 1;
+    if (++next < 2)
+        next = 2;
+    return next;
+}
+
+static void sendChat(Client &client, const string &message)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = 3;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = client.id;
+    header.receiver_id = 1;
+    header.message_id = ++client.sent;
+    header.payloadLen = message.size();
+
+    if (!frame_Send(client.fd, header, message.data(), message.size()))
+        cerr << "send failed on client fd " << client.fd << ": " << strerror(errno) << "\n";
+}
+
+//Returns the number of messages acknowledged by this read, single or range ACKs
+static int readAcks(Client &client)
+{
+    Frame frame;
+    int acks = 0;
+    while (1)
+    {
+        char *space = client.decoder.writePtr();
+        ssize_t n = recv(client.fd, space, client.decoder.writable(), 0);
+        if (n > 0)
+        {
+            client.decoder.commit(n);
+            while (client.decoder.next(frame))
+                if (frame.header.messageType == 4)
+                    acks++;
+                else if (frame.header.messageType == 9)
+                    acks += ackRange_Ids(frame.payload, frame.header.payloadLen);
+            continue;
+        }
+        if (n == 0)
+            return -1;
+        return acks;
+    }
+}
+
+static bool runRound(unsigned short port, int clientCount, int perClient)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    vector<Client> clients(clientCount);
+    int epfd = epoll_create1(0);
+
+    auto connectStart = chrono::steady_clock::now();
+    for (int i = 0; i < clientCount; i++)
+    {
+        Client &client = clients[i];
+        client.id = nextClientId();
+        client.sent = client.acked = 0;
+        client.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (client.fd < 0 || connect(client.fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+        {
+            cerr << "connect failed after " << i << " clients: " << strerror(errno) << "\n";
+            for (int j = 0; j <= i; j++)
+                if (clients[j].fd >= 0)
+                    close(clients[j].fd);
+            close(epfd);
+            return false;
+        }
+        int on = 1;
+        setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(client.fd, F_SETFL, O_NONBLOCK);
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, client.fd, &ev);
+    }
+    double connectSecs = chrono::duration<double>(chrono::steady_clock::now() - connectStart).count();
+
+    //closed loop: every client keeps exactly one chat message in flight
+    const string message = "load test message";
+    auto start = chrono::steady_clock::now();
+    for (auto &client : clients)
+        sendChat(client, message);
+
+    long total = (long)clientCount * perClient;
+    long done = 0;
+    vector<epoll_event> events(1024);
+    while (done < total)
+    {
+        int n = epoll_wait(epfd, events.data(), events.size(), 5000);
+        if (n == 0)
+        {
+            cerr << "timed out with " << done << "/" << total << " messages acknowledged\n";
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            Client &client = clients[events[i].data.u32];
+            int acks = readAcks(client);
+            if (acks < 0)
+            {
+                cerr << "server closed client fd " << client.fd << "\n";
+                done = total;
+                break;
+            }
+            client.acked += acks;
+            done += acks;
+            if (acks > 0 && client.sent < perClient)
+                sendChat(client, message);
+        }
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("%8d clients  connect %8.3f s  %10ld msgs  %8.3f s  %12.0f msgs/sec\n",
+           clientCount, connectSecs, done, secs, done / secs);
+
+    for (auto &client : clients)
+        close(client.fd);
+    close(epfd);
+    return done == total;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned short port = argc > 1 ? (unsigned short)atoi(argv[1]) : 8080;
+    int perClient = argc > 2 ? atoi(argv[2]) : 20;
+
+    vector<int> counts;
+    for (int i = 3; i < argc; i++)
+        counts.push_back(atoi(argv[i]));
+    if (counts.empty())
+        counts = {1, 10, 100, 1000, 5000};
+
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    bool ok = true;
+    for (int count : counts)
+        ok = runRound(port, count, perClient) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,281 @@
+//Local transport benchmark. Runs NetworkServer with a local socket and compares clients
+//on the same host going through TCP loopback with clients on shared memory rings:
+//round trip latency of status requests answered by the server, then throughput of
+//chats relayed from one client to another, each pair on one server run. Every relayed
+//chat must arrive intact and in order on both transports.
+//Usage: localbench [server binary] [port] [round trips] [chats]
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/checksum.h"
+#include "../Common/histogram.h"
+#include "../Common/shmring.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+}
+
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//One client's connection, over TCP or through rings
+struct Client {
+    int fd = -1;
+    unique_ptr<ShmChannel> rings;
+    uint16_t id;
+    uint32_t nextId = 0;
+    FrameDecoder decoder;
+};
+
+static bool connectTcp(unsigned short port, Client &client)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    client.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client.fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(client.fd);
+        client.fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+static bool connectLocal(const char *path, Client &client)
+{
+    string why;
+    client.rings.reset(new ShmChannel());
+    if (!client.rings->connect(path, why))
+    {
+        fprintf(stderr, "local socket %s: %s\n", path, why.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void disconnect(Client &client)
+{
+    if (client.rings)
+        client.rings.reset();
+    else
+        close(client.fd);
+}
+
+static bool sendFrame(Client &client, uint8_t type, uint16_t receiver, const char *payload, size_t len)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = client.id;
+    header.receiver_id = receiver;
+    header.message_id = ++client.nextId;
+    if (!client.rings)
+        return frame_Send(client.fd, header, payload, len);
+    uint8_t wire[headerWireLen + 1024];
+    size_t wireLen = frame_Encode(header, payload, len, wire);
+    return wireLen > 0 && client.rings->writeAll(wire, wireLen);
+}
+
+//The next frame; with wait false only one already in, with wait true blocks for it.
+//False when there is none or the server has gone.
+static bool readFrame(Client &client, Frame &frame, bool wait)
+{
+    while (!client.decoder.next(frame))
+    {
+        char *space = client.decoder.writePtr();
+        if (!client.rings)
+        {
+            ssize_t got = recv(client.fd, space, client.decoder.writable(), wait ? 0 : MSG_DONTWAIT);
+            if (got <= 0)
+                return false;
+            client.decoder.commit(got);
+            continue;
+        }
+        size_t got = client.rings->read(space, client.decoder.writable());
+        if (got > 0)
+        {
+            client.decoder.commit(got);
+            continue;
+        }
+        if (!wait)
+            return false;
+        if (!client.rings->idle())
+            continue;
+        struct pollfd fds[2] = {{client.rings->doorbell(), POLLIN, 0}, {client.rings->socket(), POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 || fds[1].revents)
+            return false;
+        client.rings->clearDoorbell();
+    }
+    return true;
+}
+
+static bool statusRequest(Client &client)
+{
+    Frame frame;
+    return sendFrame(client, 1, 1, "", 0) && readFrame(client, frame, true) && frame.header.messageType == 2;
+}
+
+struct Result {
+    double p50Us, p99Us, meanUs;
+    double chatsPerSec;
+};
+
+//Status round trips one at a time, timed each
+static bool roundTrips(Client &client, size_t count, Result &result)
+{
+    for (size_t i = 0; i < count / 10 + 100; i++)
+        if (!statusRequest(client))
+            return false;
+    Histogram latency;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t start = nowNs();
+        if (!statusRequest(client))
+            return false;
+        latency.record(nowNs() - start);
+    }
+    result.p50Us = latency.percentile(0.5) / 1e3;
+    result.p99Us = latency.percentile(0.99) / 1e3;
+    result.meanUs = latency.mean() / 1e3;
+    return true;
+}
+
+//from sends chats to to as fast as it can, reading its ACKs as they come; to checks
+//each one arrives whole and in order
+static bool relay(Client &from, Client &to, size_t chats, Result &result)
+{
+    char text[64];
+    memset(text, 'x', sizeof(text));
+    uint32_t firstId = from.nextId + 1;
+    size_t nacks = 0;
+    bool sent = true;
+    auto start = chrono::steady_clock::now();
+    thread sender([&]() {
+        Frame frame;
+        for (size_t i = 0; i < chats && sent; i++)
+        {
+            sent = sendFrame(from, 3, to.id, text, sizeof(text));
+            while (readFrame(from, frame, false))
+                nacks += frame.header.messageType == 5;
+        }
+    });
+
+    size_t got = 0;
+    Frame frame;
+    while (got < chats && readFrame(to, frame, true))
+    {
+        if (frame.header.messageType != 3)
+            continue;
+        if (frame.header.message_id != firstId + got || frame.header.payloadLen != sizeof(text) ||
+            !checkSum_Check(frame.wire, frame.payload, frame.header.payloadLen))
+        {
+            fprintf(stderr, "FAILED: chat %zu arrived out of order or damaged\n", got);
+            break;
+        }
+        got++;
+    }
+    result.chatsPerSec = got / seconds(start);
+    sender.join();
+    if (!sent || nacks > 0 || got < chats)
+    {
+        fprintf(stderr, "FAILED: %zu of %zu chats relayed, %zu NACKed\n", got, chats, nacks);
+        return false;
+    }
+    return true;
+}
+
+static bool run(const char *name, bool local, unsigned short port, const char *path, size_t trips, size_t chats,
+                Result &result)
+{
+    Client a, b;
+    a.id = local ? 4 : 2;
+    b.id = local ? 5 : 3;
+    bool ok = local ? connectLocal(path, a) && connectLocal(path, b) : connectTcp(port, a) && connectTcp(port, b);
+    ok = ok && statusRequest(a) && statusRequest(b);
+    if (!ok)
+        fprintf(stderr, "FAILED: %s: couldn't connect\n", name);
+    ok = ok && roundTrips(a, trips, result) && relay(a, b, chats, result);
+    if (ok)
+        printf("  %-22s round trip p50 %6.1f us p99 %6.1f us mean %6.1f us, %9.0f chats/s relayed\n", name,
+               result.p50Us, result.p99Us, result.meanUs, result.chatsPerSec);
+    disconnect(a);
+    disconnect(b);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8103;
+    size_t trips = argc > 3 ? (size_t)atoi(argv[3]) : 50000;
+    size_t chats = argc > 4 ? (size_t)atoi(argv[4]) : 200000;
+    string path = "/tmp/localbench." + to_string(getpid()) + ".sock";
+
+    //one worker, ACKs at the end of each batch, and queues deep enough that the relay
+    //never outruns them
+    int console[2];
+    if (pipe(console) < 0)
+        return EXIT_FAILURE;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "1", "nack", "65536", "0", "epoll", "-", path.c_str(),
+              (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+    for (int tries = 0; tries < 200 && access(path.c_str(), F_OK) != 0; tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+
+    printf("%zu round trips, %zu chats of 64 bytes relayed:\n", trips, chats);
+    Result tcp{}, rings{};
+    bool ok = run("TCP loopback", false, port, path.c_str(), trips, chats, tcp);
+    ok = run("shared memory rings", true, port, path.c_str(), trips, chats, rings) && ok;
+    if (ok)
+        printf("rings against TCP: round trip p50 %.2fx, throughput %.2fx\n", rings.p50Us / tcp.p50Us,
+               rings.chatsPerSec / tcp.chatsPerSec);
+
+    //the server has to have outlived every client coming and going
+    close(console[1]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "FAILED: the server didn't exit cleanly\n");
+        ok = false;
+    }
+    printf("%s\n", ok ? "PASSED: every chat relayed intact over both transports" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,269 @@
+//Logging cost: log calls per second from several threads with the asynchronous logger,
+//fprintf and iostream, and what logging every frame does to a receive loop (decode and
+//checksum chats fed in 4 KB reads) compared with the cout lines the servers used to
+//write and with a LOG_DEBUG line the default level compiles out.
+//Rates are per second of the logging thread's own CPU time. Threads log in bursts with a
+//short pause between them, so the writer keeps up and no lines are dropped even on one
+//core; the pauses aren't counted.
+//Checks first that the writer formats arguments like printf and loses or reorders
+//nothing a thread logs.
+//Usage: logbench [calls per thread] [threads]
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/checksum.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/log.h"
+
+using namespace std;
+
+enum Mode { AsyncLog, Fprintf, Iostream };
+
+static double threadCpuSeconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//time for the writer to catch up between bursts
+static void catchUp()
+{
+    this_thread::sleep_for(chrono::milliseconds(2));
+}
+
+//Everything written to the pipe until it's closed
+static string readAll(int fd)
+{
+    string all;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        all.append(buf, n);
+    return all;
+}
+
+static bool selfCheck()
+{
+    int pipefd[2];
+    if (pipe(pipefd) != 0)
+        return false;
+    string text;
+    thread reader([&]() { text = readAll(pipefd[0]); });
+
+    log_Start(pipefd[1]);
+    LOG_INFO("plain");
+    LOG_WARN("a %d b %s c %5.2f d %x e %% f %-4s| g %lu h %c", -5, string("xy"), 3.14159, 255u, "ab", (uint64_t)1 << 40, 'z');
+    LOG_ERROR("missing %d %s", 1);
+    const unsigned threads = 4, perThread = 3000;
+    vector<thread> loggers;
+    for (unsigned t = 0; t < threads; t++)
+        loggers.emplace_back([t]() {
+            for (unsigned i = 0; i < perThread; i++)
+                LOG_INFO("thread %u line %u", t, i);
+        });
+    for (auto &t : loggers)
+        t.join();
+    log_Stop();
+    close(pipefd[1]);
+    reader.join();
+    close(pipefd[0]);
+
+    const char *expected[] = {"INFO  plain", "WARN  a -5 b xy c  3.14 d ff e % f ab  | g 1099511627776 h z",
+                              "ERROR missing 1 %?"};
+    istringstream lines(text);
+    string line;
+    unsigned n = 0, wrong = 0;
+    vector<unsigned> next(threads, 0);
+    while (getline(lines, line))
+    {
+        //"2024-01-31 12:00:00.123 " comes first
+        string body = line.size() > 24 ? line.substr(24) : "";
+        unsigned t, i;
+        if (n < 3)
+        {
+            if (body != expected[n])
+            {
+                fprintf(stderr, "got \"%s\"\nnot \"%s\"\n", body.c_str(), expected[n]);
+                wrong++;
+            }
+        }
+        else if (sscanf(body.c_str(), "INFO  thread %u line %u", &t, &i) != 2 || t >= threads || i != next[t]++)
+            wrong++;
+        n++;
+    }
+    for (unsigned t = 0; t < threads; t++)
+        if (next[t] != perThread)
+            wrong++;
+    if (wrong != 0 || log_Dropped() != 0)
+    {
+        fprintf(stderr, "FAILED: %u lines wrong, missing or out of order, %lu dropped\n", wrong,
+                (unsigned long)log_Dropped());
+        return false;
+    }
+    return true;
+}
+
+//calls log lines like a worker handling chats; CPU seconds spent on them
+static double logCalls(Mode mode, unsigned calls, unsigned id)
+{
+    string message = "hello from client " + to_string(id);
+    double busy = 0, start = threadCpuSeconds();
+    for (unsigned i = 0; i < calls; i++)
+    {
+        if (i % 1000 == 999)
+        {
+            busy += threadCpuSeconds() - start;
+            catchUp();
+            start = threadCpuSeconds();
+        }
+        if (mode == AsyncLog)
+            LOG_INFO("Chat Message received: %s, id %u", message, i);
+        else if (mode == Fprintf)
+            fprintf(stdout, "Chat Message received: %s, id %u\n", message.c_str(), i);
+        else
+            cout << "Chat Message received: " << message << ", id " << i << "\n";
+    }
+    return busy + threadCpuSeconds() - start;
+}
+
+//count chats with the timestamp moving on one second every thousand frames
+static string encodeStream(unsigned count)
+{
+    string stream;
+    uint8_t wire[headerWireLen + 64];
+    uint32_t start = (uint32_t)time(nullptr);
+    for (unsigned i = 0; i < count; i++)
+    {
+        string text = "chat number " + to_string(i);
+        MessageHeader header;
+        header.headerLen = headerWireLen;
+        header.messageType = 3;
+        header.timeStamp = start + i / 1000;
+        header.sender_id = 2;
+        header.receiver_id = 1;
+        header.message_id = i + 1;
+        header.payloadLen = text.size();
+        header.checksum = 0;
+        size_t len = frame_Encode(header, text.data(), text.size(), wire);
+        stream.append((const char *)wire, len);
+    }
+    return stream;
+}
+
+enum LoopMode { LoopCout, LoopLog, LoopDebugOff, LoopSilent };
+
+//The receive loop of the servers, logging per frame as mode says; frames per second
+static double receiveLoop(const string &stream, LoopMode mode)
+{
+    FrameDecoder decoder;
+    Frame frame;
+    unsigned frames = 0;
+    double busy = 0, start = threadCpuSeconds();
+    for (size_t at = 0; at < stream.size(); at += 4096)
+    {
+        if (at % (16 * 4096) == 0)
+        {
+            busy += threadCpuSeconds() - start;
+            catchUp();
+            start = threadCpuSeconds();
+        }
+        decoder.feed(stream.data() + at, min<size_t>(4096, stream.size() - at));
+        while (decoder.next(frame))
+        {
+            const MessageHeader *myHeader = &frame.header;
+            if (mode == LoopCout)
+            {
+                time_t timeRaw = myHeader->timeStamp;
+                struct tm *timeInfo = localtime(&timeRaw);
+                char timeString[20];
+                strftime(timeString, sizeof(timeString), "%Y-%m-%d %H:%M:%S", timeInfo);
+                cout << "Msg timestamp: " << timeString << "\n";
+                cout << "Msg type: " << (int)myHeader->messageType << ", Payload Length: " << myHeader->payloadLen
+                     << " bytes\n";
+            }
+            else if (mode == LoopLog)
+                LOG_INFO("Timestamp: %u, Type: %d, Payload Length: %u bytes", myHeader->timeStamp,
+                         myHeader->messageType, myHeader->payloadLen);
+            else if (mode == LoopDebugOff)
+                LOG_DEBUG("Timestamp: %u, Type: %d, Payload Length: %u bytes", myHeader->timeStamp,
+                          myHeader->messageType, myHeader->payloadLen);
+            if (!checkSum_Check(frame.wire, frame.payload, myHeader->payloadLen))
+                continue;
+            string message(frame.payload, myHeader->payloadLen);
+            if (mode == LoopCout)
+                cout << "Chat Message received: " << message << "\n";
+            else if (mode == LoopLog)
+                LOG_INFO("Chat Message received: %s", message);
+            frames++;
+        }
+    }
+    return frames / (busy + threadCpuSeconds() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned calls = argc > 1 ? atoi(argv[1]) : 1000000;
+    unsigned threads = argc > 2 ? atoi(argv[2]) : 4;
+
+    if (!selfCheck())
+        return EXIT_FAILURE;
+
+    //every sink is /dev/null, so what's measured is the logging thread's own cost
+    cout.flush();
+    fflush(stdout);
+    int savedOut = dup(1);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 1);
+    log_Start(null);
+
+    const char *names[] = {"async log", "fprintf", "iostream"};
+    double rates[3];
+    uint64_t droppedBefore = log_Dropped();
+    for (int mode = AsyncLog; mode <= Iostream; mode++)
+    {
+        vector<double> busy(threads);
+        vector<thread> loggers;
+        for (unsigned t = 0; t < threads; t++)
+            loggers.emplace_back([&, t]() { busy[t] = logCalls((Mode)mode, calls, t); });
+        double total = 0;
+        for (unsigned t = 0; t < threads; t++)
+        {
+            loggers[t].join();
+            total += busy[t];
+        }
+        rates[mode] = (double)calls * threads / total;
+    }
+
+    string stream = encodeStream(calls);
+    const char *loopNames[] = {"cout per frame", "LOG_INFO per frame", "LOG_DEBUG (compiled out)", "no logging"};
+    double loopRates[4];
+    for (int mode = LoopCout; mode <= LoopSilent; mode++)
+        loopRates[mode] = receiveLoop(stream, (LoopMode)mode);
+    cout.flush();
+    log_Stop();
+    uint64_t dropped = log_Dropped() - droppedBefore;
+
+    dup2(savedOut, 1);
+    close(savedOut);
+    close(null);
+
+    printf("%u thread(s), %u log calls each, per CPU second of the logging thread\n", threads, calls);
+    for (int mode = AsyncLog; mode <= Iostream; mode++)
+        printf("%-10s %10.0f calls/s\n", names[mode], rates[mode]);
+    printf("receive loop, %u chats:\n", calls);
+    for (int mode = LoopCout; mode <= LoopSilent; mode++)
+        printf("  %-25s %10.0f frames/s\n", loopNames[mode], loopRates[mode]);
+    printf("%lu lines dropped on full rings\n", (unsigned long)dropped);
+    return 0;
+}
@@ -0,0 +1,371 @@
+//Reliable delivery check through a lossy link: two clients exchange chats via
+//NetworkServer, but through a local proxy that throws away a share of whole frames
+//in both directions. Each client resends unacknowledged chats with RetransmitQueue
+//and filters repeats with DuplicateFilter, like NetworkClient does. Passes if every
+//chat is shown exactly once on the other side and none were given up on.
+//Usage: losstest [server binary] [port] [chats per client] [drop percent]
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/checksum.h"
+#include "../Common/ackbatch.h"
+#include "../Common/reliable.h"
+
+using namespace std;
+
+static const uint16_t serverId = 1;
+
+static atomic<bool> stopping{false};
+static atomic<long> framesSeen{0};
+static atomic<long> framesDropped{0};
+static atomic<int> registered{0};
+
+static int listenOn(unsigned short port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0 || listen(fd, 16) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+//One direction of a proxied connection: relays whole frames, dropping some
+static void relayFrames(int from, int to, unsigned dropPercent, unsigned seed)
+{
+    mt19937 rng(seed);
+    FrameDecoder decoder;
+    Frame frame;
+    while (1)
+    {
+        char *space = decoder.writePtr();
+        ssize_t got = recv(from, space, decoder.writable(), 0);
+        if (got <= 0)
+            break;
+        decoder.commit(got);
+        while (decoder.next(frame))
+        {
+            framesSeen++;
+            if (rng() % 100 < dropPercent)
+            {
+                framesDropped++;
+                continue;
+            }
+            frame_Forward(to, frame);
+        }
+    }
+    shutdown(to, SHUT_WR);
+}
+
+//Accepts `count` clients and links each to its own server connection
+static void runProxy(int listenfd, unsigned short serverPort, int count, unsigned dropPercent, vector<thread> &relays)
+{
+    for (int i = 0; i < count; i++)
+    {
+        int client = accept(listenfd, nullptr, nullptr);
+        int server;
+        if (client < 0 || !connectTo(serverPort, server))
+        {
+            perror("proxy");
+            exit(EXIT_FAILURE);
+        }
+        int on = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        relays.emplace_back(relayFrames, client, server, dropPercent, 2 * i + 1);
+        relays.emplace_back(relayFrames, server, client, dropPercent, 2 * i + 2);
+    }
+}
+
+struct TestClient {
+    uint16_t id;
+    uint16_t peer;
+    int fd;
+    uint32_t nextMessageId;
+    mutex lock;
+    RetransmitQueue retransmits{100, 20, reliable_NowMs()};
+    DuplicateFilter duplicates{60000, reliable_NowMs()};
+    vector<int> shown;          //times each of the peer's chats was displayed
+    long givenUp = 0;
+    bool online = false;
+
+    void send(uint8_t type, const string &payload, uint16_t receiver)
+    {
+        MessageHeader header{};
+        header.headerLen = headerWireLen;
+        header.messageType = type;
+        header.sender_id = id;
+        header.receiver_id = receiver;
+        lock_guard<mutex> guard(lock);
+        header.message_id = ++nextMessageId;
+        string wire(headerWireLen + payload.size(), '\0');
+        frame_Encode(header, payload.data(), payload.size(), (uint8_t *)&wire[0]);
+        frame_SendWire(fd, (const uint8_t *)wire.data(), wire.size());
+        if (type == 3)
+            retransmits.track(header.message_id, std::move(wire), reliable_NowMs());
+    }
+
+    void expire()
+    {
+        lock_guard<mutex> guard(lock);
+        retransmits.expire(
+            reliable_NowMs(),
+            [this](uint32_t, const string &wire) { frame_SendWire(fd, (const uint8_t *)wire.data(), wire.size()); },
+            [this](uint32_t) { givenUp++; });
+    }
+
+    void handle(const Frame &frame)
+    {
+        const MessageHeader &header = frame.header;
+        if (!checkSum_Check(frame.wire, frame.payload, header.payloadLen))
+            return;
+        string message(frame.payload, header.payloadLen);
+        switch (header.messageType)
+        {
+        case 2:
+            if (!online)
+            {
+                online = true;
+                registered++;
+            }
+            break;
+        case 3:
+        {
+            {
+                //"chat N" is displayed
+                lock_guard<mutex> guard(lock);
+                size_t index = strtoul(message.c_str() + 5, nullptr, 10);
+                if (duplicates.firstTime(header.sender_id, header.message_id, reliable_NowMs()) && index < shown.size())
+                    shown[index]++;
+            }
+            send(4, to_string(header.message_id), header.sender_id);
+            break;
+        }
+        case 4:
+        {
+            lock_guard<mutex> guard(lock);
+            retransmits.acknowledge((uint32_t)strtoul(message.c_str(), nullptr, 10));
+            break;
+        }
+        case 9:
+        {
+            lock_guard<mutex> guard(lock);
+            for (size_t i = 0; i < ackRange_Count(header.payloadLen); i++)
+            {
+                uint32_t first, last;
+                ackRange_Load(frame.payload, i, first, last);
+                retransmits.acknowledgeRange(first, last);
+            }
+            break;
+        }
+        case 5:
+        {
+            lock_guard<mutex> guard(lock);
+            retransmits.nack((uint32_t)strtoul(message.c_str(), nullptr, 10), reliable_NowMs());
+            break;
+        }
+        }
+    }
+
+    size_t inFlight()
+    {
+        lock_guard<mutex> guard(lock);
+        return retransmits.inFlight();
+    }
+};
+
+//Registers, waits for the peer to do the same, sends its chats, then keeps receiving
+//and resending until told to stop
+static void runClient(TestClient &client, int chats)
+{
+    FrameDecoder decoder;
+    Frame frame;
+    uint64_t lastStatus = 0;
+    int sent = 0;
+    while (!stopping.load())
+    {
+        //the status request registers our id; it may be dropped too, so repeat it
+        uint64_t now = reliable_NowMs();
+        if (!client.online && now - lastStatus > 100)
+        {
+            client.send(1, "", serverId);
+            lastStatus = now;
+        }
+        if (registered.load() == 2)
+            for (; sent < chats; sent++)
+                client.send(3, "chat " + to_string(sent), client.peer);
+
+        struct pollfd pfd = {client.fd, POLLIN, 0};
+        if (poll(&pfd, 1, 10) > 0)
+        {
+            char *space = decoder.writePtr();
+            ssize_t got = recv(client.fd, space, decoder.writable(), 0);
+            if (got <= 0)
+                break;
+            decoder.commit(got);
+            while (decoder.next(frame))
+                client.handle(frame);
+        }
+        client.expire();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short serverPort = argc > 2 ? (unsigned short)atoi(argv[2]) : 8094;
+    int chats = argc > 3 ? atoi(argv[3]) : 1000;
+    unsigned dropPercent = argc > 4 ? atoi(argv[4]) : 10;
+    unsigned short proxyPort = serverPort + 1;
+
+    int console[2];
+    if (pipe(console) < 0)
+        return EXIT_FAILURE;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(serverPort);
+        execl(server, server, portArg.c_str(), "1", (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+
+    int probe = -1;
+    for (int tries = 0; tries < 200 && !connectTo(serverPort, probe); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (probe < 0)
+    {
+        fprintf(stderr, "server did not start\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        return EXIT_FAILURE;
+    }
+    close(probe);
+
+    int listenfd = listenOn(proxyPort);
+    if (listenfd < 0)
+    {
+        perror("proxy listen");
+        return EXIT_FAILURE;
+    }
+    vector<thread> relays;
+    thread proxy(runProxy, listenfd, serverPort, 2, dropPercent, ref(relays));
+
+    TestClient a, b;
+    a.id = 200;
+    a.peer = b.id = 201;
+    b.peer = 200;
+    for (TestClient *client : {&a, &b})
+    {
+        client->nextMessageId = 0;
+        client->shown.assign(chats, 0);
+        if (!connectTo(proxyPort, client->fd))
+        {
+            perror("connect");
+            return EXIT_FAILURE;
+        }
+    }
+    proxy.join();
+
+    auto start = chrono::steady_clock::now();
+    thread runA(runClient, ref(a), chats), runB(runClient, ref(b), chats);
+
+    //done once everything was shown and acknowledged, or given up on
+    auto allShown = [&](TestClient &client) {
+        lock_guard<mutex> guard(client.lock);
+        for (int count : client.shown)
+            if (count == 0)
+                return false;
+        return true;
+    };
+    double secs = 0;
+    while (secs < 60)
+    {
+        this_thread::sleep_for(chrono::milliseconds(20));
+        secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (registered.load() == 2 && allShown(a) && allShown(b) && a.inFlight() == 0 && b.inFlight() == 0)
+            break;
+    }
+    stopping.store(true);
+    runA.join();
+    runB.join();
+
+    long missing = 0, repeated = 0;
+    for (TestClient *client : {&a, &b})
+        for (int count : client->shown)
+        {
+            if (count == 0)
+                missing++;
+            else if (count > 1)
+                repeated++;
+        }
+    printf("%d chats each way, %u%% frames dropped (%ld of %ld)  %.2f s\n", chats, dropPercent, framesDropped.load(),
+           framesSeen.load(), secs);
+    printf("retransmits %llu + %llu  given up %ld + %ld  never shown %ld  shown twice or more %ld\n",
+           (unsigned long long)a.retransmits.retransmits, (unsigned long long)b.retransmits.retransmits, a.givenUp,
+           b.givenUp, missing, repeated);
+
+    shutdown(a.fd, SHUT_RDWR);
+    shutdown(b.fd, SHUT_RDWR);
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+    for (auto &relay : relays)
+        relay.join();
+    close(a.fd);
+    close(b.fd);
+    close(listenfd);
+
+    bool passed = missing == 0 && repeated == 0 && a.givenUp == 0 && b.givenUp == 0;
+    printf("%s\n", passed ? "PASSED: every chat shown exactly once" : "FAILED");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
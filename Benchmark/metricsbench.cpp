@@ -0,0 +1,301 @@
+//Metrics cost and endpoint check. Times a receive loop (decode chats fed in 4 KB reads,
+//as the reactor does) with and without the per-frame accounting the reactor now does,
+//then starts NetworkServer, relays chats between two clients and their ACKs back, and
+//checks what the stats message (type 10) reports against what was sent.
+//Checks first that histogram percentiles are within a bucket of the exact ones.
+//Usage: metricsbench [server binary] [port] [frames]
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/histogram.h"
+#include "../Common/metrics.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+}
+
+//Log-uniform values from 1 ns to 10 s, percentiles against the sorted values
+static bool selfCheck()
+{
+    mt19937_64 rng(3);
+    Histogram h;
+    vector<uint64_t> values;
+    for (int i = 0; i < 500000; i++)
+    {
+        uint64_t v = (uint64_t)exp(uniform_real_distribution<double>(0, log(1e10))(rng));
+        values.push_back(v);
+        h.record(v);
+    }
+    sort(values.begin(), values.end());
+    int wrong = 0;
+    for (double p : {0.0, 0.1, 0.5, 0.9, 0.99, 0.999, 1.0})
+    {
+        uint64_t exact = values[min(values.size() - 1, (size_t)(p * values.size()))];
+        uint64_t got = h.percentile(p);
+        if (fabs((double)got - (double)exact) > exact / 32.0 + 1)
+        {
+            fprintf(stderr, "p%g: %lu, exactly %lu\n", p * 100, (unsigned long)got, (unsigned long)exact);
+            wrong++;
+        }
+    }
+    Histogram merged;
+    merged.merge(h);
+    merged.merge(h);
+    if (wrong || h.count() != values.size() || merged.count() != 2 * values.size() ||
+        merged.percentile(0.5) != h.percentile(0.5) || h.max() != values.back())
+    {
+        fprintf(stderr, "FAILED: histogram percentiles, counts or merge are off\n");
+        return false;
+    }
+    return true;
+}
+
+//count chats from one sender, encoded back to back
+static string encodeStream(unsigned count)
+{
+    string stream;
+    uint8_t wire[headerWireLen + 64];
+    for (unsigned i = 0; i < count; i++)
+    {
+        string text = "chat number " + to_string(i);
+        MessageHeader header{};
+        header.headerLen = headerWireLen;
+        header.messageType = 3 + i % 2;
+        header.sender_id = 2;
+        header.receiver_id = 3;
+        header.message_id = i + 1;
+        header.payloadLen = text.size();
+        stream.append((const char *)wire, frame_Encode(header, text.data(), text.size(), wire));
+    }
+    return stream;
+}
+
+//Reactor::dispatchFrames' loop over one connection, with or without the metrics; ns per frame
+static double receiveLoop(const string &stream, bool withMetrics, MetricsShard &shard)
+{
+    FrameDecoder decoder;
+    Frame frame;
+    uint64_t framesIn = 0, connFrames = 0, connBytes = 0, sink = 0;
+    unsigned sampleTick = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t at = 0; at < stream.size(); at += 4096)
+    {
+        decoder.feed(stream.data() + at, min<size_t>(4096, stream.size() - at));
+        uint64_t receivedAt = withMetrics ? metrics_NowNs() : 0;
+        while (decoder.next(frame))
+        {
+            framesIn++;
+            if (withMetrics)
+            {
+                size_t len = headerWireLen + frame.header.payloadLen;
+                shard.frameIn(frame.header.messageType, len);
+                connFrames++;
+                connBytes += len;
+                if (++sampleTick == MetricsShard::sampleEvery)
+                {
+                    sampleTick = 0;
+                    shard.dispatchLatency.record(metrics_NowNs() - receivedAt);
+                }
+            }
+            sink += frame.header.message_id;
+        }
+    }
+    double ns = seconds(start) * 1e9 / framesIn;
+    if (sink == 0 || connFrames + connBytes == 1)
+        printf("?");
+    return ns;
+}
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+static void sendFrame(int fd, uint8_t type, uint16_t sender, uint16_t receiver, uint32_t id, const string &payload)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.sender_id = sender;
+    header.receiver_id = receiver;
+    header.message_id = id;
+    frame_Send(fd, header, payload.data(), payload.size());
+}
+
+//Blocks until a whole frame is in; false on EOF
+static bool readFrame(int fd, FrameDecoder &decoder, Frame &frame)
+{
+    while (!decoder.next(frame))
+    {
+        char *space = decoder.writePtr();
+        ssize_t got = recv(fd, space, decoder.writable(), 0);
+        if (got <= 0)
+            return false;
+        decoder.commit(got);
+    }
+    return true;
+}
+
+//The value of the first sample line starting with name, -1 if there is none
+static double sample(const string &text, const string &name)
+{
+    istringstream lines(text);
+    string line;
+    while (getline(lines, line))
+        if (line.compare(0, name.size(), name) == 0 && line.size() > name.size() && line[name.size()] == ' ')
+            return atof(line.c_str() + name.size() + 1);
+    return -1;
+}
+
+//A sends chats to B in windows, B ACKs each one back; then A asks for the stats
+static bool checkEndpoint(const char *server, unsigned short port, unsigned chats)
+{
+    int console[2];
+    if (pipe(console) < 0)
+        return false;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "2", (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+
+    int a = -1, b = -1;
+    for (int tries = 0; tries < 200 && !connectTo(port, a); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (a < 0 || !connectTo(port, b))
+    {
+        fprintf(stderr, "server did not start\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        return false;
+    }
+
+    FrameDecoder decoderA, decoderB;
+    Frame frame;
+    bool ok = true;
+    //B registers as client 3 with a status request
+    sendFrame(b, 1, 3, 1, 1, "");
+    ok = readFrame(b, decoderB, frame) && frame.header.messageType == 2;
+    for (unsigned sent = 0; ok && sent < chats; sent += 100)
+    {
+        for (unsigned i = 1; i <= 100; i++)
+            sendFrame(a, 3, 2, 3, sent + i, "timed chat");
+        for (unsigned i = 0; ok && i < 100; i++)
+        {
+            ok = readFrame(b, decoderB, frame) && frame.header.messageType == 3;
+            if (ok)
+                sendFrame(b, 4, 3, 2, 0, to_string(frame.header.message_id));
+        }
+        for (unsigned i = 0; ok && i < 100; i++)
+            ok = readFrame(a, decoderA, frame) && frame.header.messageType == 4;
+    }
+
+    string text;
+    if (ok)
+    {
+        sendFrame(a, 10, 2, 1, chats + 1, "");
+        ok = readFrame(a, decoderA, frame) && frame.header.messageType == 10;
+        if (ok)
+            text.assign(frame.payload, frame.header.payloadLen);
+    }
+    close(a);
+    close(b);
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+    if (!ok)
+    {
+        fprintf(stderr, "FAILED: relaying chats or getting the stats reply\n");
+        return false;
+    }
+
+    unsigned rounded = chats / 100 * 100;
+    double chatsIn = sample(text, "chat_frames_in_total{type=\"3\"}");
+    double acksIn = sample(text, "chat_frames_in_total{type=\"4\"}");
+    double timed = sample(text, "chat_ack_round_trip_seconds_count");
+    double statsIn = sample(text, "chat_frames_in_total{type=\"10\"}");
+    printf("stats reply: %zu bytes, %lu lines\n", text.size(), (unsigned long)count(text.begin(), text.end(), '\n'));
+    printf("  chats in %.0f  ACKs in %.0f  stats requests %.0f  round trips timed %.0f\n", chatsIn, acksIn, statsIn,
+           timed);
+    printf("  dispatch latency p50 %.1f us p99 %.1f us, ACK round trip p50 %.1f us p99 %.1f us\n",
+           sample(text, "chat_dispatch_latency_seconds{quantile=\"0.5\"}") * 1e6,
+           sample(text, "chat_dispatch_latency_seconds{quantile=\"0.99\"}") * 1e6,
+           sample(text, "chat_ack_round_trip_seconds{quantile=\"0.5\"}") * 1e6,
+           sample(text, "chat_ack_round_trip_seconds{quantile=\"0.99\"}") * 1e6);
+    if (chatsIn != rounded || acksIn != rounded || statsIn != 1 || timed != rounded / MetricsShard::sampleEvery ||
+        text.find("chat_connection_frames_in_total{worker=") == string::npos)
+    {
+        fprintf(stderr, "FAILED: stats don't match what was sent\n%s", text.c_str());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8097;
+    unsigned frames = argc > 3 ? atoi(argv[3]) : 2000000;
+
+    if (!selfCheck())
+        return EXIT_FAILURE;
+
+    //best of a few runs each, the difference is small next to scheduling noise
+    string stream = encodeStream(frames);
+    MetricsShard shard;
+    double without = 1e9, with = 1e9;
+    for (int run = 0; run < 5; run++)
+    {
+        without = min(without, receiveLoop(stream, false, shard));
+        with = min(with, receiveLoop(stream, true, shard));
+    }
+    printf("receive loop, %u frames: %.2f ns/frame without metrics, %.2f with, %.2f ns/frame for the metrics\n",
+           frames, without, with, with - without);
+
+    if (!checkEndpoint(server, port, 1600))
+        return EXIT_FAILURE;
+    printf("PASSED: stats match the traffic\n");
+    return 0;
+}
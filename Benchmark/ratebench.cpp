@@ -0,0 +1,338 @@
+//Admission control load test. Well-behaved clients over TCP each send NetworkServer a
+//chat every millisecond and time its ACK, while one abusive client on the server's
+//local socket floods it with chats as fast as its rings take them. Run without the
+//abuser, then with it against no limit, against per sender rate limits that NACK, and
+//against ones that defer reading the abuser; the well-behaved clients' p99 has to stay
+//near what it is without the abuser when reads are deferred. Last, a server with a
+//connection cap has to answer exactly that many clients and turn the rest away.
+//Usage: ratebench [server binary] [port] [seconds per run] [well-behaved clients]
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/ackbatch.h"
+#include "../Common/histogram.h"
+#include "../Common/shmring.h"
+
+using namespace std;
+
+//what every run's server allows one sender: 5000 frames a second in bursts of 500
+static const char *rateLimit = "5000:500";
+
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int connectTcp(unsigned short port)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+static MessageHeader chatHeader(uint16_t sender, uint32_t messageId, uint8_t type = 3)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = sender;
+    header.receiver_id = 1;
+    header.message_id = messageId;
+    return header;
+}
+
+//Whether frame acknowledges messageId, singly or in a range
+static bool acks(const Frame &frame, uint32_t messageId)
+{
+    if (frame.header.messageType == 4)
+        return strtoul(string(frame.payload, frame.header.payloadLen).c_str(), nullptr, 10) == messageId;
+    if (frame.header.messageType != 9)
+        return false;
+    for (size_t i = 0; i < ackRange_Count(frame.header.payloadLen); i++)
+    {
+        uint32_t first, last;
+        ackRange_Load(frame.payload, i, first, last);
+        if (messageId >= first && messageId <= last)
+            return true;
+    }
+    return false;
+}
+
+//A well-behaved client: a chat every millisecond, each timed until its ACK. False if
+//one went unanswered for a second.
+static bool behave(unsigned short port, uint16_t id, uint64_t until, Histogram &latency)
+{
+    int fd = connectTcp(port);
+    if (fd < 0)
+        return false;
+    char text[64];
+    memset(text, 'x', sizeof(text));
+    FrameDecoder decoder;
+    Frame frame;
+    uint64_t next = nowNs();
+    bool ok = true;
+    for (uint32_t messageId = 1; ok && nowNs() < until; messageId++)
+    {
+        next += 1000000;
+        uint64_t sentAt = nowNs();
+        MessageHeader header = chatHeader(id, messageId);
+        ok = frame_Send(fd, header, text, sizeof(text));
+        bool acked = false;
+        while (ok && !acked)
+        {
+            while (!acked && decoder.next(frame))
+                acked = acks(frame, messageId);
+            if (acked)
+                break;
+            struct pollfd pfd = {fd, POLLIN, 0};
+            char *space = decoder.writePtr();
+            ssize_t got = poll(&pfd, 1, 1000) > 0 ? recv(fd, space, decoder.writable(), 0) : -1;
+            if (got <= 0)
+                ok = false;
+            else
+                decoder.commit(got);
+        }
+        latency.record(nowNs() - sentAt);
+        uint64_t now = nowNs();
+        if (next > now)
+            this_thread::sleep_for(chrono::nanoseconds(next - now));
+        else
+            next = now;
+    }
+    close(fd);
+    return ok;
+}
+
+//The abuser: chats as fast as the rings take them, and a thread reading whatever comes back
+static void abuse(const char *path, const atomic<bool> &done, atomic<uint64_t> &sent)
+{
+    ShmChannel rings;
+    string why;
+    if (!rings.connect(path, why))
+    {
+        fprintf(stderr, "abuser: %s\n", why.c_str());
+        return;
+    }
+    thread drain([&]() {
+        char buf[65536];
+        while (!done)
+        {
+            if (rings.read(buf, sizeof(buf)) > 0 || !rings.idle())
+                continue;
+            struct pollfd fds[2] = {{rings.doorbell(), POLLIN, 0}, {rings.socket(), POLLIN, 0}};
+            if (poll(fds, 2, 10) < 0 || fds[1].revents)
+                return;
+            if (fds[0].revents)
+                rings.clearDoorbell();
+        }
+    });
+
+    //a batch of chats per write, as a flood would
+    char text[64];
+    memset(text, 'y', sizeof(text));
+    const size_t batch = 64;
+    vector<uint8_t> wire(batch * (headerWireLen + sizeof(text)));
+    uint32_t messageId = 0;
+    while (!done)
+    {
+        size_t len = 0;
+        for (size_t i = 0; i < batch; i++)
+            len += frame_Encode(chatHeader(99, ++messageId), text, sizeof(text), &wire[len]);
+        if (!rings.writeAll(wire.data(), len))
+            break;
+        sent += batch;
+    }
+    drain.join();
+}
+
+static pid_t startServer(const char *server, unsigned short port, const string &path, const char *rate,
+                         const char *policy, const char *cap, int &console)
+{
+    int fds[2];
+    if (pipe(fds) < 0)
+        return -1;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(fds[1]);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "1", "nack", "256", "0", "epoll", "-", path.c_str(), rate, policy, cap,
+              (char *)nullptr);
+        _exit(127);
+    }
+    close(fds[0]);
+    console = fds[1];
+    for (int tries = 0; tries < 200 && access(path.c_str(), F_OK) != 0; tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    return pid;
+}
+
+static bool stopServer(pid_t pid, int console)
+{
+    close(console);
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+struct Result {
+    double p50Us, p99Us;
+    double abuserPerSec;
+};
+
+static bool run(const char *name, const char *server, unsigned short port, const string &path, bool abuser,
+                const char *rate, const char *policy, double seconds, unsigned clients, Result &result)
+{
+    int console;
+    pid_t pid = startServer(server, port, path, rate, policy, "0", console);
+    if (pid < 0)
+        return false;
+
+    atomic<bool> done{false};
+    atomic<uint64_t> flooded{0};
+    thread abuserThread;
+    if (abuser)
+    {
+        abuserThread = thread(abuse, path.c_str(), cref(done), ref(flooded));
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+
+    uint64_t start = nowNs();
+    uint64_t until = start + (uint64_t)(seconds * 1e9);
+    vector<Histogram> latencies(clients);
+    vector<thread> threads;
+    atomic<unsigned> failed{0};
+    for (unsigned i = 0; i < clients; i++)
+        threads.emplace_back([&, i]() {
+            if (!behave(port, (uint16_t)(10 + i), until, latencies[i]))
+                failed++;
+        });
+    for (auto &t : threads)
+        t.join();
+    uint64_t floodedNow = flooded;
+    double elapsed = (nowNs() - start) / 1e9;
+    done = true;
+    if (abuserThread.joinable())
+        abuserThread.join();
+    bool ok = stopServer(pid, console);
+    if (!ok)
+        fprintf(stderr, "FAILED: %s: the server didn't exit cleanly\n", name);
+
+    Histogram all;
+    for (auto &latency : latencies)
+        all.merge(latency);
+    result.p50Us = all.percentile(0.5) / 1e3;
+    result.p99Us = all.percentile(0.99) / 1e3;
+    result.abuserPerSec = floodedNow / elapsed;
+    if (failed > 0)
+    {
+        fprintf(stderr, "FAILED: %s: %u well-behaved client(s) went unanswered\n", name, failed.load());
+        ok = false;
+    }
+    printf("  %-28s well-behaved ACK round trip p50 %7.1f us p99 %8.1f us", name, result.p50Us, result.p99Us);
+    if (abuser)
+        printf(", abuser wrote %9.0f chats/s", result.abuserPerSec);
+    printf("\n");
+    return ok;
+}
+
+//With a cap of cap connections, that many get their status request answered and the
+//rest are closed on
+static bool capCheck(const char *server, unsigned short port, const string &path, unsigned cap)
+{
+    int console;
+    string capArg = to_string(cap);
+    pid_t pid = startServer(server, port, path, "-", "nack", capArg.c_str(), console);
+    if (pid < 0)
+        return false;
+    vector<int> fds;
+    for (unsigned i = 0; i < cap + 4; i++)
+        fds.push_back(connectTcp(port));
+    unsigned answered = 0, refused = 0;
+    for (size_t i = 0; i < fds.size(); i++)
+    {
+        MessageHeader header = chatHeader((uint16_t)(200 + i), 1, 1);
+        frame_Send(fds[i], header, "", 0);
+        FrameDecoder decoder;
+        Frame frame;
+        struct pollfd pfd = {fds[i], POLLIN, 0};
+        char *space = decoder.writePtr();
+        ssize_t got = poll(&pfd, 1, 1000) > 0 ? recv(fds[i], space, decoder.writable(), 0) : -1;
+        if (got > 0)
+        {
+            decoder.commit(got);
+            answered += decoder.next(frame) && frame.header.messageType == 2;
+        }
+        else if (got == 0 || errno == ECONNRESET)
+            refused++;
+    }
+    for (int fd : fds)
+        close(fd);
+    bool ok = stopServer(pid, console) && answered == cap && refused == 4;
+    printf("  connection cap of %u: %u of %zu clients answered, %u turned away\n", cap, answered, fds.size(), refused);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8106;
+    double seconds = argc > 3 ? atof(argv[3]) : 3;
+    unsigned clients = argc > 4 ? (unsigned)atoi(argv[4]) : 4;
+    string path = "/tmp/ratebench." + to_string(getpid()) + ".sock";
+
+    printf("%u well-behaved clients sending a chat every ms, %.1f s per run, limits of %s frames/s:burst per sender:\n",
+           clients, seconds, rateLimit);
+    Result quiet, open, nacked, deferred;
+    bool ok = run("no abuser", server, port, path, false, "-", "nack", seconds, clients, quiet);
+    ok = run("abuser, no limits", server, port, path, true, "-", "nack", seconds, clients, open) && ok;
+    ok = run("abuser, limits that NACK", server, port, path, true, rateLimit, "nack", seconds, clients, nacked) && ok;
+    ok = run("abuser, limits that defer", server, port, path, true, rateLimit, "defer", seconds, clients, deferred) &&
+         ok;
+
+    //flat: within twice the quiet p99, give or take scheduling noise on a busy host
+    bool flat = deferred.p99Us <= 2 * quiet.p99Us + 100;
+    printf("p99 against no abuser: %.2fx with no limits, %.2fx with NACKs, %.2fx deferring reads\n",
+           open.p99Us / quiet.p99Us, nacked.p99Us / quiet.p99Us, deferred.p99Us / quiet.p99Us);
+    if (!flat)
+        fprintf(stderr, "FAILED: deferring the abuser's reads didn't keep the well-behaved p99 flat\n");
+
+    ok = capCheck(server, port, path, 8) && ok;
+    unlink(path.c_str());
+    ok = ok && flat;
+    printf("%s\n", ok ? "PASSED: well-behaved clients kept their p99 and the cap held" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,387 @@
+//Session resume benchmark. One client streams chats to another through NetworkServer;
+//the receiver, holding a resumable session, ACKs what it reads but every so often stops
+//reading for a moment and drops its connection with chats still in flight to it, then
+//reconnects and resumes. Measured: reconnect to first message, from the new connect()
+//to the first chat on the new connection, and what the server sent again per resume,
+//read from its exit summary. Chats the server couldn't relay while the receiver was away
+//are NACKed and resent by the sender; the ones lost in the dropped connection only come
+//back through the resume, so every chat arriving proves nothing was lost. Run over TCP
+//loopback and over shared memory rings.
+//Usage: resumebench [server binary] [port] [drops] [chats between drops] [sender's window]
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/checksum.h"
+#include "../Common/histogram.h"
+#include "../Common/shmring.h"
+
+using namespace std;
+
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//One client's connection, over TCP or through rings
+struct Client {
+    int fd = -1;
+    unique_ptr<ShmChannel> rings;
+    uint16_t id;
+    uint32_t nextId = 0;
+    unique_ptr<FrameDecoder> decoder;   //a fresh one for every connection
+};
+
+static bool connectTcp(unsigned short port, Client &client)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    client.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client.fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(client.fd);
+        client.fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+static bool connectTo(bool local, unsigned short port, const char *path, Client &client)
+{
+    client.decoder.reset(new FrameDecoder());
+    if (!local)
+        return connectTcp(port, client);
+    string why;
+    client.rings.reset(new ShmChannel());
+    if (!client.rings->connect(path, why))
+    {
+        fprintf(stderr, "local socket %s: %s\n", path, why.c_str());
+        return false;
+    }
+    return true;
+}
+
+//Drops the connection without a word, whatever is still on its way to us with it
+static void drop(Client &client)
+{
+    if (client.rings)
+        client.rings.reset();
+    else
+        close(client.fd);
+    client.fd = -1;
+}
+
+static bool sendFrame(Client &client, uint8_t type, uint16_t receiver, uint32_t messageId, const char *payload,
+                      size_t len)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = client.id;
+    header.receiver_id = receiver;
+    header.message_id = messageId;
+    if (!client.rings)
+        return frame_Send(client.fd, header, payload, len);
+    uint8_t wire[headerWireLen + 1024];
+    size_t wireLen = frame_Encode(header, payload, len, wire);
+    return wireLen > 0 && client.rings->writeAll(wire, wireLen);
+}
+
+//The next frame; with wait false only one already in, with wait true blocks for it.
+//False when there is none or the server has gone.
+static bool readFrame(Client &client, Frame &frame, bool wait)
+{
+    while (!client.decoder->next(frame))
+    {
+        char *space = client.decoder->writePtr();
+        if (!client.rings)
+        {
+            ssize_t got = recv(client.fd, space, client.decoder->writable(), wait ? 0 : MSG_DONTWAIT);
+            if (got <= 0)
+                return false;
+            client.decoder->commit(got);
+            continue;
+        }
+        size_t got = client.rings->read(space, client.decoder->writable());
+        if (got > 0)
+        {
+            client.decoder->commit(got);
+            continue;
+        }
+        if (!wait)
+            return false;
+        if (!client.rings->idle())
+            continue;
+        struct pollfd fds[2] = {{client.rings->doorbell(), POLLIN, 0}, {client.rings->socket(), POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 || fds[1].revents)
+            return false;
+        client.rings->clearDoorbell();
+    }
+    return true;
+}
+
+//Status request with payload, answered with the session token the server gave, 0 for none
+static bool handshake(Client &client, const string &payload, uint64_t &token)
+{
+    Frame frame;
+    if (!sendFrame(client, 1, 1, ++client.nextId, payload.data(), payload.size()))
+        return false;
+    while (readFrame(client, frame, true))
+        if (frame.header.messageType == 2)
+        {
+            token = session_Token(frame.payload, frame.header.payloadLen, (string(sessionFeature) + "=").c_str());
+            return true;
+        }
+    return false;
+}
+
+struct Result {
+    Histogram reconnect;     //new connect() to first chat, ns
+    size_t resumed = 0;
+    size_t duplicates = 0;   //chats that arrived again after all
+    size_t resent = 0;       //chats the sender resent after a NACK
+};
+
+//The sender: chats 1..count to the receiver with up to window of them not ACKed yet, as a
+//client's retransmit queue would hold, each NACKed one sent again a millisecond later,
+//until the receiver has them all
+static void stream(Client &sender, uint16_t receiver, uint32_t count, uint32_t window, const atomic<bool> &done,
+                   size_t &resent)
+{
+    char text[64];
+    memset(text, 'x', sizeof(text));
+    vector<pair<uint32_t, uint64_t>> nacked;   //id, when it may go again
+    vector<uint8_t> acked(count + 1, 0);
+    uint32_t next = 1, ackedCount = 0;
+    Frame frame;
+    while (!done)
+    {
+        if (next <= count && next - 1 - ackedCount < window)
+        {
+            if (!sendFrame(sender, 3, receiver, next, text, sizeof(text)))
+                return;
+            next++;
+        }
+        else
+            this_thread::sleep_for(chrono::microseconds(100));
+        while (readFrame(sender, frame, false))
+        {
+            uint32_t id = (uint32_t)strtoul(string(frame.payload, frame.header.payloadLen).c_str(), nullptr, 10);
+            if (frame.header.messageType == 5)
+                nacked.emplace_back(id, nowNs() + 1000000);
+            else if (frame.header.messageType == 4 && id > 0 && id <= count && !acked[id])
+            {
+                acked[id] = 1;
+                ackedCount++;
+            }
+        }
+        uint64_t now = nowNs();
+        for (size_t i = 0; i < nacked.size();)
+        {
+            if (nacked[i].second > now)
+            {
+                i++;
+                continue;
+            }
+            sendFrame(sender, 3, receiver, nacked[i].first, text, sizeof(text));
+            resent++;
+            nacked[i] = nacked.back();
+            nacked.pop_back();
+        }
+    }
+}
+
+static bool run(const char *name, bool local, unsigned short port, const char *path, size_t drops, size_t every,
+                size_t window, Result &result)
+{
+    Client sender, receiver;
+    sender.id = local ? 4 : 2;
+    receiver.id = local ? 5 : 3;
+    uint64_t token = 0, unused;
+    if (!connectTo(local, port, path, sender) || !connectTo(local, port, path, receiver) ||
+        !handshake(sender, "", unused) || !handshake(receiver, sessionFeature, token) || token == 0)
+    {
+        fprintf(stderr, "FAILED: %s: couldn't connect, or no session\n", name);
+        return false;
+    }
+
+    uint32_t count = (uint32_t)(drops * every + every);
+    vector<uint8_t> seen(count + 1, 0);
+    uint32_t got = 0;
+    atomic<bool> done{false};
+    thread streamer(stream, ref(sender), receiver.id, count, (uint32_t)window, cref(done), ref(result.resent));
+
+    bool ok = true;
+    size_t sinceDrop = 0;
+    char ack[16];
+    Frame frame;
+    while (ok && got < count)
+    {
+        if (!readFrame(receiver, frame, true))
+        {
+            fprintf(stderr, "FAILED: %s: the server hung up\n", name);
+            ok = false;
+            break;
+        }
+        if (frame.header.messageType != 3)
+            continue;
+        uint32_t id = frame.header.message_id;
+        if (id == 0 || id > count || !checkSum_Check(frame.wire, frame.payload, frame.header.payloadLen))
+        {
+            fprintf(stderr, "FAILED: %s: chat %u damaged\n", name, id);
+            ok = false;
+            break;
+        }
+        if (seen[id])
+            result.duplicates++;
+        else
+            got++;
+        seen[id] = 1;
+        int len = snprintf(ack, sizeof(ack), "%u", id);
+        sendFrame(receiver, 4, sender.id, ++receiver.nextId, ack, len);
+
+        if (++sinceDrop < every || result.resumed >= drops)
+            continue;
+
+        //let chats pile up on their way to us, then drop them with the connection
+        sinceDrop = 0;
+        this_thread::sleep_for(chrono::milliseconds(1));
+        drop(receiver);
+        uint64_t start = nowNs();
+        char resume[64];
+        snprintf(resume, sizeof(resume), "%s%llx", resumeFeature, (unsigned long long)token);
+        uint64_t again = 0;
+        if (!connectTo(local, port, path, receiver) || !handshake(receiver, resume, again) || again != token)
+        {
+            fprintf(stderr, "FAILED: %s: resume %zu wasn't accepted\n", name, result.resumed + 1);
+            ok = false;
+            break;
+        }
+        result.resumed++;
+
+        //the first chat on the new connection; counted like any other below
+        if (!readFrame(receiver, frame, true) || frame.header.messageType != 3)
+        {
+            fprintf(stderr, "FAILED: %s: nothing came after resume %zu\n", name, result.resumed);
+            ok = false;
+            break;
+        }
+        result.reconnect.record(nowNs() - start);
+        id = frame.header.message_id;
+        if (id == 0 || id > count)
+        {
+            ok = false;
+            break;
+        }
+        if (seen[id])
+            result.duplicates++;
+        else
+            got++;
+        seen[id] = 1;
+        len = snprintf(ack, sizeof(ack), "%u", id);
+        sendFrame(receiver, 4, sender.id, ++receiver.nextId, ack, len);
+    }
+    done = true;
+    streamer.join();
+
+    if (ok)
+        printf("  %-20s %zu resumes, reconnect to first message p50 %6.1f us p99 %6.1f us; %zu chats resent "
+               "after NACKs, %zu arrived twice\n",
+               name, result.resumed, result.reconnect.percentile(0.5) / 1e3, result.reconnect.percentile(0.99) / 1e3,
+               result.resent, result.duplicates);
+    else
+        fprintf(stderr, "FAILED: %s: %u of %u chats arrived\n", name, got, count);
+    drop(sender);
+    drop(receiver);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8105;
+    size_t drops = argc > 3 ? (size_t)atoi(argv[3]) : 200;
+    size_t every = argc > 4 ? (size_t)atoi(argv[4]) : 500;
+    size_t window = argc > 5 ? (size_t)atoi(argv[5]) : 256;
+    string path = "/tmp/resumebench." + to_string(getpid()) + ".sock";
+
+    //one worker, no message store, so only the sessions bring back what was in flight;
+    //its summary comes back on out
+    int console[2], out[2];
+    if (pipe(console) < 0 || pipe(out) < 0)
+        return EXIT_FAILURE;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        close(out[0]);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "1", "nack", "4096", "0", "epoll", "-", path.c_str(),
+              (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+    close(out[1]);
+    for (int tries = 0; tries < 200 && access(path.c_str(), F_OK) != 0; tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+
+    printf("%zu drops, %zu chats of 64 bytes between them, up to %zu not ACKed:\n", drops, every, window);
+    Result tcp, rings;
+    bool ok = run("TCP loopback", false, port, path.c_str(), drops, every, window, tcp);
+    ok = run("shared memory rings", true, port, path.c_str(), drops, every, window, rings) && ok;
+
+    //the server's exit summary says what resuming sent again
+    close(console[1]);
+    string summary;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(out[0], buf, sizeof(buf))) > 0)
+        summary.append(buf, n);
+    close(out[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "FAILED: the server didn't exit cleanly\n");
+        ok = false;
+    }
+    unsigned long resumed = 0, frames = 0, bytes = 0;
+    size_t at = summary.find("Sessions: ");
+    if (at == string::npos ||
+        sscanf(summary.c_str() + at, "Sessions: %lu resumed, %lu chats (%lu bytes)", &resumed, &frames, &bytes) != 3 ||
+        resumed != tcp.resumed + rings.resumed)
+    {
+        fprintf(stderr, "FAILED: the server's summary doesn't list the resumes\n");
+        ok = false;
+    }
+    else if (resumed > 0)
+        printf("replayed per resume: %.1f chats, %.0f bytes\n", (double)frames / resumed, (double)bytes / resumed);
+    printf("%s\n", ok ? "PASSED: every chat arrived, the ones dropped with a connection through the resume" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,265 @@
+//Room broadcast benchmark: starts NetworkServer, puts 1k and then 10k members in one
+//room and times how long each broadcast takes to reach the first and the last member.
+//The server's shutdown report gives the bytes it copied for the fan-out, compared
+//here with copying the frame once per recipient.
+//Usage: roombench [server binary] [port] [broadcasts] [workers]
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+
+using namespace std;
+
+static const uint16_t roomId = 42;
+static const uint16_t firstMemberId = 100;
+static const size_t payloadLen = 64;
+
+struct Member {
+    int fd;
+    uint16_t id;
+    FrameDecoder decoder;
+};
+
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+static void sendFrame(Member &member, uint8_t type, uint32_t messageId, const char *payload, size_t len)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.sender_id = member.id;
+    header.receiver_id = roomId;
+    header.message_id = messageId;
+    if (!frame_Send(member.fd, header, payload, len))
+        perror("send");
+}
+
+//Reads whatever a member has buffered, counting frames of the wanted type
+static int drain(Member &member, uint8_t type)
+{
+    int seen = 0;
+    Frame frame;
+    while (1)
+    {
+        char *space = member.decoder.writePtr();
+        ssize_t got = recv(member.fd, space, member.decoder.writable(), 0);
+        if (got <= 0)
+            break;
+        member.decoder.commit(got);
+        while (member.decoder.next(frame))
+            if (frame.header.messageType == type)
+                seen++;
+    }
+    return seen;
+}
+
+//Waits until `expected` frames of `type` have arrived across all members. Calls
+//onFirst the first time any arrive. Returns false on timeout.
+template <typename F>
+static bool collect(int epfd, vector<Member> &members, uint8_t type, long expected, F onFirst)
+{
+    long seen = 0;
+    vector<epoll_event> events(1024);
+    while (seen < expected)
+    {
+        int n = epoll_wait(epfd, events.data(), events.size(), 5000);
+        if (n == 0)
+        {
+            fprintf(stderr, "timed out, %ld/%ld frames\n", seen, expected);
+            return false;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            int got = drain(members[events[i].data.u32], type);
+            if (got > 0 && seen == 0)
+                onFirst();
+            seen += got;
+        }
+    }
+    return true;
+}
+
+static double percentile(vector<uint64_t> &v, double p)
+{
+    sort(v.begin(), v.end());
+    return v.empty() ? 0.0 : v[(size_t)(p * (v.size() - 1))] / 1000.0;
+}
+
+//"Room fan-out: N broadcasts, X deliveries, Y bytes copied" from the server's log
+static bool readFanOut(const char *logPath, unsigned long long &deliveries, unsigned long long &copied)
+{
+    ifstream log(logPath);
+    string line;
+    bool found = false;
+    while (getline(log, line))
+    {
+        unsigned long long b;
+        if (sscanf(line.c_str(), "Room fan-out: %llu broadcasts, %llu deliveries, %llu bytes copied", &b,
+                   &deliveries, &copied) == 3)
+            found = true;
+    }
+    return found;
+}
+
+static bool runWith(const char *server, unsigned short port, unsigned workers, int memberCount, int broadcasts)
+{
+    char logPath[] = "/tmp/roombench.XXXXXX";
+    int logfd = mkstemp(logPath);
+    int console[2];
+    if (logfd < 0 || pipe(console) < 0)
+        return false;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        dup2(logfd, STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port), workerArg = to_string(workers);
+        execl(server, server, portArg.c_str(), workerArg.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+    close(logfd);
+
+    int probe = -1;
+    for (int tries = 0; tries < 200 && !connectTo(port, probe); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (probe < 0)
+    {
+        fprintf(stderr, "server did not start\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        unlink(logPath);
+        return false;
+    }
+    close(probe);
+
+    //the last member is the one broadcasting
+    vector<Member> members(memberCount + 1);
+    int epfd = epoll_create1(0);
+    bool ok = true;
+    for (int i = 0; i <= memberCount && ok; i++)
+    {
+        Member &member = members[i];
+        member.id = firstMemberId + i;
+        if (!connectTo(port, member.fd))
+        {
+            perror("connect");
+            ok = false;
+            break;
+        }
+        int on = 1;
+        setsockopt(member.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(member.fd, F_SETFL, O_NONBLOCK);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, member.fd, &ev);
+
+        char join = 1;
+        sendFrame(member, 7, 0, &join, 1);
+    }
+
+    //every join is ACKed once the member is in the room
+    ok = ok && collect(epfd, members, 4, memberCount + 1, [] {});
+
+    vector<uint64_t> first, last;
+    Member &sender = members[memberCount];
+    char payload[payloadLen] = "room broadcast message";
+    for (int b = 0; b < broadcasts && ok; b++)
+    {
+        uint64_t start = nowNs(), firstAt = 0;
+        sendFrame(sender, 8, b + 1, payload, sizeof(payload));
+        ok = collect(epfd, members, 8, memberCount, [&] { firstAt = nowNs(); });
+        first.push_back(firstAt - start);
+        last.push_back(nowNs() - start);
+        //the sender's ACK, not timed
+        drain(sender, 4);
+    }
+
+    for (auto &member : members)
+        if (member.fd >= 0)
+            close(member.fd);
+    close(epfd);
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+
+    unsigned long long deliveries = 0, copied = 0;
+    if (ok && !readFanOut(logPath, deliveries, copied))
+    {
+        fprintf(stderr, "no fan-out report in the server log\n");
+        ok = false;
+    }
+    unlink(logPath);
+    if (!ok)
+        return false;
+
+    double lastP50 = percentile(last, 0.50), lastP99 = percentile(last, 0.99);
+    printf("%6d members  %u workers  first delivery p50 %8.1f us  last delivery p50 %9.1f us  p99 %9.1f us  "
+           "%7.0f deliveries/sec\n",
+           memberCount, workers, percentile(first, 0.50), lastP50, lastP99, memberCount / (lastP50 / 1e6));
+    printf("%6s bytes copied for fan-out %llu, copy per recipient would be %llu\n", "", copied,
+           deliveries * (headerWireLen + payloadLen));
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8091;
+    int broadcasts = argc > 3 ? atoi(argv[3]) : 50;
+    unsigned workers = argc > 4 ? atoi(argv[4]) : 4;
+
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    for (int memberCount : {1000, 10000})
+        if (!runWith(server, port, workers, memberCount, broadcasts))
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+//Routing benchmark: N local clients chatting with random peers through NetworkServer
+//Every chat is forwarded to its receiver, ACKed by it and the ACK routed back.
+//Usage: routebench [port] [clients] [messages per client]
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+
+using namespace std;
+
+static const uint16_t serverId = 1;
+static const uint16_t firstClientId = 100;
+
+struct Client {
+    int fd;
+    uint16_t id;
+    int sent;
+    bool registered;
+    FrameDecoder decoder;
+};
+
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void sendFrame(Client &client, uint8_t type, uint16_t receiver, uint32_t messageId, const char *payload, size_t len)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.sender_id = client.id;
+    header.receiver_id = receiver;
+    header.message_id = messageId;
+    if (!frame_Send(client.fd, header, payload, len))
+        perror("send");
+}
+
+//Chat payload carries the send time so the receiver can measure forwarding latency
+static void sendChat(Client &client, mt19937 &rng, int clientCount)
+{
+    uint16_t peer;
+    do
+        peer = firstClientId + rng() % clientCount;
+    while (peer == client.id && clientCount > 1);
+
+    char payload[64] = "routed chat message";
+    uint64_t stamp = nowNs();
+    memcpy(payload + 32, &stamp, sizeof(stamp));
+    sendFrame(client, 3, peer, ++client.sent, payload, sizeof(payload));
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned short port = argc > 1 ? (unsigned short)atoi(argv[1]) : 8080;
+    int clientCount = argc > 2 ? atoi(argv[2]) : 100;
+    int perClient = argc > 3 ? atoi(argv[3]) : 100;
+
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    vector<Client> clients(clientCount);
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < clientCount; i++)
+    {
+        Client &client = clients[i];
+        client.id = firstClientId + i;
+        client.sent = 0;
+        client.registered = false;
+        client.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(client.fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+        {
+            perror("connect");
+            return EXIT_FAILURE;
+        }
+        int on = 1;
+        setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(client.fd, F_SETFL, O_NONBLOCK);
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, client.fd, &ev);
+
+        //the status request registers the client id with the server
+        sendFrame(client, 1, serverId, 0, nullptr, 0);
+    }
+
+    mt19937 rng(12345);
+    vector<uint64_t> latencies;
+    latencies.reserve((size_t)clientCount * perClient);
+    long total = (long)clientCount * perClient;
+    long acked = 0, nacked = 0;
+    int registered = 0;
+    uint64_t start = 0;
+
+    vector<epoll_event> events(1024);
+    while (acked + nacked < total)
+    {
+        int n = epoll_wait(epfd, events.data(), events.size(), 5000);
+        if (n == 0)
+        {
+            fprintf(stderr, "timed out, %ld/%ld messages acknowledged\n", acked, total);
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            Client &client = clients[events[i].data.u32];
+            Frame frame;
+            while (1)
+            {
+                char *space = client.decoder.writePtr();
+                ssize_t got = recv(client.fd, space, client.decoder.writable(), 0);
+                if (got <= 0)
+                    break;
+                client.decoder.commit(got);
+                while (client.decoder.next(frame))
+                {
+                    const MessageHeader &header = frame.header;
+                    switch (header.messageType)
+                    {
+                    case 2:
+                        client.registered = true;
+                        //start the clock once every client can be reached
+                        if (++registered == clientCount)
+                        {
+                            start = nowNs();
+                            for (auto &c : clients)
+                                sendChat(c, rng, clientCount);
+                        }
+                        break;
+                    case 3:
+                    {
+                        uint64_t stamp;
+                        memcpy(&stamp, frame.payload + 32, sizeof(stamp));
+                        latencies.push_back(nowNs() - stamp);
+                        string id = to_string(header.message_id);
+                        sendFrame(client, 4, header.sender_id, header.message_id, id.data(), id.size());
+                        break;
+                    }
+                    case 4:
+                    case 5:
+                        if (header.messageType == 4)
+                            acked++;
+                        else
+                            nacked++;
+                        if (client.sent < perClient)
+                            sendChat(client, rng, clientCount);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    double secs = (nowNs() - start) / 1e9;
+
+    sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) { return latencies.empty() ? 0.0 : latencies[(size_t)(p * (latencies.size() - 1))] / 1000.0; };
+    printf("%d clients  %ld routed chats (%ld NACKed)  %.3f s  %.0f routed msgs/sec  forwarding latency p50 %.1f us  p99 %.1f us\n",
+           clientCount, acked, nacked, secs, acked / secs, pct(0.50), pct(0.99));
+
+    for (auto &client : clients)
+        close(client.fd);
+    close(epfd);
+    return acked == total ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,206 @@
+//Worker scaling benchmark: starts NetworkServer with 1, 2, 4 and 8 worker threads
+//and drives each with the same loopback chat load for a fixed time.
+//Usage: scalebench [server binary] [port] [clients] [seconds]
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/ackbatch.h"
+
+using namespace std;
+
+struct Client {
+    int fd;
+    uint16_t id;        //its own client id, the server pins a connection to one
+    uint32_t sent;
+    FrameDecoder decoder;
+};
+
+static atomic<bool> running{false};
+static atomic<long> acked{0};
+static atomic<uint16_t> nextId{2};   //client ids handed out across the load threads
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+static void sendChat(Client &client)
+{
+    static const char message[] = "scaling benchmark message";
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = 3;
+    header.sender_id = client.id;
+    header.receiver_id = 1;
+    header.message_id = ++client.sent;
+    frame_Send(client.fd, header, message, sizeof(message) - 1);
+}
+
+//One load thread: its clients each keep one chat in flight until time is up
+static void driveClients(unsigned short port, int count)
+{
+    vector<Client> clients(count);
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < count; i++)
+    {
+        if (!connectTo(port, clients[i].fd))
+        {
+            perror("connect");
+            exit(EXIT_FAILURE);
+        }
+        clients[i].id = nextId++;
+        clients[i].sent = 0;
+        int on = 1;
+        setsockopt(clients[i].fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(clients[i].fd, F_SETFL, O_NONBLOCK);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+    }
+
+    while (!running.load())
+        this_thread::yield();
+    for (auto &client : clients)
+        sendChat(client);
+
+    long local = 0;
+    epoll_event events[256];
+    while (running.load())
+    {
+        int n = epoll_wait(epfd, events, 256, 100);
+        for (int i = 0; i < n; i++)
+        {
+            Client &client = clients[events[i].data.u32];
+            Frame frame;
+            while (1)
+            {
+                char *space = client.decoder.writePtr();
+                ssize_t got = recv(client.fd, space, client.decoder.writable(), 0);
+                if (got <= 0)
+                    break;
+                client.decoder.commit(got);
+                while (client.decoder.next(frame))
+                {
+                    if (frame.header.messageType == 4)
+                        local++;
+                    else if (frame.header.messageType == 9)
+                        local += ackRange_Ids(frame.payload, frame.header.payloadLen);
+                    else
+                        continue;
+                    if (running.load())
+                        sendChat(client);
+                }
+            }
+        }
+    }
+    acked += local;
+
+    for (auto &client : clients)
+        close(client.fd);
+    close(epfd);
+}
+
+static bool runWith(const char *server, unsigned short port, unsigned workers, int clientCount, double seconds)
+{
+    //the server reads its console from this pipe, closing it shuts the server down
+    int console[2];
+    if (pipe(console) < 0)
+        return false;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port), workerArg = to_string(workers);
+        execl(server, server, portArg.c_str(), workerArg.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+
+    //wait for the listeners to come up
+    int probe = -1;
+    for (int tries = 0; tries < 200 && !connectTo(port, probe); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (probe < 0)
+    {
+        fprintf(stderr, "server did not start\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        return false;
+    }
+    close(probe);
+
+    unsigned loadThreads = max(1u, min(8u, thread::hardware_concurrency()));
+    running.store(false);
+    acked.store(0);
+    vector<thread> threads;
+    for (unsigned t = 0; t < loadThreads; t++)
+        threads.emplace_back(driveClients, port, clientCount / loadThreads + (t < clientCount % loadThreads));
+
+    this_thread::sleep_for(chrono::milliseconds(200));
+    running.store(true);
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    running.store(false);
+    for (auto &t : threads)
+        t.join();
+
+    printf("%2u workers  %5d clients  %12.0f msgs/sec\n", workers, clientCount, acked.load() / seconds);
+
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8090;
+    int clientCount = argc > 3 ? atoi(argv[3]) : 256;
+    double seconds = argc > 4 ? atof(argv[4]) : 3.0;
+
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    for (unsigned workers : {1, 2, 4, 8})
+        if (!runWith(server, port, workers, clientCount, seconds))
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+//Send path microbenchmark: the old new[]/memcpy/send() socket_Send vs. frame_Send()
+//Usage: sendbench [messages per size]
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <thread>
+#include "../Common/message.h"
+#include "../Common/framesend.h"
+
+using namespace std;
+
+//counting replacements for the global allocator, they pair malloc with free on purpose
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+static atomic<size_t> allocations{0};
+
+void *operator new(size_t size)
+{
+    allocations++;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static MessageHeader chatHeader(const string &message)
+{
+    MessageHeader myHeader{};
+    myHeader.headerLen = headerWireLen;
+    myHeader.messageType = 3;
+    myHeader.timeStamp = (uint32_t)time(nullptr);
+    myHeader.sender_id = 2;
+    myHeader.receiver_id = 1;
+    myHeader.message_id = 12345;
+    myHeader.payloadLen = message.size();
+    return myHeader;
+}
+
+//socket_Send as it was: heap buffer, header and payload copied in, one send()
+static void oldSend(int sockfd, const string &message)
+{
+    MessageHeader myHeader = chatHeader(message);
+    size_t packetSize = headerWireLen + message.size();
+    uint8_t *buff = new uint8_t[packetSize];
+    header_Encode(myHeader, buff);
+    memcpy(buff + headerWireLen, message.c_str(), message.size());
+    send(sockfd, buff, packetSize, 0);
+    delete[] buff;
+}
+
+static void newSend(int sockfd, const string &message)
+{
+    frame_Send(sockfd, chatHeader(message), message.data(), message.size());
+}
+
+static void measure(const char *name, void (*sendFn)(int, const string &), size_t payloadSize, long count)
+{
+    int pair[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+    string message(payloadSize, 'x');
+
+    size_t expected = count * (headerWireLen + payloadSize);
+    thread reader([&]() {
+        static char buff[1 << 16];
+        size_t got = 0;
+        while (got < expected)
+        {
+            ssize_t n = recv(pair[1], buff, sizeof(buff), 0);
+            if (n <= 0)
+                break;
+            got += n;
+        }
+    });
+
+    size_t allocStart = allocations.load();
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < count; i++)
+        sendFn(pair[0], message);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t allocs = allocations.load() - allocStart;
+
+    reader.join();
+    close(pair[0]);
+    close(pair[1]);
+
+    printf("%-4s payload %6zu B  %8.2f allocs/msg  %12.0f msgs/sec\n",
+           name, payloadSize, (double)allocs / count, count / secs);
+}
+
+int main(int argc, char *argv[])
+{
+    long count = argc > 1 ? atol(argv[1]) : 200000;
+
+    for (size_t size : {16, 256, 1024, 8192, 60000})
+    {
+        long n = size > 8192 ? count / 10 : count;
+        measure("old", oldSend, size, n);
+        measure("new", newSend, size, n);
+    }
+    return 0;
+}
@@ -0,0 +1,306 @@
+//Slow consumer benchmark: one client registers and then never reads while another
+//floods it with chats. Meanwhile a ring of well-behaved clients chat with each other
+//and time every round trip. Runs once without the stalled client as a baseline and
+//once per send queue policy, each against a fresh single-worker NetworkServer.
+//Usage: slowbench [server binary] [port] [clients] [seconds]
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+
+using namespace std;
+
+static const uint16_t serverId = 1;
+static const uint16_t flooderId = 98;
+static const uint16_t stalledId = 99;
+static const uint16_t firstClientId = 100;
+static const int queueLimitKB = 64;
+
+struct Client {
+    int fd;
+    uint16_t id;
+    uint32_t sent;
+    uint64_t sentAt;
+    FrameDecoder decoder;
+};
+
+static atomic<bool> flooding{false};
+
+static uint64_t nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool connectTo(unsigned short port, int &fd, int rcvbuf = 0)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    //has to be set before connect() for the window to stay small
+    if (rcvbuf > 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+static void sendFrame(int fd, uint16_t sender, uint8_t type, uint16_t receiver, uint32_t messageId,
+                      const char *payload, size_t len)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.sender_id = sender;
+    header.receiver_id = receiver;
+    header.message_id = messageId;
+    frame_Send(fd, header, payload, len);
+}
+
+//Keeps chats to the stalled client going at about 16 MB/s, enough to fill the kernel's
+//socket buffers and the server's send queue early on, reading back whatever NACKs it gets
+static void flood(int fd, long &sent, long &nacked)
+{
+    static char payload[1024];
+    FrameDecoder decoder;
+    Frame frame;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    while (flooding.load())
+    {
+        for (int burst = 0; burst < 16; burst++)
+            sendFrame(fd, flooderId, 3, stalledId, ++sent, payload, sizeof(payload));
+        while (1)
+        {
+            char *space = decoder.writePtr();
+            ssize_t got = recv(fd, space, decoder.writable(), 0);
+            if (got <= 0)
+                break;
+            decoder.commit(got);
+            while (decoder.next(frame))
+                if (frame.header.messageType == 5)
+                    nacked++;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+static void sendChat(Client &client, int clientCount)
+{
+    char payload[64] = "slow consumer benchmark message";
+    uint16_t peer = firstClientId + (client.id - firstClientId + 1) % clientCount;
+    client.sentAt = nowNs();
+    sendFrame(client.fd, client.id, 3, peer, ++client.sent, payload, sizeof(payload));
+}
+
+//"Send queues: peak P bytes, R frames refused, D slow connections dropped"
+static string readQueueReport(const char *logPath)
+{
+    ifstream log(logPath);
+    string line, report = "no send queue report";
+    while (getline(log, line))
+        if (line.rfind("Send queues: ", 0) == 0)
+            report = line.substr(13);
+    return report;
+}
+
+static bool runWith(const char *server, unsigned short port, const char *policy, bool stall, int clientCount,
+                    double seconds)
+{
+    char logPath[] = "/tmp/slowbench.XXXXXX";
+    int logfd = mkstemp(logPath);
+    int console[2];
+    if (logfd < 0 || pipe(console) < 0)
+        return false;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        dup2(logfd, STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port), limitArg = to_string(queueLimitKB);
+        execl(server, server, portArg.c_str(), "1", policy, limitArg.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+    close(logfd);
+
+    int probe = -1;
+    for (int tries = 0; tries < 200 && !connectTo(port, probe); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (probe < 0)
+    {
+        fprintf(stderr, "server did not start\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        unlink(logPath);
+        return false;
+    }
+    close(probe);
+
+    //the stalled client registers its id and then never reads again
+    int stalled = -1, flooder = -1;
+    long flooded = 0, nacked = 0;
+    thread flooderThread;
+    if (stall)
+    {
+        if (!connectTo(port, stalled, 4096) || !connectTo(port, flooder))
+        {
+            perror("connect");
+            return false;
+        }
+        sendFrame(stalled, stalledId, 1, serverId, 0, nullptr, 0);
+        this_thread::sleep_for(chrono::milliseconds(50));
+        flooding.store(true);
+        flooderThread = thread(flood, flooder, ref(flooded), ref(nacked));
+    }
+
+    vector<Client> clients(clientCount);
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < clientCount; i++)
+    {
+        Client &client = clients[i];
+        client.id = firstClientId + i;
+        client.sent = 0;
+        if (!connectTo(port, client.fd))
+        {
+            perror("connect");
+            return false;
+        }
+        fcntl(client.fd, F_SETFL, O_NONBLOCK);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, client.fd, &ev);
+        sendFrame(client.fd, client.id, 1, serverId, 0, nullptr, 0);
+    }
+
+    vector<uint64_t> latencies;
+    int registered = 0;
+    bool ok = true;
+    uint64_t start = 0, end = 0, lastHeard = nowNs();
+    vector<epoll_event> events(1024);
+    while (ok && (start == 0 || nowNs() < end))
+    {
+        int n = epoll_wait(epfd, events.data(), events.size(), 100);
+        if (n > 0)
+            lastHeard = nowNs();
+        else if (nowNs() - lastHeard > 5000000000ull)
+        {
+            fprintf(stderr, "timed out, the server stopped answering\n");
+            ok = false;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            Client &client = clients[events[i].data.u32];
+            Frame frame;
+            while (1)
+            {
+                char *space = client.decoder.writePtr();
+                ssize_t got = recv(client.fd, space, client.decoder.writable(), 0);
+                if (got <= 0)
+                    break;
+                client.decoder.commit(got);
+                while (client.decoder.next(frame))
+                {
+                    const MessageHeader &header = frame.header;
+                    if (header.messageType == 2 && ++registered == clientCount)
+                    {
+                        start = nowNs();
+                        end = start + (uint64_t)(seconds * 1e9);
+                        for (auto &c : clients)
+                            sendChat(c, clientCount);
+                    }
+                    else if (header.messageType == 3)
+                    {
+                        string id = to_string(header.message_id);
+                        sendFrame(client.fd, client.id, 4, header.sender_id, header.message_id, id.data(), id.size());
+                    }
+                    else if (header.messageType == 4 || header.messageType == 5)
+                    {
+                        latencies.push_back(nowNs() - client.sentAt);
+                        if (nowNs() < end)
+                            sendChat(client, clientCount);
+                    }
+                }
+            }
+        }
+    }
+    double secs = (nowNs() - start) / 1e9;
+
+    flooding.store(false);
+    if (flooderThread.joinable())
+        flooderThread.join();
+    for (auto &client : clients)
+        close(client.fd);
+    close(epfd);
+    if (stalled >= 0)
+        close(stalled);
+    if (flooder >= 0)
+        close(flooder);
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+    string report = readQueueReport(logPath);
+    unlink(logPath);
+    if (!ok)
+        return false;
+
+    sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) { return latencies.empty() ? 0.0 : latencies[(size_t)(p * (latencies.size() - 1))] / 1000.0; };
+    printf("%-10s %-9s %8.0f msgs/sec  p50 %8.1f us  p99 %8.1f us  flooded %7ld NACKed %7ld\n",
+           stall ? policy : "baseline", stall ? "stalled" : "no stall", latencies.size() / secs, pct(0.50), pct(0.99),
+           flooded, nacked);
+    printf("%-20s server: %s\n", "", report.c_str());
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8092;
+    int clientCount = argc > 3 ? atoi(argv[3]) : 50;
+    double seconds = argc > 4 ? atof(argv[4]) : 2.0;
+
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    if (!runWith(server, port, "nack", false, clientCount, seconds))
+        return EXIT_FAILURE;
+    for (const char *policy : {"drop", "nack", "disconnect"})
+        if (!runWith(server, port, policy, true, clientCount, seconds))
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
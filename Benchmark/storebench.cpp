@@ -0,0 +1,423 @@
+//Message store benchmark and crash tests. Times appends to MessageStore against one
+//write() per frame, checks recovery of a log left by a killed process with a torn frame
+//at its end, then runs NetworkServer with a store: chats to an offline client are held,
+//the server is killed and restarted, and the client's backlog is timed as it streams
+//out on reconnect (epoll, from sendfile(), then io_uring). Half of it is ACKed and the
+//rest must come back, and only the rest, after another restart.
+//Usage: storebench [server binary] [port] [frames]
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/checksum.h"
+#include "../Common/ackbatch.h"
+#include "../Common/messagestore.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+}
+
+static string encode(uint8_t type, uint16_t sender, uint16_t receiver, uint32_t id, const string &payload)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.timeStamp = (uint32_t)time(nullptr);
+    header.sender_id = sender;
+    header.receiver_id = receiver;
+    header.message_id = id;
+    string wire(headerWireLen + payload.size(), '\0');
+    frame_Encode(header, payload.data(), payload.size(), (uint8_t *)&wire[0]);
+    return wire;
+}
+
+static string rangeAck(uint16_t sender, uint16_t receiver, uint32_t first, uint32_t last)
+{
+    AckBatch batch;
+    for (uint32_t id = first; id <= last; id++)
+        batch.add(id);
+    string ranges(batch.wireLen(), '\0');
+    batch.encode((uint8_t *)&ranges[0]);
+    return encode(9, sender, receiver, 0, ranges);
+}
+
+static void removeStore(const string &dir)
+{
+    string command = "rm -rf '" + dir + "'";
+    if (system(command.c_str()) != 0)
+        fprintf(stderr, "couldn't remove %s\n", dir.c_str());
+}
+
+//Appends against one write() per frame to a plain file, 8 MB segments so it rolls a few times
+static bool appendSpeed(const string &dir, unsigned frames)
+{
+    vector<string> wires;
+    for (unsigned i = 0; i < 1000; i++)
+        wires.push_back(encode(3, 2, 3 + i % 8, i + 1, string(64, 'a' + i % 26)));
+
+    MessageStore store;
+    string why;
+    if (!store.open(dir + "/append", why, 8 << 20))
+    {
+        fprintf(stderr, "open: %s\n", why.c_str());
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    for (unsigned i = 0; i < frames; i++)
+        store.append((const uint8_t *)wires[i % 1000].data(), wires[i % 1000].size(), i % 2 == 0);
+    double storeSecs = seconds(start);
+    store.close();
+
+    int fd = open((dir + "/plain").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    start = chrono::steady_clock::now();
+    for (unsigned i = 0; i < frames; i++)
+        if (write(fd, wires[i % 1000].data(), wires[i % 1000].size()) < 0)
+            break;
+    double writeSecs = seconds(start);
+    close(fd);
+
+    double mb = (double)frames * wires[0].size() / 1e6;
+    printf("append %u frames of %zu bytes: store %.2f M frames/s (%.0f MB/s), write() per frame %.2f M frames/s\n",
+           frames, wires[0].size(), frames / storeSecs / 1e6, mb / storeSecs, frames / writeSecs / 1e6);
+    return true;
+}
+
+//Runs fn in a child process that is then killed, leaving the store as a crash would
+template <typename Fn>
+static void inCrashingChild(Fn fn)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        fn();
+        kill(getpid(), SIGKILL);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+//Reopens the store at path and checks what it recovered
+static bool recovered(const string &path, uint64_t frames, uint64_t tornBytes, const vector<uint32_t> &heldIds,
+                      const char *when)
+{
+    MessageStore store;
+    string why;
+    if (!store.open(path, why, 1 << 20))
+    {
+        fprintf(stderr, "FAILED: reopening %s: %s\n", when, why.c_str());
+        return false;
+    }
+    vector<StoredFrame> held;
+    store.heldFor(3, held);
+    bool ok = store.framesRecovered() == frames && store.bytesTruncated() == tornBytes &&
+              held.size() == heldIds.size() && store.heldCount() == heldIds.size();
+    for (size_t i = 0; ok && i < held.size(); i++)
+    {
+        const uint8_t *wire = store.frameData(held[i]);
+        MessageHeader header = header_Decode(wire);
+        ok = held[i].messageId == heldIds[i] && header.message_id == heldIds[i] && header.messageType == 3 &&
+             checkSum_Check(wire, (const char *)wire + headerWireLen, header.payloadLen);
+    }
+    printf("  %s: %lu frames recovered, %lu torn bytes cut off, %zu chats held\n", when,
+           (unsigned long)store.framesRecovered(), (unsigned long)store.bytesTruncated(), held.size());
+    if (!ok)
+        fprintf(stderr, "FAILED: expected %lu frames, %lu torn bytes and %zu chats held in order\n",
+                (unsigned long)frames, (unsigned long)tornBytes, heldIds.size());
+    return ok;
+}
+
+//A process appends chats from client 2 to client 3 and ACKs from 3 for some of them,
+//starts one more chat and dies halfway through copying it in. Reopening must find
+//every whole frame, cut the torn one off and hold exactly the unACKed chats, in order.
+//A second crash after one more append must not bring the torn bytes back.
+static bool crashRecovery(const string &dir)
+{
+    string path = dir + "/crash";
+    const uint32_t chats = 30000;     //a few 1 MB segments
+    string torn = encode(3, 2, 3, chats + 1, "chat torn by the crash");
+    const size_t tornBytes = torn.size() - 5;
+
+    inCrashingChild([&]() {
+        MessageStore store;
+        string why;
+        if (!store.open(path, why, 1 << 20))
+            return;
+        for (uint32_t id = 1; id <= chats; id++)
+        {
+            string chat = encode(3, 2, 3, id, "held chat " + to_string(id));
+            store.append((const uint8_t *)chat.data(), chat.size(), true);
+            //every third chat is ACKed on its own, then 1..1000 with one range ACK
+            if (id % 3 == 0)
+            {
+                string ack = encode(4, 3, 2, 0, to_string(id));
+                store.append((const uint8_t *)ack.data(), ack.size(), false);
+            }
+        }
+        string ack = rangeAck(3, 2, 1, 1000);
+        store.append((const uint8_t *)ack.data(), ack.size(), false);
+        //what a memcpy cut short by the crash leaves in the segment
+        store.append((const uint8_t *)torn.data(), tornBytes, false);
+    });
+
+    vector<uint32_t> heldIds;
+    for (uint32_t id = 1001; id <= chats; id++)
+        if (id % 3 != 0)
+            heldIds.push_back(id);
+    uint64_t frames = chats + chats / 3 + 1;
+    printf("crash recovery, %u chats in 1 MB segments:\n", chats);
+    if (!recovered(path, frames, tornBytes, heldIds, "after the first crash"))
+        return false;
+
+    inCrashingChild([&]() {
+        MessageStore store;
+        string why;
+        if (!store.open(path, why, 1 << 20))
+            return;
+        string chat = encode(3, 2, 3, chats + 2, "x");
+        store.append((const uint8_t *)chat.data(), chat.size(), true);
+    });
+    heldIds.push_back(chats + 2);
+    if (!recovered(path, frames + 1, 0, heldIds, "after the second crash"))
+        return false;
+    //and once more after the clean close the last check ended with
+    return recovered(path, frames + 1, 0, heldIds, "after a clean close");
+}
+
+struct Server {
+    pid_t pid = -1;
+    int console = -1;
+};
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return true;
+}
+
+static bool startServer(Server &server, const char *binary, unsigned short port, const char *engine,
+                        const string &storeDir)
+{
+    int console[2];
+    if (pipe(console) < 0)
+        return false;
+    server.pid = fork();
+    if (server.pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        close(console[1]);
+        string portArg = to_string(port);
+        execl(binary, binary, portArg.c_str(), "1", "nack", "256", "0", engine, storeDir.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+    server.console = console[1];
+
+    int probe = -1;
+    for (int tries = 0; tries < 200 && !connectTo(port, probe); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (probe < 0)
+    {
+        fprintf(stderr, "server did not start\n");
+        kill(server.pid, SIGKILL);
+        waitpid(server.pid, nullptr, 0);
+        return false;
+    }
+    close(probe);
+    return true;
+}
+
+//crash kills the server, otherwise it is stopped from its console and closes the store
+static void stopServer(Server &server, bool crash)
+{
+    if (crash)
+        kill(server.pid, SIGKILL);
+    close(server.console);
+    waitpid(server.pid, nullptr, 0);
+}
+
+static void sendFrame(int fd, uint8_t type, uint16_t sender, uint16_t receiver, uint32_t id, const string &payload)
+{
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = type;
+    header.sender_id = sender;
+    header.receiver_id = receiver;
+    header.message_id = id;
+    frame_Send(fd, header, payload.data(), payload.size());
+}
+
+//Blocks until a whole frame is in; false on EOF
+static bool readFrame(int fd, FrameDecoder &decoder, Frame &frame)
+{
+    while (!decoder.next(frame))
+    {
+        char *space = decoder.writePtr();
+        ssize_t got = recv(fd, space, decoder.writable(), 0);
+        if (got <= 0)
+            return false;
+        decoder.commit(got);
+    }
+    return true;
+}
+
+//Client 2 sends chats to client 3, who isn't connected, in windows of 100; each must be
+//ACKed by the server as held
+static bool sendHeld(unsigned short port, unsigned chats, const string &payload)
+{
+    int a;
+    if (!connectTo(port, a))
+        return false;
+    FrameDecoder decoder;
+    Frame frame;
+    bool ok = true;
+    for (unsigned sent = 0; ok && sent < chats; sent += 100)
+    {
+        unsigned batch = min(100u, chats - sent);
+        for (unsigned i = 1; i <= batch; i++)
+            sendFrame(a, 3, 2, 3, sent + i, payload);
+        for (unsigned i = 0; ok && i < batch; i++)
+            ok = readFrame(a, decoder, frame) && frame.header.messageType == 4;
+    }
+    close(a);
+    if (!ok)
+        fprintf(stderr, "FAILED: chats to an offline client weren't ACKed by the server\n");
+    return ok;
+}
+
+//Client 3 connects and registers with a status request; every chat held for it must
+//arrive, ids first..last in order. Optionally ACKs 1..ackUpTo back with a range ACK.
+static bool receiveHeld(unsigned short port, uint32_t first, uint32_t last, uint32_t ackUpTo, double &secs)
+{
+    int b;
+    if (!connectTo(port, b))
+        return false;
+    FrameDecoder decoder;
+    Frame frame;
+    auto start = chrono::steady_clock::now();
+    sendFrame(b, 1, 3, 1, 1, "");
+    uint32_t expect = first;
+    bool statusSeen = false, ok = true;
+    while (ok && (expect <= last || !statusSeen))
+    {
+        ok = readFrame(b, decoder, frame);
+        if (!ok)
+            break;
+        if (frame.header.messageType == 2)
+            statusSeen = true;
+        else
+            ok = frame.header.messageType == 3 && frame.header.sender_id == 2 && frame.header.message_id == expect++ &&
+                 checkSum_Check(frame.wire, frame.payload, frame.header.payloadLen);
+    }
+    secs = seconds(start);
+    if (ok && ackUpTo)
+    {
+        string ack = rangeAck(3, 2, 1, ackUpTo);
+        frame_SendWire(b, (const uint8_t *)ack.data(), ack.size());
+        //the server handles a connection's frames in order, so once this is answered the ACK is in
+        sendFrame(b, 1, 3, 1, 2, "");
+        ok = readFrame(b, decoder, frame) && frame.header.messageType == 2;
+    }
+    //nothing more may follow
+    if (ok)
+    {
+        timeval wait{0, 200000};
+        setsockopt(b, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+        ok = !readFrame(b, decoder, frame);
+    }
+    close(b);
+    if (!ok)
+        fprintf(stderr, "FAILED: expected held chats %u..%u, got id %u (type %d) after %u\n", first, last,
+                frame.header.message_id, frame.header.messageType, expect - 1);
+    return ok;
+}
+
+static bool offlineDelivery(const char *binary, unsigned short port, const string &dir, unsigned chats)
+{
+    string storeDir = dir + "/server";
+    string payload(100, 'm');
+    double mb = chats * (headerWireLen + payload.size()) / 1e6;
+    Server server;
+    printf("offline delivery, %u chats of %zu bytes:\n", chats, payload.size());
+
+    auto start = chrono::steady_clock::now();
+    if (!startServer(server, binary, port, "epoll", storeDir) || !sendHeld(port, chats, payload))
+        return false;
+    printf("  held at %.0f chats/s, server killed\n", chats / seconds(start));
+    stopServer(server, true);
+
+    struct Run {
+        const char *engine;
+        uint32_t ackUpTo;
+    };
+    for (Run run : {Run{"epoll", 0}, Run{"uring", chats / 2}})
+    {
+        double secs;
+        if (!startServer(server, binary, port, run.engine, storeDir))
+            return false;
+        bool ok = receiveHeld(port, 1, chats, run.ackUpTo, secs);
+        stopServer(server, false);
+        if (!ok)
+            return false;
+        printf("  replayed after a restart on %-5s %8.0f chats/s, %6.1f MB/s\n", run.engine, chats / secs, mb / secs);
+    }
+
+    double secs;
+    if (!startServer(server, binary, port, "epoll", storeDir))
+        return false;
+    bool ok = receiveHeld(port, chats / 2 + 1, chats, 0, secs);
+    stopServer(server, false);
+    if (ok)
+        printf("  after ACKing the first half, only the second half came back\n");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8099;
+    unsigned frames = argc > 3 ? atoi(argv[3]) : 2000000;
+
+    char dirTemplate[] = "/tmp/storebench.XXXXXX";
+    if (!mkdtemp(dirTemplate))
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    string dir = dirTemplate;
+    bool ok = appendSpeed(dir, frames) && crashRecovery(dir) && offlineDelivery(server, port, dir, frames / 20);
+    removeStore(dir);
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,136 @@
+//Timer throughput: schedules N timeouts, cancels half of them (like ACKs arriving) and
+//runs the clock until the rest fire, on the timing wheel and on a std::multimap.
+//Checks first that the wheel fires every timer on exactly its tick.
+//Usage: timerbench [timers] [max delay ticks]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+#include "../Common/timingwheel.h"
+
+using namespace std;
+
+static double seconds(chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+}
+
+//Random schedule/cancel/advance mix checked against the expiry each timer was given
+static bool selfCheck()
+{
+    mt19937_64 rng(1);
+    TimingWheel wheel(1000);
+    uint64_t now = 1000;
+    vector<uint64_t> expires;
+    vector<TimingWheel::Handle> handles;
+    vector<bool> done;
+    long wrong = 0;
+    auto fire = [&](uint64_t id) {
+        if (done[id] || expires[id] != wheel.now())
+            wrong++;
+        done[id] = true;
+    };
+    for (int step = 0; step < 300000; step++)
+    {
+        unsigned op = rng() % 10;
+        if (op < 6)
+        {
+            //mostly short timeouts, some far enough out to need several cascades
+            uint64_t delay = 1 + (rng() % 4 == 0 ? rng() % 20000000 : rng() % 300);
+            expires.push_back(now + delay);
+            done.push_back(false);
+            handles.push_back(wheel.schedule(now + delay, expires.size() - 1));
+        }
+        else if (op < 8 && !handles.empty())
+        {
+            size_t id = rng() % handles.size();
+            if (wheel.cancel(handles[id]) == done[id])
+                wrong++;
+            done[id] = true;
+        }
+        else
+        {
+            now += rng() % 64;
+            wheel.advance(now, fire);
+        }
+    }
+    wheel.advance(now + 30000000, fire);
+    for (bool d : done)
+        if (!d)
+            wrong++;
+    if (wrong != 0 || wheel.size() != 0)
+    {
+        fprintf(stderr, "FAILED: %ld timers fired early, late, twice or never\n", wrong);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? atol(argv[1]) : 2000000;
+    uint64_t maxDelay = argc > 2 ? atol(argv[2]) : 30000;
+
+    if (!selfCheck())
+        return EXIT_FAILURE;
+
+    mt19937_64 rng(7);
+    vector<uint64_t> delays(count);
+    for (auto &delay : delays)
+        delay = 1 + rng() % maxDelay;
+
+    printf("%zu timers, delays up to %llu ticks, half cancelled\n", count, (unsigned long long)maxDelay);
+    printf("%-16s %14s %14s %14s %14s\n", "", "schedule/sec", "cancel/sec", "fire/sec", "total ops/sec");
+
+    {
+        TimingWheel wheel(0);
+        vector<TimingWheel::Handle> handles(count);
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++)
+            handles[i] = wheel.schedule(delays[i], i);
+        double scheduleSecs = seconds(start);
+
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i += 2)
+            wheel.cancel(handles[i]);
+        double cancelSecs = seconds(start);
+
+        size_t fired = 0;
+        start = chrono::steady_clock::now();
+        wheel.advance(maxDelay, [&](uint64_t) { fired++; });
+        double fireSecs = seconds(start);
+
+        printf("%-16s %14.0f %14.0f %14.0f %14.0f\n", "timing wheel", count / scheduleSecs, count / 2 / cancelSecs,
+               fired / fireSecs, (count + count / 2 + fired) / (scheduleSecs + cancelSecs + fireSecs));
+    }
+
+    {
+        multimap<uint64_t, size_t> timers;
+        vector<multimap<uint64_t, size_t>::iterator> handles(count);
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++)
+            handles[i] = timers.emplace(delays[i], i);
+        double scheduleSecs = seconds(start);
+
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i += 2)
+            timers.erase(handles[i]);
+        double cancelSecs = seconds(start);
+
+        size_t fired = 0;
+        start = chrono::steady_clock::now();
+        while (!timers.empty())
+        {
+            fired++;
+            timers.erase(timers.begin());
+        }
+        double fireSecs = seconds(start);
+
+        printf("%-16s %14.0f %14.0f %14.0f %14.0f\n", "std::multimap", count / scheduleSecs, count / 2 / cancelSecs,
+               fired / fireSecs, (count + count / 2 + fired) / (scheduleSecs + cancelSecs + fireSecs));
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+//I/O engine comparison: clients keep a window of chats in flight to NetworkServer, which
+//ACKs every one of them, once on the epoll engine and once on io_uring. Reports chats
+//per second and the server's own count of syscalls per chat, read from the I/O line it
+//prints on shutdown.
+//Usage: uringbench [server binary] [port] [clients] [window] [seconds]
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+
+using namespace std;
+
+struct Client {
+    int fd;
+    uint16_t id;        //its own client id, the server pins a connection to one
+    uint32_t sent;
+    FrameDecoder decoder;
+};
+
+struct Result {
+    uint64_t acked = 0;
+    uint64_t syscalls = 0;
+    uint64_t framesIn = 0;
+    bool uring = false;     //the server really ran on io_uring rather than falling back
+};
+
+static bool connectTo(unsigned short port, int &fd)
+{
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+static void sendChat(Client &client)
+{
+    static const char message[] = "io engine benchmark message";
+    MessageHeader header{};
+    header.headerLen = headerWireLen;
+    header.messageType = 3;
+    header.sender_id = client.id;
+    header.receiver_id = 1;
+    header.message_id = ++client.sent;
+    frame_Send(client.fd, header, message, sizeof(message) - 1);
+}
+
+static bool drive(unsigned short port, int clientCount, int window, double seconds, Result &result)
+{
+    vector<Client> clients(clientCount);
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < clientCount; i++)
+    {
+        if (!connectTo(port, clients[i].fd))
+        {
+            perror("connect");
+            return false;
+        }
+        clients[i].id = (uint16_t)(2 + i);
+        clients[i].sent = 0;
+        int on = 1;
+        setsockopt(clients[i].fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(clients[i].fd, F_SETFL, O_NONBLOCK);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+    }
+
+    auto end = chrono::steady_clock::now() + chrono::duration<double>(seconds);
+    for (auto &client : clients)
+        for (int w = 0; w < window; w++)
+            sendChat(client);
+
+    epoll_event events[256];
+    while (chrono::steady_clock::now() < end)
+    {
+        int n = epoll_wait(epfd, events, 256, 100);
+        for (int i = 0; i < n; i++)
+        {
+            Client &client = clients[events[i].data.u32];
+            Frame frame;
+            while (1)
+            {
+                char *space = client.decoder.writePtr();
+                ssize_t got = recv(client.fd, space, client.decoder.writable(), 0);
+                if (got <= 0)
+                    break;
+                client.decoder.commit(got);
+                while (client.decoder.next(frame))
+                {
+                    if (frame.header.messageType != 4)
+                        continue;
+                    result.acked++;
+                    sendChat(client);
+                }
+            }
+        }
+    }
+
+    for (auto &client : clients)
+        close(client.fd);
+    close(epfd);
+    return true;
+}
+
+//Keeps the last few KB of the server's console, where the shutdown summary ends up
+static void drainConsole(int fd, string &tail)
+{
+    char buf[65536];
+    ssize_t got;
+    while ((got = read(fd, buf, sizeof(buf))) > 0)
+    {
+        tail.append(buf, got);
+        if (tail.size() > 16384)
+            tail.erase(0, tail.size() - 8192);
+    }
+}
+
+static bool runWith(const char *server, unsigned short port, const char *engine, int clientCount, int window,
+                    double seconds, Result &result)
+{
+    int console[2], output[2];
+    if (pipe(console) < 0 || pipe(output) < 0)
+        return false;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(console[0], STDIN_FILENO);
+        dup2(output[1], STDOUT_FILENO);
+        dup2(output[1], STDERR_FILENO);
+        close(console[1]);
+        close(output[0]);
+        string portArg = to_string(port);
+        execl(server, server, portArg.c_str(), "1", "nack", "256", "-1", engine, (char *)nullptr);
+        _exit(127);
+    }
+    close(console[0]);
+    close(output[1]);
+    string tail;
+    thread drainer(drainConsole, output[0], ref(tail));
+
+    int probe = -1;
+    for (int tries = 0; tries < 200 && !connectTo(port, probe); tries++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    if (probe < 0)
+    {
+        fprintf(stderr, "server did not start\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        drainer.join();
+        close(output[0]);
+        return false;
+    }
+    close(probe);
+
+    bool ok = drive(port, clientCount, window, seconds, result);
+    close(console[1]);
+    waitpid(pid, nullptr, 0);
+    drainer.join();
+    close(output[0]);
+
+    size_t at = tail.rfind("I/O: ");
+    unsigned long long syscalls = 0, framesIn = 0;
+    if (at == string::npos || sscanf(tail.c_str() + at, "I/O: %llu syscalls for %llu", &syscalls, &framesIn) != 2)
+    {
+        fprintf(stderr, "no I/O summary from the server\n");
+        return false;
+    }
+    result.syscalls = syscalls;
+    result.framesIn = framesIn;
+    result.uring = tail.find("falling back to epoll") == string::npos;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = argc > 1 ? argv[1] : "../NetworkServer/server";
+    unsigned short port = argc > 2 ? (unsigned short)atoi(argv[2]) : 8096;
+    int clientCount = argc > 3 ? atoi(argv[3]) : 32;
+    int window = argc > 4 ? atoi(argv[4]) : 16;
+    double seconds = argc > 5 ? atof(argv[5]) : 3.0;
+
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    printf("%d clients, %d chats in flight each, every chat ACKed\n", clientCount, window);
+    printf("%-10s %12s %14s %16s\n", "engine", "chats/sec", "syscalls/sec", "syscalls/chat");
+    double baseline = 0;
+    for (const char *engine : {"epoll", "uring"})
+    {
+        Result result;
+        if (!runWith(server, port, engine, clientCount, window, seconds, result))
+            return EXIT_FAILURE;
+        string name = engine;
+        if (name == "uring" && !result.uring)
+            name += " (fell back to epoll)";
+        double perChat = result.framesIn ? (double)result.syscalls / result.framesIn : 0.0;
+        printf("%-10s %12.0f %14.0f %16.3f\n", name.c_str(), result.acked / seconds, result.syscalls / seconds, perChat);
+        if (baseline == 0)
+            baseline = result.acked;
+        else if (baseline > 0)
+            printf("%-10s %11.0f%% throughput against epoll\n", "", 100.0 * result.acked / baseline);
+    }
+    return EXIT_SUCCESS;
+}
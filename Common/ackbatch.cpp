@@ -0,0 +1,29 @@
+//Range ACKs: many message ids acknowledged by one frame
+
+#include "ackbatch.h"
+
+bool AckBatch::add(uint32_t messageId)
+{
+    size_t n = ranges.size();
+    if (n > 0 && ranges[n - 1] + 1 == messageId)
+        ranges[n - 1] = messageId;
+    else if (n > 0 && messageId >= ranges[n - 2] && messageId <= ranges[n - 1])
+        return false;   //already waiting, a retransmit
+    else
+    {
+        ranges.push_back(messageId);
+        ranges.push_back(messageId);
+    }
+    ids++;
+    return ids >= maxIds || ranges.size() / 2 >= maxRanges;
+}
+
+size_t AckBatch::encode(uint8_t *out)
+{
+    size_t len = wireLen();
+    for (size_t i = 0; i < ranges.size(); i++)
+        wire_Store32(out + i * 4, ranges[i]);
+    ranges.clear();
+    ids = 0;
+    return len;
+}
@@ -0,0 +1,63 @@
+//Range ACKs: many message ids acknowledged by one frame
+
+#ifndef ACKBATCH_H
+#define ACKBATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "message.h"
+
+//A range ACK (type 9) payload is a list of (first, last) message id pairs, each a
+//big endian uint32, acknowledging first..last inclusive.
+constexpr size_t ackRangeWireLen = 8;
+
+inline size_t ackRange_Count(size_t payloadLen)
+{
+    return payloadLen / ackRangeWireLen;
+}
+
+inline void ackRange_Load(const char *payload, size_t index, uint32_t &first, uint32_t &last)
+{
+    const uint8_t *p = (const uint8_t *)payload + index * ackRangeWireLen;
+    first = wire_Load32(p);
+    last = wire_Load32(p + 4);
+}
+
+//How many message ids a range ACK payload acknowledges in total
+inline uint64_t ackRange_Ids(const char *payload, size_t payloadLen)
+{
+    uint64_t ids = 0;
+    for (size_t i = 0; i < ackRange_Count(payloadLen); i++)
+    {
+        uint32_t first, last;
+        ackRange_Load(payload, i, first, last);
+        ids += (uint64_t)(last - first) + 1;
+    }
+    return ids;
+}
+
+//Message ids waiting to be acknowledged on one connection. Consecutive ids, the
+//normal case with monotonic ids, collapse into a single range.
+class AckBatch {
+public:
+    //flush once this many ids are waiting, or a frame's worth of ranges
+    static const size_t maxIds = 64;
+    static const size_t maxRanges = 64;
+
+    //true once the batch is full and should be sent
+    bool add(uint32_t messageId);
+    bool empty() const { return ids == 0; }
+    size_t pending() const { return ids; }
+
+    //bytes encode() writes for the current batch
+    size_t wireLen() const { return ranges.size() / 2 * ackRangeWireLen; }
+    //writes the ranges as a type 9 payload and empties the batch
+    size_t encode(uint8_t *out);
+
+private:
+    std::vector<uint32_t> ranges;   //first, last, first, last...
+    size_t ids = 0;
+};
+
+#endif
@@ -0,0 +1,65 @@
+//Bump allocator for memory that only has to last until the next reset
+
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+using namespace std;
+
+Arena::~Arena()
+{
+    for (uint8_t *spent : full)
+        free(spent);
+    free(block);
+}
+
+void *Arena::grow(size_t n, size_t align)
+{
+    if (block)
+    {
+        full.push_back(block);
+        fullBytes += capacity;
+    }
+    //at least double what there is, so a burst takes few blocks; the block just retired
+    //is in fullBytes already
+    capacity = max(max(blockBytes, n + align), fullBytes * 2);
+    block = (uint8_t *)malloc(capacity);
+    if (!block)
+        throw bad_alloc();
+    allocations++;
+    used = 0;
+    return alloc(n, align);
+}
+
+string_view Arena::copy(string_view text)
+{
+    char *to = (char *)alloc(text.size(), 1);
+    memcpy(to, text.data(), text.size());
+    return string_view(to, text.size());
+}
+
+void Arena::reset()
+{
+    used = 0;
+    if (full.empty() && capacity <= keptBytes)
+        return;
+    //one block the size of them all, allocated when it is next needed, unless that is
+    //more than is worth keeping between batches
+    size_t total = fullBytes + capacity;
+    for (uint8_t *spent : full)
+        free(spent);
+    full.clear();
+    fullBytes = 0;
+    free(block);
+    block = nullptr;
+    capacity = 0;
+    blockBytes = min(max(blockBytes, total), keptBytes);
+}
+
+size_t Arena::reserved() const
+{
+    return fullBytes + capacity;
+}
@@ -0,0 +1,60 @@
+//Bump allocator for memory that only has to last until the next reset
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+//Hands out memory by moving a pointer through a block, and frees all of it at once
+//with reset(). The first allocation gets the first block. Running out of room starts
+//a bigger one; the next reset() frees them all for a single block as big as they
+//were together, so once an arena has seen its usual load it never allocates again.
+//That block stays at most maxKeptBytes (or the first block size if bigger): a batch
+//that needed more, say one huge payload, gets its memory back on reset() rather than
+//pinning it for good. Nothing is destroyed, only for trivially destructible things.
+//Not thread safe.
+class Arena {
+public:
+    static const size_t maxKeptBytes = 64 * 1024;
+
+    explicit Arena(size_t blockBytes = 1024)
+        : blockBytes(blockBytes), keptBytes(blockBytes > maxKeptBytes ? blockBytes : maxKeptBytes) {}
+    ~Arena();
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    //n bytes aligned to align, a power of two
+    void *alloc(size_t n, size_t align = alignof(std::max_align_t))
+    {
+        size_t at = (used + align - 1) & ~(align - 1);
+        //no block yet: even zero bytes need somewhere real to point
+        if (at + n > capacity || !block)
+            return grow(n, align);
+        used = at + n;
+        return block + at;
+    }
+
+    std::string_view copy(std::string_view text);
+    void reset();
+
+    //bytes in blocks right now, and how many times a block was allocated
+    size_t reserved() const;
+    uint64_t blockAllocations() const { return allocations; }
+
+private:
+    void *grow(size_t n, size_t align);
+
+    size_t blockBytes;
+    size_t keptBytes;                 //most blockBytes grows to, and most reset() keeps
+    uint8_t *block = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    std::vector<uint8_t *> full;      //earlier blocks, freed on reset()
+    size_t fullBytes = 0;
+    uint64_t allocations = 0;
+};
+
+#endif
@@ -0,0 +1,214 @@
+//Frame integrity check: CRC32C folded into the header's 16-bit checksum field
+
+#include "checksum.h"
+
+#include <cstring>
+#include "message.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define CRC32C_X86 1
+#endif
+
+//reflected Castagnoli polynomial
+static const uint32_t crcPoly = 0x82F63B78;
+
+struct CrcTables {
+    uint32_t t[8][256];
+};
+
+//t[0] is the classic byte table, t[k] advances a byte seen k positions earlier
+static constexpr CrcTables makeTables()
+{
+    CrcTables tables{};
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (crcPoly & (0 - (crc & 1)));
+        tables.t[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (int k = 1; k < 8; k++)
+            tables.t[k][i] = (tables.t[k - 1][i] >> 8) ^ tables.t[0][tables.t[k - 1][i] & 0xff];
+    return tables;
+}
+
+static constexpr CrcTables crcTables = makeTables();
+
+uint32_t crc32c_Portable(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    const auto &t = crcTables.t;
+    crc = ~crc;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    //slicing-by-8: eight table lookups per 64-bit word instead of a dependent chain per byte
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^
+              t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+              t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^
+              t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+#ifdef CRC32C_X86
+//Multiplication modulo the polynomial in the reflected domain, x^0 being the top bit
+static constexpr uint32_t multModP(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31, product = 0;
+    while (m)
+    {
+        if (a & m)
+            product ^= b;
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ crcPoly : b >> 1;
+    }
+    return product;
+}
+
+static constexpr uint32_t xPowModP(uint64_t n)
+{
+    uint32_t result = 1u << 31, x = 1u << 30;
+    while (n)
+    {
+        if (n & 1)
+            result = multModP(result, x);
+        x = multModP(x, x);
+        n >>= 1;
+    }
+    return result;
+}
+
+//Lane sizes for the interleaved kernel and the constants that shift a lane's CRC
+//past the bytes that follow it: a carry-less multiply by x^(8n-33) mod P, with the
+//crc32 instruction doing the final reduction
+static const size_t laneLong = 1024;
+static const size_t laneShort = 128;
+static constexpr uint32_t kLong1 = xPowModP(8 * laneLong - 33);
+static constexpr uint32_t kLong2 = xPowModP(16 * laneLong - 33);
+static constexpr uint32_t kShort1 = xPowModP(8 * laneShort - 33);
+static constexpr uint32_t kShort2 = xPowModP(16 * laneShort - 33);
+
+static const bool haveClmul = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.2");
+}();
+
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t crcShift(uint32_t crc, uint32_t k)
+{
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc), _mm_cvtsi32_si128(k), 0);
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product));
+}
+
+//crc32 has a 3 cycle latency but issues every cycle, so three independent chains
+//over adjacent lanes keep it busy; the lanes are merged with crcShift()
+__attribute__((target("sse4.2,pclmul")))
+static uint64_t crcInterleaved(uint64_t crc, const uint8_t *&p, size_t &len, size_t lane, uint32_t k1, uint32_t k2)
+{
+    while (len >= 3 * lane)
+    {
+        uint64_t c0 = crc, c1 = 0, c2 = 0;
+        for (size_t i = 0; i < lane; i += 8)
+        {
+            uint64_t w0, w1, w2;
+            memcpy(&w0, p + i, 8);
+            memcpy(&w1, p + lane + i, 8);
+            memcpy(&w2, p + 2 * lane + i, 8);
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+        }
+        crc = crcShift((uint32_t)c0, k2) ^ crcShift((uint32_t)c1, k1) ^ (uint32_t)c2;
+        p += 3 * lane;
+        len -= 3 * lane;
+    }
+    return crc;
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_Hardware(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+#ifdef __x86_64__
+    uint64_t crc64 = ~crc;
+    if (haveClmul)
+    {
+        crc64 = crcInterleaved(crc64, p, len, laneLong, kLong1, kLong2);
+        crc64 = crcInterleaved(crc64, p, len, laneShort, kShort1, kShort2);
+    }
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    uint32_t crc32 = (uint32_t)crc64;
+#else
+    uint32_t crc32 = ~crc;
+#endif
+    while (len >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc32 = _mm_crc32_u32(crc32, word);
+        p += 4;
+        len -= 4;
+    }
+    while (len--)
+        crc32 = _mm_crc32_u8(crc32, *p++);
+    return ~crc32;
+}
+
+bool crc32c_HardwareAvailable()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#else
+uint32_t crc32c_Hardware(uint32_t crc, const void *data, size_t len)
+{
+    return crc32c_Portable(crc, data, len);
+}
+
+bool crc32c_HardwareAvailable()
+{
+    return false;
+}
+#endif
+
+//picked once at startup
+static uint32_t (*const crcImpl)(uint32_t, const void *, size_t) =
+    crc32c_HardwareAvailable() ? crc32c_Hardware : crc32c_Portable;
+
+uint32_t crc32c_Update(uint32_t crc, const void *data, size_t len)
+{
+    return crcImpl(crc, data, len);
+}
+
+uint16_t checkSum_Gen(const uint8_t *wireHeader, const char *payload, size_t len)
+{
+    uint32_t crc = crc32c_Update(0, wireHeader, offsetof(WireHeader, checksum));
+    crc = crc32c_Update(crc, payload, len);
+    return (uint16_t)(crc ^ (crc >> 16));
+}
+
+bool checkSum_Check(const uint8_t *wireHeader, const char *payload, size_t len)
+{
+    return checkSum_Gen(wireHeader, payload, len) == wire_Load16(wireHeader + offsetof(WireHeader, checksum));
+}
@@ -0,0 +1,27 @@
+//Frame integrity check: CRC32C folded into the header's 16-bit checksum field
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+//CRC32C (Castagnoli) continued from crc; start with 0. Uses the SSE4.2 crc32
+//instruction when the CPU has it (checked once at startup), three lanes at a
+//time merged with PCLMUL where that is available too, otherwise a slicing-by-8
+//table implementation.
+uint32_t crc32c_Update(uint32_t crc, const void *data, size_t len);
+
+//The two implementations behind crc32c_Update, exposed for the benchmark
+uint32_t crc32c_Portable(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_Hardware(uint32_t crc, const void *data, size_t len);
+bool crc32c_HardwareAvailable();
+
+//A frame's checksum covers the encoded header up to the checksum field and the
+//payload. wireHeader points at the headerWireLen encoded bytes.
+uint16_t checkSum_Gen(const uint8_t *wireHeader, const char *payload, size_t len);
+
+//Compares against the checksum stored in the encoded header
+bool checkSum_Check(const uint8_t *wireHeader, const char *payload, size_t len);
+
+#endif
@@ -0,0 +1,231 @@
+//Chat payload compression: LZ77 sequences primed with a dictionary of chat text
+
+#include "compress.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+//Words and phrases chats are made of. Both ends must have exactly these bytes: any
+//change needs a new format number, and a new compressFeature for the handshake.
+static const char chatDictionary[] =
+    "http://https://www..com/.org/.html?id=&amp; the and that have for not with you this but "
+    "his from they say her she will one all would there their what out about who get which "
+    "when make can like time just him know take people into year your good some could them "
+    "see other than then now look only come its over think also back after use two how our "
+    "work first well way even new want because any these give day most us is are was were "
+    "been has had did does doing going gonna wanna yeah yes no nope ok okay sure thanks "
+    "thank you! thx np lol lmao haha hahaha :) :( :D ;) <3 omg btw imo idk tbh brb gtg ttyl "
+    "please sorry hello hi hey there good morning good night see you later tomorrow today "
+    "tonight yesterday this morning this afternoon this evening next week last week weekend "
+    "Monday Tuesday Wednesday Thursday Friday Saturday Sunday meeting call lunch dinner "
+    "coffee let me know what do you think? sounds good, I'm not sure I don't know I think "
+    "we should I'll be there in 5 minutes on my way running late just a sec one moment "
+    "can you send me the link? did you see the message? have you got a minute? "
+    "what time works for you? How are you doing? I'm doing well, how about you? "
+    "The server is down again, can someone take a look? It works on my machine. "
+    "error: failed to connect: connection refused\n"
+    "warning: deprecated, use instead\n"
+    "Traceback (most recent call last):\n  File \"\", line , in \n"
+    "    at java.lang.Thread.run(Thread.java:)\n"
+    "INFO DEBUG WARN ERROR [main] 2024-01-01T00:00:00.000Z "
+    "{\"id\": , \"name\": \"\", \"type\": \"\", \"status\": \"ok\", \"message\": \"\"}\n"
+    "#include <std::string std::vector const auto return nullptr; } else { if (i = 0; i < ; i++)\n"
+    "https://github.com/ https://www.google.com/search?q= https://www.youtube.com/watch?v=";
+
+static const size_t dictionaryLen = sizeof(chatDictionary) - 1;
+
+static const size_t minMatch = 4;
+static const size_t maxOffset = 65535;
+static const unsigned hashBits = 12;
+static const size_t formatHeaderLen = 5;
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash4(const uint8_t *p)
+{
+    return (load32(p) * 2654435761u) >> (32 - hashBits);
+}
+
+//Where each 4 bytes of the dictionary were last seen, the starting table for every
+//chat compressed with it
+struct DictionaryTable {
+    uint32_t at[1 << hashBits];
+    DictionaryTable()
+    {
+        memset(at, 0, sizeof(at));
+        for (size_t i = 0; i + minMatch <= dictionaryLen; i++)
+            at[hash4((const uint8_t *)chatDictionary + i)] = (uint32_t)i;
+    }
+};
+
+static void putLength(string &out, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        out += (char)255;
+    out += (char)len;
+}
+
+//One sequence: literals, then a match of matchLen at offset (none for the last one)
+static void putSequence(string &out, const uint8_t *literals, size_t literalLen, size_t matchLen, size_t offset)
+{
+    size_t matchCode = matchLen ? matchLen - minMatch : 0;
+    out += (char)((min<size_t>(literalLen, 15) << 4) | min<size_t>(matchCode, 15));
+    if (literalLen >= 15)
+        putLength(out, literalLen - 15);
+    out.append((const char *)literals, literalLen);
+    if (!matchLen)
+        return;
+    out += (char)(offset & 0xff);
+    out += (char)(offset >> 8);
+    if (matchCode >= 15)
+        putLength(out, matchCode - 15);
+}
+
+bool compress_Chat(const char *text, size_t len, string &out, CompressFormat format)
+{
+    if (len > compressMaxBytes || len <= formatHeaderLen)
+        return false;
+
+    //the text follows the dictionary in one window, so matches may start in either
+    static const DictionaryTable dictionaryTable;
+    thread_local vector<uint8_t> window(chatDictionary, chatDictionary + dictionaryLen);
+    thread_local vector<uint32_t> table(1 << hashBits);
+    size_t start = 0;
+    if (format == CompressChatDictionary)
+    {
+        start = dictionaryLen;
+        memcpy(table.data(), dictionaryTable.at, sizeof(dictionaryTable.at));
+    }
+    else
+        fill(table.begin(), table.end(), UINT32_MAX);
+    //the dictionary stays at the front of the window from one call to the next
+    window.resize(dictionaryLen);
+    window.insert(window.end(), (const uint8_t *)text, (const uint8_t *)text + len);
+    const uint8_t *base = window.data() + dictionaryLen - start;
+    size_t end = start + len;
+
+    out.clear();
+    out.reserve(len);
+    out += (char)format;
+    uint8_t lenBytes[4];
+    wire_Store32(lenBytes, (uint32_t)len);
+    out.append((const char *)lenBytes, 4);
+
+    size_t pos = start, anchor = start;
+    while (pos + minMatch <= end)
+    {
+        uint32_t h = hash4(base + pos);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)pos;
+        if (candidate == UINT32_MAX || pos - candidate > maxOffset || load32(base + candidate) != load32(base + pos))
+        {
+            pos++;
+            continue;
+        }
+        size_t matchLen = minMatch;
+        while (pos + matchLen < end && base[candidate + matchLen] == base[pos + matchLen])
+            matchLen++;
+        putSequence(out, base + anchor, pos - anchor, matchLen, pos - candidate);
+        if (out.size() >= len)
+            return false;
+        pos += matchLen;
+        anchor = pos;
+    }
+    putSequence(out, base + anchor, end - anchor, 0, 0);
+    return out.size() < len;
+}
+
+static bool getLength(const uint8_t *&in, const uint8_t *end, size_t &len)
+{
+    uint8_t more;
+    do
+    {
+        if (in == end)
+            return false;
+        more = *in++;
+        len += more;
+    } while (more == 255);
+    return true;
+}
+
+bool compress_TextLen(const char *payload, size_t len, size_t &textLen)
+{
+    const uint8_t *in = (const uint8_t *)payload;
+    if (len < formatHeaderLen || in[0] > CompressChatDictionary)
+        return false;
+    textLen = wire_Load32(in + 1);
+    return textLen <= compressMaxBytes;
+}
+
+bool compress_Expand(const char *payload, size_t len, string &out)
+{
+    size_t textLen;
+    if (!compress_TextLen(payload, len, textLen))
+        return false;
+    out.resize(textLen);
+    return compress_ExpandTo(payload, len, &out[0]);
+}
+
+bool compress_ExpandTo(const char *payload, size_t len, char *out)
+{
+    size_t textLen;
+    if (!compress_TextLen(payload, len, textLen))
+        return false;
+    const uint8_t *in = (const uint8_t *)payload + formatHeaderLen, *end = (const uint8_t *)payload + len;
+    bool dictionary = payload[0] == CompressChatDictionary;
+    uint8_t *text = (uint8_t *)out;
+    size_t pos = 0;
+    while (true)
+    {
+        if (in == end)
+            return false;
+        uint8_t token = *in++;
+        size_t literalLen = token >> 4;
+        if (literalLen == 15 && !getLength(in, end, literalLen))
+            return false;
+        if (literalLen > (size_t)(end - in) || literalLen > textLen - pos)
+            return false;
+        memcpy(text + pos, in, literalLen);
+        in += literalLen;
+        pos += literalLen;
+        if (in == end)
+            return pos == textLen;
+
+        if (end - in < 2)
+            return false;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !getLength(in, end, matchLen))
+            return false;
+        matchLen += minMatch;
+        if (offset == 0 || matchLen > textLen - pos || offset > pos + (dictionary ? dictionaryLen : 0))
+            return false;
+
+        //a match reaching back past the text starts in the dictionary
+        if (offset > pos)
+        {
+            size_t from = dictionaryLen - (offset - pos);
+            size_t n = min(matchLen, offset - pos);
+            memcpy(text + pos, chatDictionary + from, n);
+            pos += n;
+            matchLen -= n;
+        }
+        //a match closer than its length overlaps what it copies, so goes byte by byte
+        uint8_t *to = text + pos;
+        pos += matchLen;
+        if (offset >= matchLen)
+            memcpy(to, to - offset, matchLen);
+        else
+            for (const uint8_t *from = to - offset; matchLen > 0; matchLen--)
+                *to++ = *from++;
+    }
+}
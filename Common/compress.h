@@ -0,0 +1,46 @@
+//Chat payload compression, agreed per connection in the status handshake
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "message.h"
+
+//A client that reads compressed chats says so by putting compressFeature in the payload
+//of its status request (type 1); a server that will send it compressed chats echoes it
+//after the message id in its status response (type 2). Either side may then set
+//compressedFlag on the chats (3 and 8) it sends the other. A peer that never asked is
+//only ever sent plain chats, the server expands them for it.
+const char compressFeature[] = "lz1";
+
+//Below this a chat isn't worth compressing, most of what is left after the dictionary
+//is the 5 byte format header
+const size_t compressMinBytes = 48;
+
+//Largest chat text a compressed payload may expand to. Compression lets a chat longer
+//than a frame's 64 KB through as long as it shrinks to fit one; a receiver that can't
+//take it compressed gets an error back to its sender instead.
+const size_t compressMaxBytes = 1 << 20;
+
+//A compressed payload: format byte, the text's length as a big endian uint32, then the
+//text as LZ77 sequences in the style of LZ4 (a token of literal and match lengths, the
+//literals, a 2 byte match offset) reaching back up to 64 KB. Format 1 starts every
+//payload with a built-in dictionary of common chat text already seen, so even a short
+//chat finds matches; format 0 starts from nothing.
+enum CompressFormat : uint8_t { CompressPlain = 0, CompressChatDictionary = 1 };
+
+//Compresses text into out, replacing what it held. False, with out left undefined, if
+//the result wouldn't be smaller than the text or the text is too long.
+bool compress_Chat(const char *text, size_t len, std::string &out, CompressFormat format = CompressChatDictionary);
+
+//Expands a compressed payload into out. False if it is corrupt or too long.
+bool compress_Expand(const char *payload, size_t len, std::string &out);
+
+//The same in two steps, for callers with their own memory: the text's length, false if
+//the payload can't be one, then the text itself into textLen bytes at out
+bool compress_TextLen(const char *payload, size_t len, size_t &textLen);
+bool compress_ExpandTo(const char *payload, size_t len, char *out);
+
+#endif
@@ -0,0 +1,145 @@
+//Presentation thread that formats and prints lines handed over by network threads
+
+#include "console.h"
+
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+using namespace std;
+
+//lines written per batch at most, so a flood still gets the prompt back now and then
+static const int maxBatch = 1024;
+
+//Writes all of it, resuming short writes
+static void writeAll(int fd, const string &data)
+{
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n > 0)
+            done += n;
+        else if (n < 0 && errno != EINTR)
+            return;
+    }
+}
+
+Console::Console(int out, int err)
+    : outFd(out), errFd(err), stopping(false), sleeping(false), lineCount(0), batchCount(0), stampSecond(0)
+{
+    stampText[0] = '\0';
+}
+
+Console::~Console()
+{
+    stop();
+}
+
+void Console::start()
+{
+    if (!thread.joinable())
+        thread = std::thread(&Console::run, this);
+}
+
+void Console::stop()
+{
+    if (!thread.joinable())
+        return;
+    {
+        lock_guard<mutex> guard(sleepLock);
+        stopping.store(true);
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void Console::setPrompt(string text)
+{
+    prompt = std::move(text);
+}
+
+void Console::print(string text, uint32_t timeStamp, bool error)
+{
+    Line line;
+    line.text = std::move(text);
+    line.timeStamp = timeStamp;
+    line.error = error;
+    queue.push(std::move(line));
+
+    //the consumer sets sleeping before its last look at the queue and we read it after
+    //our push, so at least one of us sees the other
+    if (sleeping.load() && sleeping.exchange(false))
+    {
+        lock_guard<mutex> guard(sleepLock);
+        wake.notify_one();
+    }
+}
+
+//"[2024-01-31 12:00:00]: ", localtime() and strftime() only run when the second changes
+void Console::appendStamp(string &out, uint32_t timeStamp)
+{
+    if (timeStamp != stampSecond || stampText[0] == '\0')
+    {
+        time_t raw = timeStamp;
+        struct tm info;
+        localtime_r(&raw, &info);
+        strftime(stampText, sizeof(stampText), "%Y-%m-%d %H:%M:%S", &info);
+        stampSecond = timeStamp;
+    }
+    out += '[';
+    out += stampText;
+    out += "]: ";
+}
+
+void Console::run()
+{
+    string out, err;
+    Line line;
+    while (1)
+    {
+        int taken = 0;
+        while (taken < maxBatch && queue.pop(line))
+        {
+            string &dest = line.error ? err : out;
+            if (line.timeStamp != 0)
+                appendStamp(dest, line.timeStamp);
+            dest += line.text;
+            dest += '\n';
+            taken++;
+        }
+
+        if (taken > 0)
+        {
+            //the prompt the batch interrupted gets its own line back
+            if (!prompt.empty() && !out.empty())
+                out.insert(0, 1, '\n');
+            writeAll(errFd, err);
+            if (!prompt.empty())
+                out += prompt;
+            writeAll(outFd, out);
+            out.clear();
+            err.clear();
+            lineCount += taken;
+            batchCount++;
+            continue;
+        }
+
+        if (stopping.load())
+            return;
+
+        //nothing left: announce we are going to sleep, then look once more before doing so
+        sleeping.store(true);
+        if (!queue.empty())
+        {
+            sleeping.store(false);
+            continue;
+        }
+        unique_lock<mutex> guard(sleepLock);
+        //print() clears sleeping before notifying, the timeout is only a safety net
+        wake.wait_for(guard, chrono::milliseconds(100), [this]() { return !sleeping.load() || stopping.load(); });
+        sleeping.store(false);
+    }
+}
@@ -0,0 +1,66 @@
+//Presentation thread that formats and prints lines handed over by network threads
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "mpscqueue.h"
+
+//Network threads call print(), which only queues the line on a lock-free MPSC queue.
+//The console's own thread takes whatever has piled up, formats the timestamps (once
+//per second of time, not once per line) and writes the batch with one write() per
+//stream, followed by the prompt if one is set. While idle it sleeps; a producer only
+//pays for waking it when it actually is asleep.
+class Console {
+public:
+    Console(int outFd = 1, int errFd = 2);
+    ~Console();
+    Console(const Console &) = delete;
+    Console &operator=(const Console &) = delete;
+
+    void start();
+    //prints everything still queued, then returns
+    void stop();
+
+    //any thread. A timeStamp (seconds since the epoch) is shown as "[date time]: "
+    //before the text, 0 leaves it out; error lines go to errFd.
+    void print(std::string text, uint32_t timeStamp = 0, bool error = false);
+    //before start(): printed after every batch, e.g. "Enter message: " so it stays
+    //below the output
+    void setPrompt(std::string text);
+
+    uint64_t lines() const { return lineCount.load(); }
+    uint64_t batches() const { return batchCount.load(); }
+
+private:
+    struct Line {
+        std::string text;
+        uint32_t timeStamp = 0;
+        bool error = false;
+    };
+
+    void run();
+    void appendStamp(std::string &out, uint32_t timeStamp);
+
+    MpscQueue<Line> queue;
+    int outFd;
+    int errFd;
+    std::string prompt;
+    std::thread thread;
+    std::atomic<bool> stopping;
+    std::atomic<bool> sleeping;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<uint64_t> lineCount;
+    std::atomic<uint64_t> batchCount;
+
+    uint32_t stampSecond;    //the second stampText was formatted for
+    char stampText[24];
+};
+
+#endif
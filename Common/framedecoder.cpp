@@ -0,0 +1,87 @@
+//Incremental decoder turning a TCP byte stream into MessageHeader frames
+
+#include "framedecoder.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static const size_t initialCapacity = 8192;
+
+FrameDecoder::FrameDecoder()
+    : buff(nullptr), capacity(0), readPos(0), writePos(0), isCorrupt(false)
+{
+}
+
+FrameDecoder::~FrameDecoder()
+{
+    free(buff);
+}
+
+char *FrameDecoder::writePtr(size_t minSpace)
+{
+    if (capacity - writePos >= minSpace)
+        return buff + writePos;
+
+    //reclaim what next() has consumed, only a partial frame is ever left to move
+    size_t unread = writePos - readPos;
+    if (readPos > 0)
+    {
+        memmove(buff, buff + readPos, unread);
+        readPos = 0;
+        writePos = unread;
+    }
+
+    if (capacity - writePos < minSpace)
+    {
+        size_t newCapacity = capacity ? capacity : initialCapacity;
+        while (newCapacity - writePos < minSpace)
+            newCapacity *= 2;
+        char *grown = (char *)realloc(buff, newCapacity);
+        if (!grown)
+            throw std::bad_alloc();
+        buff = grown;
+        capacity = newCapacity;
+    }
+    return buff + writePos;
+}
+
+void FrameDecoder::feed(const char *data, size_t len)
+{
+    memcpy(writePtr(len), data, len);
+    commit(len);
+}
+
+bool FrameDecoder::next(Frame &frame)
+{
+    size_t unread = writePos - readPos;
+    if (isCorrupt || unread < headerWireLen)
+    {
+        //give back memory grown for an oversized frame once it has been drained
+        if (unread == 0 && capacity > initialCapacity)
+        {
+            free(buff);
+            buff = nullptr;
+            capacity = readPos = writePos = 0;
+        }
+        return false;
+    }
+
+    //decoded straight out of the receive buffer, nothing is staged
+    frame.header = header_Decode((const uint8_t *)buff + readPos);
+    if (frame.header.headerLen != headerWireLen)
+    {
+        //no way to find the next frame boundary in a corrupt stream
+        isCorrupt = true;
+        return false;
+    }
+
+    size_t frameLen = frame.header.headerLen + frame.header.payloadLen;
+    if (unread < frameLen)
+        return false;
+
+    frame.wire = (const uint8_t *)buff + readPos;
+    frame.payload = buff + readPos + frame.header.headerLen;
+    readPos += frameLen;
+    return true;
+}
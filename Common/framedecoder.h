@@ -0,0 +1,55 @@
+//Incremental decoder turning a TCP byte stream into MessageHeader frames
+
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "message.h"
+
+//A complete frame. payload points into the decoder's buffer and stays valid
+//until the next call to next(), writePtr() or feed().
+struct Frame {
+    MessageHeader header;
+    const uint8_t *wire;     //the encoded header, for checkSum_Check()
+    const char *payload;
+};
+
+//One per connection. recv() straight into writePtr()/commit() (call writePtr()
+//before writable(), it is what makes the space), then pull frames
+//with next() until it returns false. Frames may arrive split across reads or
+//several to a read; a frame is only handed out once all of it is buffered.
+//
+//Consumed bytes are reclaimed by sliding the unread tail (at most one partial
+//frame) to the front rather than wrapping, so every frame is contiguous and can
+//be viewed in place. A buffer grown past its initial 8 KB for a large frame is
+//released again once drained.
+class FrameDecoder {
+public:
+    FrameDecoder();
+    ~FrameDecoder();
+    FrameDecoder(const FrameDecoder &) = delete;
+    FrameDecoder &operator=(const FrameDecoder &) = delete;
+
+    char *writePtr(size_t minSpace = 2048);
+    size_t writable() const { return capacity - writePos; }
+    void commit(size_t len) { writePos += len; }
+    void feed(const char *data, size_t len);
+
+    bool next(Frame &frame);
+    //gives back the frame next() just returned, to be returned again by the next call
+    void unread(const Frame &frame) { readPos -= frame.header.headerLen + frame.header.payloadLen; }
+
+    //set once the stream can't be framed any more (bad header length)
+    bool corrupt() const { return isCorrupt; }
+    size_t buffered() const { return writePos - readPos; }
+
+private:
+    char *buff;
+    size_t capacity;
+    size_t readPos;
+    size_t writePos;
+    bool isCorrupt;
+};
+
+#endif
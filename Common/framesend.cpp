@@ -0,0 +1,119 @@
+//Scatter-gather frame sending shared by the servers, the client and their tools
+
+#include "framesend.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include "checksum.h"
+
+//payloads up to this size are staged on the stack and sent with plain send()
+static const size_t smallFrameLen = 1024;
+
+static bool waitWritable(int sockfd)
+{
+    struct pollfd pfd = {sockfd, POLLOUT, 0};
+    return poll(&pfd, 1, 1000) >= 0 || errno == EINTR;
+}
+
+static bool sendAll(int sockfd, const uint8_t *data, size_t len)
+{
+    size_t sent = 0;
+    while (sent < len)
+    {
+        ssize_t outBytes = send(sockfd, data + sent, len - sent, MSG_NOSIGNAL);
+        if (outBytes > 0)
+            sent += outBytes;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            waitWritable(sockfd);
+        else if (errno != EINTR)
+            return false;
+    }
+    return true;
+}
+
+size_t frame_Encode(MessageHeader header, const char *payload, size_t len, uint8_t *out)
+{
+    if (len > UINT16_MAX)
+        return 0;
+    header.payloadLen = (uint16_t)len;
+    header_Encode(header, out);
+    memcpy(out + headerWireLen, payload, len);
+    wire_Store16(out + offsetof(WireHeader, checksum), checkSum_Gen(out, payload, len));
+    return headerWireLen + len;
+}
+
+bool frame_Send(int sockfd, MessageHeader header, const char *payload, size_t len)
+{
+    if (len > UINT16_MAX)
+    {
+        errno = EMSGSIZE;
+        return false;
+    }
+    header.payloadLen = (uint16_t)len;
+
+    //small frames: one contiguous stack copy is cheaper than the kernel walking an iovec
+    if (len <= smallFrameLen)
+    {
+        uint8_t frame[headerWireLen + smallFrameLen];
+        return sendAll(sockfd, frame, frame_Encode(header, payload, len, frame));
+    }
+
+    uint8_t wire[headerWireLen];
+    header_Encode(header, wire);
+    wire_Store16(wire + offsetof(WireHeader, checksum), checkSum_Gen(wire, payload, len));
+
+    struct iovec iov[2];
+    iov[0].iov_base = wire;
+    iov[0].iov_len = headerWireLen;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = len;
+
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    while (msg.msg_iovlen > 0)
+    {
+        ssize_t outBytes = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (outBytes < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                waitWritable(sockfd);
+                continue;
+            }
+            return false;
+        }
+
+        //skip what went out and resume from the middle of the frame
+        size_t done = outBytes;
+        while (msg.msg_iovlen > 0 && done >= msg.msg_iov->iov_len)
+        {
+            done -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + done;
+            msg.msg_iov->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+bool frame_Forward(int sockfd, const Frame &frame)
+{
+    return sendAll(sockfd, frame.wire, headerWireLen + frame.header.payloadLen);
+}
+
+bool frame_SendWire(int sockfd, const uint8_t *wire, size_t len)
+{
+    return sendAll(sockfd, wire, len);
+}
@@ -0,0 +1,32 @@
+//Scatter-gather frame sending shared by the servers, the client and their tools
+
+#ifndef FRAMESEND_H
+#define FRAMESEND_H
+
+#include <cstddef>
+#include "message.h"
+#include "framedecoder.h"
+
+//Sends one frame without touching the heap. Large payloads go out with sendmsg()
+//straight from the caller's memory next to the header encoded on the stack; small
+//ones (up to 1 KB) are cheaper copied behind the header into a stack buffer and
+//sent with one send(). Short writes are resumed and a full send
+//buffer on a non-blocking socket is waited out with poll(). header.payloadLen
+//is taken from len and the checksum is always computed here, whatever
+//header.checksum holds. Returns false if the payload doesn't fit a frame or the
+//socket failed.
+bool frame_Send(int sockfd, MessageHeader header, const char *payload, size_t len);
+
+//Encodes a whole frame into out, which must hold headerWireLen + len bytes, with
+//payloadLen and the checksum filled in. For callers that queue frames rather than
+//send them. Returns the frame length, 0 if the payload doesn't fit a frame.
+size_t frame_Encode(MessageHeader header, const char *payload, size_t len, uint8_t *out);
+
+//Relays a received frame exactly as it arrived (header, checksum and payload
+//are contiguous in the decoder's buffer), with the same short write handling
+bool frame_Forward(int sockfd, const Frame &frame);
+
+//Sends already encoded frame bytes, e.g. a forwarded frame copied between threads
+bool frame_SendWire(int sockfd, const uint8_t *wire, size_t len);
+
+#endif
@@ -0,0 +1,74 @@
+//HDR-style latency histogram with a fixed relative error
+
+#include "histogram.h"
+
+using namespace std;
+
+Histogram::Histogram()
+{
+    clear();
+}
+
+void Histogram::clear()
+{
+    for (auto &c : counts)
+        c.store(0, memory_order_relaxed);
+    total.store(0, memory_order_relaxed);
+    sum.store(0, memory_order_relaxed);
+    maxSeen.store(0, memory_order_relaxed);
+}
+
+void Histogram::merge(const Histogram &other)
+{
+    for (size_t i = 0; i < bucketCount; i++)
+    {
+        uint64_t n = other.counts[i].load(memory_order_relaxed);
+        if (n)
+            bump(counts[i], n);
+    }
+    bump(total, other.total.load(memory_order_relaxed));
+    bump(sum, other.sum.load(memory_order_relaxed));
+    if (other.max() > max())
+        maxSeen.store(other.max(), memory_order_relaxed);
+}
+
+double Histogram::mean() const
+{
+    uint64_t n = count();
+    return n ? (double)sum.load(memory_order_relaxed) / n : 0;
+}
+
+uint64_t Histogram::valueOf(size_t bucket)
+{
+    if (bucket < (1u << subBits))
+        return bucket;
+    int shift = (int)(bucket >> subBits) - 1;
+    uint64_t low = ((uint64_t)(bucket & ((1u << subBits) - 1)) + (1u << subBits)) << shift;
+    return low + ((uint64_t)1 << shift) / 2;
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+    //counts are read once each, so a histogram still being recorded into gives a
+    //slightly stale answer rather than a wrong one
+    uint64_t seen[bucketCount];
+    uint64_t n = 0;
+    for (size_t i = 0; i < bucketCount; i++)
+        n += seen[i] = counts[i].load(memory_order_relaxed);
+    if (n == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p * n);
+    if (rank >= n)
+        rank = n - 1;
+    uint64_t below = 0;
+    for (size_t i = 0; i < bucketCount; i++)
+    {
+        below += seen[i];
+        if (below > rank)
+        {
+            uint64_t v = valueOf(i);
+            return v < max() ? v : max();
+        }
+    }
+    return max();
+}
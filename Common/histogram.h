@@ -0,0 +1,71 @@
+//HDR-style latency histogram with a fixed relative error
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//Values (ns, or any unit) fall into log-linear buckets: 32 per power of two, so a
+//bucket is never wider than 1/32 (3%) of the values in it, from 0 up to 2^40 (about
+//18 minutes in ns); larger values count as 2^40. record() is a handful of
+//instructions and no locked ones: one thread records, any thread may read, and
+//readers add histograms up with merge() into one of their own.
+class Histogram {
+public:
+    static const int subBits = 5;
+    static const int maxBits = 40;
+    static const size_t bucketCount = (size_t)(maxBits - subBits + 1) << subBits;
+
+    Histogram();
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+    //recording thread only
+    void record(uint64_t value)
+    {
+        bump(counts[bucketOf(value)], 1);
+        bump(total, 1);
+        bump(sum, value);
+        if (value > maxSeen.load(std::memory_order_relaxed))
+            maxSeen.store(value, std::memory_order_relaxed);
+    }
+
+    //adds other's counts into this one, which must not be recorded into meanwhile
+    void merge(const Histogram &other);
+    void clear();
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return maxSeen.load(std::memory_order_relaxed); }
+    double mean() const;
+    //value below which the fraction p (0..1) of recorded values fall, to within a bucket
+    uint64_t percentile(double p) const;
+
+    static size_t bucketOf(uint64_t value)
+    {
+        if (value < (1u << subBits))
+            return value;
+        int msb = 63 - __builtin_clzll(value);
+        if (msb >= maxBits)
+            return bucketCount - 1;
+        int shift = msb - subBits;
+        return ((size_t)(shift + 1) << subBits) + (value >> shift) - (1u << subBits);
+    }
+    //the middle of what a bucket holds
+    static uint64_t valueOf(size_t bucket);
+
+private:
+    //single writer, so a plain load and store instead of an atomic add
+    static void bump(std::atomic<uint64_t> &counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> counts[bucketCount];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> maxSeen;
+};
+
+#endif
@@ -0,0 +1,44 @@
+//Scrollback queries: which stored chats a history request (type 11) asks for
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include "message.h"
+
+//A history request asks the server for the chats between its sender and peer, either
+//way, whose header timeStamp is in from..to inclusive: the last limit of them, sent
+//back oldest first in history replies (type 12). from 0 and to UINT32_MAX ask for the
+//last limit chats of all. On the wire: peer, from, to, limit, big endian.
+struct HistoryQuery {
+    uint16_t peer;
+    uint32_t from;
+    uint32_t to;
+    uint16_t limit;
+};
+
+constexpr size_t historyQueryWireLen = 12;
+
+inline void historyQuery_Encode(const HistoryQuery &query, uint8_t *out)
+{
+    wire_Store16(out, query.peer);
+    wire_Store32(out + 2, query.from);
+    wire_Store32(out + 6, query.to);
+    wire_Store16(out + 10, query.limit);
+}
+
+//false if the payload is too short to be a query
+inline bool historyQuery_Decode(const char *payload, size_t len, HistoryQuery &query)
+{
+    if (len < historyQueryWireLen)
+        return false;
+    const uint8_t *p = (const uint8_t *)payload;
+    query.peer = wire_Load16(p);
+    query.from = wire_Load32(p + 2);
+    query.to = wire_Load32(p + 6);
+    query.limit = wire_Load16(p + 10);
+    return true;
+}
+
+#endif
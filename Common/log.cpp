@@ -0,0 +1,443 @@
+//Asynchronous logging: compile-time levels, per-thread rings, formatting on a writer thread
+
+#include "log.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//Bytes logged by one thread and not written out yet. Only its thread writes records in,
+//only the writer takes them out; head and tail count bytes ever, so they never wrap.
+struct LogRing {
+    static const size_t capacity = 1 << 18;
+
+    alignas(64) atomic<uint64_t> head{0};   //published by the logging thread
+    uint64_t cachedTail = 0;                //its last look at tail
+    uint64_t pendingSkip = 0;               //bytes left at the end by the record being written
+    alignas(64) atomic<uint64_t> tail{0};   //advanced by the writer
+    atomic<uint64_t> dropped{0};
+    uint64_t droppedReported = 0;           //writer only
+    atomic<bool> retired{false};            //its thread has exited
+    char data[capacity];
+};
+
+//The thread's ring, retired (and freed by the writer once drained) when the thread exits
+struct ThreadRing {
+    LogRing *ring = nullptr;
+    ~ThreadRing()
+    {
+        if (ring)
+            ring->retired.store(true);
+    }
+};
+
+static thread_local ThreadRing threadRing;
+//the same pointer, plain so the logging path doesn't go through the holder's TLS guard
+static thread_local LogRing *myRing = nullptr;
+
+static void writeAll(int fd, const string &data)
+{
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n > 0)
+            done += n;
+        else if (n < 0 && errno != EINTR)
+            return;
+    }
+}
+
+//Owns the rings and the writer thread
+class Logger {
+public:
+    ~Logger()
+    {
+        stop();
+        //nothing may log once statics are being torn down, so this is the last pass
+        drain();
+    }
+
+    LogRing *addRing()
+    {
+        LogRing *ring = new LogRing();
+        lock_guard<mutex> guard(ringsLock);
+        rings.push_back(ring);
+        return ring;
+    }
+
+    void start(int toFd)
+    {
+        lock_guard<mutex> guard(controlLock);
+        if (thread.joinable())
+            return;
+        fd = toFd;
+        stopping.store(false);
+        thread = std::thread(&Logger::run, this);
+    }
+
+    void stop()
+    {
+        lock_guard<mutex> guard(controlLock);
+        if (!thread.joinable())
+            return;
+        {
+            lock_guard<mutex> sleepGuard(sleepLock);
+            stopping.store(true);
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+    //after a record is published: wakes the writer, only if it's asleep
+    void notify()
+    {
+        if (sleeping.load() && sleeping.exchange(false))
+        {
+            lock_guard<mutex> guard(sleepLock);
+            wake.notify_one();
+        }
+    }
+
+    uint64_t dropped()
+    {
+        lock_guard<mutex> guard(ringsLock);
+        uint64_t total = droppedRetired;
+        for (LogRing *ring : rings)
+            total += ring->dropped.load(memory_order_relaxed);
+        return total;
+    }
+
+private:
+    void run();
+    bool drain();
+    void format(string &out, const LogRecord &record, const char *args);
+    void appendStamp(string &out, uint64_t timeNs);
+
+    int fd = 2;
+    mutex controlLock;
+    std::thread thread;
+    atomic<bool> stopping{false};
+    atomic<bool> sleeping{false};
+    mutex sleepLock;
+    condition_variable wake;
+
+    mutex ringsLock;        //taken when a thread logs for the first time, and once per writer pass
+    vector<LogRing *> rings;
+    uint64_t droppedRetired = 0;
+
+    string out;             //writer only, like everything below
+    vector<LogRing *> draining;   //rings the current pass goes over, kept for its capacity
+    time_t stampSecond = 0; //the second stampText was formatted for
+    char stampText[24] = "";
+};
+
+static Logger logger;
+
+void log_Start(int fd)
+{
+    logger.start(fd);
+}
+
+void log_Stop()
+{
+    logger.stop();
+}
+
+uint64_t log_Dropped()
+{
+    return logger.dropped();
+}
+
+//the coarse clock is a plain read of the kernel's last tick, a few ns instead of ~30;
+//lines only show milliseconds and a tick is at most a few of them
+uint64_t log_NowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+char *log_Reserve(size_t size)
+{
+    LogRing *ring = myRing;
+    if (!ring)
+        ring = myRing = threadRing.ring = logger.addRing();
+    if (size > LogRing::capacity / 2)
+    {
+        ring->dropped.fetch_add(1, memory_order_relaxed);
+        return nullptr;
+    }
+
+    //a record never wraps: if it doesn't fit before the end, the rest of the ring is skipped
+    uint64_t head = ring->head.load(memory_order_relaxed);
+    size_t pos = head & (LogRing::capacity - 1);
+    uint64_t skip = pos + size > LogRing::capacity ? LogRing::capacity - pos : 0;
+    if (head + skip + size - ring->cachedTail > LogRing::capacity)
+    {
+        ring->cachedTail = ring->tail.load(memory_order_acquire);
+        if (head + skip + size - ring->cachedTail > LogRing::capacity)
+        {
+            ring->dropped.fetch_add(1, memory_order_relaxed);
+            return nullptr;
+        }
+    }
+    ring->pendingSkip = skip;
+    if (skip)
+    {
+        uint32_t wrap = 0;
+        memcpy(ring->data + pos, &wrap, sizeof(wrap));
+        return ring->data;
+    }
+    return ring->data + pos;
+}
+
+void log_Commit(size_t size)
+{
+    LogRing *ring = myRing;
+    //seq_cst so the writer either sees this record or is seen to be asleep (see notify())
+    ring->head.store(ring->head.load(memory_order_relaxed) + ring->pendingSkip + size);
+    logger.notify();
+}
+
+static const char *levelNames[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+//the writer writes once this much text is waiting, and reserves twice it up front so
+//formatting never has to grow the buffer
+static const size_t writeBytes = 65536;
+
+//"2024-01-31 12:00:00.123 ", localtime() and strftime() only run when the second changes
+void Logger::appendStamp(string &out, uint64_t timeNs)
+{
+    time_t second = timeNs / 1000000000;
+    if (second != stampSecond || stampText[0] == '\0')
+    {
+        struct tm info;
+        localtime_r(&second, &info);
+        strftime(stampText, sizeof(stampText), "%Y-%m-%d %H:%M:%S", &info);
+        stampSecond = second;
+    }
+    unsigned ms = timeNs / 1000000 % 1000;
+    char frac[6] = {'.', char('0' + ms / 100), char('0' + ms / 10 % 10), char('0' + ms % 10), ' ', '\0'};
+    out += stampText;
+    out += frac;
+}
+
+static void appendf(string &out, const char *spec, ...)
+{
+    char buf[256];
+    va_list ap, copy;
+    va_start(ap, spec);
+    va_copy(copy, ap);
+    int n = vsnprintf(buf, sizeof(buf), spec, ap);
+    va_end(ap);
+    if (n > 0 && (size_t)n < sizeof(buf))
+        out.append(buf, n);
+    else if (n > 0)
+    {
+        size_t at = out.size();
+        out.resize(at + n + 1);
+        vsnprintf(&out[at], n + 1, spec, copy);
+        out.resize(at + n);
+    }
+    va_end(copy);
+}
+
+//Runs printf's conversions against the recorded arguments, each one converted to what
+//the conversion wants whatever its length modifier says
+void Logger::format(string &out, const LogRecord &record, const char *args)
+{
+    appendStamp(out, record.timeNs);
+    out += levelNames[record.level < 4 ? record.level : 3];
+    out += ' ';
+
+    unsigned left = record.argCount;
+    for (const char *f = record.format; *f; f++)
+    {
+        if (*f != '%')
+        {
+            out += *f;
+            continue;
+        }
+        if (f[1] == '%')
+        {
+            out += '%';
+            f++;
+            continue;
+        }
+        //flags, width and precision are kept; length modifiers are dropped
+        char spec[32] = "%";
+        size_t len = 1;
+        const char *c = f + 1;
+        for (; *c && strchr("-+ #0123456789.", *c); c++)
+            if (len < 20)
+                spec[len++] = *c;
+        while (*c && strchr("hlLqjzt", *c))
+            c++;
+        if (!*c)
+            break;
+        char conv = *c;
+        f = c;
+        if (left == 0)
+        {
+            out += "%?";
+            continue;
+        }
+        left--;
+
+        uint8_t tag = *args++;
+        if (tag == LogArgString)
+        {
+            uint32_t n;
+            memcpy(&n, args, 4);
+            string_view text(args + 4, n);
+            args += 4 + n;
+            if (len == 1)
+                out += text;
+            else
+            {
+                memcpy(spec + len, ".*s", 4);
+                appendf(out, spec, (int)n, text.data());
+            }
+            continue;
+        }
+
+        uint64_t bits;
+        memcpy(&bits, args, 8);
+        args += 8;
+        if (tag == LogArgDouble || strchr("fFeEgGaA", conv))
+        {
+            double d;
+            if (tag == LogArgDouble)
+                memcpy(&d, &bits, 8);
+            else
+                d = tag == LogArgInt ? (double)(int64_t)bits : (double)bits;
+            if (!strchr("fFeEgGaA", conv))
+                conv = 'g';
+            spec[len++] = conv;
+            spec[len] = '\0';
+            appendf(out, spec, d);
+        }
+        else if (conv == 'c')
+        {
+            spec[len++] = 'c';
+            spec[len] = '\0';
+            appendf(out, spec, (int)bits);
+        }
+        else
+        {
+            if ((conv == 'd' || conv == 'i') && tag == LogArgUint)
+                conv = 'u';
+            else if (!strchr("diuoxX", conv))
+                conv = tag == LogArgInt ? 'd' : 'u';
+            spec[len++] = 'l';
+            spec[len++] = 'l';
+            spec[len++] = conv;
+            spec[len] = '\0';
+            appendf(out, spec, (long long)bits);
+        }
+    }
+    out += '\n';
+}
+
+//One pass over every ring; true if anything was written
+bool Logger::drain()
+{
+    {
+        lock_guard<mutex> guard(ringsLock);
+        draining.assign(rings.begin(), rings.end());
+    }
+
+    for (LogRing *ring : draining)
+    {
+        bool retired = ring->retired.load();
+        uint64_t tail = ring->tail.load(memory_order_relaxed);
+        uint64_t head = ring->head.load();
+        while (tail != head)
+        {
+            size_t pos = tail & (LogRing::capacity - 1);
+            LogRecord record;
+            memcpy(&record, ring->data + pos, sizeof(record.size));
+            if (record.size == 0)
+            {
+                tail += LogRing::capacity - pos;
+                continue;
+            }
+            memcpy(&record, ring->data + pos, sizeof(record));
+            format(out, record, ring->data + pos + sizeof(record));
+            tail += record.size;
+            if (out.size() > writeBytes)
+            {
+                ring->tail.store(tail, memory_order_release);
+                writeAll(fd, out);
+                out.clear();
+            }
+        }
+        ring->tail.store(tail, memory_order_release);
+
+        uint64_t dropped = ring->dropped.load(memory_order_relaxed);
+        if (dropped != ring->droppedReported)
+        {
+            appendStamp(out, log_NowNs());
+            out += levelNames[LOG_LEVEL_WARN];
+            appendf(out, " Log ring full, %llu line(s) dropped\n", (unsigned long long)(dropped - ring->droppedReported));
+            ring->droppedReported = dropped;
+        }
+
+        //its thread is gone and everything it logged is out
+        if (retired)
+        {
+            lock_guard<mutex> guard(ringsLock);
+            droppedRetired += dropped;
+            for (size_t i = 0; i < rings.size(); i++)
+                if (rings[i] == ring)
+                {
+                    rings.erase(rings.begin() + i);
+                    break;
+                }
+            delete ring;
+        }
+    }
+
+    bool any = !out.empty();
+    writeAll(fd, out);
+    out.clear();
+    return any;
+}
+
+void Logger::run()
+{
+    out.reserve(2 * writeBytes);
+    while (1)
+    {
+        if (drain())
+            continue;
+        if (stopping.load())
+        {
+            drain();
+            return;
+        }
+
+        //nothing new: announce we are going to sleep, then look once more before doing so
+        sleeping.store(true);
+        if (drain())
+        {
+            sleeping.store(false);
+            continue;
+        }
+        unique_lock<mutex> guard(sleepLock);
+        //notify() clears sleeping before waking us, the timeout is only a safety net
+        wake.wait_for(guard, chrono::seconds(1), [this]() { return !sleeping.load() || stopping.load(); });
+        sleeping.store(false);
+    }
+}
@@ -0,0 +1,143 @@
+//Asynchronous logging: compile-time levels, per-thread rings, formatting on a writer thread
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_OFF 4
+
+//Levels below this are compiled out, arguments and all; build with -DLOG_LEVEL=LOG_LEVEL_DEBUG
+//to see every frame, or LOG_LEVEL_OFF for none at all
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+//printf-style format, which must be a string literal: only its address is recorded.
+//Integers, floating point and strings (copied, up to 4 KB) can be passed; the length
+//modifier in the format doesn't matter, %d takes a uint64_t as well as a char.
+#define LOG_AT(level, ...)                    \
+    do                                        \
+    {                                         \
+        if constexpr ((level) >= LOG_LEVEL)   \
+            log_Write((level), __VA_ARGS__);  \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+//Starts the writer thread, lines go to fd (stderr by default). Lines logged before this
+//wait in their thread's ring.
+void log_Start(int fd = 2);
+//Writes out everything logged so far and stops the writer. Also done at exit, even if
+//log_Start() never was.
+void log_Stop();
+//records thrown away because their thread's ring was full
+uint64_t log_Dropped();
+
+//Everything below is what the macros expand to.
+//
+//A call reserves space in the calling thread's ring (a single-producer byte ring the
+//writer thread drains), copies the level, the time, the format's address and the raw
+//arguments in, and publishes it. No formatting, no locks and no system calls happen
+//on the logging thread; the writer turns records into text and writes them in batches.
+//When a ring is full the record is dropped and counted rather than waited for.
+
+enum LogArg : uint8_t { LogArgInt, LogArgUint, LogArgDouble, LogArgString };
+
+struct LogRecord {
+    uint32_t size;          //of the record and its arguments, 8 byte aligned; 0 marks a wrap
+    uint8_t level;
+    uint8_t argCount;
+    uint16_t unused;
+    uint64_t timeNs;        //wall clock
+    const char *format;
+};
+
+static const size_t logMaxString = 4096;
+
+//space for size bytes in this thread's ring, null if it's full
+char *log_Reserve(size_t size);
+void log_Commit(size_t size);
+
+template <typename T>
+inline size_t log_ArgSize(const T &value)
+{
+    if constexpr (std::is_arithmetic_v<T> || std::is_enum_v<T>)
+        return 1 + 8;
+    else
+        return 1 + 4 + std::min(std::string_view(value).size(), logMaxString);
+}
+
+template <typename T>
+inline void log_PutArg(char *&out, const T &value)
+{
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        double d = value;
+        *out++ = LogArgDouble;
+        memcpy(out, &d, 8);
+        out += 8;
+    }
+    else if constexpr (std::is_arithmetic_v<T> || std::is_enum_v<T>)
+    {
+        if constexpr (std::is_enum_v<T> || std::is_signed_v<T>)
+        {
+            int64_t i = (int64_t)value;
+            *out++ = LogArgInt;
+            memcpy(out, &i, 8);
+        }
+        else
+        {
+            uint64_t u = value;
+            *out++ = LogArgUint;
+            memcpy(out, &u, 8);
+        }
+        out += 8;
+    }
+    else
+    {
+        std::string_view text(value);
+        uint32_t len = std::min(text.size(), logMaxString);
+        *out++ = LogArgString;
+        memcpy(out, &len, 4);
+        memcpy(out + 4, text.data(), len);
+        out += 4 + len;
+    }
+}
+
+uint64_t log_NowNs();
+
+template <typename... Args>
+void log_Write(int level, const char *format, const Args &...args)
+{
+    size_t size = (sizeof(LogRecord) + (size_t(0) + ... + log_ArgSize(args)) + 7) & ~size_t(7);
+    char *out = log_Reserve(size);
+    if (!out)
+        return;
+    LogRecord record;
+    record.size = size;
+    record.level = level;
+    record.argCount = sizeof...(args);
+    record.unused = 0;
+    record.timeNs = log_NowNs();
+    record.format = format;
+    memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+    (log_PutArg(out, args), ...);
+    log_Commit(size);
+}
+
+#endif
@@ -0,0 +1,190 @@
+//Message framing shared by the servers, the client and their tools
+//Author: Justin Jeirles
+
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <cstddef>
+#include <cstdint>
+
+//Message types:
+//  1 status request     2 status response    3 chat (receiver_id = client)
+//  4 ACK                5 NACK               6 error
+//  7 room membership: receiver_id = room, payload byte 1 joins, 0 leaves
+//  8 room chat: receiver_id = room, sent to every other member
+//  9 range ACK: payload is binary (first, last) message_id ranges, see ackbatch.h
+// 10 stats: empty to the server, which answers with its metrics as Prometheus text
+// 11 history request: which conversation and how much of it, see history.h
+// 12 history reply: stored chat frames back to back, an empty one ends the reply
+//A chat (3 or 8) with compressedFlag set in messageType carries a compressed payload,
+//see compress.h. message_id counts up per sender and connection, so it identifies what
+//an ACK is for
+
+//A client that wants to survive a dropped connection asks for a session by putting
+//sessionFeature in its status request, and the server answers with sessionFeature, '='
+//and the session's token in hex. Reconnecting, the client puts resumeFeature and that
+//token in its status request instead; if the session is still there the answer carries
+//the same token, and the chats sent to the client that it hadn't ACKed follow it again.
+//A different token means the old session was gone and this is a new one. No token means
+//the client id has a session that hasn't expired, which only its token takes over.
+const char sessionFeature[] = "session";
+const char resumeFeature[] = "resume=";
+
+//The hex token right after feature (e.g. "session=") in a status payload, 0 if none
+inline uint64_t session_Token(const char *payload, size_t len, const char *feature)
+{
+    size_t featureLen = 0;
+    while (feature[featureLen])
+        featureLen++;
+    for (size_t at = 0; at + featureLen <= len; at++)
+    {
+        size_t i = 0;
+        while (i < featureLen && payload[at + i] == feature[i])
+            i++;
+        if (i < featureLen)
+            continue;
+        uint64_t token = 0;
+        for (at += featureLen; at < len && i < featureLen + 16; at++, i++)
+        {
+            char c = payload[at];
+            if (c >= '0' && c <= '9')
+                token = token << 4 | (uint64_t)(c - '0');
+            else if (c >= 'a' && c <= 'f')
+                token = token << 4 | (uint64_t)(c - 'a' + 10);
+            else
+                break;
+        }
+        return token;
+    }
+    return 0;
+}
+
+//Host-side view of a header: natural alignment, host byte order. Never sent as is,
+//use header_Encode()/header_Decode() to go to and from the wire.
+struct MessageHeader {
+    uint8_t headerLen;
+    uint8_t messageType;
+    uint32_t timeStamp;
+    uint16_t sender_id;
+    uint16_t receiver_id;
+    uint32_t message_id;
+    uint16_t payloadLen;
+    uint16_t checksum;
+};
+
+//On the wire the header is packed, 18 bytes, multi-byte fields in network (big endian)
+//byte order, and headerLen always carries headerWireLen. This struct only documents and
+//pins the layout; it is never read or written through.
+struct __attribute__((packed)) WireHeader {
+    uint8_t headerLen;
+    uint8_t messageType;
+    uint32_t timeStamp;
+    uint16_t sender_id;
+    uint16_t receiver_id;
+    uint32_t message_id;
+    uint16_t payloadLen;
+    uint16_t checksum;
+};
+
+constexpr size_t headerWireLen = 18;
+
+static_assert(sizeof(WireHeader) == headerWireLen, "wire header must be 18 bytes");
+static_assert(offsetof(WireHeader, headerLen) == 0, "wire layout changed");
+static_assert(offsetof(WireHeader, messageType) == 1, "wire layout changed");
+static_assert(offsetof(WireHeader, timeStamp) == 2, "wire layout changed");
+static_assert(offsetof(WireHeader, sender_id) == 6, "wire layout changed");
+static_assert(offsetof(WireHeader, receiver_id) == 8, "wire layout changed");
+static_assert(offsetof(WireHeader, message_id) == 10, "wire layout changed");
+static_assert(offsetof(WireHeader, payloadLen) == 14, "wire layout changed");
+static_assert(offsetof(WireHeader, checksum) == 16, "wire layout changed");
+
+constexpr uint8_t compressedFlag = 0x80;
+
+//Whether a frame's payload is compressed, and its type without the flag
+constexpr bool frame_Compressed(uint8_t messageType)
+{
+    return (messageType & compressedFlag) != 0;
+}
+
+constexpr uint8_t frame_Type(uint8_t messageType)
+{
+    return messageType & ~compressedFlag;
+}
+
+//Byte-wise big endian loads/stores; the compiler folds these into single
+//unaligned moves plus a bswap, no alignment or aliasing assumptions needed
+constexpr uint16_t wire_Load16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+constexpr uint32_t wire_Load32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+constexpr void wire_Store16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+constexpr void wire_Store32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+//Writes exactly headerWireLen bytes; headerLen is always stamped as headerWireLen
+constexpr void header_Encode(const MessageHeader &header, uint8_t *out)
+{
+    out[offsetof(WireHeader, headerLen)] = (uint8_t)headerWireLen;
+    out[offsetof(WireHeader, messageType)] = header.messageType;
+    wire_Store32(out + offsetof(WireHeader, timeStamp), header.timeStamp);
+    wire_Store16(out + offsetof(WireHeader, sender_id), header.sender_id);
+    wire_Store16(out + offsetof(WireHeader, receiver_id), header.receiver_id);
+    wire_Store32(out + offsetof(WireHeader, message_id), header.message_id);
+    wire_Store16(out + offsetof(WireHeader, payloadLen), header.payloadLen);
+    wire_Store16(out + offsetof(WireHeader, checksum), header.checksum);
+}
+
+//Reads headerWireLen bytes; the caller checks headerLen before trusting the rest
+constexpr MessageHeader header_Decode(const uint8_t *in)
+{
+    MessageHeader header{};
+    header.headerLen = in[offsetof(WireHeader, headerLen)];
+    header.messageType = in[offsetof(WireHeader, messageType)];
+    header.timeStamp = wire_Load32(in + offsetof(WireHeader, timeStamp));
+    header.sender_id = wire_Load16(in + offsetof(WireHeader, sender_id));
+    header.receiver_id = wire_Load16(in + offsetof(WireHeader, receiver_id));
+    header.message_id = wire_Load32(in + offsetof(WireHeader, message_id));
+    header.payloadLen = wire_Load16(in + offsetof(WireHeader, payloadLen));
+    header.checksum = wire_Load16(in + offsetof(WireHeader, checksum));
+    return header;
+}
+
+//Round trip evaluated by the compiler, so a broken encoder fails the build
+constexpr bool header_RoundTrips()
+{
+    MessageHeader in{};
+    in.messageType = 3;
+    in.timeStamp = 0x01020304;
+    in.sender_id = 0x0506;
+    in.receiver_id = 0x0708;
+    in.message_id = 0x090a0b0c;
+    in.payloadLen = 0x0d0e;
+    in.checksum = 0x0f10;
+    uint8_t wire[headerWireLen] = {};
+    header_Encode(in, wire);
+    MessageHeader out = header_Decode(wire);
+    return wire[0] == headerWireLen && wire[2] == 0x01 && wire[5] == 0x04 && wire[17] == 0x10 &&
+           out.messageType == in.messageType && out.timeStamp == in.timeStamp &&
+           out.sender_id == in.sender_id && out.receiver_id == in.receiver_id &&
+           out.message_id == in.message_id && out.payloadLen == in.payloadLen &&
+           out.checksum == in.checksum;
+}
+static_assert(header_RoundTrips(), "header encode/decode disagree");
+
+#endif
@@ -0,0 +1,419 @@
+//Append-only, memory-mapped log of routed frames, holding chats for offline clients
+
+#include "messagestore.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "message.h"
+#include "checksum.h"
+#include "ackbatch.h"
+
+using namespace std;
+
+//smallest segment that still takes the largest frame
+static const size_t minSegmentBytes = 1 << 20;
+
+static string segmentPath(const string &dir, uint32_t number)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%08u.seg", number);
+    return dir + name;
+}
+
+//An ACK's payload is the message id as text
+static uint32_t ackedId(const uint8_t *payload, size_t len)
+{
+    uint32_t id = 0;
+    for (size_t i = 0; i < len && payload[i] >= '0' && payload[i] <= '9'; i++)
+        id = id * 10 + (payload[i] - '0');
+    return id;
+}
+
+MessageStore::MessageStore()
+    : segmentBytes(defaultSegmentBytes), first(1), heldTotal(0), appended(0), appendedBytes(0), recovered(0),
+      truncated(0)
+{
+}
+
+MessageStore::~MessageStore()
+{
+    close();
+}
+
+bool MessageStore::open(const string &dir, string &why, size_t bytes)
+{
+    lock_guard<mutex> guard(lock);
+    if (!segments.empty())
+    {
+        why = "already open";
+        return false;
+    }
+    directory = dir;
+    segmentBytes = max(bytes, minSegmentBytes);
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        why = dir + ": " + strerror(errno);
+        return false;
+    }
+
+    vector<uint32_t> numbers;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+    {
+        why = dir + ": " + strerror(errno);
+        return false;
+    }
+    while (dirent *entry = readdir(d))
+    {
+        unsigned number;
+        char rest;
+        if (sscanf(entry->d_name, "%8u.se%c", &number, &rest) == 2 && rest == 'g' && number > 0)
+            numbers.push_back(number);
+    }
+    closedir(d);
+    sort(numbers.begin(), numbers.end());
+    if (numbers.empty())
+        numbers.push_back(1);
+    first = numbers.front();
+
+    //segments are numbered without gaps; a missing one would leave held chats pointing nowhere
+    for (size_t i = 0; i < numbers.size(); i++)
+    {
+        if (numbers[i] != first + i)
+        {
+            why = segmentPath(dir, first + i) + " is missing";
+            break;
+        }
+        if (!openSegment(numbers[i], i + 1 == numbers.size(), why))
+            break;
+    }
+    if (segments.size() != numbers.size())
+    {
+        closeLocked();
+        return false;
+    }
+    return true;
+}
+
+bool MessageStore::openSegment(uint32_t number, bool last, string &why)
+{
+    string path = segmentPath(directory, number);
+    unique_ptr<Segment> segment(new Segment);
+    segment->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (segment->fd < 0 || fstat(segment->fd, &st) < 0)
+    {
+        why = path + ": " + strerror(errno);
+        if (segment->fd >= 0)
+            ::close(segment->fd);
+        return false;
+    }
+
+    //the segment being appended to is mapped full size, the others only as far as they go.
+    //Its blocks are allocated up front: running out of disk under a shared mapping is a
+    //SIGBUS on the memcpy, not an error we could report.
+    segment->capacity = last ? max((size_t)st.st_size, segmentBytes) : (size_t)st.st_size;
+    int err = segment->capacity == 0 ? EINVAL : last ? posix_fallocate(segment->fd, 0, segment->capacity) : 0;
+    if (err)
+    {
+        why = path + (segment->capacity ? string(": ") + strerror(err) : string(" is empty"));
+        ::close(segment->fd);
+        return false;
+    }
+    void *data = mmap(nullptr, segment->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (data == MAP_FAILED)
+    {
+        why = path + ": " + strerror(errno);
+        ::close(segment->fd);
+        return false;
+    }
+    segment->data = (uint8_t *)data;
+
+    size_t end = scan(*segment, number);
+    if (last)
+    {
+        //zero whatever a torn append left past the end, up to where the file was never
+        //written, so the next run's scan can't mistake its remains for frames
+        size_t junk = end;
+        while (junk < segment->capacity)
+        {
+            size_t block = min<size_t>(4096 - junk % 4096, segment->capacity - junk);
+            const uint8_t *p = segment->data + junk;
+            if (all_of(p, p + block, [](uint8_t b) { return b == 0; }))
+                break;
+            junk += block;
+        }
+        while (junk > end && segment->data[junk - 1] == 0)
+            junk--;
+        memset(segment->data + end, 0, junk - end);
+        truncated += junk - end;
+    }
+    else if (end < segment->capacity)
+    {
+        truncated += segment->capacity - end;
+        if (ftruncate(segment->fd, end) < 0)
+            why = path + ": " + strerror(errno);
+    }
+    segment->used = end;
+    segments.push_back(move(segment));
+    return true;
+}
+
+//Indexes the whole frames at the start of a segment, returns where they end. Every
+//chat counts as held until an ACK for it turns up later in the log.
+size_t MessageStore::scan(Segment &segment, uint32_t number)
+{
+    size_t at = 0;
+    while (at + headerWireLen <= segment.capacity)
+    {
+        const uint8_t *wire = segment.data + at;
+        MessageHeader header = header_Decode(wire);
+        size_t len = headerWireLen + header.payloadLen;
+        if (header.headerLen != headerWireLen || at + len > segment.capacity ||
+            !checkSum_Check(wire, (const char *)wire + headerWireLen, header.payloadLen))
+            break;
+        index(number, at, wire, len, true);
+        recovered++;
+        at += len;
+    }
+    return at;
+}
+
+void MessageStore::close()
+{
+    lock_guard<mutex> guard(lock);
+    closeLocked();
+}
+
+void MessageStore::closeLocked()
+{
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        Segment &segment = *segments[i];
+        munmap(segment.data, segment.capacity);
+        //a clean shutdown leaves the last segment its real length too
+        if (i + 1 == segments.size() && ftruncate(segment.fd, segment.used) < 0)
+            perror("message store");
+        ::close(segment.fd);
+    }
+    segments.clear();
+    held.clear();
+    conversations.clear();
+    heldTotal = 0;
+}
+
+//Cuts the full segment to its length and starts the next
+bool MessageStore::roll()
+{
+    Segment &full = *segments.back();
+    if (ftruncate(full.fd, full.used) < 0)
+        return false;
+    string why;
+    if (!openSegment(first + segments.size(), true, why))
+    {
+        fprintf(stderr, "message store: %s\n", why.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MessageStore::append(const uint8_t *wire, size_t len, bool keep)
+{
+    lock_guard<mutex> guard(lock);
+    if (segments.empty())
+        return false;
+    if (segments.back()->used + len > segments.back()->capacity && !roll())
+        return false;
+    Segment &segment = *segments.back();
+    uint32_t offset = segment.used;
+    memcpy(segment.data + offset, wire, len);
+    segment.used += len;
+    appended++;
+    appendedBytes += len;
+    index(first + segments.size() - 1, offset, wire, len, keep);
+    return true;
+}
+
+void MessageStore::index(uint32_t segment, uint32_t offset, const uint8_t *wire, size_t len, bool keep)
+{
+    MessageHeader header = header_Decode(wire);
+    const uint8_t *payload = wire + headerWireLen;
+    uint8_t type = frame_Type(header.messageType);
+    if (type == 3)
+    {
+        uint16_t low = min(header.sender_id, header.receiver_id), high = max(header.sender_id, header.receiver_id);
+        Conversation &conversation = conversations[(uint32_t)low << 16 | high];
+        uint32_t stamp = header.timeStamp;
+        if (conversation.entries.size() % Conversation::blockSize == 0)
+            conversation.blocks.push_back(HistoryBlock{stamp, stamp});
+        HistoryBlock &block = conversation.blocks.back();
+        if (!conversation.entries.empty() && stamp < conversation.entries.back().timeStamp)
+            conversation.ordered = false;
+        block.minStamp = min(block.minStamp, stamp);
+        block.maxStamp = max(block.maxStamp, stamp);
+        conversation.entries.push_back(HistoryEntry{stamp, segment, offset});
+    }
+    if (type == 3 && keep)
+    {
+        HeldList &list = held[header.receiver_id];
+        uint64_t key = (uint64_t)header.sender_id << 32 | header.message_id;
+        //a resent chat that is already held stays held once
+        if (!list.where.emplace(key, list.dropped + list.frames.size()).second)
+            return;
+        list.frames.push_back(StoredFrame{segment, offset, (uint32_t)len, header.sender_id, header.message_id});
+        heldTotal++;
+    }
+    else if (type == 4)
+    {
+        uint32_t id = ackedId(payload, header.payloadLen);
+        settle(header.sender_id, header.receiver_id, id, id);
+    }
+    else if (type == 9)
+    {
+        for (size_t r = 0; r < ackRange_Count(header.payloadLen); r++)
+        {
+            uint32_t from, to;
+            ackRange_Load((const char *)payload, r, from, to);
+            settle(header.sender_id, header.receiver_id, from, to);
+        }
+    }
+}
+
+//receiver ACKed sender's chats first..last: whichever of them are held are done with
+void MessageStore::settle(uint16_t receiver, uint16_t sender, uint32_t from, uint32_t to)
+{
+    auto it = held.find(receiver);
+    if (it == held.end() || from > to)
+        return;
+    HeldList &list = it->second;
+
+    auto drop = [&](unordered_map<uint64_t, size_t>::iterator found) {
+        list.frames[found->second - list.dropped].len = 0;
+        list.where.erase(found);
+        heldTotal--;
+    };
+    //look the ids up one by one, or go through the list if it is the shorter of the two
+    if ((uint64_t)to - from < list.where.size())
+    {
+        for (uint64_t id = from; id <= to; id++)
+        {
+            auto found = list.where.find((uint64_t)sender << 32 | id);
+            if (found != list.where.end())
+                drop(found);
+        }
+    }
+    else
+    {
+        for (const StoredFrame &frame : list.frames)
+            if (frame.len && frame.sender == sender && frame.messageId >= from && frame.messageId <= to)
+                drop(list.where.find((uint64_t)sender << 32 | frame.messageId));
+    }
+
+    while (!list.frames.empty() && list.frames.front().len == 0)
+    {
+        list.frames.pop_front();
+        list.dropped++;
+    }
+    if (list.frames.empty())
+        held.erase(it);
+}
+
+void MessageStore::heldFor(uint16_t clientId, vector<StoredFrame> &out) const
+{
+    lock_guard<mutex> guard(lock);
+    out.clear();
+    auto it = held.find(clientId);
+    if (it == held.end())
+        return;
+    out.reserve(it->second.where.size());
+    for (const StoredFrame &frame : it->second.frames)
+        if (frame.len)
+            out.push_back(frame);
+}
+
+size_t MessageStore::heldCount() const
+{
+    lock_guard<mutex> guard(lock);
+    return heldTotal;
+}
+
+void MessageStore::history(uint16_t a, uint16_t b, uint32_t from, uint32_t to, size_t limit,
+                           vector<StoredFrame> &out) const
+{
+    lock_guard<mutex> guard(lock);
+    out.clear();
+    auto it = conversations.find((uint32_t)min(a, b) << 16 | max(a, b));
+    if (it == conversations.end() || from > to)
+        return;
+    const Conversation &conversation = it->second;
+    const vector<HistoryEntry> &entries = conversation.entries;
+    const vector<HistoryBlock> &blocks = conversation.blocks;
+
+    //newest first, from the last block that can hold anything up to to
+    size_t block = blocks.size();
+    if (conversation.ordered)
+        block = upper_bound(blocks.begin(), blocks.end(), to,
+                            [](uint32_t stamp, const HistoryBlock &b) { return stamp < b.minStamp; }) -
+                blocks.begin();
+    while (block-- > 0 && out.size() < limit)
+    {
+        if (blocks[block].maxStamp < from)
+        {
+            if (conversation.ordered)
+                break;
+            continue;
+        }
+        if (blocks[block].minStamp > to)
+            continue;
+        size_t begin = block * Conversation::blockSize;
+        size_t end = min(begin + Conversation::blockSize, entries.size());
+        for (size_t i = end; i-- > begin && out.size() < limit;)
+        {
+            const HistoryEntry &entry = entries[i];
+            if (entry.timeStamp < from || entry.timeStamp > to)
+                continue;
+            const uint8_t *wire = segments[entry.segment - first]->data + entry.offset;
+            MessageHeader header = header_Decode(wire);
+            out.push_back(StoredFrame{entry.segment, entry.offset, (uint32_t)(headerWireLen + header.payloadLen),
+                                      header.sender_id, header.message_id});
+        }
+    }
+    reverse(out.begin(), out.end());
+}
+
+size_t MessageStore::conversationCount() const
+{
+    lock_guard<mutex> guard(lock);
+    return conversations.size();
+}
+
+int MessageStore::segmentFd(uint32_t segment) const
+{
+    lock_guard<mutex> guard(lock);
+    return segments[segment - first]->fd;
+}
+
+const uint8_t *MessageStore::frameData(const StoredFrame &frame) const
+{
+    lock_guard<mutex> guard(lock);
+    return segments[frame.segment - first]->data + frame.offset;
+}
+
+uint64_t MessageStore::framesAppended() const
+{
+    lock_guard<mutex> guard(lock);
+    return appended;
+}
+
+uint64_t MessageStore::bytesAppended() const
+{
+    lock_guard<mutex> guard(lock);
+    return appendedBytes;
+}
@@ -0,0 +1,138 @@
+//Append-only, memory-mapped log of routed frames, holding chats for offline clients
+
+#ifndef MESSAGESTORE_H
+#define MESSAGESTORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Where one stored frame is, and whose chat it is
+struct StoredFrame {
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t len;
+    uint16_t sender;
+    uint32_t messageId;
+};
+
+//The log is a directory of fixed size segment files (00000001.seg, ...) holding frames
+//back to back exactly as they went over the wire, so a stored frame can be sent again
+//straight from its file with sendfile(). Each segment is mapped shared for its whole
+//size: appending is a memcpy under the lock, and what is appended is in the page cache
+//at once, safe from a server crash (a machine crash loses what the kernel hadn't
+//written back yet). A full segment is cut to its length and stays mapped for reading.
+//
+//Chats (type 3, compressed or not) and ACKs (4, and range ACKs 9) going between clients
+//are appended. A chat whose receiver isn't connected is also held for it, in a
+//per-receiver list, until an ACK from that receiver for it is appended. Opening an
+//existing log rebuilds the lists the same way: a chat with no ACK after it is held.
+//Every chat is also indexed by conversation for history queries.
+//
+//Thread safe; frames are immutable once appended, so the bytes a StoredFrame points at
+//may be read without the lock.
+class MessageStore {
+public:
+    static const size_t defaultSegmentBytes = 64 << 20;
+
+    MessageStore();
+    ~MessageStore();
+    MessageStore(const MessageStore &) = delete;
+    MessageStore &operator=(const MessageStore &) = delete;
+
+    //Opens dir (created if missing) and recovers it: each segment is scanned frame by
+    //frame, and whatever follows the last whole frame with a good checksum, e.g. one
+    //torn by a crash mid-append, is cut off. False with the reason if it can't.
+    bool open(const std::string &dir, std::string &why, size_t segmentBytes = defaultSegmentBytes);
+    //Cuts the last segment to its length and unmaps everything
+    void close();
+    bool isOpen() const { return !segments.empty(); }
+
+    //Appends a routed frame; held keeps a chat for its receiver. False if the frame
+    //couldn't be written (no room for a new segment).
+    bool append(const uint8_t *wire, size_t len, bool held);
+
+    //Chats held for clientId, oldest first
+    void heldFor(uint16_t clientId, std::vector<StoredFrame> &out) const;
+    size_t heldCount() const;
+
+    //The last limit chats between a and b, either way, with timeStamp in from..to
+    //inclusive, oldest first
+    void history(uint16_t a, uint16_t b, uint32_t from, uint32_t to, size_t limit,
+                 std::vector<StoredFrame> &out) const;
+    size_t conversationCount() const;
+
+    //The segment file and mapping a stored frame is in
+    int segmentFd(uint32_t segment) const;
+    const uint8_t *frameData(const StoredFrame &frame) const;
+
+    //totals, appended and held counting this run only
+    uint64_t framesAppended() const;
+    uint64_t bytesAppended() const;
+    uint64_t framesRecovered() const { return recovered; }
+    uint64_t bytesTruncated() const { return truncated; }
+
+private:
+    struct Segment {
+        int fd = -1;
+        uint8_t *data = nullptr;
+        size_t capacity = 0;     //bytes mapped
+        size_t used = 0;         //bytes of whole frames
+    };
+
+    //One receiver's held chats in log order. Settled ones are blanked (len 0) where they
+    //are and dropped once they reach the front, which is where a replay's ACKs land.
+    struct HeldList {
+        std::deque<StoredFrame> frames;
+        size_t dropped = 0;      //frames popped off the front so far, for positions
+        std::unordered_map<uint64_t, size_t> where;   //sender << 32 | messageId to position
+    };
+
+    //One conversation's chats in log order, 12 bytes each, with the timestamp range of
+    //every block of them so a query skips whole blocks outside its range. Timestamps
+    //come from the clients and usually only go up; while they do, the blocks are
+    //binary searched for where the range ends instead of walked back to it.
+    struct HistoryEntry {
+        uint32_t timeStamp;
+        uint32_t segment;
+        uint32_t offset;
+    };
+    struct HistoryBlock {
+        uint32_t minStamp;
+        uint32_t maxStamp;
+    };
+    struct Conversation {
+        static const size_t blockSize = 64;
+        std::vector<HistoryEntry> entries;
+        std::vector<HistoryBlock> blocks;
+        bool ordered = true;     //timestamps never went down
+    };
+
+    void closeLocked();
+    bool openSegment(uint32_t number, bool last, std::string &why);
+    bool roll();
+    size_t scan(Segment &segment, uint32_t number);
+    void index(uint32_t segment, uint32_t offset, const uint8_t *wire, size_t len, bool held);
+    void settle(uint16_t receiver, uint16_t sender, uint32_t first, uint32_t last);
+
+    mutable std::mutex lock;
+    std::string directory;
+    size_t segmentBytes;
+    //segment n is segments[n - first]; unique_ptr so a Segment never moves once readers know it
+    std::vector<std::unique_ptr<Segment>> segments;
+    uint32_t first;
+    std::unordered_map<uint16_t, HeldList> held;
+    std::unordered_map<uint32_t, Conversation> conversations;   //lower id << 16 | higher id
+    size_t heldTotal;
+    uint64_t appended;
+    uint64_t appendedBytes;
+    uint64_t recovered;
+    uint64_t truncated;
+};
+
+#endif
@@ -0,0 +1,76 @@
+//Per-thread message metrics, added up when read
+
+#include "metrics.h"
+
+#include <cstdio>
+#include <ctime>
+
+using namespace std;
+
+uint64_t metrics_NowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void metrics_Line(string &out, const string &name, const char *type, const char *help, uint64_t value)
+{
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+    out += name + " " + to_string(value) + "\n";
+}
+
+static void typeCounters(string &out, const string &name, const char *help,
+                         const vector<const MetricsShard *> &shards, bool in)
+{
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " counter\n";
+    for (int type = 0; type < 256; type++)
+    {
+        uint64_t n = 0;
+        for (const MetricsShard *shard : shards)
+            n += (in ? shard->framesIn[type] : shard->framesOut[type]).load(memory_order_relaxed);
+        if (n)
+            out += name + "{type=\"" + to_string(type) + "\"} " + to_string(n) + "\n";
+    }
+}
+
+static void summary(string &out, const string &name, const string &help, const Histogram &h)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    char line[160];
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " summary\n";
+    for (double q : quantiles)
+    {
+        snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %.9f\n", name.c_str(), q, h.percentile(q) / 1e9);
+        out += line;
+    }
+    snprintf(line, sizeof(line), "%s_sum %.9f\n%s_count %lu\n", name.c_str(), h.mean() * h.count() / 1e9,
+             name.c_str(), (unsigned long)h.count());
+    out += line;
+}
+
+void metrics_Render(const vector<const MetricsShard *> &shards, const string &prefix, string &out)
+{
+    typeCounters(out, prefix + "frames_in_total", "Frames received, by message type", shards, true);
+    typeCounters(out, prefix + "frames_out_total", "Frames sent or queued, by message type", shards, false);
+
+    uint64_t in = 0, outBytes = 0;
+    Histogram dispatch, ack;
+    for (const MetricsShard *shard : shards)
+    {
+        in += shard->bytesIn.load(memory_order_relaxed);
+        outBytes += shard->bytesOut.load(memory_order_relaxed);
+        dispatch.merge(shard->dispatchLatency);
+        ack.merge(shard->ackRoundTrip);
+    }
+    metrics_Line(out, prefix + "bytes_in_total", "counter", "Frame bytes received", in);
+    metrics_Line(out, prefix + "bytes_out_total", "counter", "Frame bytes sent or queued", outBytes);
+    string sampled = ", 1 in " + to_string(MetricsShard::sampleEvery);
+    summary(out, prefix + "dispatch_latency_seconds",
+            "Time from a read returning to its frame's handler running" + sampled + " frames", dispatch);
+    summary(out, prefix + "ack_round_trip_seconds",
+            "Time from relaying a chat to relaying its ACK back to the sender" + sampled + " chats", ack);
+}
@@ -0,0 +1,57 @@
+//Per-thread message metrics, added up when read
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "histogram.h"
+
+//Counters one thread keeps about the frames it handles. Only its own thread writes
+//a shard, with plain relaxed stores; readers on other threads add shards up, so
+//nothing is shared or locked on the frame path.
+//
+//Latencies are sampled: the caller times one frame in sampleEvery, which keeps the
+//clock reads off most frames.
+struct MetricsShard {
+    static const unsigned sampleEvery = 64;
+
+    std::atomic<uint64_t> framesIn[256] = {};    //by messageType
+    std::atomic<uint64_t> framesOut[256] = {};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    Histogram dispatchLatency;      //ns from recv() returning to the frame's handler running
+    Histogram ackRoundTrip;         //ns from relaying a chat to relaying its ACK back
+
+    void frameIn(uint8_t type, size_t bytes)
+    {
+        bump(framesIn[type], 1);
+        bump(bytesIn, bytes);
+    }
+    void frameOut(uint8_t type, size_t bytes)
+    {
+        bump(framesOut[type], 1);
+        bump(bytesOut, bytes);
+    }
+
+    static void bump(std::atomic<uint64_t> &counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+//CLOCK_MONOTONIC in ns, for latencies
+uint64_t metrics_NowNs();
+
+//Prometheus text exposition of the shards' sum: per type frame counters, byte
+//counters and the two latency histograms as summaries (in seconds), every name
+//starting with prefix
+void metrics_Render(const std::vector<const MetricsShard *> &shards, const std::string &prefix, std::string &out);
+
+//One more gauge or counter line, with its HELP and TYPE lines
+void metrics_Line(std::string &out, const std::string &name, const char *type, const char *help, uint64_t value);
+
+#endif
@@ -0,0 +1,67 @@
+//Lock-free multi-producer single-consumer queue
+
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <utility>
+
+//Unbounded linked list after Dmitry Vyukov's MPSC queue. push() from any thread is one
+//atomic exchange plus a store, it never waits on other producers or on the consumer;
+//pop() and empty() belong to the single consumer thread.
+//
+//A push is visible once its link is stored: a consumer that looks in between may find
+//the queue empty for a moment even though the exchange happened, so a consumer that
+//sleeps must be woken by the producer after its push (see Console).
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue()
+        : head(new Node()), tail(head.load())
+    {
+    }
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value))
+            ;
+        delete tail;
+    }
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    void push(T value)
+    {
+        Node *node = new Node(std::move(value));
+        Node *prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    //consumer only: false if nothing is ready yet
+    bool pop(T &value)
+    {
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        value = std::move(next->value);
+        delete tail;
+        tail = next;     //next becomes the new stub, its value already moved out
+        return true;
+    }
+
+    //consumer only
+    bool empty() const { return tail->next.load(std::memory_order_acquire) == nullptr; }
+
+private:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        T value;
+        Node() : value() {}
+        explicit Node(T v) : value(std::move(v)) {}
+    };
+
+    std::atomic<Node *> head;   //newest node, producers swap themselves in here
+    Node *tail;                 //stub before the oldest node, consumer side
+};
+
+#endif
@@ -0,0 +1,79 @@
+//Blocking readiness waits with an eventfd for prompt shutdown
+//Receive threads sleep in poll() instead of spinning on MSG_PEEK, so an idle
+//connection costs no CPU; writing to the eventfd wakes every waiter at once.
+
+#ifndef READINESS_H
+#define READINESS_H
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+
+inline int shutdownFd_Create()
+{
+    return eventfd(0, EFD_CLOEXEC);
+}
+
+//The counter is never read back, so once signalled the fd stays readable for every thread
+inline void shutdownFd_Signal(int exitfd)
+{
+    uint64_t one = 1;
+    ssize_t ret = write(exitfd, &one, sizeof(one));
+    (void)ret;
+}
+
+//Returns true once sockfd or hangupfd (-1 for none) is readable, false when shutdown
+//was signalled on exitfd or timeoutMs (-1 waits forever) ran out, which sets timedOut.
+//A shared memory channel waits on its doorbell and passes its socket as hangupfd.
+inline bool waitReadable(int sockfd, int hangupfd, int exitfd, int timeoutMs, bool &timedOut)
+{
+    struct pollfd fds[3];
+    fds[0].fd = sockfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = exitfd;
+    fds[1].events = POLLIN;
+    fds[2].fd = hangupfd;
+    fds[2].events = POLLIN;
+
+    while (1)
+    {
+        fds[0].revents = fds[1].revents = fds[2].revents = 0;
+        timedOut = false;
+        int ready = poll(fds, hangupfd < 0 ? 2 : 3, timeoutMs);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (ready == 0)
+        {
+            timedOut = true;
+            return false;
+        }
+        if (fds[1].revents)
+            return false;
+        if (fds[0].revents || fds[2].revents)
+            return true;
+    }
+}
+
+//Returns true once sockfd has data (or EOF/error to collect with recv), false when
+//shutdown was signalled on exitfd or timeoutMs (-1 waits forever) ran out, which
+//sets timedOut
+inline bool waitReadable(int sockfd, int exitfd, int timeoutMs, bool &timedOut)
+{
+    return waitReadable(sockfd, -1, exitfd, timeoutMs, timedOut);
+}
+
+//Returns true once sockfd has data (or EOF/error to collect with recv),
+//false when shutdown was signalled on exitfd
+inline bool waitReadable(int sockfd, int exitfd)
+{
+    bool timedOut;
+    return waitReadable(sockfd, exitfd, -1, timedOut);
+}
+
+#endif
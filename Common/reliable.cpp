@@ -0,0 +1,137 @@
+//Reliable chat delivery on top of ACK/NACK: retransmission on the sending side,
+//duplicate suppression on the receiving side
+
+#include "reliable.h"
+
+#include <algorithm>
+#include <ctime>
+#include <vector>
+
+using namespace std;
+
+uint64_t reliable_NowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+RetransmitQueue::RetransmitQueue(unsigned timeout, unsigned attempts, uint64_t nowMs)
+    : timeoutMs(timeout), maxAttempts(attempts), wheel(nowMs)
+{
+}
+
+void RetransmitQueue::track(uint32_t messageId, string wire, uint64_t nowMs)
+{
+    Entry &entry = pending[messageId];
+    wheel.cancel(entry.timer);
+    entry.wire = std::move(wire);
+    entry.attempts = 1;
+    entry.timer = wheel.schedule(nowMs + timeoutMs, messageId);
+}
+
+bool RetransmitQueue::acknowledge(uint32_t messageId)
+{
+    auto it = pending.find(messageId);
+    if (it == pending.end())
+        return false;
+    wheel.cancel(it->second.timer);
+    pending.erase(it);
+    return true;
+}
+
+size_t RetransmitQueue::acknowledgeRange(uint32_t first, uint32_t last)
+{
+    if (first > last)
+        return 0;
+    size_t acked = 0;
+    //look the ids up one by one, or go through what is in flight if that is shorter
+    if ((uint64_t)last - first < pending.size())
+    {
+        for (uint64_t id = first; id <= last; id++)
+            acked += acknowledge((uint32_t)id);
+        return acked;
+    }
+    for (auto it = pending.begin(); it != pending.end();)
+    {
+        if (it->first < first || it->first > last)
+        {
+            ++it;
+            continue;
+        }
+        wheel.cancel(it->second.timer);
+        it = pending.erase(it);
+        acked++;
+    }
+    return acked;
+}
+
+void RetransmitQueue::nack(uint32_t messageId, uint64_t nowMs)
+{
+    auto it = pending.find(messageId);
+    if (it == pending.end())
+        return;
+    wheel.cancel(it->second.timer);
+    it->second.timer = wheel.schedule(nowMs + timeoutMs / 4, messageId);
+}
+
+void RetransmitQueue::expire(uint64_t nowMs, const ResendFn &resend, const GiveUpFn &giveUp)
+{
+    wheel.advance(nowMs, [&](uint64_t data) {
+        uint32_t messageId = (uint32_t)data;
+        auto it = pending.find(messageId);
+        if (it == pending.end())
+            return;
+        Entry &entry = it->second;
+        if (entry.attempts >= maxAttempts)
+        {
+            pending.erase(it);
+            givenUp++;
+            giveUp(messageId);
+            return;
+        }
+        //back off: 2, 4, 8... timeouts between attempts, then stay at maxBackoff
+        unsigned backoff = maxBackoff;
+        if (entry.attempts < 31 && (1u << entry.attempts) < maxBackoff)
+            backoff = 1u << entry.attempts;
+        entry.timer = wheel.schedule(nowMs + (uint64_t)timeoutMs * backoff, messageId);
+        entry.attempts++;
+        retransmits++;
+        resend(messageId, entry.wire);
+    });
+}
+
+void RetransmitQueue::resendAll(const ResendFn &resend)
+{
+    vector<uint32_t> ids;
+    ids.reserve(pending.size());
+    for (const auto &entry : pending)
+        ids.push_back(entry.first);
+    sort(ids.begin(), ids.end());
+    for (uint32_t messageId : ids)
+    {
+        retransmits++;
+        resend(messageId, pending[messageId].wire);
+    }
+}
+
+int RetransmitQueue::msUntilNext() const
+{
+    uint64_t ticks = wheel.ticksUntilNext();
+    return ticks == UINT64_MAX ? -1 : (int)ticks;
+}
+
+DuplicateFilter::DuplicateFilter(unsigned retain, uint64_t nowMs)
+    : retainMs(retain), wheel(nowMs)
+{
+}
+
+bool DuplicateFilter::firstTime(uint16_t sender, uint32_t messageId, uint64_t nowMs)
+{
+    wheel.advance(nowMs, [this](uint64_t key) { seen.erase(key); });
+    uint64_t key = ((uint64_t)sender << 32) | messageId;
+    if (!seen.insert(key).second)
+        return false;
+    wheel.schedule(nowMs + retainMs, key);
+    return true;
+}
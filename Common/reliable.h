@@ -0,0 +1,86 @@
+//Reliable chat delivery on top of ACK/NACK: retransmission on the sending side,
+//duplicate suppression on the receiving side
+
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "timingwheel.h"
+
+//Milliseconds on the monotonic clock, the tick both classes below count in
+uint64_t reliable_NowMs();
+
+//Frames sent but not acknowledged yet, keyed by message_id. Each waits on a timing
+//wheel timer; a timeout or a NACK sends the identical frame again, with the timeout
+//doubling every attempt up to maxBackoff times the first, until maxAttempts sends
+//have gone unacknowledged.
+//Not thread safe.
+class RetransmitQueue {
+public:
+    typedef std::function<void(uint32_t messageId, const std::string &wire)> ResendFn;
+    typedef std::function<void(uint32_t messageId)> GiveUpFn;
+
+    static const unsigned maxBackoff = 8;
+
+    RetransmitQueue(unsigned timeoutMs, unsigned maxAttempts, uint64_t nowMs);
+
+    //wire is the encoded frame exactly as it was sent the first time
+    void track(uint32_t messageId, std::string wire, uint64_t nowMs);
+    //false if the id was not in flight (a duplicate ACK, or one for an untracked frame)
+    bool acknowledge(uint32_t messageId);
+    //acknowledges whichever of first..last are in flight, how many that was; an empty
+    //range (first > last) acknowledges nothing
+    size_t acknowledgeRange(uint32_t first, uint32_t last);
+    //the receiver couldn't be reached: try again a quarter timeout from now, which
+    //counts as an attempt like a timeout does
+    void nack(uint32_t messageId, uint64_t nowMs);
+    //resends whatever timed out, gives up on frames out of attempts
+    void expire(uint64_t nowMs, const ResendFn &resend, const GiveUpFn &giveUp);
+    //resends everything in flight at once, oldest first, e.g. over a new connection;
+    //doesn't count as an attempt or move the timers
+    void resendAll(const ResendFn &resend);
+
+    size_t inFlight() const { return pending.size(); }
+    //for poll() timeouts, -1 if nothing is in flight
+    int msUntilNext() const;
+
+    //totals since construction
+    uint64_t retransmits = 0;
+    uint64_t givenUp = 0;
+
+private:
+    struct Entry {
+        std::string wire;
+        TimingWheel::Handle timer = 0;
+        unsigned attempts = 0;   //sends so far
+    };
+
+    unsigned timeoutMs;
+    unsigned maxAttempts;
+    TimingWheel wheel;
+    std::unordered_map<uint32_t, Entry> pending;
+};
+
+//Remembers which (sender, message_id) pairs were already delivered, for as long as a
+//sender could still be retransmitting them, so a chat whose ACK got lost is ACKed
+//again but shown only once. Not thread safe.
+class DuplicateFilter {
+public:
+    DuplicateFilter(unsigned retainMs, uint64_t nowMs);
+
+    //true the first time a message is seen
+    bool firstTime(uint16_t sender, uint32_t messageId, uint64_t nowMs);
+    size_t remembered() const { return seen.size(); }
+
+private:
+    unsigned retainMs;
+    TimingWheel wheel;
+    std::unordered_set<uint64_t> seen;
+};
+
+#endif
@@ -0,0 +1,146 @@
+//Client send path that coalesces frames from several threads into one write
+
+#include "sendpipeline.h"
+
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include "framesend.h"
+
+using namespace std;
+
+SendPipeline::SendPipeline(int sock, Mode mode, unsigned quietUs, unsigned windowUs, size_t bytes)
+    : sockfd(sock), sendMode(mode), quiet(quietUs), window(windowUs), flushBytes(bytes)
+{
+    int on = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    pending.reserve(flushBytes);
+    writingNow.reserve(flushBytes);
+    if (sendMode == Throughput)
+        flusher = thread(&SendPipeline::run, this);
+}
+
+SendPipeline::~SendPipeline()
+{
+    stop();
+}
+
+void SendPipeline::stop()
+{
+    {
+        unique_lock<mutex> guard(lock);
+        stopping = true;
+        if (!writing)
+            writeOut(guard);
+    }
+    wake.notify_all();
+    if (flusher.joinable())
+        flusher.join();
+}
+
+void SendPipeline::reattach(int sock)
+{
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    unique_lock<mutex> guard(lock);
+    wake.wait(guard, [this]() { return !writing; });
+    sockfd = sock;
+    pending.clear();
+    failed = false;
+}
+
+bool SendPipeline::send(const uint8_t *wire, size_t len)
+{
+    unique_lock<mutex> guard(lock);
+    if (failed)
+        return false;
+    bool wasEmpty = pending.empty();
+    pending.append((const char *)wire, len);
+    return queued(guard, wasEmpty);
+}
+
+bool SendPipeline::send(MessageHeader header, const char *payload, size_t len)
+{
+    unique_lock<mutex> guard(lock);
+    if (failed || len > UINT16_MAX)
+        return false;
+    bool wasEmpty = pending.empty();
+    size_t at = pending.size();
+    pending.resize(at + headerWireLen + len);
+    frame_Encode(header, payload, len, (uint8_t *)&pending[at]);
+    return queued(guard, wasEmpty);
+}
+
+bool SendPipeline::queued(unique_lock<mutex> &guard, bool wasEmpty)
+{
+    frameCount++;
+    if (sendMode == Throughput)
+    {
+        lastQueued = chrono::steady_clock::now();
+        if (wasEmpty)
+            firstQueued = lastQueued;
+    }
+    if (writing)
+        return true;
+    if (sendMode == LowLatency || pending.size() >= flushBytes || stopping)
+        writeOut(guard);
+    else if (wasEmpty)
+        wake.notify_all();
+    return !failed;
+}
+
+bool SendPipeline::flush()
+{
+    unique_lock<mutex> guard(lock);
+    wake.wait(guard, [this]() { return !writing; });
+    writeOut(guard);
+    return !failed;
+}
+
+//Takes the writer's role until pending is empty, writing without the lock held so other
+//threads keep queueing meanwhile
+void SendPipeline::writeOut(unique_lock<mutex> &guard)
+{
+    writing = true;
+    while (!pending.empty() && !failed)
+    {
+        writingNow.swap(pending);
+        guard.unlock();
+        bool ok = frame_SendWire(sockfd, (const uint8_t *)writingNow.data(), writingNow.size());
+        writeCount++;
+        writingNow.clear();
+        guard.lock();
+        if (!ok)
+            failed = true;
+    }
+    pending.clear();
+    writing = false;
+    wake.notify_all();
+}
+
+//Throughput mode: writes out what has waited long enough
+void SendPipeline::run()
+{
+    //the timers are tens of microseconds, don't let the kernel stretch them by its default 50
+    prctl(PR_SET_TIMERSLACK, 1000, 0, 0, 0);
+    unique_lock<mutex> guard(lock);
+    while (1)
+    {
+        if (pending.empty() || writing)
+        {
+            if (stopping)
+                return;
+            wake.wait(guard);
+            continue;
+        }
+        auto due = min(lastQueued + quiet, firstQueued + window);
+        if (!stopping && chrono::steady_clock::now() < due)
+        {
+            wake.wait_until(guard, due);
+            continue;
+        }
+        writeOut(guard);
+    }
+}
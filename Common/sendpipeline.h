@@ -0,0 +1,79 @@
+//Client send path that coalesces frames from several threads into one write
+
+#ifndef SENDPIPELINE_H
+#define SENDPIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "message.h"
+
+//Any thread may send(); frames are appended to one buffer under a lock and written to
+//the socket by whichever thread holds the writer's role, so frames that come in while
+//a write is under way go out together with the next one, in the order they were sent.
+//
+//LowLatency writes at once: the sender that finds no write under way becomes the
+//writer and keeps writing until the buffer is empty. Throughput holds frames back until
+//none has come for quietUs, windowUs after the first at the latest, or until flushBytes
+//have piled up, so a burst goes out in a few large writes a moment after it ends; a
+//thread of its own writes out what the timers close on. Both leave TCP_NODELAY set,
+//batching is done here, where it costs no extra syscalls.
+class SendPipeline {
+public:
+    enum Mode { LowLatency, Throughput };
+
+    SendPipeline(int sockfd, Mode mode, unsigned quietUs = 50, unsigned windowUs = 1000,
+                 size_t flushBytes = 32 * 1024);
+    ~SendPipeline();
+    SendPipeline(const SendPipeline &) = delete;
+    SendPipeline &operator=(const SendPipeline &) = delete;
+
+    //An encoded frame, or one encoded straight into the buffer with payloadLen and the
+    //checksum filled in. False once a write has failed or the payload doesn't fit a frame.
+    bool send(const uint8_t *wire, size_t len);
+    bool send(MessageHeader header, const char *payload, size_t len);
+    //returns once everything sent so far has been written
+    bool flush();
+    //writes out what is left and stops the window's thread
+    void stop();
+    //carries on over a new socket once the old one's connection dropped: waits out a write
+    //under way, discards what hadn't been written and clears the failure
+    void reattach(int sockfd);
+
+    Mode mode() const { return sendMode; }
+    uint64_t frames() const { return frameCount.load(); }
+    uint64_t writes() const { return writeCount.load(); }
+
+private:
+    //the caller holds lock, a whole frame has just been appended to pending
+    bool queued(std::unique_lock<std::mutex> &guard, bool wasEmpty);
+    void writeOut(std::unique_lock<std::mutex> &guard);
+    void run();
+
+    int sockfd;
+    Mode sendMode;
+    std::chrono::microseconds quiet;
+    std::chrono::microseconds window;
+    size_t flushBytes;
+
+    std::mutex lock;
+    std::condition_variable wake;   //the flusher thread, and flush() waiting on a writer
+    std::string pending;            //encoded frames not written yet
+    std::string writingNow;         //what the writer took from pending, kept for its capacity
+    std::chrono::steady_clock::time_point firstQueued;   //when pending last became non-empty
+    std::chrono::steady_clock::time_point lastQueued;
+    bool writing = false;
+    bool failed = false;
+    bool stopping = false;
+    std::thread flusher;
+
+    std::atomic<uint64_t> frameCount{0};
+    std::atomic<uint64_t> writeCount{0};
+};
+
+#endif
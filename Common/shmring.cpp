@@ -0,0 +1,317 @@
+//Shared memory transport for clients on the same host as the server
+
+#include "shmring.h"
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+
+using namespace std;
+
+//each ring's ShmRing gets a page to itself, its bytes start on the next one
+static const size_t controlBytes = 4096;
+
+//a producer blocked in writeAll() looks for a peer that went away without a word this often
+static const int roomWaitMs = 100;
+
+//what offer() sends along with the memfd and the doorbells
+struct ShmOffer {
+    char magic[4];
+    uint32_t ringBytes;
+};
+static const char offerMagic[4] = {'S', 'H', 'M', '1'};
+
+static void futexWait(atomic<uint32_t> *word, uint32_t seen, int ms)
+{
+    struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000};
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, seen, &ts, nullptr, 0);
+}
+
+static void futexWake(atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+ShmChannel::~ShmChannel()
+{
+    if (segment)
+    {
+        //the peer may be asleep on either ring: tell it, and wake it to find out
+        out->closed.store(1, memory_order_release);
+        in->roomSeq.fetch_add(1);
+        futexWake(&in->roomSeq);
+        ring(peerBell);
+        munmap(segment, segmentBytes);
+    }
+    if (ownBell >= 0)
+        close(ownBell);
+    if (peerBell >= 0)
+        close(peerBell);
+    if (ownsSock && sock >= 0)
+        close(sock);
+}
+
+bool ShmChannel::offer(int sockfd, size_t ringBytes, string &why)
+{
+    sock = sockfd;
+    int memfd = memfd_create("chat-rings", MFD_CLOEXEC);
+    if (memfd < 0 || ftruncate(memfd, 2 * (controlBytes + ringBytes)) < 0)
+    {
+        why = string("memfd: ") + strerror(errno);
+        if (memfd >= 0)
+            close(memfd);
+        return false;
+    }
+    ownBell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    peerBell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ownBell < 0 || peerBell < 0 || !map(memfd, ringBytes, true, why))
+    {
+        if (why.empty())
+            why = string("eventfd: ") + strerror(errno);
+        close(memfd);
+        return false;
+    }
+
+    //the client gets the segment, the doorbell it sleeps on and the one that wakes us
+    ShmOffer offered;
+    memcpy(offered.magic, offerMagic, sizeof(offerMagic));
+    offered.ringBytes = (uint32_t)ringBytes;
+    struct iovec iov = {&offered, sizeof(offered)};
+    int fds[3] = {memfd, peerBell, ownBell};
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    close(memfd);
+    if (sent != (ssize_t)sizeof(offered))
+    {
+        why = string("sendmsg: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool ShmChannel::connect(const char *path, string &why)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        why = "socket path too long";
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ownsSock = true;
+    if (sock < 0 || ::connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        why = string("connect: ") + strerror(errno);
+        return false;
+    }
+
+    ShmOffer offered;
+    struct iovec iov = {&offered, sizeof(offered)};
+    int fds[3];
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t got;
+    do
+        got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    while (got < 0 && errno == EINTR);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (got != (ssize_t)sizeof(offered) || !cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        why = got < 0 ? string("recvmsg: ") + strerror(errno) : "the server offered no rings";
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    ownBell = fds[1];
+    peerBell = fds[2];
+    bool mapped = memcmp(offered.magic, offerMagic, sizeof(offerMagic)) == 0 &&
+                  map(fds[0], offered.ringBytes, false, why);
+    close(fds[0]);
+    if (!mapped && why.empty())
+        why = "the server offered something other than rings";
+    return mapped;
+}
+
+bool ShmChannel::map(int memfd, size_t ringBytes, bool server, string &why)
+{
+    struct stat st;
+    if (ringBytes == 0 || (ringBytes & (ringBytes - 1)) != 0 || fstat(memfd, &st) < 0 ||
+        (size_t)st.st_size != 2 * (controlBytes + ringBytes))
+    {
+        why = "bad ring size";
+        return false;
+    }
+    segmentBytes = st.st_size;
+    void *base = mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (base == MAP_FAILED)
+    {
+        why = string("mmap: ") + strerror(errno);
+        return false;
+    }
+    //the client to server ring comes first; a fresh memfd is all zeroes, an empty ring
+    segment = base;
+    capacity = ringBytes;
+    char *first = (char *)base;
+    char *second = first + controlBytes + ringBytes;
+    in = (ShmRing *)(server ? first : second);
+    out = (ShmRing *)(server ? second : first);
+    inBytes = (char *)in + controlBytes;
+    outBytes = (char *)out + controlBytes;
+    return true;
+}
+
+size_t ShmChannel::read(char *to, size_t len)
+{
+    uint64_t tail = in->tail.load(memory_order_relaxed);
+    uint64_t head = in->head.load(memory_order_acquire);
+    size_t n = min<size_t>(len, head - tail);
+    if (n == 0)
+        return 0;
+    size_t at = tail & (capacity - 1);
+    size_t first = min(n, capacity - at);
+    memcpy(to, inBytes + at, first);
+    memcpy(to + first, inBytes, n - first);
+    in->tail.store(tail + n, memory_order_release);
+
+    //pairs with the fence in awaitRoom() and writeAll(): either the producer sees the
+    //room we made, or we see it waiting for some
+    atomic_thread_fence(memory_order_seq_cst);
+    if (in->producerWaiting.load(memory_order_relaxed) != NotWaiting)
+    {
+        uint32_t waiting = in->producerWaiting.exchange(NotWaiting);
+        if (waiting == WaitFutex)
+        {
+            in->roomSeq.fetch_add(1);
+            futexWake(&in->roomSeq);
+        }
+        else if (waiting == WaitDoorbell)
+            ring(peerBell);
+    }
+    return n;
+}
+
+size_t ShmChannel::write(const void *data, size_t len)
+{
+    uint64_t head = out->head.load(memory_order_relaxed);
+    uint64_t tail = out->tail.load(memory_order_acquire);
+    size_t n = min<size_t>(len, capacity - (head - tail));
+    if (n == 0)
+        return 0;
+    size_t at = head & (capacity - 1);
+    size_t first = min(n, capacity - at);
+    memcpy(outBytes + at, data, first);
+    memcpy(outBytes, (const char *)data + first, n - first);
+    out->head.store(head + n, memory_order_release);
+
+    //pairs with the fence in idle()
+    atomic_thread_fence(memory_order_seq_cst);
+    if (out->consumerWaiting.load(memory_order_relaxed) && out->consumerWaiting.exchange(0))
+        ring(peerBell);
+    return n;
+}
+
+bool ShmChannel::writeAll(const void *data, size_t len)
+{
+    const char *from = (const char *)data;
+    while (len > 0)
+    {
+        size_t n = write(from, len);
+        from += n;
+        len -= n;
+        if (len == 0 || n > 0)
+            continue;
+        if (peerClosed())
+            return false;
+
+        //full: say we are waiting, then look again in case the consumer made room
+        //before it could have seen that
+        uint32_t seen = out->roomSeq.load(memory_order_acquire);
+        out->producerWaiting.store(WaitFutex, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (out->head.load(memory_order_relaxed) - out->tail.load(memory_order_relaxed) < capacity)
+        {
+            out->producerWaiting.store(NotWaiting, memory_order_relaxed);
+            continue;
+        }
+        futexWait(&out->roomSeq, seen, roomWaitMs);
+    }
+    return true;
+}
+
+bool ShmChannel::idle()
+{
+    in->consumerWaiting.store(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (in->head.load(memory_order_relaxed) != in->tail.load(memory_order_relaxed))
+    {
+        in->consumerWaiting.store(0, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void ShmChannel::awaitRoom()
+{
+    out->producerWaiting.store(WaitDoorbell, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (out->head.load(memory_order_relaxed) - out->tail.load(memory_order_relaxed) < capacity &&
+        out->producerWaiting.exchange(NotWaiting) == WaitDoorbell)
+        ring(ownBell);
+}
+
+void ShmChannel::clearDoorbell()
+{
+    uint64_t count;
+    ssize_t ret = ::read(ownBell, &count, sizeof(count));
+    (void)ret;
+}
+
+bool ShmChannel::peerClosed() const
+{
+    if (in->closed.load(memory_order_acquire))
+        return true;
+    //nothing is ever sent on the socket after the offer, so readable means hung up
+    struct pollfd pfd = {sock, POLLIN | POLLRDHUP, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+void ShmChannel::ring(int bell)
+{
+    uint64_t one = 1;
+    ssize_t ret = ::write(bell, &one, sizeof(one));
+    (void)ret;
+}
@@ -0,0 +1,88 @@
+//Shared memory transport for clients on the same host as the server
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//One direction of a channel, at the start of its page in the shared segment with the
+//ring's bytes on the pages after it. head and tail count every byte ever written and
+//read, so the ring is empty when they are equal and full when they are capacity apart;
+//each is written by one side only and sits on its own cache line.
+struct ShmRing {
+    alignas(64) std::atomic<uint64_t> head;           //producer
+    alignas(64) std::atomic<uint64_t> tail;           //consumer
+    alignas(64) std::atomic<uint32_t> consumerWaiting;   //asleep on its doorbell, wants a ring on data
+    std::atomic<uint32_t> producerWaiting;   //a WaitFor, wants a wakeup when there is room
+    std::atomic<uint32_t> roomSeq;           //futex word, bumped for a producer waiting on it
+    std::atomic<uint32_t> closed;            //the producer has gone
+};
+
+//A pair of single producer single consumer byte rings in a memfd shared by the server
+//and one client, carrying the same frames the TCP stream would. The client connects to
+//the server's Unix socket, which answers by passing over the memfd and two eventfd
+//doorbells, one each side sleeps on; the socket then stays open only so either side
+//sees the other go away.
+//
+//Nothing is a syscall while both sides keep up. A consumer that finds its ring empty
+//says it is going to sleep with idle() before waiting on its doorbell, and a producer
+//only rings the doorbell when it sees that. A producer that finds the ring full waits
+//on a futex (writeAll(), for threads that can block) or asks for its own doorbell to
+//be rung (awaitRoom(), for an event loop).
+class ShmChannel {
+public:
+    enum WaitFor : uint32_t { NotWaiting = 0, WaitFutex, WaitDoorbell };
+    static const size_t defaultRingBytes = 256 * 1024;
+
+    ShmChannel() = default;
+    ~ShmChannel();
+    ShmChannel(const ShmChannel &) = delete;
+    ShmChannel &operator=(const ShmChannel &) = delete;
+
+    //Server side, on a client just accepted on the Unix socket, which stays the
+    //caller's: sets up rings of ringBytes (a power of two) each way and hands them over
+    bool offer(int sock, size_t ringBytes, std::string &why);
+    //Client side: connects to the server's Unix socket at path and maps the rings it offers
+    bool connect(const char *path, std::string &why);
+
+    //Copy out up to len bytes, or in as much of len as there is room for; how many.
+    //One thread reads and one writes at a time.
+    size_t read(char *to, size_t len);
+    size_t write(const void *data, size_t len);
+    //write() that waits on a futex while the ring is full; false once the peer has gone
+    bool writeAll(const void *data, size_t len);
+
+    //The consumer is about to wait on doorbell(): true if it may, false if data came in
+    //meanwhile and it should read() again instead
+    bool idle();
+    //A producer that couldn't write everything wants doorbell() rung when there is room.
+    //Rings it at once if room came up meanwhile.
+    void awaitRoom();
+    //eventfd to poll for data or room; drain it with clearDoorbell() once it fires
+    int doorbell() const { return ownBell; }
+    void clearDoorbell();
+    //the Unix socket the channel was set up on, readable only when the peer hangs up
+    int socket() const { return sock; }
+    bool peerClosed() const;
+
+private:
+    bool map(int memfd, size_t ringBytes, bool server, std::string &why);
+    void ring(int bell);
+
+    void *segment = nullptr;
+    size_t segmentBytes = 0;
+    ShmRing *in = nullptr;
+    ShmRing *out = nullptr;
+    char *inBytes = nullptr;
+    char *outBytes = nullptr;
+    size_t capacity = 0;
+    int ownBell = -1;
+    int peerBell = -1;
+    int sock = -1;
+    bool ownsSock = false;    //the client's, closed with the channel
+};
+
+#endif
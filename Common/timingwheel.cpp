@@ -0,0 +1,113 @@
+//Hierarchical timing wheel for large numbers of cheap timeouts
+
+#include "timingwheel.h"
+
+TimingWheel::TimingWheel(uint64_t now)
+    : current(now), live(0)
+{
+    //node 0 is the null link
+    nodes.push_back(Node{});
+    for (uint32_t &head : heads)
+        head = 0;
+}
+
+TimingWheel::Handle TimingWheel::schedule(uint64_t expiresAt, uint64_t data)
+{
+    uint32_t index;
+    if (!freeNodes.empty())
+    {
+        index = freeNodes.back();
+        freeNodes.pop_back();
+    }
+    else
+    {
+        index = (uint32_t)nodes.size();
+        nodes.push_back(Node{});
+    }
+    Node &node = nodes[index];
+    node.expires = expiresAt;
+    node.data = data;
+    link(index, false);
+    live++;
+    return ((uint64_t)node.generation << 32) | index;
+}
+
+bool TimingWheel::cancel(Handle handle)
+{
+    uint32_t index = (uint32_t)handle;
+    if (index == 0 || index >= nodes.size() || nodes[index].generation != (uint32_t)(handle >> 32))
+        return false;
+    unlink(index);
+    release(index);
+    return true;
+}
+
+uint64_t TimingWheel::ticksUntilNext() const
+{
+    if (live == 0)
+        return UINT64_MAX;
+    for (uint64_t ahead = 1; ahead < slots; ahead++)
+        if (heads[(current + ahead) & (slots - 1)] != 0)
+            return ahead;
+    //everything is on the upper levels, look again when the next cascade happens
+    return slots - (current & (slots - 1));
+}
+
+//Puts a node in the slot matching how far off it is. A newly scheduled timer that is
+//already due goes in the next tick's slot (this one may be done, or being fired right
+//now); a cascaded one can still make the current tick, which has yet to fire.
+void TimingWheel::link(uint32_t index, bool cascading)
+{
+    Node &node = nodes[index];
+    uint64_t earliest = cascading ? current : current + 1;
+    uint64_t expires = node.expires > earliest ? node.expires : earliest;
+    uint64_t delta = expires - current;
+
+    unsigned level = 0;
+    while (level < levels - 1 && delta >= (1ull << (slotBits * (level + 1))))
+        level++;
+    //beyond the top level's reach: park it in the furthest slot, it is re-placed on cascade
+    if (delta >= (1ull << (slotBits * levels)))
+        expires = current + (1ull << (slotBits * levels)) - 1;
+
+    unsigned slot = level * slots + ((expires >> (slotBits * level)) & (slots - 1));
+    node.slot = (uint16_t)slot;
+    node.prev = 0;
+    node.next = heads[slot];
+    if (node.next != 0)
+        nodes[node.next].prev = index;
+    heads[slot] = index;
+}
+
+void TimingWheel::unlink(uint32_t index)
+{
+    Node &node = nodes[index];
+    if (node.prev != 0)
+        nodes[node.prev].next = node.next;
+    else
+        heads[node.slot] = node.next;
+    if (node.next != 0)
+        nodes[node.next].prev = node.prev;
+}
+
+//Bumping the generation invalidates every handle to the node
+void TimingWheel::release(uint32_t index)
+{
+    nodes[index].generation++;
+    freeNodes.push_back(index);
+    live--;
+}
+
+//Re-places every timer in this level's current slot; they all land lower down
+void TimingWheel::cascade(unsigned level)
+{
+    unsigned slot = level * slots + ((current >> (slotBits * level)) & (slots - 1));
+    uint32_t index = heads[slot];
+    heads[slot] = 0;
+    while (index != 0)
+    {
+        uint32_t next = nodes[index].next;
+        link(index, true);
+        index = next;
+    }
+}
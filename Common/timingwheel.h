@@ -0,0 +1,107 @@
+//Hierarchical timing wheel for large numbers of cheap timeouts
+
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Four levels of 256 slots; a tick is whatever unit the caller counts in (the client
+//uses milliseconds). Level 0 holds timers due within 256 ticks, one slot per tick;
+//each level above covers 256 times the span of the one below and is cascaded down
+//as time reaches it. Scheduling and cancelling are O(1): timers live in a node pool
+//linked into their slot's list, so no allocation happens once the pool has grown.
+//
+//Handles carry a generation, so cancelling a timer that already fired (and whose
+//node was reused) is a harmless no-op. Not thread safe.
+class TimingWheel {
+public:
+    typedef uint64_t Handle;     //0 is never a valid handle
+
+    static const unsigned levels = 4;
+    static const unsigned slotBits = 8;
+    static const unsigned slots = 1u << slotBits;
+
+    explicit TimingWheel(uint64_t now = 0);
+
+    //fires during the first advance() that reaches expiresAt, data is handed back
+    Handle schedule(uint64_t expiresAt, uint64_t data);
+    //false if the timer already fired or was cancelled
+    bool cancel(Handle handle);
+
+    //moves time forward to now, calling fire(data) for every timer that came due
+    template <typename F>
+    void advance(uint64_t now, F fire);
+
+    uint64_t now() const { return current; }
+    size_t size() const { return live; }
+    //ticks until the next timer may fire (exact within 256 ticks, otherwise the next
+    //cascade); UINT64_MAX if nothing is scheduled. For poll() timeouts.
+    uint64_t ticksUntilNext() const;
+
+private:
+    struct Node {
+        uint64_t expires;
+        uint64_t data;
+        uint32_t prev;           //node indexes, 0 is the null node
+        uint32_t next;
+        uint32_t generation;
+        uint16_t slot;           //level * slots + slot, while linked
+    };
+
+    void link(uint32_t index, bool cascading);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    void cascade(unsigned level);
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> freeNodes;
+    uint32_t heads[levels * slots];
+    uint64_t current;
+    size_t live;
+};
+
+template <typename F>
+void TimingWheel::advance(uint64_t now, F fire)
+{
+    //nothing pending: just move the clock
+    if (live == 0)
+    {
+        if (now > current)
+            current = now;
+        return;
+    }
+    while (current < now)
+    {
+        current++;
+        unsigned index = current & (slots - 1);
+        //a level 0 lap is complete: pull the next slot of each level above down,
+        //highest level first so its timers can land in the level below's fresh slot
+        if (index == 0)
+        {
+            unsigned top = 1;
+            while (top < levels - 1 && ((current >> (slotBits * top)) & (slots - 1)) == 0)
+                top++;
+            for (unsigned level = top; level >= 1; level--)
+                cascade(level);
+        }
+        //take one timer at a time, fire() may cancel or schedule others
+        uint32_t &head = heads[index];
+        while (head != 0)
+        {
+            uint32_t node = head;
+            uint64_t data = nodes[node].data;
+            unlink(node);
+            release(node);
+            fire(data);
+        }
+        if (live == 0)
+        {
+            current = now;
+            return;
+        }
+    }
+}
+
+#endif
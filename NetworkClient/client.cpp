@@ -1,139 +1,392 @@
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <poll.h>
 #include <ctime>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/checksum.h"
+#include "../Common/readiness.h"
+#include "../Common/ackbatch.h"
+#include "../Common/history.h"
+#include "../Common/compress.h"
+#include "../Common/shmring.h"
+#include "../Common/sendpipeline.h"
+#include "../Common/reliable.h"
+#include "../Common/console.h"
+#include "../Common/log.h"
 
 // Using individual declarations to avoid std:: prefixes
 using namespace std;
 
-// Define the message header structure
-struct MessageHeader
+// Ids used for routing: the server is always 1, clients pick theirs on the command line
+const uint16_t SERVER_ID = 1;
+uint16_t client_id = 2; // This client's ID
+uint16_t peer_id = 1;   // Who chat messages go to, the server by default
+
+// Reliable delivery: chats are resent until ACKed, and resent chats we already showed are
+// only ACKed again. Both threads send and receive, so the tables share one lock.
+mutex reliableLock;
+RetransmitQueue retransmits(500, 6, reliable_NowMs()); // 0.5 s first timeout, doubling to 4 s, 6 tries
+DuplicateFilter duplicates(60000, reliable_NowMs());    // well past the sender's last retry
+
+// Set once the server's status response says it takes and sends compressed chats
+atomic<bool> compressChats{false};
+
+// Where the server is, "host:port" on the command line
+string serverHost = "192.168.190.19";
+unsigned short serverPort = 8080;
+
+// Set when the server is on this host and we connected to its local socket: frames then
+// go through shared memory rings, which take one writer at a time, and both threads send.
+// A reconnect swaps in new rings under the same lock.
+string localPath;
+unique_ptr<ShmChannel> localRings;
+mutex localSendLock;
+
+// The socket we are connected on, the rings' one when using them; replaced on reconnects
+atomic<int> serverSock{-1};
+
+// Token of our session on the server, 0 until the first status response; a reconnect
+// resumes the session with it
+atomic<uint64_t> sessionToken{0};
+
+// Over TCP both threads' frames go through the pipeline, which writes them out together
+SendPipeline *pipeline = nullptr;
+
+// message_id of the last frame sent, from either thread
+atomic<uint32_t> message_counter{0};
+
+// Sends encoded frames through the rings, or the pipeline when there are none
+bool sendWire(const uint8_t *wire, size_t len)
 {
-    uint8_t header_length;
-    uint8_t message_type;
-    uint32_t timestamp;
-    uint16_t sender_id;
-    uint16_t receiver_id;
-    uint32_t message_id;
-    uint16_t payload_length;
-};
+    if (localPath.empty())
+        return pipeline->send(wire, len);
+    lock_guard<mutex> guard(localSendLock);
+    return localRings->writeAll(wire, len);
+}
+
+// The receive thread hands what it shows to the console thread, which formats and prints
+// it in batches, so slow terminal output never holds up reading the socket
+Console console;
 
 // Function to send a message (MessageHeader)
-void sendMessage(int sock, uint8_t message_type, const string &message)
+// receiver defaults to peer_id, replies pass the ID of the client being answered
+void sendMessage(uint8_t message_type, const string &message, uint16_t receiver = 0)
 {
-    static int message_counter = 0; // Static counter for unique message IDs
+    // Longer chats go out compressed if the server agreed to it and it makes them smaller
+    const string *payload = &message;
+    string compressed;
+    if ((message_type == 3 || message_type == 8) && compressChats && message.size() >= compressMinBytes &&
+        compress_Chat(message.data(), message.size(), compressed))
+    {
+        payload = &compressed;
+        message_type |= compressedFlag;
+    }
 
     MessageHeader header;
-    header.header_length = sizeof(MessageHeader);
-    header.message_type = message_type; // CHAT
+    header.headerLen = headerWireLen;
+    header.messageType = message_type; // CHAT
 
     // Set the current time as timestamp
-    header.timestamp = static_cast<uint32_t>(time(nullptr));
-    header.sender_id = 2;                  // Client ID
-    header.receiver_id = 1;                // Server ID
+    header.timeStamp = static_cast<uint32_t>(time(nullptr));
+    header.sender_id = client_id;
+    header.receiver_id = receiver ? receiver : peer_id;
     header.message_id = ++message_counter; // Generate unique message ID
-    header.payload_length = message.size();
+    header.payloadLen = payload->size();
+    header.checksum = 0; // filled in when the frame is encoded
 
-    // Combining MessageHeader and payload into single buffer:
-    // Calculate the total size of the message
-    // size_t represents the size of an object in bytes
-    size_t total_size = sizeof(header) + message.size();
+    // Chats are kept, encoded, until they are acknowledged so they can be resent as they were
+    if (frame_Type(message_type) == 3 || frame_Type(message_type) == 8)
+    {
+        string wire(headerWireLen + payload->size(), '\0');
+        if (frame_Encode(header, payload->data(), payload->size(), (uint8_t *)&wire[0]) == 0)
+        {
+            LOG_WARN("Message too long");
+            return;
+        }
+        lock_guard<mutex> guard(reliableLock);
+        if (!sendWire((const uint8_t *)wire.data(), wire.size()))
+            LOG_ERROR("Error sending message: %s", strerror(errno));
+        retransmits.track(header.message_id, std::move(wire), reliable_NowMs());
+        return;
+    }
 
-    // Allocate memory for the combined buffer
-    char *buffer = new char[total_size];
+    // The rings take the frame whole, so it is encoded first
+    if (!localPath.empty())
+    {
+        string wire(headerWireLen + message.size(), '\0');
+        if (frame_Encode(header, message.data(), message.size(), (uint8_t *)&wire[0]) == 0 ||
+            !sendWire((const uint8_t *)wire.data(), wire.size()))
+            LOG_ERROR("Error sending message to the local server");
+        return;
+    }
 
-    // Copy the header to the buffer
-    memcpy(buffer, &header, sizeof(header));
+    // Encoded straight into the pipeline, behind whatever else is waiting to go out
+    if (!pipeline->send(header, message.data(), message.size()))
+        LOG_ERROR("Error sending message: %s", strerror(errno));
+}
 
-    // Copy the message payload to the buffer after the header
-    memcpy(buffer + sizeof(header), message.c_str(), message.size());
+// Resends chats whose ACK is overdue, or that were NACKed
+void resendOverdue()
+{
+    lock_guard<mutex> guard(reliableLock);
+    retransmits.expire(
+        reliable_NowMs(),
+        [](uint32_t, const string &wire) {
+            sendWire((const uint8_t *)wire.data(), wire.size());
+        },
+        [](uint32_t message_id) {
+            console.print("Message ID " + to_string(message_id) + " could not be delivered", 0, true);
+        });
+}
 
-    // Send the combined buffer over the socket
-    // Send all bytes of buffer through socket
-    send(sock, buffer, total_size, 0);
+// A status request's payload: compressed chats, and the session to resume or a new one
+string statusPayload()
+{
+    string payload = string(compressFeature) + " ";
+    uint64_t token = sessionToken;
+    if (token == 0)
+        return payload + sessionFeature;
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%llx", (unsigned long long)token);
+    return payload + resumeFeature + hex;
+}
 
-    // Free the allocated memory
-    delete[] buffer;
+// ACK and NACK payloads carry the message ID they are about as text
+uint32_t payloadMessageId(const string &message)
+{
+    return static_cast<uint32_t>(strtoul(message.c_str(), nullptr, 10));
 }
 
 // Function to handle server responses/retrieve msgs
 // Different ways to respond depending on msgs type
-void handleServerResponse(int sock)
+// Sleeps in poll() until data arrives, a resend is due, or exitfd is signalled on quit.
+// Returns true when the connection was lost, false on quit.
+bool receiveFrames(int sock, int exitfd)
 {
-    char buffer[1024];
+    FrameDecoder decoder;
+    Frame frame;
     while (true)
     {
-        // writes into the buffer from socket file descriptor
-        int bytesRead = recv(sock, buffer, sizeof(buffer), 0);
-        if (bytesRead > 0)
+        int timeout;
         {
-            // cast buffer into MessageHeader
-            MessageHeader *header = reinterpret_cast<MessageHeader *>(buffer);
-
-            // Convert timestamp to human-readable format
-            time_t raw_time = header->timestamp;
-            struct tm *time_info = localtime(&raw_time);
-            char time_str[20];
-            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", time_info); // FORMAT time into string
+            lock_guard<mutex> guard(reliableLock);
+            timeout = retransmits.msUntilNext();
+        }
+        // On the rings, only sleep once the server knows to ring our doorbell
+        bool timedOut = false;
+        bool readable;
+        if (!localRings)
+            readable = waitReadable(sock, exitfd, timeout, timedOut);
+        else if ((readable = !localRings->idle()) == false &&
+                 (readable = waitReadable(localRings->doorbell(), sock, exitfd, timeout, timedOut)))
+            localRings->clearDoorbell();
+        resendOverdue();
+        if (!readable)
+        {
+            if (timedOut)
+                continue;
+            return false;
+        }
 
-            // Display the timestamp and message content
-            cout << "\n[" << time_str << "]: ";
+        // writes into the decoder's buffer from socket file descriptor, or the rings
+        char *space = decoder.writePtr();
+        int bytesRead;
+        if (!localRings)
+            bytesRead = recv(sock, space, decoder.writable(), 0);
+        else if ((bytesRead = (int)localRings->read(space, decoder.writable())) == 0 && !localRings->peerClosed())
+            continue; // a doorbell rung for room, or for data we had already read
+        if (bytesRead > 0)
+        {
+            decoder.commit(bytesRead);
 
-            string message(buffer + sizeof(MessageHeader), header->payload_length);
-            switch (header->message_type)
+            // a read can carry several messages, or only part of one
+            while (decoder.next(frame))
             {
-            case 1: // ON_REQ
-                cout << "Received online status request from server" << endl;
-                sendMessage(sock, 2, "Online status response"); // Respond with ON_RES
-                break;
-            case 2: // ON_RES
-                cout << "Received online status response from server" << endl;
-                break;
-            case 3: // CHAT
-                cout << "Server: " << message << endl;
-
-                // Send ACK for the received chat message
-                sendMessage(sock, 4, to_string(header->message_id));
-
-                break;
-            case 4: // ACK
-                cout << "Received ACK for message ID: " << header->message_id << endl;
-                break;
-            case 5: // NACK
-                cerr << "Received NACK for message ID: " << header->message_id << endl;
-                break;
-            case 6: // ERR
-                cout << "Received error message from server: " << message << endl;
-                break;
-            default:
-                cerr << "Server: Unknown message type received" << endl;
-                break;
+                const MessageHeader *header = &frame.header;
+
+                // A resent chat we already showed: its ACK got lost, so only ACK it again
+                uint8_t type = frame_Type(header->messageType);
+                if ((type == 3 || type == 8) &&
+                    checkSum_Check(frame.wire, frame.payload, header->payloadLen))
+                {
+                    bool first;
+                    {
+                        lock_guard<mutex> guard(reliableLock);
+                        first = duplicates.firstTime(header->sender_id, header->message_id, reliable_NowMs());
+                    }
+                    if (!first)
+                    {
+                        if (type == 3)
+                            sendMessage(4, to_string(header->message_id), header->sender_id);
+                        continue;
+                    }
+                }
+
+                // Each line is shown with the frame's timestamp, formatted by the console thread
+                uint32_t stamp = header->timeStamp;
+
+                // Drop corrupted messages and tell the server which one it was
+                if (!checkSum_Check(frame.wire, frame.payload, header->payloadLen))
+                {
+                    console.print("Invalid checksum on message ID: " + to_string(header->message_id), stamp, true);
+                    sendMessage(6, to_string(header->message_id), header->sender_id);
+                    continue;
+                }
+
+                // A compressed chat is shown as the text it expands to; one that doesn't expand is corrupt
+                string message;
+                if (!frame_Compressed(header->messageType))
+                    message.assign(frame.payload, header->payloadLen);
+                else if (!compress_Expand(frame.payload, header->payloadLen, message))
+                {
+                    console.print("Corrupt compressed message ID: " + to_string(header->message_id), stamp, true);
+                    sendMessage(6, to_string(header->message_id), header->sender_id);
+                    continue;
+                }
+                switch (type)
+                {
+                case 1: // ON_REQ
+                    console.print("Received online status request from server", stamp);
+                    sendMessage(2, "Online status response", header->sender_id); // Respond with ON_RES
+                    break;
+                case 2: // ON_RES, listing after the message ID what the server agreed to
+                {
+                    if (message.find(string(" ") + compressFeature) != string::npos)
+                        compressChats = true;
+                    uint64_t token = session_Token(message.data(), message.size(), (string(sessionFeature) + "=").c_str());
+                    uint64_t had = sessionToken.exchange(token);
+                    if (had != 0 && token != had)
+                        console.print("The server no longer had our session, chats sent to us while away may be lost", stamp, true);
+                    console.print("Received online status response from server", stamp);
+                    break;
+                }
+                case 3: // CHAT
+                    if (header->sender_id == SERVER_ID)
+                        console.print("Server: " + message, stamp);
+                    else
+                        console.print("Client " + to_string(header->sender_id) + ": " + message, stamp);
+
+                    // Send ACK for the received chat message back to whoever sent it
+                    sendMessage(4, to_string(header->message_id), header->sender_id);
+
+                    break;
+                case 4: // ACK
+                {
+                    uint32_t acked = payloadMessageId(message);
+                    {
+                        lock_guard<mutex> guard(reliableLock);
+                        retransmits.acknowledge(acked);
+                    }
+                    console.print("Received ACK for message ID: " + to_string(acked), stamp);
+                    break;
+                }
+                case 9: // RANGE ACK, the server acknowledges chats in batches
+                {
+                    string ids = "Received ACK for message IDs:";
+                    for (size_t i = 0; i < ackRange_Count(header->payloadLen); i++)
+                    {
+                        uint32_t first, last;
+                        ackRange_Load(frame.payload, i, first, last);
+                        // anyone can send us one of these, a reversed range is garbage
+                        if (first > last)
+                            continue;
+                        {
+                            lock_guard<mutex> guard(reliableLock);
+                            retransmits.acknowledgeRange(first, last);
+                        }
+                        ids += " " + to_string(first);
+                        if (last != first)
+                            ids += "-" + to_string(last);
+                    }
+                    console.print(ids, stamp);
+                    break;
+                }
+                case 5: // NACK, resent shortly
+                {
+                    uint32_t nacked = payloadMessageId(message);
+                    {
+                        lock_guard<mutex> guard(reliableLock);
+                        retransmits.nack(nacked, reliable_NowMs());
+                    }
+                    console.print("Received NACK for message ID: " + to_string(nacked), stamp, true);
+                    break;
+                }
+                case 6: // ERR
+                    console.print("Received error message from server: " + message, stamp);
+                    break;
+                case 8: // ROOM CHAT
+                    console.print("[room " + to_string(header->receiver_id) + "] Client " + to_string(header->sender_id) +
+                                      ": " + message,
+                                  stamp);
+                    break;
+                case 10: // STATS, the server's metrics as text
+                    console.print("Server stats:\n" + message, stamp);
+                    break;
+                case 12: // HISTORY, stored chats back to back, each shown with its own timestamp
+                {
+                    if (header->payloadLen == 0)
+                    {
+                        console.print("End of history", stamp);
+                        break;
+                    }
+                    const uint8_t *at = (const uint8_t *)frame.payload, *end = at + header->payloadLen;
+                    while (end - at >= (ptrdiff_t)headerWireLen)
+                    {
+                        MessageHeader chat = header_Decode(at);
+                        if (end - at < (ptrdiff_t)(headerWireLen + chat.payloadLen))
+                            break;
+                        const char *body = (const char *)at + headerWireLen;
+                        string text;
+                        if (!frame_Compressed(chat.messageType))
+                            text.assign(body, chat.payloadLen);
+                        else if (!compress_Expand(body, chat.payloadLen, text))
+                            text = "(corrupt)";
+                        string who = chat.sender_id == client_id ? "You" : "Client " + to_string(chat.sender_id);
+                        console.print("[history] " + who + ": " + text, chat.timeStamp);
+                        at += headerWireLen + chat.payloadLen;
+                    }
+                    break;
+                }
+                default:
+                    console.print("Server: Unknown message type received", stamp, true);
+                    break;
+                }
             }
 
-            cout << "Enter message: ";
-            cout.flush();
+            if (decoder.corrupt())
+            {
+                console.print("Corrupt message stream from server.", 0, true);
+                return true;
+            }
         }
         else if (bytesRead == 0)
         {
             // Connection closed by server
-            cout << "\nServer disconnected." << endl;
-            close(sock);
-            return;
+            console.print("Server disconnected.");
+            return true;
         }
         else
         {
-            cerr << "Error receiving message: " << strerror(errno) << endl;
-            close(sock);
-            return;
+            if (errno == EINTR)
+                continue;
+            console.print(string("Error receiving message: ") + strerror(errno), 0, true);
+            return true;
         }
     }
 }
 
-int main()
+// Connects over TCP, showing both ends of the connection; -1 if it failed
+int connectToServer()
 {
     int sock = 0;
     struct sockaddr_in serv_addr;
@@ -146,8 +399,8 @@ int main()
     }
 
     serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(8080);                        // Port number for the server
-    serv_addr.sin_addr.s_addr = inet_addr("192.168.190.19"); // Server IP address, REPLACE this using server IP (use Windows wireless IP forwarded to WSL IP). Client and server must be connected to the same wifi network
+    serv_addr.sin_port = htons(serverPort);                    // Port number for the server
+    serv_addr.sin_addr.s_addr = inet_addr(serverHost.c_str()); // Server IP address, e.g. the Windows wireless IP forwarded to WSL. Client and server must be on the same network
 
     // Step 2: Connect to the server, -1 means error
     if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
@@ -187,11 +440,126 @@ int main()
         cout << "Connected to IP: " << remoteIP << ", Port: " << ntohs(remoteAddress.sin_port) << endl;
     }
 
-    // Step 3: Send an online status request
-    sendMessage(sock, 1, "");
+    return sock;
+}
+
+// Connects again after the connection dropped, retrying with a growing pause until it
+// works or we quit, and resumes our session: the server sends again the chats we hadn't
+// ACKed, and we resend every chat of ours that wasn't ACKed. False on quit.
+bool reconnect(int exitfd)
+{
+    unsigned pauseMs = 0; // the first try goes straight away
+    while (true)
+    {
+        struct pollfd quit = {exitfd, POLLIN, 0};
+        if (poll(&quit, 1, pauseMs) > 0)
+            return false;
+        pauseMs = min(max(pauseMs * 2, 50u), 2000u);
+
+        if (localPath.empty())
+        {
+            int sock = connectToServer();
+            if (sock < 0)
+                continue;
+            pipeline->reattach(sock);
+            close(serverSock.exchange(sock));
+        }
+        else
+        {
+            unique_ptr<ShmChannel> rings(new ShmChannel());
+            string why;
+            if (!rings->connect(localPath.c_str(), why))
+                continue;
+            lock_guard<mutex> guard(localSendLock);
+            localRings = std::move(rings); // the old rings close their socket
+            serverSock = localRings->socket();
+        }
+        console.print("Reconnected, resuming the session");
+
+        // The status request goes first so the server has resumed the session before our resent chats
+        sendMessage(1, statusPayload(), SERVER_ID);
+        lock_guard<mutex> guard(reliableLock);
+        retransmits.resendAll([](uint32_t, const string &wire) {
+            sendWire((const uint8_t *)wire.data(), wire.size());
+        });
+        return true;
+    }
+}
+
+// Receives until quit, reconnecting whenever the connection drops
+void handleServerResponse(int exitfd)
+{
+    while (receiveFrames(serverSock, exitfd) && reconnect(exitfd))
+        ;
+}
+
+// Usage: client [client id] [peer id] [server's local socket path, or -] [latency|throughput] [server host:port]
+// With the local socket path the server must be on this host, and frames go through
+// shared memory instead of TCP. Over TCP, latency (the default) writes every frame out
+// at once and throughput holds them back briefly to write a burst in a few calls. The
+// server is at 192.168.190.19:8080 unless given. A dropped connection is reconnected and
+// the session resumed, so chats in flight either way when it dropped still arrive.
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        client_id = static_cast<uint16_t>(atoi(argv[1]));
+    if (argc > 2)
+        peer_id = static_cast<uint16_t>(atoi(argv[2]));
+    SendPipeline::Mode sendMode = SendPipeline::LowLatency;
+    if (argc > 4)
+    {
+        string name = argv[4];
+        if (name == "throughput")
+            sendMode = SendPipeline::Throughput;
+        else if (name != "latency")
+        {
+            cerr << "Unknown send mode " << name << ", expected latency or throughput" << endl;
+            return -1;
+        }
+    }
+
+    if (argc > 5)
+    {
+        string address = argv[5];
+        size_t colon = address.rfind(':');
+        serverHost = address.substr(0, colon);
+        if (colon != string::npos)
+            serverPort = static_cast<unsigned short>(atoi(address.c_str() + colon + 1));
+    }
+
+    if (argc > 3 && string(argv[3]) != "-")
+    {
+        string why;
+        localRings.reset(new ShmChannel());
+        if (!localRings->connect(argv[3], why))
+        {
+            cerr << "Local connection failed: " << why << endl;
+            return -1;
+        }
+        localPath = argv[3];
+        cout << "Connected to the local server at " << argv[3] << endl;
+    }
+
+    serverSock = localRings ? localRings->socket() : connectToServer();
+    if (serverSock < 0)
+        return -1;
+    unique_ptr<SendPipeline> tcpPipeline;
+    if (!localRings)
+    {
+        tcpPipeline.reset(new SendPipeline(serverSock, sendMode));
+        pipeline = tcpPipeline.get();
+    }
+
+    // Step 3: Send an online status request, this also registers our ID with the server,
+    // offers to take compressed chats and asks for a session to resume if we get cut off
+    sendMessage(1, statusPayload(), SERVER_ID);
 
-    // Step 4: Create a thread to handle server responses
-    thread responseThread(handleServerResponse, sock);
+    // Step 4: Create a thread to handle server responses, and the console thread that shows them
+    console.setPrompt("Enter message: ");
+    console.start();
+    log_Start();
+    int exitfd = shutdownFd_Create();
+    thread responseThread(handleServerResponse, exitfd);
 
     // Step 5: Main loop to send chat messages
     string message;
@@ -208,9 +576,42 @@ int main()
 
         if (message == "ON_REQ")
         {
-            sendMessage(sock, 1, "");
+            sendMessage(1, statusPayload(), SERVER_ID);
             cout << "Sent online status request" << endl;
         }
+        else if (message == "/stats")
+        {
+            // The server's metrics, answered with a stats message
+            sendMessage(10, "", SERVER_ID);
+        }
+        else if (message.rfind("/history ", 0) == 0)
+        {
+            // Scrollback with another client: "/history 3" for the last 20 chats, "/history 3 100" for more
+            HistoryQuery query{};
+            char *rest;
+            query.peer = (uint16_t)strtoul(message.c_str() + 9, &rest, 10);
+            unsigned long count = strtoul(rest, nullptr, 10);
+            query.limit = (uint16_t)(count ? min(count, 65535ul) : 20);
+            query.to = UINT32_MAX;
+            string payload(historyQueryWireLen, '\0');
+            historyQuery_Encode(query, (uint8_t *)&payload[0]);
+            sendMessage(11, payload, SERVER_ID);
+        }
+        else if (message.rfind("/join ", 0) == 0 || message.rfind("/leave ", 0) == 0)
+        {
+            // Room membership: "/join 7" or "/leave 7"
+            bool joining = message[1] == 'j';
+            uint16_t room = (uint16_t)atoi(message.c_str() + message.find(' ') + 1);
+            sendMessage(7, string(1, joining ? 1 : 0), room);
+        }
+        else if (message.rfind("/room ", 0) == 0)
+        {
+            // Room chat: "/room 7 hello everyone" goes to every other member of room 7
+            size_t idStart = 6;
+            size_t textStart = message.find(' ', idStart);
+            uint16_t room = (uint16_t)atoi(message.c_str() + idStart);
+            sendMessage(8, textStart == string::npos ? "" : message.substr(textStart + 1), room);
+        }
         else
         {
             // Capture the current time for display purposes
@@ -221,15 +622,23 @@ int main()
 
             // Display the timestamp and message
             cout << "Client [" << time_str << "]: " << message << endl;
-            sendMessage(sock, 3, message);
+            sendMessage(3, message);
         }
     }
 
-    // Step 6: Close the socket and clean up
-    close(sock);
+    // Step 6: Wake the response thread, then close the socket and clean up
+    shutdownFd_Signal(exitfd);
 
     // join() - wait for thread to finish execution before the main program exits
     responseThread.join();
+    console.stop();
+    log_Stop();
+    if (localPath.empty())
+    {
+        pipeline->stop();
+        close(serverSock);
+    }
+    close(exitfd);
 
     return 0;
 }
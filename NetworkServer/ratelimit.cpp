@@ -0,0 +1,49 @@
+//Per sender rate limits for frames coming into the server
+//Author: Justin Jeirles
+
+#include "ratelimit.h"
+
+using namespace std;
+
+void RateLimiter::configure(double rate, unsigned burst)
+{
+    if (rate <= 0)
+    {
+        interval = 0;
+        return;
+    }
+    interval = (uint64_t)(1e9 / rate);
+    if (interval == 0)
+        interval = 1;
+    tolerance = interval * (burst > 0 ? burst - 1 : 0);
+    full.reset(new atomic<uint64_t>[UINT16_MAX + 1]);
+    for (size_t i = 0; i <= UINT16_MAX; i++)
+        full[i].store(0, memory_order_relaxed);
+    byAddress.reset(new atomic<uint64_t>[addressSlots]);
+    for (size_t i = 0; i < addressSlots; i++)
+        byAddress[i].store(0, memory_order_relaxed);
+}
+
+uint64_t RateLimiter::takeForAddress(uint32_t addr, uint64_t nowNs)
+{
+    //Fibonacci hashing, the top bits of the product spread neighbouring addresses apart
+    return take(byAddress[(uint32_t)(addr * 2654435769u) >> 20], nowNs);
+}
+
+uint64_t RateLimiter::take(atomic<uint64_t> &bucket, uint64_t nowNs)
+{
+    uint64_t seen = bucket.load(memory_order_relaxed);
+    while (1)
+    {
+        //there is a token as long as the bucket is full again within tolerance of now,
+        //taking it pushes that out by an interval
+        uint64_t from = seen > nowNs ? seen : nowNs;
+        if (from - nowNs > tolerance)
+        {
+            limited++;
+            return from - nowNs - tolerance;
+        }
+        if (bucket.compare_exchange_weak(seen, from + interval, memory_order_relaxed))
+            return 0;
+    }
+}
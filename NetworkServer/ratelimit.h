@@ -0,0 +1,44 @@
+//Per sender rate limits for frames coming into the server
+//Author: Justin Jeirles
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//A token bucket for every client id, refilled at rate frames a second and holding up
+//to burst. Each is kept as the one timestamp of the equivalent generic cell rate
+//algorithm: when the client's bucket would next be full again. Taking a token is a
+//compare-and-swap on it, so a client's connections on different workers share their
+//bucket without a lock. Frames from connections that haven't said who they are yet
+//take from a bucket for the address they came from, addresses hashed into
+//addressSlots of them, so reconnecting doesn't start a fresh one.
+class RateLimiter {
+public:
+    static const size_t addressSlots = 4096;
+
+    //rate 0 turns limiting off, which it is until configured
+    void configure(double rate, unsigned burst);
+    bool enabled() const { return interval != 0; }
+
+    //Takes a token for client at nowNs: 0 if it had one, otherwise how many ns until
+    //it will, and nothing is taken
+    uint64_t take(uint16_t client, uint64_t nowNs) { return take(full[client], nowNs); }
+    //the same for a frame from an IPv4 address (host order) that no client id is known for
+    uint64_t takeForAddress(uint32_t addr, uint64_t nowNs);
+
+    std::atomic<uint64_t> limited{0};    //frames turned away or held back
+
+private:
+    uint64_t take(std::atomic<uint64_t> &bucket, uint64_t nowNs);
+
+    uint64_t interval = 0;     //ns one token takes to come back
+    uint64_t tolerance = 0;    //how far ahead of now a sender may run, burst - 1 intervals
+    std::unique_ptr<std::atomic<uint64_t>[]> full;   //by client id, ns the bucket is full again
+    std::unique_ptr<std::atomic<uint64_t>[]> byAddress;   //the same by hashed address
+};
+
+#endif
@@ -0,0 +1,1122 @@
+//Edge-triggered epoll event loop for the messaging server
+//Author: Justin Jeirles
+
+#include "reactor.h"
+#include "uring.h"
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include "../Common/log.h"
+
+using namespace std;
+
+static const int maxEvents = 256;
+
+//recv() calls one connection gets per loop turn before the others have theirs, so a
+//client that never stops sending can't starve the rest
+static const int maxReadsPerTurn = 16;
+//connections cut off mid-read, or tasks posted, that a loop turn has room for up front
+static const size_t turnReserve = 64;
+
+//queued frames handed to the kernel per sendmsg() when flushing
+static const int maxFlushFrames = 64;
+
+//io_uring engine: submission queue size, and the recv buffers the kernel picks from
+static const unsigned uringEntries = 4096;
+static const unsigned recvBufferCount = 256;
+static const unsigned recvBufferSize = 8192;
+
+//What a completion is for, in the low bits of its user_data; the rest is the Connection
+//it belongs to, if any (they are at least 8 byte aligned)
+enum : uint64_t { TagAccept = 1, TagWake, TagTimer, TagRecv, TagSend, TagCancel, TagMask = 7 };
+
+//epoll data of a local client's doorbell: its connection's fd with this bit above it,
+//where every other registration has only an fd
+static const uint64_t doorbellTag = 1ull << 32;
+
+static uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+Reactor::Reactor(FrameHandler handler)
+    : epfd(-1), listenfd(-1), wakefd(-1), sparefd(-1), timerfd(-1), localfd(-1), nextId(1),
+      stopping(false), connCount(0), timerSeq(0), armedFor(0), onFrame(std::move(handler)),
+      maxQueueBytes(256 * 1024), policy(NackWhenFull), connCap(nullptr), sampleTick(0)
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sparefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    //room for what a busy loop turn leaves for the next, so the loop doesn't allocate
+    readAgain.reserve(turnReserve);
+    readingAgain.reserve(turnReserve);
+    posted.reserve(turnReserve);
+    running.reserve(turnReserve);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakefd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+    ev.data.fd = timerfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev);
+}
+
+Reactor::~Reactor()
+{
+    for (auto &entry : conns)
+        close(entry.first);
+    for (auto &entry : closed)
+        close(entry.first->fd);
+    //the kernel tears a ring down after we have gone, and an accept still armed in it
+    //keeps the listener alive until then, taking connections meant for a new server on
+    //the port; shut down, it stops listening now
+    if (listenfd != -1)
+        shutdown(listenfd, SHUT_RDWR);
+    ring.reset();
+    if (listenfd != -1)
+        close(listenfd);
+    if (localfd != -1)
+    {
+        close(localfd);
+        unlink(localPath.c_str());
+    }
+    close(sparefd);
+    close(timerfd);
+    close(wakefd);
+    close(epfd);
+}
+
+bool Reactor::listenOn(unsigned short port, bool reusePort)
+{
+    struct sockaddr_in saddr;
+
+    if ((listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        LOG_ERROR("%s", strerror(errno));
+        return false;
+    }
+    int on = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reusePort && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        LOG_ERROR("SO_REUSEPORT: %s", strerror(errno));
+        close(listenfd);
+        listenfd = -1;
+        return false;
+    }
+
+    memset(&saddr, '\0', sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    saddr.sin_port = htons(port);
+
+    if (bind(listenfd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0 || listen(listenfd, SOMAXCONN) < 0)
+    {
+        LOG_ERROR("%s", strerror(errno));
+        close(listenfd);
+        listenfd = -1;
+        return false;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listenfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+    return true;
+}
+
+bool Reactor::listenLocal(const string &path)
+{
+    if (ring)
+    {
+        LOG_ERROR("Local clients need the epoll engine");
+        return false;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        LOG_ERROR("Local socket path too long: %s", path.c_str());
+        return false;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+
+    //a socket file left behind by a server that didn't exit cleanly would fail the bind
+    unlink(path.c_str());
+    if ((localfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(localfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(localfd, SOMAXCONN) < 0)
+    {
+        LOG_ERROR("%s: %s", path.c_str(), strerror(errno));
+        if (localfd != -1)
+            close(localfd);
+        localfd = -1;
+        return false;
+    }
+    localPath = path;
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = localfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, localfd, &ev);
+    return true;
+}
+
+void Reactor::run()
+{
+    if (ring)
+    {
+        runUring();
+        return;
+    }
+    epoll_event events[maxEvents];
+
+    while (!stopping.load())
+    {
+        //connections with data left over from last turn mean we must not sleep
+        int n = epoll_wait(epfd, events, maxEvents, readAgain.empty() ? -1 : 0);
+        io.syscalls++;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("epoll_wait: %s", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == wakefd)
+            {
+                uint64_t count;
+                while (read(wakefd, &count, sizeof(count)) > 0)
+                    io.syscalls++;
+                io.syscalls++;
+                runPosted();
+            }
+            else if (fd == timerfd)
+                runTimers();
+            else if (fd == listenfd)
+                acceptAll();
+            else if (fd == localfd)
+                acceptLocal();
+            else
+            {
+                auto it = conns.find(fd);
+                if (it == conns.end())
+                    continue;
+                //a local client's socket only ever reports it hanging up
+                if (events[i].data.u64 & doorbellTag)
+                {
+                    ringsReady(*it->second);
+                    continue;
+                }
+                if (it->second->shm)
+                {
+                    closeConnection(fd);
+                    continue;
+                }
+                if ((events[i].events & EPOLLOUT) && !flush(*it->second))
+                    continue;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    readAll(*it->second);
+            }
+        }
+
+        //edge triggered: no new event comes for data we left unread, so go back for it
+        readingAgain.swap(readAgain);
+        for (auto &entry : readingAgain)
+            if (Connection *conn = connection(entry.first, entry.second))
+                readAll(*conn);
+        readingAgain.clear();
+    }
+}
+
+void Reactor::stop()
+{
+    stopping.store(true);
+    uint64_t one = 1;
+    write(wakefd, &one, sizeof(one));
+}
+
+void Reactor::post(function<void()> task)
+{
+    {
+        lock_guard<mutex> guard(postLock);
+        posted.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    write(wakefd, &one, sizeof(one));
+    io.syscalls++;
+}
+
+void Reactor::forEachConnection(const function<void(Connection &)> &fn)
+{
+    for (auto &entry : conns)
+        fn(*entry.second);
+}
+
+//Null if the connection has closed, even if its fd has been handed out again
+Connection *Reactor::connection(int fd, uint32_t connId)
+{
+    auto it = conns.find(fd);
+    if (it == conns.end() || it->second->id != connId)
+        return nullptr;
+    return it->second.get();
+}
+
+void Reactor::setSendLimit(size_t maxBytes, SendPolicy whenFull)
+{
+    maxQueueBytes = maxBytes;
+    policy = whenFull;
+}
+
+Reactor::SendResult Reactor::send(Connection &conn, const uint8_t *wire, size_t len)
+{
+    if (conn.shedding || conn.closing)
+        return SendFailed;
+
+    //nothing queued ahead of it, so it can go straight to the socket. The io_uring
+    //engine always queues, the ring picks the frames up before the loop waits again.
+    size_t sent = 0;
+    if (conn.outQueue.empty() && conn.shm)
+    {
+        sent = conn.shm->write(wire, len);
+        if (sent == len)
+        {
+            countSent(conn, wire, len);
+            return SendDone;
+        }
+    }
+    else if (conn.outQueue.empty() && !ring)
+    {
+        while (sent < len)
+        {
+            ssize_t outBytes = ::send(conn.fd, wire + sent, len - sent, MSG_NOSIGNAL);
+            io.syscalls++;
+            if (outBytes > 0)
+                sent += outBytes;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            else if (errno != EINTR)
+                return SendFailed;
+        }
+        if (sent == len)
+        {
+            countSent(conn, wire, len);
+            return SendDone;
+        }
+    }
+    return queueFrame(conn, wire, len, sent);
+}
+
+Reactor::SendResult Reactor::sendFile(Connection &conn, int fileFd, off_t offset, const uint8_t *wire, size_t len)
+{
+    if (conn.shedding || conn.closing)
+        return SendFailed;
+    //nothing to gain from the page cache when the bytes are copied into a ring anyway
+    if (conn.shm)
+        return send(conn, wire, len);
+
+    size_t sent = 0;
+    if (conn.outQueue.empty() && !ring)
+    {
+        while (sent < len)
+        {
+            ssize_t outBytes = ::sendfile(conn.fd, fileFd, &offset, len - sent);
+            io.syscalls++;
+            if (outBytes > 0)
+                sent += outBytes;
+            else if (outBytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            else if (errno != EINTR)
+                return SendFailed;
+        }
+        if (sent == len)
+        {
+            countSent(conn, wire, len);
+            return SendDone;
+        }
+    }
+    return queueFrame(conn, wire, len, sent);
+}
+
+//Queues what is left of a frame after the first sent bytes went straight out
+Reactor::SendResult Reactor::queueFrame(Connection &conn, const uint8_t *wire, size_t len, size_t sent)
+{
+    //the tail of a frame that is already partly out has to be queued whatever the limit,
+    //or the stream would be left with half a frame in it
+    if (sent == 0 && conn.outBytes + len > maxQueueBytes)
+    {
+        stats.overflows++;
+        if (policy == DisconnectWhenFull)
+        {
+            //the EOF this causes lets readAll() close it once we are back in the loop
+            conn.shedding = true;
+            stats.disconnects++;
+            shutdown(conn.fd, SHUT_RDWR);
+            io.syscalls++;
+        }
+        return SendOverflow;
+    }
+
+    if (ring && !conn.flushPending)
+    {
+        conn.flushPending = true;
+        toFlush.emplace_back(conn.fd, conn.id);
+    }
+    else if (!ring && conn.outQueue.empty())
+        watchWritable(conn, true);
+    countSent(conn, wire, len);
+    conn.outQueue.emplace_back((const char *)wire + sent, len - sent);
+    conn.outBytes += len - sent;
+    stats.queuedBytes += len - sent;
+    if (conn.outBytes > stats.peakBytes.load(memory_order_relaxed))
+        stats.peakBytes.store(conn.outBytes, memory_order_relaxed);
+    return SendQueued;
+}
+
+//wire may hold several whole frames back to back, as a replay from a file does
+void Reactor::countSent(Connection &conn, const uint8_t *wire, size_t len)
+{
+    for (size_t at = 0; at + headerWireLen <= len;)
+    {
+        size_t frameLen = headerWireLen + wire_Load16(wire + at + offsetof(WireHeader, payloadLen));
+        shard.frameOut(wire[at + offsetof(WireHeader, messageType)], frameLen);
+        io.framesOut++;
+        conn.framesOut++;
+        at += frameLen;
+    }
+    conn.bytesOut += len;
+}
+
+//Writes out as much of the queue as the socket takes, several frames per sendmsg()
+bool Reactor::flush(Connection &conn)
+{
+    if (conn.shm)
+    {
+        flushLocal(conn);
+        return true;
+    }
+    while (!conn.outQueue.empty())
+    {
+        struct iovec iov[maxFlushFrames];
+        int count = 0;
+        for (auto it = conn.outQueue.begin(); it != conn.outQueue.end() && count < maxFlushFrames; ++it, ++count)
+        {
+            size_t skip = count == 0 ? conn.outHead : 0;
+            iov[count].iov_base = (char *)it->data() + skip;
+            iov[count].iov_len = it->size() - skip;
+        }
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        ssize_t outBytes = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        io.syscalls++;
+        if (outBytes < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            closeConnection(conn.fd);
+            return false;
+        }
+
+        conn.outBytes -= outBytes;
+        stats.queuedBytes -= outBytes;
+        size_t done = outBytes + conn.outHead;
+        while (!conn.outQueue.empty() && done >= conn.outQueue.front().size())
+        {
+            done -= conn.outQueue.front().size();
+            conn.outQueue.pop_front();
+        }
+        conn.outHead = done;
+    }
+    watchWritable(conn, false);
+    return true;
+}
+
+//flush() into a local client's ring, as much as it has room for
+void Reactor::flushLocal(Connection &conn)
+{
+    while (!conn.outQueue.empty())
+    {
+        const string &front = conn.outQueue.front();
+        size_t outBytes = conn.shm->write(front.data() + conn.outHead, front.size() - conn.outHead);
+        conn.outBytes -= outBytes;
+        stats.queuedBytes -= outBytes;
+        conn.outHead += outBytes;
+        if (conn.outHead < front.size())
+        {
+            conn.shm->awaitRoom();
+            return;
+        }
+        conn.outQueue.pop_front();
+        conn.outHead = 0;
+    }
+}
+
+//EPOLLOUT is only asked for while something is queued, an idle socket is always writable.
+//A local client's ring rings our doorbell instead once the client has made room.
+void Reactor::watchWritable(Connection &conn, bool on)
+{
+    if (conn.shm)
+    {
+        if (on)
+            conn.shm->awaitRoom();
+        return;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    if (on)
+        ev.events |= EPOLLOUT;
+    ev.data.fd = conn.fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+    io.syscalls++;
+}
+
+void Reactor::runAfter(unsigned ms, function<void()> task)
+{
+    timers.push(Timer{monotonicNs() + ms * 1000000ull, timerSeq++, std::move(task)});
+    armTimer();
+}
+
+void Reactor::runTimers()
+{
+    uint64_t expirations;
+    while (read(timerfd, &expirations, sizeof(expirations)) > 0)
+        io.syscalls++;
+    io.syscalls++;
+    armedFor = 0;
+
+    uint64_t now = monotonicNs();
+    while (!timers.empty() && timers.top().deadline <= now)
+    {
+        //a task may add timers, so take it off the heap before running it
+        function<void()> task = std::move(const_cast<Timer &>(timers.top()).task);
+        timers.pop();
+        task();
+    }
+    armTimer();
+}
+
+//Only touches the timerfd when the earliest deadline moved
+void Reactor::armTimer()
+{
+    if (timers.empty() || timers.top().deadline == armedFor)
+        return;
+    armedFor = timers.top().deadline;
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = armedFor / 1000000000ull;
+    spec.it_value.tv_nsec = armedFor % 1000000000ull;
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    io.syscalls++;
+}
+
+//The two vectors trade places every turn, so neither gives its memory back
+void Reactor::runPosted()
+{
+    {
+        lock_guard<mutex> guard(postLock);
+        running.swap(posted);
+    }
+    for (auto &task : running)
+        task();
+    running.clear();
+}
+
+void Reactor::acceptAll()
+{
+    //edge triggered: keep accepting until the backlog is drained
+    while (1)
+    {
+        struct sockaddr_in caddr;
+        socklen_t clen = sizeof(caddr);
+        int fd = accept4(listenfd, (struct sockaddr *)&caddr, &clen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        io.syscalls++;
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE)
+            {
+                //out of descriptors: free the spare one, take the pending client and drop it,
+                //otherwise it sits in the backlog and we never get another edge
+                LOG_WARN("Out of file descriptors, dropping incoming connection");
+                close(sparefd);
+                fd = accept(listenfd, nullptr, nullptr);
+                if (fd >= 0)
+                    close(fd);
+                sparefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("accept: %s", strerror(errno));
+            return;
+        }
+        if (!admit(fd))
+            continue;
+
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        io.syscalls += 2;
+
+        unique_ptr<Connection> conn(new Connection());
+        conn->fd = fd;
+        conn->id = nextId++;
+        conn->owner = this;
+        conn->clientId = 0;
+        conn->peerAddr = ntohl(caddr.sin_addr.s_addr);
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            LOG_ERROR("epoll_ctl: %s", strerror(errno));
+            close(fd);
+            unadmit();
+            continue;
+        }
+        conns[fd] = std::move(conn);
+        connCount.store(conns.size());
+    }
+}
+
+//A local client connects to be handed its rings, and is from then on a connection
+//like any other with its doorbell in the epoll set next to its socket
+void Reactor::acceptLocal()
+{
+    while (1)
+    {
+        int fd = accept4(localfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        io.syscalls++;
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("accept: %s", strerror(errno));
+            return;
+        }
+        if (!admit(fd))
+            continue;
+
+        unique_ptr<Connection> conn(new Connection());
+        conn->fd = fd;
+        conn->id = nextId++;
+        conn->owner = this;
+        conn->clientId = 0;
+        conn->peerAddr = INADDR_LOOPBACK;
+        conn->shm.reset(new ShmChannel());
+        string why;
+        if (!conn->shm->offer(fd, ShmChannel::defaultRingBytes, why))
+        {
+            LOG_WARN("Couldn't set up rings for a local client: %s", why.c_str());
+            close(fd);
+            unadmit();
+            continue;
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        epoll_event bell{};
+        bell.events = EPOLLIN | EPOLLET;
+        bell.data.u64 = doorbellTag | (uint32_t)fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0 ||
+            epoll_ctl(epfd, EPOLL_CTL_ADD, conn->shm->doorbell(), &bell) < 0)
+        {
+            LOG_ERROR("epoll_ctl: %s", strerror(errno));
+            close(fd);
+            unadmit();
+            continue;
+        }
+        io.syscalls += 2;
+        conns[fd] = std::move(conn);
+        connCount.store(conns.size());
+        //frames the client wrote before its doorbell was watched would never ring it
+        readLocal(*conns[fd]);
+    }
+}
+
+//Counts a new connection against the cap, or turns it away
+bool Reactor::admit(int fd)
+{
+    if (!connCap || connCap->limit == 0)
+        return true;
+    if (connCap->open.fetch_add(1) < connCap->limit)
+        return true;
+    connCap->open--;
+    if (connCap->refused++ % 1000 == 0)
+        LOG_WARN("At the cap of %zu connections, turning new ones away", connCap->limit);
+    close(fd);
+    io.syscalls++;
+    return false;
+}
+
+void Reactor::unadmit()
+{
+    if (connCap && connCap->limit != 0)
+        connCap->open--;
+}
+
+//The doorbell rings for frames in, or for room to write what is queued
+void Reactor::ringsReady(Connection &conn)
+{
+    conn.shm->clearDoorbell();
+    io.syscalls++;
+    if (!conn.outQueue.empty())
+        flushLocal(conn);
+    readLocal(conn);
+}
+
+void Reactor::readAll(Connection &conn)
+{
+    if (conn.readsDeferred)
+        return;
+    if (conn.shm)
+    {
+        readLocal(conn);
+        return;
+    }
+    int fd = conn.fd;
+
+    //edge triggered: read until the kernel buffer is empty or we lose the next edge,
+    //handing out frames after every read so a busy client can't grow the buffer unbounded.
+    //After maxReadsPerTurn the rest waits for the next loop turn.
+    for (int reads = 0;; reads++)
+    {
+        if (reads == maxReadsPerTurn)
+        {
+            readAgain.emplace_back(fd, conn.id);
+            return;
+        }
+        char *space = conn.decoder.writePtr();
+        ssize_t inBytes = recv(fd, space, conn.decoder.writable(), 0);
+        io.syscalls++;
+        if (inBytes > 0)
+        {
+            conn.decoder.commit(inBytes);
+            if (!dispatchFrames(conn, monotonicNs()) || conn.readsDeferred)
+                return;
+            continue;
+        }
+        if (inBytes == 0)
+        {
+            closeConnection(fd);
+            return;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        LOG_ERROR("%s", strerror(errno));
+        closeConnection(fd);
+        return;
+    }
+}
+
+//readAll() from a local client's ring. Empty, it tells the client we are going idle,
+//so its next write rings the doorbell.
+void Reactor::readLocal(Connection &conn)
+{
+    if (conn.readsDeferred)
+        return;
+    for (int reads = 0;; reads++)
+    {
+        if (reads == maxReadsPerTurn)
+        {
+            readAgain.emplace_back(conn.fd, conn.id);
+            return;
+        }
+        char *space = conn.decoder.writePtr();
+        size_t inBytes = conn.shm->read(space, conn.decoder.writable());
+        if (inBytes > 0)
+        {
+            conn.decoder.commit(inBytes);
+            if (!dispatchFrames(conn, monotonicNs()) || conn.readsDeferred)
+                return;
+        }
+        else if (conn.shm->idle())
+            return;
+    }
+}
+
+//receivedAt is when the read holding these frames returned; one frame in
+//MetricsShard::sampleEvery has its wait for the handler timed
+bool Reactor::dispatchFrames(Connection &conn, uint64_t receivedAt)
+{
+    Frame frame;
+    while (!conn.readsDeferred && conn.decoder.next(frame))
+    {
+        io.framesIn++;
+        size_t len = headerWireLen + frame.header.payloadLen;
+        shard.frameIn(frame.header.messageType, len);
+        conn.framesIn++;
+        conn.bytesIn += len;
+        if (++sampleTick == MetricsShard::sampleEvery)
+        {
+            sampleTick = 0;
+            shard.dispatchLatency.record(monotonicNs() - receivedAt);
+        }
+        onFrame(conn, frame);
+    }
+    conn.arena.reset();
+
+    if (conn.decoder.corrupt())
+    {
+        LOG_WARN("Bad header length from connection %u, closing", conn.id);
+        closeConnection(conn.fd);
+        return false;
+    }
+    return true;
+}
+
+void Reactor::deferFrame(Connection &conn, const Frame &frame, unsigned ms)
+{
+    conn.decoder.unread(frame);
+    conn.readsDeferred = true;
+    int fd = conn.fd;
+    uint32_t connId = conn.id;
+    runAfter(ms, [this, fd, connId]() {
+        Connection *later = connection(fd, connId);
+        if (!later)
+            return;
+        later->readsDeferred = false;
+        //edge triggered: nothing says there is more waiting, so go and look
+        if (dispatchFrames(*later, monotonicNs()) && !ring)
+            readAll(*later);
+    });
+}
+
+void Reactor::closeConnection(int fd)
+{
+    LOG_INFO("Connection has been closed");
+    auto it = conns.find(fd);
+    if (it != conns.end())
+    {
+        unadmit();
+        stats.queuedBytes -= it->second->outBytes;
+        if (onClose)
+            onClose(*it->second);
+    }
+
+    //the ring may still be receiving into or sending from the connection: shut the
+    //socket down so those end, and keep the connection (and its fd) until they have
+    if (ring)
+    {
+        if (it == conns.end())
+            return;
+        Connection *conn = it->second.get();
+        conn->closing = true;
+        closed[conn] = std::move(it->second);
+        conns.erase(it);
+        connCount.store(conns.size());
+        shutdown(fd, SHUT_RDWR);
+        io.syscalls++;
+        if (conn->recvArmed)
+            if (io_uring_sqe *sqe = nextSqe())
+            {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = (uint64_t)conn | TagRecv;
+                sqe->user_data = TagCancel;
+            }
+        release(conn);
+        return;
+    }
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    if (it != conns.end() && it->second->shm)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, it->second->shm->doorbell(), nullptr);
+        io.syscalls++;
+    }
+    close(fd);
+    io.syscalls += 2;
+    conns.erase(fd);
+    connCount.store(conns.size());
+}
+
+bool Reactor::useUring(string &why)
+{
+    unique_ptr<Uring> candidate(new Uring());
+    if (!candidate->setup(uringEntries, why) || !candidate->provideBuffers(recvBufferCount, recvBufferSize, why))
+        return false;
+    ring = std::move(candidate);
+    return true;
+}
+
+//The io_uring engine's loop. Each turn submits everything the last one produced and
+//waits for completions in the same io_uring_enter(), then handles them all.
+void Reactor::runUring()
+{
+    //sockets stay blocking so the ring waits for readiness itself rather than failing with EAGAIN
+    if (listenfd != -1)
+        fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) & ~O_NONBLOCK);
+    armAccept();
+    armPoll(wakefd, TagWake);
+    armPoll(timerfd, TagTimer);
+
+    while (!stopping.load())
+    {
+        submitFlushes();
+        int got = ring->enter(1);
+        io.syscalls++;
+        if (got < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+        {
+            LOG_ERROR("io_uring_enter: %s", strerror(errno));
+            return;
+        }
+        while (ring->reap([this](const io_uring_cqe &cqe) { onCompletion(cqe); }) > 0)
+            ;
+        ring->publishBuffers();
+    }
+}
+
+void Reactor::onCompletion(const io_uring_cqe &cqe)
+{
+    Connection *conn = (Connection *)(cqe.user_data & ~(uint64_t)TagMask);
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    switch (cqe.user_data & TagMask)
+    {
+    case TagAccept:
+        if (cqe.res >= 0)
+            acceptedUring(cqe.res);
+        else if (cqe.res == -EMFILE || cqe.res == -ENFILE)
+        {
+            //same as acceptAll(): take the pending client on the spare descriptor and drop it
+            LOG_WARN("Out of file descriptors, dropping incoming connection");
+            close(sparefd);
+            int fd = accept(listenfd, nullptr, nullptr);
+            if (fd >= 0)
+                close(fd);
+            sparefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            io.syscalls += 4;
+        }
+        else if (cqe.res != -EINTR && cqe.res != -ECONNABORTED)
+            LOG_ERROR("accept: %s", strerror(-cqe.res));
+        if (!more)
+            armAccept();
+        break;
+    case TagWake:
+    {
+        uint64_t count;
+        read(wakefd, &count, sizeof(count));
+        io.syscalls++;
+        runPosted();
+        if (!more)
+            armPoll(wakefd, TagWake);
+        break;
+    }
+    case TagTimer:
+        runTimers();
+        if (!more)
+            armPoll(timerfd, TagTimer);
+        break;
+    case TagRecv:
+        receivedUring(conn, cqe.res, cqe.flags);
+        break;
+    case TagSend:
+        sentUring(conn, cqe.res);
+        break;
+    }
+}
+
+void Reactor::acceptedUring(int fd)
+{
+    if (!admit(fd))
+        return;
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    io.syscalls++;
+
+    unique_ptr<Connection> conn(new Connection());
+    conn->fd = fd;
+    conn->id = nextId++;
+    conn->owner = this;
+    conn->clientId = 0;
+    struct sockaddr_in caddr{};
+    socklen_t clen = sizeof(caddr);
+    if (getpeername(fd, (struct sockaddr *)&caddr, &clen) == 0)
+        conn->peerAddr = ntohl(caddr.sin_addr.s_addr);
+    io.syscalls++;
+    armRecv(*conn);
+    conns[fd] = std::move(conn);
+    connCount.store(conns.size());
+}
+
+//Frames are handed out straight after each buffer is copied into the decoder, and the
+//buffer goes back to the kernel. A recv that stops without being closed (the buffer
+//ring ran dry) is simply armed again.
+void Reactor::receivedUring(Connection *conn, int res, unsigned flags)
+{
+    if (res > 0)
+    {
+        uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (!conn->closing)
+            conn->decoder.feed(ring->buffer(bid), res);
+        if (!ring->recycle(bid))
+        {
+            ring->enter(0);
+            io.syscalls++;
+            ring->recycle(bid);
+        }
+        if (!conn->closing)
+            dispatchFrames(*conn, monotonicNs());
+    }
+    else if (res != -ENOBUFS && !conn->closing)
+    {
+        if (res < 0)
+            LOG_ERROR("%s", strerror(-res));
+        closeConnection(conn->fd);
+    }
+
+    if (flags & IORING_CQE_F_MORE)
+        return;
+    conn->recvArmed = false;
+    if (conn->closing)
+        release(conn);
+    else
+        armRecv(*conn);
+}
+
+//Sends carry MSG_WAITALL, so one either sent its whole frame or failed and took the
+//rest of the chain down with it
+void Reactor::sentUring(Connection *conn, int res)
+{
+    conn->sendsInFlight--;
+    if (conn->closing)
+    {
+        release(conn);
+        return;
+    }
+    size_t len = conn->outQueue.front().size();
+    if (res < 0 || (size_t)res != len)
+    {
+        closeConnection(conn->fd);
+        return;
+    }
+    conn->outQueue.pop_front();
+    conn->outBytes -= len;
+    stats.queuedBytes -= len;
+    if (conn->sendsInFlight == 0 && !conn->outQueue.empty())
+        submitQueue(*conn);
+}
+
+//Hands the front of the queue to the ring as one chain of linked sends, which the
+//kernel runs strictly in order
+void Reactor::submitQueue(Connection &conn)
+{
+    unsigned count = conn.outQueue.size() < (size_t)maxFlushFrames ? conn.outQueue.size() : maxFlushFrames;
+    //a chain can't be split across submissions, make room for all of it first
+    if (ring->sqSpace() < count)
+    {
+        ring->enter(0);
+        io.syscalls++;
+    }
+    auto it = conn.outQueue.begin();
+    for (unsigned i = 0; i < count; i++, ++it)
+    {
+        io_uring_sqe *sqe = ring->sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn.fd;
+        sqe->addr = (uint64_t)it->data();
+        sqe->len = it->size();
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        if (i + 1 < count)
+            sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = (uint64_t)&conn | TagSend;
+    }
+    conn.sendsInFlight = count;
+}
+
+//Before waiting: every connection that queued frames this turn and has nothing in flight
+void Reactor::submitFlushes()
+{
+    for (auto &entry : toFlush)
+        if (Connection *conn = connection(entry.first, entry.second))
+        {
+            conn->flushPending = false;
+            if (conn->sendsInFlight == 0 && !conn->outQueue.empty())
+                submitQueue(*conn);
+        }
+    toFlush.clear();
+}
+
+//Next submission entry, submitting what is queued first if the ring is full
+io_uring_sqe *Reactor::nextSqe()
+{
+    io_uring_sqe *sqe = ring->sqe();
+    if (!sqe)
+    {
+        ring->enter(0);
+        io.syscalls++;
+        sqe = ring->sqe();
+    }
+    return sqe;
+}
+
+void Reactor::armAccept()
+{
+    if (listenfd == -1 || stopping.load())
+        return;
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = TagAccept;
+}
+
+void Reactor::armPoll(int fd, uint64_t tag)
+{
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = tag;
+}
+
+void Reactor::armRecv(Connection &conn)
+{
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = Uring::bufferGroup;
+    sqe->user_data = (uint64_t)&conn | TagRecv;
+    conn.recvArmed = true;
+}
+
+//Frees a closed connection once the ring has nothing of it left
+void Reactor::release(Connection *conn)
+{
+    if (conn->recvArmed || conn->sendsInFlight > 0)
+        return;
+    close(conn->fd);
+    io.syscalls++;
+    closed.erase(conn);
+}
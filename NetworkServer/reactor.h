@@ -0,0 +1,246 @@
+//Edge-triggered epoll event loop for the messaging server
+//Author: Justin Jeirles
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <sys/types.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/ackbatch.h"
+#include "../Common/metrics.h"
+#include "../Common/arena.h"
+#include "../Common/shmring.h"
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+class Reactor;
+struct ResumableSession;
+
+struct Connection {
+    int fd;
+    uint32_t id;             //assigned by the reactor, unlike fds never reused
+    Reactor *owner;          //the reactor whose thread this connection belongs to
+    uint16_t clientId;       //sender_id the client registered with, 0 until then
+    uint32_t peerAddr = 0;   //IPv4 address it connected from, host order; loopback for the local socket
+    FrameDecoder decoder;    //reassembles frames from whatever recv() hands us
+    std::vector<uint16_t> rooms;  //rooms joined, left again when the connection closes
+    uint32_t nextMessageId = 0;   //message_id of the last frame the server itself sent here
+    AckBatch acks;                //chats received but not acknowledged yet
+    bool compressed = false;      //asked for compressed chats in its status request
+    std::shared_ptr<ResumableSession> resumable;  //asked for a session it can resume, chats to it are retained
+    Arena arena;                  //replies and expanded payloads, reset after each batch of frames
+    //set for a client that came in on the local socket: its frames go through these rings
+    //and fd is that socket, watched only for the client hanging up
+    std::unique_ptr<ShmChannel> shm;
+
+    //this connection's share of the metrics, and 1 in MetricsShard::sampleEvery of the
+    //chats it sent, with when, until their ACK comes back through the server
+    uint64_t framesIn = 0;
+    uint64_t framesOut = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    std::vector<std::pair<uint32_t, uint64_t>> timedChats;
+
+    //frames the socket couldn't take yet, oldest first; flushed on EPOLLOUT
+    std::deque<std::string> outQueue;
+    size_t outHead = 0;      //bytes of outQueue.front() already sent
+    size_t outBytes = 0;     //unsent bytes across outQueue
+    bool shedding = false;   //over its limit under DisconnectWhenFull, being shut down
+    bool readsDeferred = false;   //deferFrame() stopped reading it for now
+
+    //io_uring engine only: queued frames stay put until the ring is done sending them
+    unsigned sendsInFlight = 0;   //frames at the front of outQueue handed to the ring
+    bool recvArmed = false;       //a multishot recv is outstanding
+    bool flushPending = false;    //has frames queued this turn, submitted before we wait
+    bool closing = false;         //closed, kept alive until the ring lets go of it
+};
+
+//Outbound queue accounting across a reactor's connections
+struct SendQueueStats {
+    std::atomic<uint64_t> queuedBytes{0};    //waiting in queues right now
+    std::atomic<uint64_t> peakBytes{0};      //deepest single connection queue seen
+    std::atomic<uint64_t> overflows{0};      //frames refused because a queue was full
+    std::atomic<uint64_t> disconnects{0};    //connections shed for being too slow
+};
+
+//What a reactor's I/O costs, to compare engines. Syscalls are the ones the reactor
+//itself makes for networking, timers and wakeups.
+struct IoStats {
+    std::atomic<uint64_t> syscalls{0};
+    std::atomic<uint64_t> framesIn{0};
+    std::atomic<uint64_t> framesOut{0};     //accepted by send()
+};
+
+//Open connections across every reactor sharing it. Past limit a new connection is
+//closed as soon as it is accepted, before anything is allocated for it.
+struct ConnectionCap {
+    size_t limit = 0;     //0 for no cap
+    std::atomic<size_t> open{0};
+    std::atomic<uint64_t> refused{0};
+};
+
+class Uring;
+
+//Owns a listening socket and every client accepted on it. All connection state is
+//touched only from the thread inside run(); other threads hand work over with post().
+//A server runs one reactor per worker thread.
+//
+//Two I/O engines sit behind the same interface. The default waits on epoll and makes
+//the socket calls itself. The io_uring engine keeps a multishot accept and one
+//multishot recv per connection outstanding, receiving into a ring of kernel-picked
+//buffers, and sends each connection's queue as a chain of linked sends; everything a
+//loop turn produced is submitted by the same io_uring_enter() that waits for more.
+//
+//On epoll a reactor can also take clients on the same host over a Unix socket, which
+//hands each one a ShmChannel; its doorbell stands in for the socket's readiness and
+//the rest of the connection's life is the same as over TCP.
+class Reactor {
+public:
+    typedef std::function<void(Connection &, const Frame &)> FrameHandler;
+    typedef std::function<void(Connection &)> CloseHandler;
+
+    //What to do when a connection's outbound queue is full. The frame is refused in
+    //every case; NackWhenFull tells the caller to NACK whoever sent it and
+    //DisconnectWhenFull also shuts the slow connection down.
+    enum SendPolicy { DropWhenFull, NackWhenFull, DisconnectWhenFull };
+    enum SendResult { SendDone, SendQueued, SendOverflow, SendFailed };
+    enum IoEngine { EpollEngine, UringEngine };
+
+    explicit Reactor(FrameHandler handler);
+    ~Reactor();
+
+    //with reusePort several reactors each get their own listener on the same port
+    //and the kernel spreads incoming connections across them
+    bool listenOn(unsigned short port, bool reusePort = false);
+    //switches to the io_uring engine before run(); false with the reason if the kernel
+    //can't, and the reactor stays on epoll
+    bool useUring(std::string &why);
+    //takes local clients on a Unix socket at path (epoll engine only), which is removed
+    //again with the reactor
+    bool listenLocal(const std::string &path);
+    IoEngine engine() const { return ring ? UringEngine : EpollEngine; }
+    void run();
+    void stop();
+    void post(std::function<void()> task);
+    void setCloseHandler(CloseHandler handler) { onClose = std::move(handler); }
+    void setSendLimit(size_t maxQueueBytes, SendPolicy policy);
+    //before run(); the cap may be shared with other reactors
+    void setConnectionCap(ConnectionCap *cap) { connCap = cap; }
+    SendPolicy sendPolicy() const { return policy; }
+    const SendQueueStats &sendStats() const { return stats; }
+    const IoStats &ioStats() const { return io; }
+    //frame counters and latencies of this reactor's thread; written by it alone
+    MetricsShard &metrics() { return shard; }
+    const MetricsShard &metrics() const { return shard; }
+
+    //loop thread only
+    void forEachConnection(const std::function<void(Connection &)> &fn);
+    Connection *connection(int fd, uint32_t connId);
+    //runs task once on the loop thread, ms milliseconds from now
+    void runAfter(unsigned ms, std::function<void()> task);
+    //Never blocks: writes what the socket takes now and queues the rest
+    SendResult send(Connection &conn, const uint8_t *wire, size_t len);
+    //send() for frames kept in a file, one or several back to back, offset into fileFd
+    //with wire mapping the same bytes: with nothing queued ahead they go from the page
+    //cache with sendfile(), what the socket doesn't take (and everything on the io_uring
+    //engine) is queued from wire
+    SendResult sendFile(Connection &conn, int fileFd, off_t offset, const uint8_t *wire, size_t len);
+    //From the frame handler: puts back the frame it was given and stops reading conn for
+    //ms milliseconds, leaving the client's frames in its socket or ring, then handles it
+    //and what came after it as if they had just arrived. Epoll engine only, io_uring
+    //keeps receiving into the decoder meanwhile.
+    void deferFrame(Connection &conn, const Frame &frame, unsigned ms);
+    size_t connectionCount() const { return connCount.load(); }
+
+private:
+    void acceptAll();
+    void acceptLocal();
+    bool admit(int fd);    //false if the cap is reached, fd is closed then
+    void unadmit();        //gives back what admit() counted, for a connection that is gone
+    void readAll(Connection &conn);
+    void readLocal(Connection &conn);
+    void ringsReady(Connection &conn);
+    bool dispatchFrames(Connection &conn, uint64_t receivedAt);   //false if the connection was dropped
+    void countSent(Connection &conn, const uint8_t *wire, size_t len);
+    SendResult queueFrame(Connection &conn, const uint8_t *wire, size_t len, size_t sent);
+    bool flush(Connection &conn);              //false if the connection was dropped
+    void flushLocal(Connection &conn);
+    void watchWritable(Connection &conn, bool on);
+    void closeConnection(int fd);
+    void runPosted();
+    void runTimers();
+    void armTimer();
+
+    //io_uring engine
+    void runUring();
+    void onCompletion(const io_uring_cqe &cqe);
+    void acceptedUring(int fd);
+    void receivedUring(Connection *conn, int res, unsigned flags);
+    void sentUring(Connection *conn, int res);
+    void submitQueue(Connection &conn);
+    void submitFlushes();
+    void armAccept();
+    void armPoll(int fd, uint64_t tag);
+    void armRecv(Connection &conn);
+    void release(Connection *conn);
+    io_uring_sqe *nextSqe();
+
+    struct Timer {
+        uint64_t deadline;    //CLOCK_MONOTONIC ns
+        uint64_t seq;         //keeps timers with the same deadline in order
+        std::function<void()> task;
+    };
+    struct TimerLater {
+        bool operator()(const Timer &a, const Timer &b) const
+        {
+            return a.deadline != b.deadline ? a.deadline > b.deadline : a.seq > b.seq;
+        }
+    };
+
+    int epfd;
+    int listenfd;
+    int wakefd;
+    int sparefd;    //kept open so we can still shed connections when out of fds
+    int timerfd;    //armed for the earliest entry in timers
+    int localfd;    //Unix socket local clients connect to, -1 if none
+    std::string localPath;
+    uint32_t nextId;
+    std::atomic<bool> stopping;
+    std::atomic<size_t> connCount;
+    std::unordered_map<int, std::unique_ptr<Connection>> conns;
+    std::mutex postLock;
+    std::vector<std::function<void()>> posted;
+    std::vector<std::function<void()>> running;   //posted tasks being run, kept for its capacity
+    std::vector<std::pair<int, uint32_t>> readAgain;   //fd and id of connections cut off mid-read
+    std::vector<std::pair<int, uint32_t>> readingAgain;   //the ones being read now, kept for its capacity
+    std::priority_queue<Timer, std::vector<Timer>, TimerLater> timers;
+    uint64_t timerSeq;
+    uint64_t armedFor;    //deadline timerfd is set to, 0 if disarmed
+    FrameHandler onFrame;
+    CloseHandler onClose;
+    size_t maxQueueBytes;
+    SendPolicy policy;
+    ConnectionCap *connCap;
+    SendQueueStats stats;
+    IoStats io;
+    MetricsShard shard;
+    unsigned sampleTick;     //frames since the last timed one
+
+    std::vector<std::pair<int, uint32_t>> toFlush;   //connections with flushPending set
+    std::unordered_map<Connection *, std::unique_ptr<Connection>> closed;   //waiting on the ring
+    std::unique_ptr<Uring> ring;     //null on the epoll engine; goes before the connections it points at
+};
+
+#endif
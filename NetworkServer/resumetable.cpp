@@ -0,0 +1,142 @@
+//Resumable sessions: chats sent to a client and not acknowledged yet, kept across a
+//dropped connection so the client can pick up where it left off
+//Author: Justin Jeirles
+
+#include "resumetable.h"
+
+#include <sys/random.h>
+#include <chrono>
+#include <random>
+
+using namespace std;
+
+static uint64_t nowMs()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//Unguessable enough that a client can't resume someone else's session by trying tokens
+static uint64_t newToken()
+{
+    uint64_t token = 0;
+    if (getrandom(&token, sizeof(token), 0) != (ssize_t)sizeof(token))
+    {
+        random_device device;
+        token = ((uint64_t)device() << 32) | device();
+    }
+    return token ? token : 1;
+}
+
+void ResumableSession::retain(uint16_t sender, uint32_t messageId, const uint8_t *wire, size_t len)
+{
+    lock_guard<mutex> guard(lock);
+    frames.push_back(RetainedFrame{sender, messageId, string((const char *)wire, len)});
+    bytes += len;
+    while (frames.size() > ResumeTable::maxFrames || bytes > ResumeTable::maxBytes)
+    {
+        bytes -= frames.front().wire.size();
+        frames.pop_front();
+    }
+}
+
+void ResumableSession::release(uint16_t sender, uint32_t messageId)
+{
+    lock_guard<mutex> guard(lock);
+    //ACKs mostly come back in the order the chats went out, so the oldest is the usual match
+    for (auto it = frames.begin(); it != frames.end(); ++it)
+        if (it->messageId == messageId && it->sender == sender)
+        {
+            bytes -= it->wire.size();
+            frames.erase(it);
+            return;
+        }
+}
+
+void ResumableSession::copyFrames(vector<string> &out)
+{
+    lock_guard<mutex> guard(lock);
+    for (const RetainedFrame &frame : frames)
+        out.push_back(frame.wire);
+}
+
+size_t ResumableSession::retainedBytes()
+{
+    lock_guard<mutex> guard(lock);
+    return bytes;
+}
+
+shared_ptr<ResumableSession> ResumeTable::open(uint16_t clientId, const SessionRef &conn)
+{
+    Shard &shard = shardFor(clientId);
+    lock_guard<mutex> guard(shard.lock);
+    //sessions nobody came back for go when another client in the shard starts one
+    uint64_t now = nowMs();
+    for (auto it = shard.sessions.begin(); it != shard.sessions.end();)
+    {
+        bool expired;
+        {
+            lock_guard<mutex> sessionGuard(it->second->lock);
+            expired = !it->second->attached.owner && now - it->second->detachedMs > keepMs;
+        }
+        if (expired)
+            it = shard.sessions.erase(it);
+        else
+            ++it;
+    }
+    //one still live on another connection, or waiting for its client to come back, is
+    //only taken over with its token, through resume()
+    auto it = shard.sessions.find(clientId);
+    if (it != shard.sessions.end())
+    {
+        lock_guard<mutex> sessionGuard(it->second->lock);
+        if (it->second->attached.owner != conn.owner || it->second->attached.connId != conn.connId)
+            return nullptr;
+    }
+
+    auto session = make_shared<ResumableSession>();
+    session->token = newToken();
+    session->clientId = clientId;
+    session->attached = conn;
+    shard.sessions[clientId] = session;
+    return session;
+}
+
+shared_ptr<ResumableSession> ResumeTable::resume(uint16_t clientId, uint64_t token, const SessionRef &conn)
+{
+    Shard &shard = shardFor(clientId);
+    lock_guard<mutex> guard(shard.lock);
+    auto it = shard.sessions.find(clientId);
+    if (it == shard.sessions.end() || it->second->token != token)
+        return nullptr;
+    shared_ptr<ResumableSession> session = it->second;
+    {
+        lock_guard<mutex> sessionGuard(session->lock);
+        if (session->attached.owner || nowMs() - session->detachedMs <= keepMs)
+        {
+            session->attached = conn;
+            return session;
+        }
+    }
+    shard.sessions.erase(it);
+    return nullptr;
+}
+
+bool ResumeTable::matches(uint16_t clientId, uint64_t token)
+{
+    Shard &shard = shardFor(clientId);
+    lock_guard<mutex> guard(shard.lock);
+    auto it = shard.sessions.find(clientId);
+    if (it == shard.sessions.end() || it->second->token != token)
+        return false;
+    lock_guard<mutex> sessionGuard(it->second->lock);
+    return it->second->attached.owner || nowMs() - it->second->detachedMs <= keepMs;
+}
+
+void ResumeTable::detach(ResumableSession &session, const SessionRef &conn)
+{
+    lock_guard<mutex> guard(session.lock);
+    if (session.attached.owner != conn.owner || session.attached.connId != conn.connId)
+        return;
+    session.attached.owner = nullptr;
+    session.detachedMs = nowMs();
+}
@@ -0,0 +1,83 @@
+//Resumable sessions: chats sent to a client and not acknowledged yet, kept across a
+//dropped connection so the client can pick up where it left off
+//Author: Justin Jeirles
+
+#ifndef RESUMETABLE_H
+#define RESUMETABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sessiontable.h"
+
+//A chat as it went out to the client, until the client ACKs it
+struct RetainedFrame {
+    uint16_t sender;
+    uint32_t messageId;
+    std::string wire;
+};
+
+//One client's session, known to the client by its token. Whichever connection the
+//session is on retains and releases frames, and a reconnect may land on another
+//worker, so it has a lock of its own.
+struct ResumableSession {
+    uint64_t token;
+    uint16_t clientId;
+
+    //Keeps a chat sent to the client. Past ResumeTable::maxFrames or maxBytes the oldest
+    //go, their senders' retransmits still cover them.
+    void retain(uint16_t sender, uint32_t messageId, const uint8_t *wire, size_t len);
+    //the client ACKed sender's chat
+    void release(uint16_t sender, uint32_t messageId);
+    //what is retained, oldest first, for a replay
+    void copyFrames(std::vector<std::string> &out);
+    size_t retainedBytes();
+
+private:
+    friend class ResumeTable;
+
+    std::mutex lock;
+    std::deque<RetainedFrame> frames;
+    size_t bytes = 0;
+    SessionRef attached{nullptr, -1, 0};   //the connection it is on, owner null once that dropped
+    uint64_t detachedMs = 0;
+};
+
+//Sessions by client id, sharded like SessionTable. A session outlives its connection
+//by keepMs; resuming it within that time attaches it to the new connection.
+class ResumeTable {
+public:
+    static const size_t shardCount = 16;
+    static const size_t maxFrames = 1024;
+    static const size_t maxBytes = 1024 * 1024;
+    static const unsigned keepMs = 60000;
+
+    //a new session with a fresh token, replacing one the client had on conn; null while
+    //the client has one that hasn't expired anywhere else
+    std::shared_ptr<ResumableSession> open(uint16_t clientId, const SessionRef &conn);
+    //the client's session if token is its token and it hasn't expired, attached to conn;
+    //null otherwise
+    std::shared_ptr<ResumableSession> resume(uint16_t clientId, uint64_t token, const SessionRef &conn);
+    //whether token is the client's session token and the session hasn't expired; nothing
+    //is attached
+    bool matches(uint16_t clientId, uint64_t token);
+    //conn dropped; a session already resumed on another connection stays attached there
+    void detach(ResumableSession &session, const SessionRef &conn);
+
+private:
+    struct alignas(64) Shard {
+        std::mutex lock;
+        std::unordered_map<uint16_t, std::shared_ptr<ResumableSession>> sessions;
+    };
+
+    Shard &shardFor(uint16_t clientId) { return shards[clientId % shardCount]; }
+
+    Shard shards[shardCount];
+};
+
+#endif
@@ -0,0 +1,69 @@
+//Chat room membership for broadcast messages
+//Author: Justin Jeirles
+
+#include "rooms.h"
+
+using namespace std;
+
+void RoomTable::join(uint16_t roomId, const SessionRef &member)
+{
+    Shard &shard = shardFor(roomId);
+    lock_guard<mutex> guard(shard.lock);
+
+    auto &current = shard.rooms[roomId];
+    shared_ptr<RoomMembers> updated = current ? make_shared<RoomMembers>(*current) : make_shared<RoomMembers>();
+
+    for (auto &group : updated->byOwner)
+    {
+        if (group.first != member.owner)
+            continue;
+        for (const SessionRef &existing : group.second)
+            if (existing.connId == member.connId)
+                return;
+        group.second.push_back(member);
+        updated->count++;
+        current = updated;
+        return;
+    }
+    updated->byOwner.emplace_back(member.owner, vector<SessionRef>{member});
+    updated->count++;
+    current = updated;
+}
+
+void RoomTable::leave(uint16_t roomId, Reactor *owner, uint32_t connId)
+{
+    Shard &shard = shardFor(roomId);
+    lock_guard<mutex> guard(shard.lock);
+
+    auto it = shard.rooms.find(roomId);
+    if (it == shard.rooms.end())
+        return;
+
+    shared_ptr<RoomMembers> updated = make_shared<RoomMembers>(*it->second);
+    for (auto group = updated->byOwner.begin(); group != updated->byOwner.end(); ++group)
+    {
+        if (group->first != owner)
+            continue;
+        for (auto member = group->second.begin(); member != group->second.end(); ++member)
+        {
+            if (member->connId != connId)
+                continue;
+            group->second.erase(member);
+            if (group->second.empty())
+                updated->byOwner.erase(group);
+            if (--updated->count == 0)
+                shard.rooms.erase(it);
+            else
+                it->second = updated;
+            return;
+        }
+    }
+}
+
+shared_ptr<const RoomMembers> RoomTable::members(uint16_t roomId) const
+{
+    const Shard &shard = shardFor(roomId);
+    lock_guard<mutex> guard(shard.lock);
+    auto it = shard.rooms.find(roomId);
+    return it == shard.rooms.end() ? nullptr : it->second;
+}
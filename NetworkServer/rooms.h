@@ -0,0 +1,56 @@
+//Chat room membership for broadcast messages
+//Author: Justin Jeirles
+
+#ifndef ROOMS_H
+#define ROOMS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "sessiontable.h"
+
+//Immutable member list of a room, grouped by the reactor owning each member so
+//a broadcast posts at most one task per worker. Joins and leaves build a new
+//list (copy on write), a broadcast just takes a reference to the current one.
+struct RoomMembers {
+    std::vector<std::pair<Reactor *, std::vector<SessionRef>>> byOwner;
+    size_t count = 0;
+};
+
+//Encoded frames shared between every recipient of a broadcast
+typedef std::shared_ptr<const std::string> FrameBuffer;
+
+class RoomTable {
+public:
+    static const size_t shardCount = 16;
+
+    void join(uint16_t roomId, const SessionRef &member);
+    //connection ids are only unique per reactor, so members are matched on both
+    void leave(uint16_t roomId, Reactor *owner, uint32_t connId);
+    //null if nobody is in the room
+    std::shared_ptr<const RoomMembers> members(uint16_t roomId) const;
+
+    //fan-out accounting, printed when the server shuts down
+    std::atomic<uint64_t> broadcasts{0};
+    std::atomic<uint64_t> deliveries{0};
+    std::atomic<uint64_t> bytesCopied{0};
+
+private:
+    struct alignas(64) Shard {
+        mutable std::mutex lock;
+        std::unordered_map<uint16_t, std::shared_ptr<const RoomMembers>> rooms;
+    };
+
+    Shard &shardFor(uint16_t roomId) { return shards[roomId % shardCount]; }
+    const Shard &shardFor(uint16_t roomId) const { return shards[roomId % shardCount]; }
+
+    Shard shards[shardCount];
+};
+
+#endif
@@ -2,249 +2,1149 @@
 //Author: Justin Jeirles
 
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <iostream>
 #include <netinet/in.h>
 #include <cstring>
 #include <unistd.h>
 #include <cstdio>
+#include <cstdlib>
 #include <thread>
 #include <ctime>
 #include <atomic>
+#include <algorithm>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "../Common/message.h"
+#include "../Common/checksum.h"
+#include "../Common/framesend.h"
+#include "../Common/ackbatch.h"
+#include "../Common/log.h"
+#include "../Common/messagestore.h"
+#include "../Common/history.h"
+#include "../Common/compress.h"
+#include "reactor.h"
+#include "sessiontable.h"
+#include "rooms.h"
+#include "resumetable.h"
+#include "ratelimit.h"
 
 using namespace std;
 
-struct MessageHeader {
-    uint8_t headerLen;
-    uint8_t messageType;
-    uint32_t timeStamp;
-    uint16_t sender_id;
-    uint16_t receiver_id;
-    uint32_t message_id;
-    uint16_t payloadLen;
-    uint16_t checksum;
-};
+//the server's own id, frames addressed to it are handled here instead of routed
+const uint16_t serverId = 1;
 
-atomic<bool> exitThread{false};
-atomic<uint32_t> messageCount{0};
+//registered clients, for routing frames by receiver_id
+SessionTable sessions;
 
-uint16_t checkSum_Gen(const uint8_t *data, size_t len)
-{
-    uint32_t sum = 0;
-    for (uint i = 0; i < len; i++)
-        sum += data[i];
+//chat rooms, for broadcasting frames to every member
+RoomTable rooms;
 
-    return (uint16_t)sum;
-}
+//log of routed chats and ACKs, holding chats for clients that aren't connected;
+//only open when the server was given a directory for it
+MessageStore store;
+atomic<uint64_t> framesReplayed{0};
+
+//sessions clients can resume after their connection drops, and what resuming them sent again
+ResumeTable resumable;
+atomic<uint64_t> sessionsResumed{0};
+atomic<uint64_t> framesResumed{0};
+atomic<uint64_t> bytesResumed{0};
+
+//how much a replay leaves queued on a connection before waiting for it to drain, and
+//how often it looks. On epoll it waits as soon as anything is queued, so the rest of
+//the backlog keeps going out with sendfile().
+const size_t replayQueueBytes = 64 * 1024;
+const unsigned replayRetryMs = 1;
+
+//most chats one history request gets back
+const size_t historyMaxChats = 1000;
+
+//Admission control: frames over their sender's rate are NACKed, or with deferLimited
+//left unread until the sender has a token again; connections past the cap are turned away
+RateLimiter limiter;
+bool deferLimited = false;
+ConnectionCap connectionCap;
+
+//one reactor per worker thread; filled in before the workers start, then left alone
+vector<unique_ptr<Reactor>> reactors;
 
-bool checkSum_Check(uint16_t checkSum)
+//how long chats to the server wait to be acknowledged together in one range ACK:
+//0 means until the worker has handled the frames it has now, -1 ACKs each chat on its own
+int ackDelayMs = 0;
+
+//Keeps a chat that goes out to a client with a resumable session until the client ACKs it
+void retainChat(Connection &dest, const uint8_t *wire, size_t len)
 {
-    return true;
+    if (!dest.resumable || frame_Type(wire[offsetof(WireHeader, messageType)]) != 3)
+        return;
+    dest.resumable->retain(wire_Load16(wire + offsetof(WireHeader, sender_id)),
+                           wire_Load32(wire + offsetof(WireHeader, message_id)), wire, len);
 }
 
-void socket_Send(int sockfd, const u_int8_t msgType, const string& message)
+void socket_Send(Connection &conn, const u_int8_t msgType, string_view message, uint16_t receiver = 0)
 {
     //When message is sent:
         //1) write appropriate header
         MessageHeader myHeader;
-        myHeader.headerLen = sizeof(MessageHeader); //Calculate after filling header?
+        myHeader.headerLen = headerWireLen;
         myHeader.messageType = msgType;
         myHeader.timeStamp = (uint32_t)time(nullptr);
-        myHeader.sender_id = 2; //sample id
-        myHeader.receiver_id = 1; //sample id
-        myHeader.message_id = 12345; //sample id
+        myHeader.sender_id = serverId;
+        myHeader.receiver_id = receiver;
+        myHeader.message_id = ++conn.nextMessageId;
         myHeader.payloadLen = message.size();
-        myHeader.checksum = 0; //calculate
-        
-        size_t packetSize = myHeader.headerLen + myHeader.payloadLen;
-        uint8_t *buff = new uint8_t[packetSize];
-        memcpy(buff, &myHeader, sizeof(myHeader));
-        memcpy(buff + sizeof(myHeader), message.c_str(), message.size());
-        myHeader.checksum = checkSum_Gen(buff, packetSize);
-        //memcpy(buff, &myHeader, sizeof(myHeader));
+        myHeader.checksum = 0; //filled in by frame_Encode
+
+        //4) hand the frame to the connection's reactor, which sends or queues it without blocking
+        uint8_t frame[headerWireLen + UINT16_MAX];
+        size_t len = frame_Encode(myHeader, message.data(), message.size(), frame);
+        if (len == 0)
+        {
+            LOG_WARN("Message too long for one frame");
+            return;
+        }
+        retainChat(conn, frame, len);
+        if (conn.owner->send(conn, frame, len) == Reactor::SendFailed)
+            LOG_ERROR("%s", strerror(errno));
+}
+
+//A message id as the text ACKs, NACKs and errors carry, in the connection's arena
+string_view idText(Connection &conn, uint32_t messageId)
+{
+    char *text = (char *)conn.arena.alloc(10, 1);
+    return string_view(text, to_chars(text, text + 10, messageId).ptr - text);
+}
+
+//Answers a frame with type and its message id as the payload, e.g. an ACK
+void answerId(Connection &conn, uint8_t type, const MessageHeader &header)
+{
+    socket_Send(conn, type, idText(conn, header.message_id), header.sender_id);
+}
+
+//Sends everything waiting in conn.acks as one range ACK (type 9)
+void flushAcks(Connection &conn)
+{
+    if (conn.acks.empty())
+        return;
+    size_t len = conn.acks.wireLen();
+    uint8_t *ranges = (uint8_t *)conn.arena.alloc(len, 1);
+    conn.acks.encode(ranges);
+    socket_Send(conn, 9, string_view((const char *)ranges, len), conn.clientId);
+}
+
+//Acknowledges a chat sent to the server. The first chat of a batch schedules the flush;
+//a batch that fills up before then goes out straight away.
+void ackChat(Connection &conn, uint32_t messageId)
+{
+    if (ackDelayMs < 0)
+    {
+        socket_Send(conn, 4, idText(conn, messageId), conn.clientId);
+        return;
+    }
+    bool scheduled = !conn.acks.empty();
+    if (conn.acks.add(messageId))
+    {
+        flushAcks(conn);
+        return;
+    }
+    if (scheduled)
+        return;
+
+    Reactor *owner = conn.owner;
+    int fd = conn.fd;
+    uint32_t connId = conn.id;
+    auto flush = [owner, fd, connId]() {
+        if (Connection *later = owner->connection(fd, connId))
+            flushAcks(*later);
+    };
+    if (ackDelayMs == 0)
+        owner->post(flush);
+    else
+        owner->runAfter(ackDelayMs, flush);
+}
 
-        //4) pass message to TCP
-        send(sockfd, buff, packetSize, 0);
+//Starts timing one chat in MetricsShard::sampleEvery on its way to the receiver and
+//back as an ACK. A connection times a few at once; ones whose ACK never came make
+//room after a minute.
+void timeChat(Connection &conn, uint32_t messageId)
+{
+    if (messageId % MetricsShard::sampleEvery != 0)
+        return;
+    uint64_t now = metrics_NowNs();
+    auto &timed = conn.timedChats;
+    if (timed.size() >= 64)
+        timed.erase(remove_if(timed.begin(), timed.end(),
+                              [now](const pair<uint32_t, uint64_t> &t) { return now - t.second > 60000000000ull; }),
+                    timed.end());
+    if (timed.size() < 64)
+        timed.emplace_back(messageId, now);
 }
 
-void socket_Receive(int sockfd)
+//A relayed ACK (type 4) or range ACK (type 9) on its way back to the chat's sender:
+//records the round trip of any timed chat it acknowledges
+void ackRelayed(Connection &dest, const uint8_t *wire, size_t len)
 {
-    MessageHeader *myHeader;
-    //int error=0;
-    char buff[1024];
-    while (1) {
-        cout << "Waiting for Msg\n";
-        while (recv(sockfd, buff, sizeof(buff), MSG_DONTWAIT | MSG_PEEK) == -1)
+    auto &timed = dest.timedChats;
+    uint8_t type = wire[offsetof(WireHeader, messageType)];
+    if (timed.empty() || (type != 4 && type != 9))
+        return;
+    const char *payload = (const char *)wire + headerWireLen;
+    size_t payloadLen = len - headerWireLen;
+    uint32_t single = 0;
+    if (type == 4)
+        from_chars(payload, payload + payloadLen, single);
+    uint64_t now = metrics_NowNs();
+    for (size_t i = 0; i < timed.size();)
+    {
+        uint32_t id = timed[i].first;
+        bool acked = type == 4 && id == single;
+        for (size_t r = 0; type == 9 && !acked && r < ackRange_Count(payloadLen); r++)
         {
-            if (exitThread.load() == 1)
-                return;
+            uint32_t first, last;
+            ackRange_Load(payload, r, first, last);
+            acked = id >= first && id <= last;
         }
-        ssize_t inBytes = recv(sockfd, buff, sizeof(buff), 0);
-        if (inBytes > 0)
+        if (!acked)
         {
-        //When message is received:
-            //1) convert header
-            myHeader = reinterpret_cast<MessageHeader *>(buff);
-            time_t timeRaw = myHeader->timeStamp;
-            struct tm* timeInfo = localtime(&timeRaw);
-            char timeString[20];
-            strftime(timeString, sizeof(timeString), "%Y-%m-%d %H:%M%S", timeInfo);
+            i++;
+            continue;
+        }
+        dest.owner->metrics().ackRoundTrip.record(now - timed[i].second);
+        timed[i] = timed.back();
+        timed.pop_back();
+    }
+}
+
+//The plain version of a compressed chat, for a receiver that didn't ask for compressed
+//ones. False if it is corrupt or its text is too long for a frame.
+bool plainFrame(const uint8_t *wire, size_t len, string &plain)
+{
+    MessageHeader header = header_Decode(wire);
+    string text;
+    if (!compress_Expand((const char *)wire + headerWireLen, len - headerWireLen, text))
+        return false;
+    header.messageType = frame_Type(header.messageType);
+    plain.resize(headerWireLen + text.size());
+    return frame_Encode(header, text.data(), text.size(), (uint8_t *)&plain[0]) != 0;
+}
 
-            cout << "Timestamp: " << timeString << ", Type: " << (int)myHeader->messageType << ", Payload Length: " << myHeader->payloadLen << " bytes\n";
+//Whether dest needs a compressed chat expanded before it goes out
+bool needsPlain(const Connection &dest, const uint8_t *wire)
+{
+    return !dest.compressed && frame_Compressed(wire[offsetof(WireHeader, messageType)]);
+}
+
+//Queues a relayed frame on its receiver. False if the sender should get a NACK:
+//the receiver is gone, or its queue is full and the policy is to NACK.
+bool relayTo(Connection *dest, const uint8_t *wire, size_t len)
+{
+    if (!dest)
+        return false;
+    ackRelayed(*dest, wire, len);
+    retainChat(*dest, wire, len);
+    Reactor::SendResult result = dest->owner->send(*dest, wire, len);
+    if (result == Reactor::SendOverflow)
+        return dest->owner->sendPolicy() != Reactor::NackWhenFull;
+    return result != Reactor::SendFailed;
+}
+
+//Appends a routed chat (type 3) or ACK (4 or 9) to the message store if there is one.
+//held keeps a chat for a receiver that isn't connected; false if it wasn't kept.
+bool storeFrame(const uint8_t *wire, size_t len, bool held = false)
+{
+    uint8_t type = frame_Type(wire[offsetof(WireHeader, messageType)]);
+    if (!store.isOpen() || (type != 3 && type != 4 && type != 9))
+        return false;
+    return store.append(wire, len, held);
+}
 
-            if (myHeader->payloadLen > sizeof(buff) - sizeof(myHeader))
+//Streams the chats held for a client while it was away, oldest first, from next on.
+//Frames lying back to back in a segment go out together with one sendfile() while the
+//socket takes them; once they back up the rest waits for them to drain, so a long
+//backlog never sits in memory. They stay held until the client ACKs them, so a replay
+//cut short is repeated in full on the next reconnect, and the client's duplicate
+//filter drops the repeats. A compressed chat for a client that didn't ask for them is
+//expanded and sent on its own.
+void replayHeld(Reactor *owner, int fd, uint32_t connId, shared_ptr<vector<StoredFrame>> backlog, size_t next)
+{
+    Connection *conn = owner->connection(fd, connId);
+    if (!conn)
+        return;
+    size_t budget = owner->engine() == Reactor::UringEngine ? replayQueueBytes : 0;
+    bool single = false;    //runs don't fit the queue limit, one frame at a time
+    while (next < backlog->size())
+    {
+        if (conn->outBytes > budget)
+        {
+            owner->runAfter(replayRetryMs, [owner, fd, connId, backlog, next]() {
+                replayHeld(owner, fd, connId, backlog, next);
+            });
+            return;
+        }
+        const StoredFrame &first = (*backlog)[next];
+        size_t end = next + 1, len = first.len;
+        Reactor::SendResult result;
+        string plain;
+        if (needsPlain(*conn, store.frameData(first)))
+            result = plainFrame(store.frameData(first), first.len, plain)
+                         ? owner->send(*conn, (const uint8_t *)plain.data(), plain.size())
+                         : Reactor::SendDone;
+        else
+        {
+            while (!single && end < backlog->size() && len < replayQueueBytes &&
+                   (*backlog)[end].segment == first.segment && (*backlog)[end].offset == first.offset + len &&
+                   !needsPlain(*conn, store.frameData((*backlog)[end])))
+                len += (*backlog)[end++].len;
+            result = owner->sendFile(*conn, store.segmentFd(first.segment), first.offset, store.frameData(first), len);
+        }
+        if (result == Reactor::SendFailed)
+            return;
+        if (result == Reactor::SendOverflow)
+        {
+            //try again once the queue has drained; if it is empty already the limit is
+            //below the run, so go frame by frame, and give up on a frame that can't fit
+            if (conn->outBytes == 0)
             {
-                cerr << "Message Length exceedes Buffer, dumping Message and sending Error\n";
-                socket_Send(sockfd, 6, to_string(myHeader->message_id));
+                if (single)
+                    return;
+                single = true;
                 continue;
             }
-            else if (!checkSum_Check(myHeader->checksum))
-            {
-                cerr << "Invalid checksum, sending Error Message\n";
-                socket_Send(sockfd, 6, to_string(myHeader->message_id));
+            owner->runAfter(replayRetryMs, [owner, fd, connId, backlog, next]() {
+                replayHeld(owner, fd, connId, backlog, next);
+            });
+            return;
+        }
+        framesReplayed += end - next;
+        next = end;
+    }
+}
+
+//Sends a resumed session's retained chats to its new connection, oldest first, waiting
+//for the queue to drain whenever it backs up. They stay retained until the client ACKs
+//them; any the client had seen after all its duplicate filter drops.
+void replayRetained(Reactor *owner, int fd, uint32_t connId, shared_ptr<vector<string>> frames, size_t next)
+{
+    Connection *conn = owner->connection(fd, connId);
+    if (!conn)
+        return;
+    while (next < frames->size())
+    {
+        if (conn->outBytes > replayQueueBytes)
+        {
+            owner->runAfter(replayRetryMs, [owner, fd, connId, frames, next]() {
+                replayRetained(owner, fd, connId, frames, next);
+            });
+            return;
+        }
+        const string &wire = (*frames)[next];
+        Reactor::SendResult result;
+        string plain;
+        if (needsPlain(*conn, (const uint8_t *)wire.data()))
+            result = plainFrame((const uint8_t *)wire.data(), wire.size(), plain)
+                         ? owner->send(*conn, (const uint8_t *)plain.data(), plain.size())
+                         : Reactor::SendDone;
+        else
+            result = owner->send(*conn, (const uint8_t *)wire.data(), wire.size());
+        if (result == Reactor::SendFailed)
+            return;
+        //a frame the queue can't take even empty is given up on, its sender may retransmit it
+        if (result == Reactor::SendOverflow && conn->outBytes > 0)
+        {
+            owner->runAfter(replayRetryMs, [owner, fd, connId, frames, next]() {
+                replayRetained(owner, fd, connId, frames, next);
+            });
+            return;
+        }
+        framesResumed++;
+        bytesResumed += wire.size();
+        next++;
+    }
+}
+
+//A status request resuming clientId's session with its token, which is what lets a
+//client that reconnected before the server noticed its old connection go take its id back
+bool resumesSession(const Frame &frame, uint16_t clientId)
+{
+    if (frame_Type(frame.header.messageType) != 1)
+        return false;
+    uint64_t token = session_Token(frame.payload, frame.header.payloadLen, resumeFeature);
+    return token != 0 && resumable.matches(clientId, token);
+}
+
+//Sends what the store held for a client while it was away to its connection
+void replayBacklog(Connection &conn)
+{
+    if (!store.isOpen())
+        return;
+    auto backlog = make_shared<vector<StoredFrame>>();
+    store.heldFor(conn.clientId, *backlog);
+    if (!backlog->empty())
+    {
+        LOG_INFO("Replaying %zu held message(s) to %d", backlog->size(), conn.clientId);
+        replayHeld(conn.owner, conn.fd, conn.id, backlog, 0);
+    }
+}
+
+//Remembers which connection a client id lives on: the first frame a client sends claims
+//its id and pins the connection to it. False if the frame is to be refused, for another
+//sender_id than the one pinned, the server's own, or one a live connection holds and
+//isn't being resumed. Only a claim nobody contested gets what was held for the client;
+//a resume taking the id over from a live connection gets its session's chats instead,
+//and a pinned connection never claims again.
+bool registerClient(Connection &conn, const Frame &frame)
+{
+    uint16_t clientId = frame.header.sender_id;
+    if (conn.clientId != 0)
+        return clientId == conn.clientId;
+    if (clientId == 0)
+        return true;      //hasn't said who it is yet
+    if (clientId == serverId)
+        return false;
+    SessionRef here{conn.owner, conn.fd, conn.id};
+    bool uncontested = sessions.claim(clientId, here);
+    if (!uncontested)
+    {
+        if (!resumesSession(frame, clientId))
+        {
+            LOG_WARN("Connection claimed %d, which another connection holds", clientId);
+            return false;
+        }
+        sessions.add(clientId, here);
+    }
+    conn.clientId = clientId;
+    if (uncontested)
+        replayBacklog(conn);
+    return true;
+}
+
+void unregisterClient(Connection &conn)
+{
+    if (conn.clientId != 0)
+        sessions.remove(conn.clientId, conn.id);
+    if (conn.resumable)
+        resumable.detach(*conn.resumable, SessionRef{conn.owner, conn.fd, conn.id});
+    for (uint16_t roomId : conn.rooms)
+        rooms.leave(roomId, conn.owner, conn.id);
+}
+
+//Payload byte 1 joins the room in receiver_id, 0 leaves it
+void changeMembership(Connection &conn, const Frame &frame)
+{
+    uint16_t roomId = frame.header.receiver_id;
+    bool joining = frame.header.payloadLen > 0 && frame.payload[0] == 1;
+    auto it = find(conn.rooms.begin(), conn.rooms.end(), roomId);
+
+    if (joining && it == conn.rooms.end())
+    {
+        rooms.join(roomId, SessionRef{conn.owner, conn.fd, conn.id});
+        conn.rooms.push_back(roomId);
+    }
+    else if (!joining && it != conn.rooms.end())
+    {
+        rooms.leave(roomId, conn.owner, conn.id);
+        conn.rooms.erase(it);
+    }
+}
+
+//Sends one shared frame to a worker's share of a room, skipping whoever sent it;
+//senderConn is 0 for workers other than the sender's. A member whose queue is full
+//just misses the frame, NACKing the sender once per slow member would flood it, as
+//does one that needs a compressed chat expanded and can't have it.
+void deliverToMembers(Reactor *owner, const vector<SessionRef> &members, uint32_t senderConn,
+                      const uint8_t *wire, size_t len)
+{
+    uint64_t delivered = 0;
+    string plain;
+    bool expanded = false, expandable = false;
+    for (const SessionRef &member : members)
+    {
+        if (member.connId == senderConn)
+            continue;
+        Connection *dest = owner->connection(member.fd, member.connId);
+        if (!dest)
+            continue;
+        Reactor::SendResult result;
+        if (needsPlain(*dest, wire))
+        {
+            //expanded once, for the first member that needs it
+            if (!expanded)
+                expandable = plainFrame(wire, len, plain);
+            expanded = true;
+            if (!expandable)
                 continue;
-            }
-            
-            string message(buff + sizeof(MessageHeader), myHeader->payloadLen);
+            result = owner->send(*dest, (const uint8_t *)plain.data(), plain.size());
+        }
+        else
+            result = owner->send(*dest, wire, len);
+        if (result == Reactor::SendDone || result == Reactor::SendQueued)
+            delivered++;
+    }
+    rooms.deliveries += delivered;
+}
+
+//Room chat goes out as the sender encoded it. Members on this worker get it straight
+//from the receive buffer; if other workers have members it is copied exactly once into
+//a refcounted buffer that all of their tasks share.
+void broadcastRoom(Connection &conn, const Frame &frame)
+{
+    shared_ptr<const RoomMembers> members = rooms.members(frame.header.receiver_id);
+    if (!members)
+        return;
+    rooms.broadcasts++;
+
+    size_t len = headerWireLen + frame.header.payloadLen;
+    FrameBuffer shared;
+    for (const auto &group : members->byOwner)
+    {
+        if (group.first == conn.owner)
+        {
+            deliverToMembers(conn.owner, group.second, conn.id, frame.wire, len);
+            continue;
+        }
+        if (!shared)
+        {
+            shared = make_shared<const string>((const char *)frame.wire, len);
+            rooms.bytesCopied += len;
+        }
+        Reactor *owner = group.first;
+        const vector<SessionRef> *share = &group.second;
+        owner->post([owner, members, share, shared]() {
+            deliverToMembers(owner, *share, 0, (const uint8_t *)shared->data(), shared->size());
+        });
+    }
+}
+
+//Answers a chat that couldn't be delivered now, from whichever thread found out: an ACK
+//(type 4) if the store is holding it for the receiver, a NACK (5) to resend it, or an
+//error (6) if it never can be delivered
+void answerUndelivered(const SessionRef &origin, const MessageHeader &header, uint8_t type)
+{
+    if (frame_Type(header.messageType) != 3)
+        return;
+    uint16_t sender = header.sender_id;
+    uint32_t messageId = header.message_id;
+    origin.owner->post([origin, sender, messageId, type]() {
+        if (Connection *conn = origin.owner->connection(origin.fd, origin.connId))
+            socket_Send(*conn, type, idText(*conn, messageId), sender);
+    });
+}
+
+//Hands a routed frame to its receiver's connection, dest (null if it has gone), on the
+//receiver's worker and logs it. Returns the type to answer the sender of a chat that
+//wasn't delivered with, 0 for none: a chat for a client that has gone is held if the
+//server keeps a store, one that didn't fit the receiver's queue is NACKed to be resent.
+//A compressed chat is expanded for a receiver that didn't ask for compressed ones; if
+//it can't be, it is an error, resending won't help. The store keeps it as it came.
+uint8_t deliver(Connection *dest, const uint8_t *wire, size_t len)
+{
+    //an ACK is logged whether or not its chat's sender is still there for it
+    if (frame_Type(wire[offsetof(WireHeader, messageType)]) != 3)
+    {
+        relayTo(dest, wire, len);
+        storeFrame(wire, len);
+        return 0;
+    }
+    if (!dest)
+        return storeFrame(wire, len, true) ? 4 : 5;
+    string plain;
+    if (needsPlain(*dest, wire))
+    {
+        if (!plainFrame(wire, len, plain))
+            return 6;
+        if (!relayTo(dest, (const uint8_t *)plain.data(), plain.size()))
+            return 5;
+    }
+    else if (!relayTo(dest, wire, len))
+        return 5;
+    storeFrame(wire, len);
+    return 0;
+}
+
+//Relays a chat/ACK/NACK frame untouched to the connection owning receiver_id.
+//A chat for a client that isn't connected is kept in the message store and ACKed on the
+//receiver's behalf, or without a store NACKed back to its sender.
+void routeFrame(Connection &conn, const Frame &frame)
+{
+    const MessageHeader &header = frame.header;
+    size_t len = headerWireLen + header.payloadLen;
+    SessionRef target;
+    if (!sessions.find(header.receiver_id, target))
+    {
+        if (uint8_t answer = deliver(nullptr, frame.wire, len))
+            answerId(conn, answer, header);
+        return;
+    }
+
+    //same worker: straight out of the receive buffer
+    if (target.owner == conn.owner)
+    {
+        if (uint8_t answer = deliver(conn.owner->connection(target.fd, target.connId), frame.wire, len))
+            answerId(conn, answer, header);
+        return;
+    }
+
+    //another worker owns the receiver: the buffer is only ours until we return, so copy the frame over
+    SessionRef origin{conn.owner, conn.fd, conn.id};
+    MessageHeader copied = header;
+    string wire((const char *)frame.wire, len);
+    target.owner->post([target, origin, copied, wire]() {
+        Connection *dest = target.owner->connection(target.fd, target.connId);
+        if (uint8_t answer = deliver(dest, (const uint8_t *)wire.data(), wire.size()))
+            answerUndelivered(origin, copied, answer);
+    });
+}
+
+//A stats request being answered; the workers fill in their connections' lines
+struct StatsRequest {
+    SessionRef requester;
+    uint16_t clientId;
+    mutex lock;
+    vector<string> families;    //per connection samples, one string per metric
+    unsigned pending;           //workers still to report
+};
+
+//per connection metrics: name, help, and how to read it
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+    uint64_t (*value)(const Connection &);
+} connectionMetrics[] = {
+    {"chat_connection_frames_in_total", "counter", "Frames received on a connection",
+     [](const Connection &c) { return c.framesIn; }},
+    {"chat_connection_frames_out_total", "counter", "Frames sent or queued on a connection",
+     [](const Connection &c) { return c.framesOut; }},
+    {"chat_connection_bytes_in_total", "counter", "Frame bytes received on a connection",
+     [](const Connection &c) { return c.bytesIn; }},
+    {"chat_connection_bytes_out_total", "counter", "Frame bytes sent or queued on a connection",
+     [](const Connection &c) { return c.bytesOut; }},
+    {"chat_connection_send_queue_bytes", "gauge", "Bytes waiting in a connection's send queue",
+     [](const Connection &c) { return (uint64_t)c.outBytes; }},
+};
+static const size_t connectionMetricCount = sizeof(connectionMetrics) / sizeof(connectionMetrics[0]);
+
+//Renders everything and sends it back on the requester's worker
+void replyStats(StatsRequest &request)
+{
+    Connection *conn = request.requester.owner->connection(request.requester.fd, request.requester.connId);
+    if (!conn)
+        return;
+
+    string text;
+    vector<const MetricsShard *> shards;
+    uint64_t connections = 0, queued = 0, peak = 0, overflows = 0, disconnects = 0, syscalls = 0;
+    for (auto &reactor : reactors)
+    {
+        shards.push_back(&reactor->metrics());
+        connections += reactor->connectionCount();
+        const SendQueueStats &queues = reactor->sendStats();
+        queued += queues.queuedBytes.load();
+        peak = max<uint64_t>(peak, queues.peakBytes.load());
+        overflows += queues.overflows.load();
+        disconnects += queues.disconnects.load();
+        syscalls += reactor->ioStats().syscalls.load();
+    }
+    metrics_Render(shards, "chat_", text);
+    metrics_Line(text, "chat_connections", "gauge", "Open client connections", connections);
+    metrics_Line(text, "chat_send_queue_bytes", "gauge", "Bytes waiting in send queues", queued);
+    metrics_Line(text, "chat_send_queue_peak_bytes", "gauge", "Deepest single send queue seen", peak);
+    metrics_Line(text, "chat_send_overflows_total", "counter", "Frames refused by a full send queue", overflows);
+    metrics_Line(text, "chat_slow_disconnects_total", "counter", "Connections dropped for not reading", disconnects);
+    metrics_Line(text, "chat_syscalls_total", "counter", "Networking system calls made by the workers", syscalls);
+    metrics_Line(text, "chat_rate_limited_total", "counter", "Frames over their sender's rate", limiter.limited.load());
+    metrics_Line(text, "chat_connections_refused_total", "counter", "Connections turned away at the cap",
+                 connectionCap.refused.load());
+    for (size_t i = 0; i < connectionMetricCount; i++)
+    {
+        text += string("# HELP ") + connectionMetrics[i].name + " " + connectionMetrics[i].help + "\n";
+        text += string("# TYPE ") + connectionMetrics[i].name + " " + connectionMetrics[i].type + "\n";
+        text += request.families[i];
+    }
+
+    //one frame's worth; with that many connections the last ones are left out
+    if (text.size() > UINT16_MAX)
+    {
+        const char *cut = "# truncated\n";
+        text.resize(text.rfind('\n', UINT16_MAX - strlen(cut)) + 1);
+        text += cut;
+    }
+    socket_Send(*conn, 10, text, request.clientId);
+}
 
-            //1) determine message type and perform appropriate functions
-            switch ((int)myHeader->messageType)
+//Answers a stats request (type 10) with the server's metrics as Prometheus text.
+//Counters and histograms are read straight from the workers' shards. Per connection
+//numbers belong to each worker's thread, so every worker lists its own connections
+//and the last one to finish passes the request back to the requester's worker.
+void sendStats(Connection &conn, uint16_t clientId)
+{
+    auto request = make_shared<StatsRequest>();
+    request->requester = SessionRef{conn.owner, conn.fd, conn.id};
+    request->clientId = clientId;
+    request->families.resize(connectionMetricCount);
+    request->pending = reactors.size();
+    for (size_t worker = 0; worker < reactors.size(); worker++)
+    {
+        Reactor *owner = reactors[worker].get();
+        owner->post([owner, worker, request]() {
+            vector<string> lines(connectionMetricCount);
+            owner->forEachConnection([&lines, worker](Connection &c) {
+                string labels = "{worker=\"" + to_string(worker) + "\",conn=\"" + to_string(c.id) + "\",client=\"" +
+                                to_string(c.clientId) + "\"} ";
+                for (size_t i = 0; i < connectionMetricCount; i++)
+                    lines[i] += connectionMetrics[i].name + labels + to_string(connectionMetrics[i].value(c)) + "\n";
+            });
+            bool last;
             {
-                case 1:
-                    cout << "Status Request received from: " << (int)myHeader->sender_id << ", sending response\n";
-                    socket_Send(sockfd, 2, to_string(myHeader->message_id));
-                    break;
-                case 2:
-                    cout << "Status Response received, " << (int)myHeader->sender_id << " is online\n";
-                    break;
-                case 3:
-                    cout << "Chat Message received: " << message << "\n";
-                    socket_Send(sockfd, 4, to_string(myHeader->message_id));
-                    break;
-                case 4:
-                    cout << "Received ACK for Message " << message << "\n";
-                    break;
-                case 5:
-                    cout << "Received NACK for Message " << message << "\n";
-                    break;
-                case 6:
-                    cout << "Received Error for Message " << message << "\n";
-                    break;
-                default:
-                    cout << "Unknown message type: " << (int)myHeader->messageType << " received, sending Error Message\n";
-                    socket_Send(sockfd, 6, to_string(myHeader->message_id));
-                    break;
+                lock_guard<mutex> guard(request->lock);
+                for (size_t i = 0; i < connectionMetricCount; i++)
+                    request->families[i] += lines[i];
+                last = --request->pending == 0;
             }
+            if (last)
+                request->requester.owner->post([request]() { replyStats(*request); });
+        });
+    }
+}
+
+//Answers a history request (type 11) with the chats it asks for, packed as they were
+//stored into as few history replies (type 12) as fit them, and an empty reply to end.
+//Without a store there is no history, just the empty reply. Only the connection's own
+//registered client's conversations are served, whatever sender_id the request carries.
+void sendHistory(Connection &conn, const Frame &frame)
+{
+    const MessageHeader &header = frame.header;
+    HistoryQuery query;
+    if (conn.clientId == 0 || !historyQuery_Decode(frame.payload, header.payloadLen, query))
+    {
+        answerId(conn, 6, header);
+        return;
+    }
+    vector<StoredFrame> chats;
+    if (store.isOpen())
+        store.history(conn.clientId, query.peer, query.from, query.to, min<size_t>(query.limit, historyMaxChats),
+                      chats);
 
-            cout << "Enter Message or 'e' to exit\n";
+    string reply;
+    for (const StoredFrame &chat : chats)
+    {
+        const uint8_t *wire = store.frameData(chat);
+        size_t len = chat.len;
+        string plain;
+        if (needsPlain(conn, wire))
+        {
+            if (!plainFrame(wire, len, plain))
+                continue;
+            wire = (const uint8_t *)plain.data();
+            len = plain.size();
         }
-        else if (inBytes == 0)
+        if (reply.size() + len > UINT16_MAX)
         {
-            cout << "Connection has been closed\n";
-            close(sockfd);
-            return;
+            socket_Send(conn, 12, reply, conn.clientId);
+            reply.clear();
         }
+        reply.append((const char *)wire, len);
     }
+    if (!reply.empty())
+        socket_Send(conn, 12, reply, conn.clientId);
+    socket_Send(conn, 12, "", conn.clientId);
 }
 
+//Answers a status request (type 1) with its message id and what the server agreed to of
+//what the client listed: compressed chats, and a session it can resume after a dropped
+//connection. Resuming one sends the chats the client hadn't ACKed again, after the answer.
+//Sessions are the pinned client's, and a live one is never replaced without its token.
+void answerStatus(Connection &conn, const Frame &frame, string_view payload)
+{
+    LOG_INFO("Status Request received from: %d, sending response", frame.header.sender_id);
+    conn.compressed = payload.find(compressFeature) != string_view::npos;
+
+    uint64_t token = session_Token(payload.data(), payload.size(), resumeFeature);
+    bool resumed = false;
+    if (conn.clientId != 0 && (token != 0 || payload.find(sessionFeature) != string_view::npos) &&
+        !(conn.resumable && conn.resumable->token == token))
+    {
+        SessionRef here{conn.owner, conn.fd, conn.id};
+        conn.resumable = token ? resumable.resume(conn.clientId, token, here) : nullptr;
+        resumed = conn.resumable != nullptr;
+        if (!resumed)
+            conn.resumable = resumable.open(conn.clientId, here);
+    }
 
+    const size_t replyMax = 64;
+    char *reply = (char *)conn.arena.alloc(replyMax, 1);
+    int len = snprintf(reply, replyMax, "%u", frame.header.message_id);
+    if (conn.compressed)
+        len += snprintf(reply + len, replyMax - len, " %s", compressFeature);
+    if (conn.resumable)
+        len += snprintf(reply + len, replyMax - len, " %s=%llx", sessionFeature,
+                        (unsigned long long)conn.resumable->token);
+    socket_Send(conn, 2, string_view(reply, len), frame.header.sender_id);
 
-int main (){
-    //Declare variables
-    struct sockaddr_in saddr, caddr;
-    int sockfd, isock;
-    unsigned int clen;
-    unsigned short port = 8080;
-    bool isError;
-    int loops = 0;
+    if (!resumed)
+        return;
+    auto frames = make_shared<vector<string>>();
+    conn.resumable->copyFrames(*frames);
+    sessionsResumed++;
+    LOG_INFO("Resuming the session of %d, sending %zu chat(s) again", conn.clientId, frames->size());
+    replayRetained(conn.owner, conn.fd, conn.id, frames, 0);
+}
 
-//Establishing Connection
-    do {
-        /*
-        if (isError)
+//What a frame addressed to the server does, by message type. A handler gets the frame
+//and its payload as a view into the receive buffer, or into the connection's arena if
+//it came compressed; either is only good until the handler returns. Replies take what
+//memory they need from the arena too, so handling a frame doesn't touch the heap.
+typedef void (*MessageHandler)(Connection &conn, const Frame &frame, string_view payload);
+
+static const struct {
+    uint8_t type;
+    MessageHandler handler;
+} messageHandlers[] = {
+    {1, answerStatus},
+    {2, [](Connection &, const Frame &frame, string_view) {
+         LOG_INFO("Status Response received, %d is online", frame.header.sender_id);
+     }},
+    {3, [](Connection &conn, const Frame &frame, string_view payload) {
+         LOG_INFO("Chat Message received: %s", payload);
+         ackChat(conn, frame.header.message_id);
+     }},
+    {4, [](Connection &, const Frame &, string_view payload) {
+         LOG_INFO("Received ACK for Message %s", payload);
+     }},
+    {5, [](Connection &, const Frame &, string_view payload) {
+         LOG_INFO("Received NACK for Message %s", payload);
+     }},
+    {6, [](Connection &, const Frame &, string_view payload) {
+         LOG_INFO("Received Error for Message %s", payload);
+     }},
+    {7, [](Connection &conn, const Frame &frame, string_view) {
+         changeMembership(conn, frame);
+         answerId(conn, 4, frame.header);
+     }},
+    {8, [](Connection &conn, const Frame &frame, string_view) {
+         broadcastRoom(conn, frame);
+         answerId(conn, 4, frame.header);
+     }},
+    {9, [](Connection &, const Frame &frame, string_view) {
+         LOG_INFO("Received ACK for %u range(s) of Messages", ackRange_Count(frame.header.payloadLen));
+     }},
+    {10, [](Connection &conn, const Frame &frame, string_view) { sendStats(conn, frame.header.sender_id); }},
+    {11, [](Connection &conn, const Frame &frame, string_view) { sendHistory(conn, frame); }},
+};
+
+//by type, filled in from messageHandlers before the workers start
+MessageHandler handlers[256];
+
+void unknownMessage(Connection &conn, const Frame &frame, string_view)
+{
+    LOG_WARN("Unknown message type: %d received, sending Error Message", frame.header.messageType);
+    answerId(conn, 6, frame.header);
+}
+
+void registerHandlers()
+{
+    fill(begin(handlers), end(handlers), unknownMessage);
+    for (const auto &entry : messageHandlers)
+        handlers[entry.type] = entry.handler;
+}
+
+//Takes a token for the connection, or turns the frame away if it has none: a NACK, or
+//on epoll with deferLimited the connection goes unread until a token is due, so the
+//client's writes back up instead. The token comes from the client id the connection is
+//pinned to, or before it has one from the address it connected from; never by the
+//frame's sender_id, which isn't checked yet here. Answers to the server (ACK, NACK,
+//error) are let through, they only settle what it sent; ones for other clients get
+//relayed and count like chats.
+bool overRate(Connection &conn, const Frame &frame)
+{
+    uint8_t type = frame_Type(frame.header.messageType);
+    if ((type == 4 || type == 5 || type == 6 || type == 9) && frame.header.receiver_id == serverId)
+        return false;
+    uint64_t now = metrics_NowNs();
+    uint64_t waitNs = conn.clientId ? limiter.take(conn.clientId, now) : limiter.takeForAddress(conn.peerAddr, now);
+    if (waitNs == 0)
+        return false;
+    if (deferLimited && conn.owner->engine() == Reactor::EpollEngine)
+        conn.owner->deferFrame(conn, frame, (unsigned)((waitNs + 999999) / 1000000));
+    else
+        answerId(conn, 5, frame.header);
+    return true;
+}
+
+//Called by the reactor for every complete frame on a connection
+void handleFrame(Connection &conn, const Frame &frame)
+{
+    const MessageHeader *myHeader = &frame.header;
+
+    //before anything else is done for it
+    if (limiter.enabled() && overRate(conn, frame))
+        return;
+
+    LOG_DEBUG("Timestamp: %u, Type: %d, Payload Length: %u bytes", myHeader->timeStamp, myHeader->messageType, myHeader->payloadLen);
+
+    if (!checkSum_Check(frame.wire, frame.payload, myHeader->payloadLen))
+    {
+        LOG_WARN("Invalid checksum, sending Error Message");
+        answerId(conn, 6, *myHeader);
+        return;
+    }
+
+    if (!registerClient(conn, frame))
+    {
+        answerId(conn, 6, *myHeader);
+        return;
+    }
+
+    //chat and its ACK/NACK between clients go straight through
+    uint8_t type = frame_Type(myHeader->messageType);
+
+    //an ACK from a client with a session: the chat it is for needn't be kept for a resume
+    if (type == 4 && conn.resumable)
+    {
+        uint32_t acked = 0;
+        from_chars(frame.payload, frame.payload + myHeader->payloadLen, acked);
+        conn.resumable->release(myHeader->receiver_id, acked);
+    }
+
+    bool relayed = (type >= 3 && type <= 5) || type == 9;
+    if (myHeader->receiver_id != serverId && relayed)
+    {
+        if (type == 3)
+            timeChat(conn, myHeader->message_id);
+        routeFrame(conn, frame);
+        return;
+    }
+
+    string_view payload(frame.payload, myHeader->payloadLen);
+    if (frame_Compressed(myHeader->messageType))
+    {
+        size_t textLen;
+        char *text = nullptr;
+        if (compress_TextLen(frame.payload, myHeader->payloadLen, textLen))
+            text = (char *)conn.arena.alloc(textLen, 1);
+        if (!text || !compress_ExpandTo(frame.payload, myHeader->payloadLen, text))
         {
-            string reattempt;
-            cout << "Connection Failed, would you like to reattempt? y/n\n";
-            getline(cin, reattempt);
-            
-            if (reattempt == "y")
-                close(sockfd);
-            else if ()
+            LOG_WARN("Corrupt compressed payload, sending Error Message");
+            answerId(conn, 6, *myHeader);
+            return;
         }
-        */
-        isError = false;
-        loops++;
+        payload = string_view(text, textLen);
+    }
 
+    //1) determine message type and perform appropriate functions
+    handlers[type](conn, frame, payload);
+}
+
+//Let one process hold as many client sockets as the hard limit allows
+void raiseFdLimit()
+{
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
 
-        if (loops > 2)
+//Usage: server [port] [worker threads] [drop|nack|disconnect] [send queue limit in KB] [ACK delay ms] [epoll|uring]
+//              [message store directory or -] [local socket path or -] [frames/s per sender[:burst] or -]
+//              [nack|defer] [connection cap]
+//The policy and limit say how much may wait for a slow client and what happens beyond
+//that. The ACK delay is ackDelayMs. uring runs the workers on io_uring where the kernel
+//supports it and on epoll otherwise. With a store directory chats between clients are
+//logged there and kept for receivers that aren't connected, across restarts too, and
+//history requests are answered from it. With a local socket path, clients on this host
+//may connect there instead and exchange frames through shared memory rings; the first
+//worker takes them, and only on epoll. With a rate, each sender_id may send that many
+//frames a second, in bursts of up to a tenth of that unless given; frames beyond it are
+//NACKed, or with defer (epoll only) its connection isn't read until it may send again.
+//The connection cap counts every worker's clients, TCP and local.
+int main (int argc, char *argv[]){
+    //Declare variables
+    unsigned short port = 8080;
+    unsigned workers = thread::hardware_concurrency();
+    Reactor::SendPolicy policy = Reactor::NackWhenFull;
+    size_t queueLimit = 256 * 1024;
+    bool uring = false;
+    if (argc > 1)
+        port = (unsigned short)atoi(argv[1]);
+    if (argc > 2)
+        workers = (unsigned)atoi(argv[2]);
+    if (workers == 0)
+        workers = 1;
+    if (argc > 3)
+    {
+        string name = argv[3];
+        if (name == "drop")
+            policy = Reactor::DropWhenFull;
+        else if (name == "disconnect")
+            policy = Reactor::DisconnectWhenFull;
+        else if (name != "nack")
         {
-            cerr << "Failed to establish connection after 3 attempts, exiting program\n";
-            close(sockfd);
+            cerr << "Unknown send queue policy " << name << ", expected drop, nack or disconnect\n";
             return EXIT_FAILURE;
         }
-
-        //1) setup socket
-        if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    }
+    if (argc > 4)
+        queueLimit = (size_t)atoi(argv[4]) * 1024;
+    if (argc > 5)
+        ackDelayMs = atoi(argv[5]);
+    if (argc > 6)
+    {
+        string name = argv[6];
+        uring = name == "uring";
+        if (!uring && name != "epoll")
         {
-            cerr << strerror(errno) << "\n";
-            close(sockfd);
-            isError = EXIT_FAILURE;
+            cerr << "Unknown I/O engine " << name << ", expected epoll or uring\n";
+            return EXIT_FAILURE;
         }
-        printf("Socket created\n");
-
-        //2) bind socket 
-        memset(&saddr, '\0', sizeof(saddr)); 
-        saddr.sin_family = AF_INET;
-        saddr.sin_addr.s_addr = htonl(INADDR_ANY);
-        saddr.sin_port = htons(port);
+    }
 
-        if ((bind(sockfd, (struct sockaddr*) &saddr, sizeof(saddr)) < 0))
+    if (argc > 9 && string(argv[9]) != "-")
+    {
+        char *rest;
+        double rate = strtod(argv[9], &rest);
+        unsigned burst = *rest == ':' ? (unsigned)atoi(rest + 1) : (unsigned)max(1.0, rate / 10);
+        limiter.configure(rate, burst);
+    }
+    if (argc > 10)
+    {
+        string name = argv[10];
+        deferLimited = name == "defer";
+        if (!deferLimited && name != "nack")
         {
-            cerr << strerror(errno) << "\n";
-            close(sockfd);
-            isError = EXIT_FAILURE;
+            cerr << "Unknown rate limit policy " << name << ", expected nack or defer\n";
+            return EXIT_FAILURE;
         }
-        printf("Socket bound\n");
+    }
+    if (argc > 11)
+        connectionCap.limit = (size_t)atoi(argv[11]);
 
-        //3) listen for client
-        if (listen(sockfd, 5) < 0)
+    if (argc > 7 && string(argv[7]) != "-")
+    {
+        string why;
+        if (!store.open(argv[7], why))
         {
-            cerr << strerror(errno) << "\n";
-            close(sockfd);
-            isError = EXIT_FAILURE;
+            cerr << "Can't open the message store: " << why << "\n";
+            return EXIT_FAILURE;
         }
-        printf("Socket listening\n");
+        printf("Message store in %s: %lu frames recovered, %zu held, %zu conversations, %lu torn bytes cut off\n",
+               argv[7], (unsigned long)store.framesRecovered(), store.heldCount(), store.conversationCount(),
+               (unsigned long)store.bytesTruncated());
+    }
+
+    raiseFdLimit();
+    registerHandlers();
 
-        //4) accept connection
-        clen = sizeof(caddr);
-        if ((isock = accept(sockfd, (struct sockaddr *) &caddr, &clen)) < 0)
+//Establishing Connection
+    //one reactor per worker, each with its own SO_REUSEPORT listener and event loop
+    for (unsigned i = 0; i < workers; i++)
+    {
+        reactors.emplace_back(new Reactor(handleFrame));
+        reactors.back()->setCloseHandler(unregisterClient);
+        reactors.back()->setSendLimit(queueLimit, policy);
+        reactors.back()->setConnectionCap(&connectionCap);
+        string why;
+        if (uring && !reactors.back()->useUring(why))
+        {
+            cerr << "io_uring unavailable (" << why << "), falling back to epoll\n";
+            uring = false;
+        }
+        if (!reactors.back()->listenOn(port, workers > 1))
         {
-            cerr << strerror(errno) << "\n";
-            close(sockfd);
-            isError = EXIT_FAILURE;
+            cerr << "Failed to set up listening socket, exiting program\n";
+            return EXIT_FAILURE;
         }
-    } while (isError);
-    printf("Client connection accepted\n");
+    }
+    printf("Socket listening on port %u with %u worker thread(s) on %s\n", port, workers, uring ? "io_uring" : "epoll");
+    if (argc > 8 && string(argv[8]) != "-")
+    {
+        if (uring)
+            cerr << "Local clients need the epoll engine, not listening on " << argv[8] << "\n";
+        else if (!reactors.front()->listenLocal(argv[8]))
+        {
+            cerr << "Failed to set up the local socket, exiting program\n";
+            return EXIT_FAILURE;
+        }
+        else
+            printf("Local clients take shared memory rings from %s\n", argv[8]);
+    }
 
-    //create thread to handle message receiving
-    thread t1(socket_Receive, isock);
+    //worker threads accept clients and handle all of their messages
+    cout.flush();
+    log_Start();
+    vector<thread> threads;
+    for (auto &reactor : reactors)
+        threads.emplace_back(&Reactor::run, reactor.get());
 
     string message;
 
     while (1)
     {
         cout << "Enter Message, or 'e' to exit\n";
-        getline(cin, message);
-        if (message == "e")
+        if (!getline(cin, message) || message == "e")
             break;
 
-        socket_Send(isock, 3, message);
+        //connections belong to their worker thread, so hand the send over to each one
+        for (auto &reactor : reactors)
+        {
+            Reactor *owner = reactor.get();
+            owner->post([owner, message]() {
+                owner->forEachConnection([&message](Connection &conn) {
+                    socket_Send(conn, 3, message, conn.clientId);
+                });
+            });
+        }
     }
 
-//5) close socket
-    close(sockfd);
-    cout << "Socket closed\n";
-    exitThread.store(true);
-
-    t1.join();
+//5) close sockets
+    for (auto &reactor : reactors)
+        reactor->stop();
+    for (auto &t : threads)
+        t.join();
+    log_Stop();
     cout << "Thread(s) joined\n";
-}
\ No newline at end of file
+    cout << "Room fan-out: " << rooms.broadcasts.load() << " broadcasts, " << rooms.deliveries.load()
+         << " deliveries, " << rooms.bytesCopied.load() << " bytes copied\n";
+    uint64_t peak = 0, overflows = 0, disconnects = 0;
+    for (auto &reactor : reactors)
+    {
+        const SendQueueStats &stats = reactor->sendStats();
+        peak = max<uint64_t>(peak, stats.peakBytes.load());
+        overflows += stats.overflows.load();
+        disconnects += stats.disconnects.load();
+    }
+    uint64_t syscalls = 0, framesIn = 0, framesOut = 0;
+    for (auto &reactor : reactors)
+    {
+        const IoStats &io = reactor->ioStats();
+        syscalls += io.syscalls.load();
+        framesIn += io.framesIn.load();
+        framesOut += io.framesOut.load();
+    }
+    Histogram dispatch, ack;
+    for (auto &reactor : reactors)
+    {
+        dispatch.merge(reactor->metrics().dispatchLatency);
+        ack.merge(reactor->metrics().ackRoundTrip);
+    }
+    printf("Latency: dispatch p50 %.1f us p99 %.1f us (%lu sampled), ACK round trip p50 %.1f us p99 %.1f us (%lu sampled)\n",
+           dispatch.percentile(0.5) / 1e3, dispatch.percentile(0.99) / 1e3, (unsigned long)dispatch.count(),
+           ack.percentile(0.5) / 1e3, ack.percentile(0.99) / 1e3, (unsigned long)ack.count());
+    cout << "I/O: " << syscalls << " syscalls for " << framesIn << " frames in and " << framesOut << " out\n";
+    if (store.isOpen())
+        cout << "Message store: " << store.framesAppended() << " frames (" << store.bytesAppended()
+             << " bytes) appended, " << store.heldCount() << " held, " << framesReplayed.load() << " replayed\n";
+    cout << "Sessions: " << sessionsResumed.load() << " resumed, " << framesResumed.load() << " chats ("
+         << bytesResumed.load() << " bytes) sent again\n";
+    cout << "Admission: " << limiter.limited.load() << " frames over their sender's rate "
+         << (deferLimited ? "deferred" : "NACKed") << ", " << connectionCap.refused.load()
+         << " connections turned away\n";
+    cout << "Send queues: peak " << peak << " bytes, " << overflows << " frames refused, "
+         << disconnects << " slow connections dropped\n";
+    cout << "Socket closed\n";
+}
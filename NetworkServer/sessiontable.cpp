@@ -0,0 +1,51 @@
+//Client id to connection lookup for routing messages between clients
+//Author: Justin Jeirles
+
+#include "sessiontable.h"
+
+using namespace std;
+
+void SessionTable::add(uint16_t clientId, const SessionRef &ref)
+{
+    Shard &shard = shardFor(clientId);
+    lock_guard<mutex> guard(shard.lock);
+    shard.sessions[clientId] = ref;
+}
+
+bool SessionTable::claim(uint16_t clientId, const SessionRef &ref)
+{
+    Shard &shard = shardFor(clientId);
+    lock_guard<mutex> guard(shard.lock);
+    return shard.sessions.emplace(clientId, ref).second;
+}
+
+void SessionTable::remove(uint16_t clientId, uint32_t connId)
+{
+    Shard &shard = shardFor(clientId);
+    lock_guard<mutex> guard(shard.lock);
+    auto it = shard.sessions.find(clientId);
+    if (it != shard.sessions.end() && it->second.connId == connId)
+        shard.sessions.erase(it);
+}
+
+bool SessionTable::find(uint16_t clientId, SessionRef &ref) const
+{
+    const Shard &shard = shardFor(clientId);
+    lock_guard<mutex> guard(shard.lock);
+    auto it = shard.sessions.find(clientId);
+    if (it == shard.sessions.end())
+        return false;
+    ref = it->second;
+    return true;
+}
+
+size_t SessionTable::size() const
+{
+    size_t total = 0;
+    for (const Shard &shard : shards)
+    {
+        lock_guard<mutex> guard(shard.lock);
+        total += shard.sessions.size();
+    }
+    return total;
+}
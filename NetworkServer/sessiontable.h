@@ -0,0 +1,49 @@
+//Client id to connection lookup for routing messages between clients
+//Author: Justin Jeirles
+
+#ifndef SESSIONTABLE_H
+#define SESSIONTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+class Reactor;
+
+//Where a registered client can be reached. fd alone isn't enough since fds are
+//reused; connId tells a stale entry from the connection now holding the fd.
+struct SessionRef {
+    Reactor *owner;
+    int fd;
+    uint32_t connId;
+};
+
+//Split into shards by client id, each with its own lock, so lookups for
+//different clients from different threads don't serialize on one mutex.
+class SessionTable {
+public:
+    static const size_t shardCount = 64;
+
+    //A client registering again (e.g. after reconnecting) replaces its old entry
+    void add(uint16_t clientId, const SessionRef &ref);
+    //Adds the entry unless another connection holds clientId already; false then
+    bool claim(uint16_t clientId, const SessionRef &ref);
+    //Only removes the entry if it still belongs to connId
+    void remove(uint16_t clientId, uint32_t connId);
+    bool find(uint16_t clientId, SessionRef &ref) const;
+    size_t size() const;
+
+private:
+    struct alignas(64) Shard {
+        mutable std::mutex lock;
+        std::unordered_map<uint16_t, SessionRef> sessions;
+    };
+
+    Shard &shardFor(uint16_t clientId) { return shards[clientId % shardCount]; }
+    const Shard &shardFor(uint16_t clientId) const { return shards[clientId % shardCount]; }
+
+    Shard shards[shardCount];
+};
+
+#endif
@@ -0,0 +1,280 @@
+//Minimal io_uring wrapper over the raw syscalls, for the reactor's io_uring engine
+//Author: Justin Jeirles
+
+#include "uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+static int uring_Setup(unsigned entries, io_uring_params &params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, &params);
+}
+
+static int uring_Register(int fd, unsigned opcode, void *arg, unsigned count)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+Uring::Uring()
+    : fd(-1), sqMap(MAP_FAILED), sqMapLen(0), cqMap(MAP_FAILED), cqMapLen(0), sqes((io_uring_sqe *)MAP_FAILED),
+      sqesLen(0), sqHead(nullptr), sqTail(nullptr), sqMask(0), sqEntries(0), sqLocalTail(0), cqHead(nullptr),
+      cqTail(nullptr), cqMask(0), cqes(nullptr), bufRing(nullptr), bufRingLen(0), buffers((char *)MAP_FAILED),
+      bufferCount(0), bufferSize(0), bufTail(0)
+{
+}
+
+Uring::~Uring()
+{
+    //closing the ring cancels whatever is still in flight
+    if (fd != -1)
+        close(fd);
+    if (buffers != MAP_FAILED)
+        munmap(buffers, (size_t)bufferCount * bufferSize);
+    if (bufRing)
+        munmap(bufRing, bufRingLen);
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqesLen);
+    if (cqMap != MAP_FAILED && cqMap != sqMap)
+        munmap(cqMap, cqMapLen);
+    if (sqMap != MAP_FAILED)
+        munmap(sqMap, sqMapLen);
+}
+
+bool Uring::setup(unsigned entries, string &why)
+{
+    //completions are only needed when the loop asks for them, so the kernel need not
+    //interrupt it to post them
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    fd = uring_Setup(entries, params);
+    if (fd < 0 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        fd = uring_Setup(entries, params);
+    }
+    if (fd < 0)
+    {
+        why = string("io_uring_setup: ") + strerror(errno);
+        return false;
+    }
+
+    //multishot recv came with Linux 6.0, as did zero copy send, which the probe can see
+    vector<uint8_t> probeSpace(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = (io_uring_probe *)probeSpace.data();
+    if (uring_Register(fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    {
+        why = string("io_uring probe: ") + strerror(errno);
+        return false;
+    }
+    for (unsigned op : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL,
+                        IORING_OP_PROVIDE_BUFFERS, IORING_OP_SEND_ZC})
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+        {
+            why = "kernel lacks multishot recv (needs Linux 6.0)";
+            return false;
+        }
+
+    sqMapLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapLen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+        sqMapLen = cqMapLen = max(sqMapLen, cqMapLen);
+    sqMap = mmap(nullptr, sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED)
+    {
+        why = string("io_uring mmap: ") + strerror(errno);
+        return false;
+    }
+    cqMap = single ? sqMap
+                   : mmap(nullptr, cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqesLen = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(nullptr, sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                IORING_OFF_SQES);
+    if (cqMap == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        why = string("io_uring mmap: ") + strerror(errno);
+        return false;
+    }
+
+    char *sq = (char *)sqMap;
+    sqHead = (unsigned *)(sq + params.sq_off.head);
+    sqTail = (unsigned *)(sq + params.sq_off.tail);
+    sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sqEntries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    sqLocalTail = *sqTail;
+    //entry i of the submission array always names sqe i
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sqEntries; i++)
+        array[i] = i;
+
+    char *cq = (char *)cqMap;
+    cqHead = (unsigned *)(cq + params.cq_off.head);
+    cqTail = (unsigned *)(cq + params.cq_off.tail);
+    cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool Uring::provideBuffers(unsigned count, unsigned size, string &why)
+{
+    buffers = (char *)mmap(nullptr, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED)
+    {
+        why = string("recv buffers: ") + strerror(errno);
+        return false;
+    }
+    bufferCount = count;
+    bufferSize = size;
+
+    if (registerBufferRing() && bufferRingWorks())
+        return true;
+    if (bufRing)
+    {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = bufferGroup;
+        uring_Register(fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(bufRing, bufRingLen);
+        bufRing = nullptr;
+    }
+    if (!provideAll())
+    {
+        why = string("provided buffers: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool Uring::registerBufferRing()
+{
+    bufRingLen = bufferCount * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, bufRingLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    bufRing = (io_uring_buf_ring *)ring;
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)bufRing;
+    reg.ring_entries = bufferCount;
+    reg.bgid = bufferGroup;
+    if (uring_Register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return false;
+    for (unsigned bid = 0; bid < bufferCount; bid++)
+        recycle((uint16_t)bid);
+    publishBuffers();
+    return true;
+}
+
+//Reads one byte from a pipe into a ring buffer and gives the buffer back
+bool Uring::bufferRingWorks()
+{
+    int pipefd[2];
+    if (pipe(pipefd) < 0)
+        return false;
+    bool works = false;
+    io_uring_sqe *read = sqe();
+    if (write(pipefd[1], "", 1) == 1 && read)
+    {
+        read->opcode = IORING_OP_READ;
+        read->fd = pipefd[0];
+        read->off = (uint64_t)-1;
+        read->flags = IOSQE_BUFFER_SELECT;
+        read->buf_group = bufferGroup;
+        if (enter(1) >= 0)
+            reap([&](const io_uring_cqe &cqe) {
+                if (cqe.res == 1 && (cqe.flags & IORING_CQE_F_BUFFER))
+                {
+                    works = true;
+                    recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                    publishBuffers();
+                }
+            });
+    }
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return works;
+}
+
+//Hands every buffer to the kernel in one request
+bool Uring::provideAll()
+{
+    io_uring_sqe *provide = sqe();
+    if (!provide)
+        return false;
+    provide->opcode = IORING_OP_PROVIDE_BUFFERS;
+    provide->fd = bufferCount;
+    provide->addr = (uint64_t)buffers;
+    provide->len = bufferSize;
+    provide->buf_group = bufferGroup;
+    int res = -1;
+    if (enter(1) < 0)
+        return false;
+    reap([&](const io_uring_cqe &cqe) { res = cqe.res; });
+    if (res < 0)
+        errno = -res;
+    return res >= 0;
+}
+
+io_uring_sqe *Uring::sqe()
+{
+    if (sqSpace() == 0)
+        return nullptr;
+    io_uring_sqe *entry = &sqes[sqLocalTail & sqMask];
+    memset(entry, 0, sizeof(*entry));
+    sqLocalTail++;
+    return entry;
+}
+
+unsigned Uring::sqSpace() const
+{
+    return sqEntries - (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE));
+}
+
+int Uring::enter(unsigned waitFor)
+{
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, waitFor, flags, nullptr, 0);
+}
+
+bool Uring::recycle(uint16_t bid)
+{
+    if (!bufRing)
+    {
+        //its completion is only posted if it fails, and then it is ignored
+        io_uring_sqe *provide = sqe();
+        if (!provide)
+            return false;
+        provide->opcode = IORING_OP_PROVIDE_BUFFERS;
+        provide->flags = IOSQE_CQE_SKIP_SUCCESS;
+        provide->fd = 1;
+        provide->addr = (uint64_t)buffer(bid);
+        provide->len = bufferSize;
+        provide->off = bid;
+        provide->buf_group = bufferGroup;
+        return true;
+    }
+    io_uring_buf &buf = bufRing->bufs[bufTail & (bufferCount - 1)];
+    buf.addr = (uint64_t)buffer(bid);
+    buf.len = bufferSize;
+    buf.bid = bid;
+    bufTail++;
+    return true;
+}
+
+void Uring::publishBuffers()
+{
+    if (bufRing)
+        __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,97 @@
+//Minimal io_uring wrapper over the raw syscalls, for the reactor's io_uring engine
+//Author: Justin Jeirles
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//One submission/completion ring plus a pool of provided receive buffers. There is no
+//liburing here, so this maps the rings itself and talks to the kernel through
+//io_uring_setup/io_uring_enter/io_uring_register. Used from one thread at a time.
+//
+//Receive buffers go in a registered buffer ring, which the kernel takes from and we
+//refill with plain memory writes. Some kernels accept the registration but never hand
+//a ring buffer out, so one read is tried first; if it fails the buffers are provided
+//with IORING_OP_PROVIDE_BUFFERS instead and recycling each one costs a submission entry.
+class Uring {
+public:
+    Uring();
+    ~Uring();
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    //false with the reason if this kernel can't run the reactor's ring: no io_uring at
+    //all, or too old for multishot recv and provided buffer rings (Linux 6.0)
+    bool setup(unsigned entries, std::string &why);
+    //recv buffers handed out by the kernel, group bufferGroup; count is a power of two
+    bool provideBuffers(unsigned count, unsigned size, std::string &why);
+    bool bufferRing() const { return bufRing != nullptr; }
+
+    //next submission entry, zeroed; null if the queue is full (enter() frees it up)
+    io_uring_sqe *sqe();
+    unsigned sqSpace() const;
+    //submits everything queued and waits for at least waitFor completions; -1 with errno set
+    int enter(unsigned waitFor);
+    //calls onCompletion for every completion available now, returns how many there were
+    template <typename F>
+    unsigned reap(F onCompletion);
+
+    const char *buffer(uint16_t bid) const { return buffers + (size_t)bid * bufferSize; }
+    //gives a buffer back to the kernel once its data has been copied out; false if that
+    //needs a submission entry and the queue is full
+    bool recycle(uint16_t bid);
+    //makes recycled buffers visible to the kernel, once per batch of completions
+    void publishBuffers();
+
+    static const uint16_t bufferGroup = 0;
+
+private:
+    bool registerBufferRing();
+    bool bufferRingWorks();
+    bool provideAll();
+
+    int fd;
+
+    void *sqMap;
+    size_t sqMapLen;
+    void *cqMap;
+    size_t cqMapLen;
+    io_uring_sqe *sqes;
+    size_t sqesLen;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqLocalTail;   //entries handed out by sqe(), published to *sqTail on enter()
+
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+
+    io_uring_buf_ring *bufRing;     //null when buffers are provided one entry at a time
+    size_t bufRingLen;
+    char *buffers;
+    unsigned bufferCount;
+    unsigned bufferSize;
+    uint16_t bufTail;
+};
+
+template <typename F>
+unsigned Uring::reap(F onCompletion)
+{
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    unsigned count = tail - head;
+    for (; head != tail; head++)
+        onCompletion(cqes[head & cqMask]);
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+#endif
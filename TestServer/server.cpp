@@ -7,130 +7,106 @@
 #include <thread>
 #include <ctime>
 #include <atomic>
+#include "../Common/message.h"
+#include "../Common/framedecoder.h"
+#include "../Common/framesend.h"
+#include "../Common/checksum.h"
+#include "../Common/readiness.h"
+#include "../Common/log.h"
 
 using namespace std;
 
-struct MessageHeader
-{
-    uint8_t headerLen;
-    uint8_t messageType;
-    uint32_t timeStamp;
-    uint16_t sender_id;
-    uint16_t receiver_id;
-    uint32_t message_id;
-    uint16_t payloadLen;
-    uint16_t checksum;
-};
-
-atomic<bool> exitThread{false};
-
-uint16_t checkSum_Gen(const uint8_t *data, size_t len)
-{
-    uint32_t sum = 0;
-    for (int i = 0; i < len; i++)
-        sum += data[i];
-    return (uint16_t)sum;
-}
-
-bool checkSum_Check(uint16_t checkSum, size_t len)
-{
-    return true;
-}
+int exitfd = -1; //signalled once to stop the receive thread
+atomic<uint32_t> nextMessageId{0}; //the console and the receive thread both send
 
 void socket_Send(int sockfd, const u_int8_t msgType, const string &message)
 {
     MessageHeader myHeader;
-    myHeader.headerLen = sizeof(MessageHeader);
+    myHeader.headerLen = headerWireLen;
     myHeader.messageType = msgType;
     myHeader.timeStamp = (uint32_t)time(nullptr);
     myHeader.sender_id = 2;      // sample id
     myHeader.receiver_id = 1;    // sample id
-    myHeader.message_id = 12345; // sample id
+    myHeader.message_id = ++nextMessageId;
     myHeader.payloadLen = message.size();
-    myHeader.checksum = 0; // calculate
-
-    size_t packetSize = myHeader.headerLen + myHeader.payloadLen;
-    uint8_t *buff = new uint8_t[packetSize];
-    memcpy(buff, &myHeader, sizeof(myHeader));
-    memcpy(buff + sizeof(myHeader), message.c_str(), message.size());
-    myHeader.checksum = checkSum_Gen(buff, packetSize);
-    memcpy(buff, &myHeader, sizeof(myHeader));
+    myHeader.checksum = 0; // filled in by frame_Send
 
-    send(sockfd, buff, packetSize, 0); // Ensure sending the entire packet
-    delete[] buff;
+    if (!frame_Send(sockfd, myHeader, message.data(), message.size()))
+        LOG_ERROR("%s", strerror(errno));
 }
 
 void socket_Receive(int sockfd)
 {
-    MessageHeader *myHeader;
-    char buff[1024];
+    const MessageHeader *myHeader;
+    FrameDecoder decoder;
+    Frame frame;
     while (true)
     {
-        cout << "Waiting for Msg\n";
-        while (recv(sockfd, buff, sizeof(buff), MSG_DONTWAIT | MSG_PEEK) == -1)
-        {
-            if (exitThread.load())
-                return;
-        }
-        ssize_t inBytes = recv(sockfd, buff, sizeof(buff), 0);
+        LOG_DEBUG("Waiting for Msg");
+        if (!waitReadable(sockfd, exitfd))
+            return;
+        char *space = decoder.writePtr();
+        ssize_t inBytes = recv(sockfd, space, decoder.writable(), 0);
         if (inBytes > 0)
         {
-            myHeader = reinterpret_cast<MessageHeader *>(buff);
-            cout << "Msg received\n";
-            time_t timeRaw = myHeader->timeStamp;
-            struct tm *timeInfo = localtime(&timeRaw);
-            char timeString[20];
-            strftime(timeString, sizeof(timeString), "%Y-%m-%d %H:%M:%S", timeInfo);
-
-            cout << "Msg timestamp: " << timeString << "\n";
-            cout << "Msg type: " << (int)myHeader->messageType << ", Payload Length: " << myHeader->payloadLen << " bytes\n";
-
-            if (myHeader->payloadLen > sizeof(buff) - sizeof(MessageHeader))
-            {
-                cerr << "Message Length exceeds Buffer, dumping Message and sending Error\n";
-                socket_Send(sockfd, 6, to_string(myHeader->message_id));
-                continue;
-            }
-            else if (!checkSum_Check(myHeader->checksum, myHeader->payloadLen))
+            decoder.commit(inBytes);
+            //one read may hold several frames, or only part of one
+            while (decoder.next(frame))
             {
-                cerr << "Invalid checksum, sending Error Message\n";
-                socket_Send(sockfd, 6, to_string(myHeader->message_id));
-                continue;
+                myHeader = &frame.header;
+                LOG_DEBUG("Msg received, timestamp: %u, type: %d, Payload Length: %u bytes",
+                          myHeader->timeStamp, myHeader->messageType, myHeader->payloadLen);
+
+                if (!checkSum_Check(frame.wire, frame.payload, myHeader->payloadLen))
+                {
+                    LOG_WARN("Invalid checksum, sending Error Message");
+                    socket_Send(sockfd, 6, to_string(myHeader->message_id));
+                    continue;
+                }
+
+                string message(frame.payload, myHeader->payloadLen);
+                switch ((int)myHeader->messageType)
+                {
+                case 1:
+                    LOG_INFO("Status Request received from: %d, sending response", myHeader->sender_id);
+                    socket_Send(sockfd, 2, to_string(myHeader->message_id));
+                    break;
+                case 2:
+                    LOG_INFO("Status Response received, %d is online", myHeader->sender_id);
+                    break;
+                case 3:
+                    LOG_INFO("Chat Message received: %s", message);
+                    socket_Send(sockfd, 4, to_string(myHeader->message_id));
+                    break;
+                case 4:
+                    LOG_INFO("Received ACK for Message %s", message);
+                    break;
+                case 5:
+                    LOG_INFO("Received NACK for Message %s", message);
+                    break;
+                case 6:
+                    LOG_INFO("Received Error for Message %s", message);
+                    break;
+                default:
+                    LOG_WARN("Unknown message type: %d received, sending Error Message", myHeader->messageType);
+                    socket_Send(sockfd, 6, to_string(myHeader->message_id));
+                    break;
+                }
             }
-
-            string message(buff + sizeof(MessageHeader), myHeader->payloadLen);
-            switch ((int)myHeader->messageType)
+            if (decoder.corrupt())
             {
-            case 1:
-                cout << "Status Request received from: " << (int)myHeader->sender_id << ", sending response\n";
-                socket_Send(sockfd, 2, to_string(myHeader->message_id));
-                break;
-            case 2:
-                cout << "Status Response received, " << (int)myHeader->sender_id << " is online\n";
-                break;
-            case 3:
-                cout << "Chat Message received: " << message << "\n";
-                socket_Send(sockfd, 4, to_string(myHeader->message_id));
-                break;
-            case 4:
-                cout << "Received ACK for Message " << message << "\n";
-                break;
-            case 5:
-                cout << "Received NACK for Message " << message << "\n";
-                break;
-            case 6:
-                cout << "Received Error for Message " << message << "\n";
-                break;
-            default:
-                cout << "Unknown message type: " << (int)myHeader->messageType << " received, sending Error Message\n";
-                socket_Send(sockfd, 6, to_string(myHeader->message_id));
-                break;
+                LOG_WARN("Corrupt message stream, closing connection");
+                return;
             }
         }
-        else if (inBytes == -1)
+        else if (inBytes == 0)
         {
-            cerr << strerror(errno) << "\n";
-            close(sockfd);
+            LOG_INFO("Connection has been closed");
+            return;
+        }
+        else if (errno != EINTR)
+        {
+            LOG_ERROR("%s", strerror(errno));
             return;
         }
     }
@@ -204,23 +180,27 @@ int main()
 
     } while (isError);
 
+    log_Start();
+    exitfd = shutdownFd_Create();
     thread t1(socket_Receive, isock);
 
     string message;
     while (true)
     {
         cout << "Enter Message, or 'e' to exit\n";
-        getline(cin, message);
-        if (message == "e")
+        if (!getline(cin, message) || message == "e")
             break;
 
         socket_Send(isock, 3, message);
     }
 
-    close(sockfd);
-    cout << "Socket closed\n";
-    exitThread.store(true);
-
+    shutdownFd_Signal(exitfd);
     t1.join();
+    log_Stop();
     cout << "Thread(s) joined\n";
+
+    close(isock);
+    close(sockfd);
+    close(exitfd);
+    cout << "Socket closed\n";
 }